@@ -37,6 +37,10 @@ struct {
 			.pio_bitmap_size = 0,
 
 			.num_pci_devices = 0,
+
+			/* account spinning root cell CPUs */
+			.ple_gap = 128,
+			.ple_window = 4096,
 		},
 	},
 
@@ -42,6 +42,10 @@ struct {
 			.num_irq_lines = 0,
 			.pio_bitmap_size = ARRAY_SIZE(config.pio_bitmap),
 			.num_pci_devices = ARRAY_SIZE(config.pci_devices),
+
+			/* account spinning root cell CPUs */
+			.ple_gap = 128,
+			.ple_window = 4096,
 		},
 	},
 
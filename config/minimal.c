@@ -33,6 +33,9 @@ struct {
 		.pio_bitmap_size = ARRAY_SIZE(config.pio_bitmap),
 
 		.num_pci_devices = 0,
+
+		/* right above the RAM, see CONFIG_INMATE_TIME_PAGE */
+		.time_page_address = 0x100000,
 	},
 
 	.cpus = {
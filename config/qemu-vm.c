@@ -46,6 +46,10 @@ struct {
 			.pio_bitmap_size = ARRAY_SIZE(config.pio_bitmap),
 
 			.num_pci_devices = 0,
+
+			/* account spinning root cell CPUs */
+			.ple_gap = 128,
+			.ple_window = 4096,
 		},
 	},
 
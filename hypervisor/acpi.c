@@ -13,6 +13,19 @@
 #include <jailhouse/acpi.h>
 #include <jailhouse/control.h>
 #include <jailhouse/entry.h>
+#include <jailhouse/printk.h>
+
+/*
+ * The tables in config_memory are indexed once during setup. If the blob
+ * contains an XSDT or RSDT, the tables it references are taken, otherwise
+ * all tables found in the blob. Only complete tables with a valid checksum
+ * are indexed.
+ */
+#define ACPI_MAX_TABLES		64
+
+static const struct acpi_table_header *acpi_tables[ACPI_MAX_TABLES];
+static unsigned int acpi_num_tables;
+static unsigned int acpi_dropped_tables;
 
 static bool acpi_valid_checksum(const struct acpi_table_header *table)
 {
@@ -25,21 +38,130 @@ static bool acpi_valid_checksum(const struct acpi_table_header *table)
 	return sum == 0;
 }
 
+/* signatures consist of upper-case letters, digits and underscores */
+static bool acpi_plausible_signature(const struct acpi_table_header *table)
+{
+	const u8 *sig = (const u8 *)&table->signature;
+	unsigned int n;
+
+	for (n = 0; n < 4; n++)
+		if (!(sig[n] >= 'A' && sig[n] <= 'Z') &&
+		    !(sig[n] >= '0' && sig[n] <= '9') && sig[n] != '_')
+			return false;
+	return true;
+}
+
+static bool acpi_signature_is(const struct acpi_table_header *table,
+			      const char name[4])
+{
+	return table->signature == *(const u32 *)name;
+}
+
+static const struct acpi_table_header *acpi_table_at(unsigned long offset)
+{
+	unsigned long size = system_config->config_memory.size;
+	const struct acpi_table_header *table = config_memory + offset;
+
+	/* cheap checks first, the scan in acpi_init probes every offset */
+	if (offset > size || size - offset < sizeof(*table) ||
+	    !acpi_plausible_signature(table) ||
+	    table->length < sizeof(*table) || table->length > size - offset ||
+	    !acpi_valid_checksum(table))
+		return NULL;
+	return table;
+}
+
+static void acpi_index_table(const struct acpi_table_header *table)
+{
+	if (acpi_num_tables == ACPI_MAX_TABLES)
+		acpi_dropped_tables++;
+	else
+		acpi_tables[acpi_num_tables++] = table;
+}
+
+/* SDT entries are physical addresses, only tables in the blob are usable */
+static const struct acpi_table_header *
+acpi_sdt_entry(const struct acpi_table_header *sdt, unsigned int entry_size,
+	       unsigned int n)
+{
+	unsigned long phys_start = system_config->config_memory.phys_start;
+	const u8 *entry = (const u8 *)(sdt + 1) + n * entry_size;
+	unsigned long addr;
+
+	addr = *(const u32 *)entry;
+	if (entry_size == 8)
+		addr |= (unsigned long)*(const u32 *)(entry + 4) << 32;
+
+	if (addr < phys_start)
+		return NULL;
+	return acpi_table_at(addr - phys_start);
+}
+
+void acpi_init(void)
+{
+	unsigned long size = system_config->config_memory.size;
+	const struct acpi_table_header *table, *sdt = NULL;
+	unsigned int entry_size = 0, entries = 0, n;
+	unsigned long offset = 0;
+
+	while (offset + sizeof(struct acpi_table_header) <= size) {
+		table = acpi_table_at(offset);
+		if (!table) {
+			offset++;
+			continue;
+		}
+
+		if (acpi_signature_is(table, "XSDT")) {
+			sdt = table;
+			entry_size = 8;
+		} else if (acpi_signature_is(table, "RSDT") &&
+			   entry_size != 8) {
+			sdt = table;
+			entry_size = 4;
+		}
+		acpi_index_table(table);
+		offset += table->length;
+	}
+
+	/* keep what we found if the SDT references nothing in the blob */
+	if (sdt) {
+		entries = (sdt->length - sizeof(*sdt)) / entry_size;
+		for (n = 0; n < entries; n++)
+			if (acpi_sdt_entry(sdt, entry_size, n))
+				break;
+		if (n == entries)
+			sdt = NULL;
+	}
+
+	if (sdt) {
+		acpi_num_tables = acpi_dropped_tables = 0;
+		acpi_index_table(sdt);
+		for (n = 0; n < entries; n++) {
+			table = acpi_sdt_entry(sdt, entry_size, n);
+			if (table)
+				acpi_index_table(table);
+		}
+	}
+
+	printk("ACPI: %d tables indexed%s\n", acpi_num_tables,
+	       !sdt ? "" : (entry_size == 8 ? " via XSDT" : " via RSDT"));
+	if (acpi_dropped_tables > 0)
+		printk("WARNING: %d ACPI tables not indexed\n",
+		       acpi_dropped_tables);
+}
+
 const struct acpi_table_header *
 acpi_find_table(char name[4], const struct acpi_table_header *start)
 {
-	void *end = config_memory + system_config->config_memory.size;
-	const struct acpi_table_header *tab;
-	const void *pos;
+	unsigned int n = 0;
 
-	pos = start ? ((const void *)start) + start->length : config_memory;
-	while ((pos + sizeof(struct acpi_table_header)) < end) {
-		tab = pos++;
+	if (start)
+		while (n < acpi_num_tables && acpi_tables[n++] != start)
+			;
 
-		if (tab->signature == *(u32 *)name &&
-		    (pos + tab->length) < end && acpi_valid_checksum(tab))
-			return tab;
-	}
+	for (; n < acpi_num_tables; n++)
+		if (acpi_signature_is(acpi_tables[n], name))
+			return acpi_tables[n];
 
 	return NULL;
 }
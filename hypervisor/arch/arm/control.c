@@ -0,0 +1,206 @@
+/*
+ * Jailhouse, a Linux-based partitioning hypervisor
+ *
+ * Copyright (c) Siemens AG, 2013
+ *
+ * Authors:
+ *  Jan Kiszka <jan.kiszka@siemens.com>
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.  See
+ * the COPYING file in the top-level directory.
+ */
+
+#include <jailhouse/control.h>
+#include <jailhouse/entry.h>
+#include <jailhouse/paging.h>
+#include <jailhouse/printk.h>
+#include <asm/control.h>
+
+/*
+ * Stage-2 translation of the cells. Each cell gets a VMID equal to its ID,
+ * so TLB maintenance after reconfigurations only hits the affected cells.
+ * Regions are mapped with 1G and 2M blocks whenever alignment permits.
+ */
+
+#define VTCR_RES1		(1UL << 31)
+#define VTCR_T0SZ_32BIT		(0 << 0)
+#define VTCR_SL0_LEVEL1		(1 << 6)
+#define VTCR_IRGN0_WB		(1 << 8)
+#define VTCR_ORGN0_WB		(1 << 10)
+#define VTCR_SH0_INNER		(3 << 12)
+
+#define VTCR_CELL		(VTCR_RES1 | VTCR_T0SZ_32BIT | \
+				 VTCR_SL0_LEVEL1 | VTCR_IRGN0_WB | \
+				 VTCR_ORGN0_WB | VTCR_SH0_INNER)
+
+#define VTTBR_VMID_SHIFT	48
+#define NUM_VMIDS		256
+
+#define S2_TABLE_FLAGS		PAGE_FLAG_PRESENT
+
+static unsigned long s2_huge_pages = PAGE_MAP_HUGE_2M | PAGE_MAP_HUGE_1G;
+
+static inline u64 read_vttbr(void)
+{
+	u64 vttbr;
+
+	asm volatile("mrrc p15, 6, %Q0, %R0, c2" : "=r" (vttbr));
+	return vttbr;
+}
+
+static inline void write_vttbr(u64 vttbr)
+{
+	asm volatile("mcrr p15, 6, %Q0, %R0, c2\n\t"
+		     "isb" : : "r" (vttbr) : "memory");
+}
+
+static u64 s2_vttbr(struct cell *cell)
+{
+	return page_map_hvirt2phys(cell->s2.root_table) |
+		((u64)cell->s2.vmid << VTTBR_VMID_SHIFT);
+}
+
+/*
+ * Invalidates the stage-2 derived TLB entries of the cell on all CPUs of the
+ * inner shareable domain. TLBIALLIS only affects the current VMID, so it is
+ * switched temporarily.
+ */
+static void s2_flush_cell_tlb(struct cell *cell)
+{
+	u64 vttbr = read_vttbr();
+
+	write_vttbr(s2_vttbr(cell));
+	asm volatile("mcr p15, 0, %0, c8, c3, 0	@ TLBIALLIS\n\t"
+		     "dsb ish\n\t"
+		     "isb" : : "r" (0) : "memory");
+	write_vttbr(vttbr);
+}
+
+static unsigned long s2_page_flags(const struct jailhouse_memory *mem)
+{
+	unsigned long flags = PAGE_FLAG_PRESENT | PAGE_FLAG_AF |
+		PAGE_FLAG_SH_INNER | S2_FLAG_MEMATTR_NORMAL;
+
+	if (mem->access_flags & JAILHOUSE_MEM_READ)
+		flags |= S2_FLAG_READ;
+	if (mem->access_flags & JAILHOUSE_MEM_WRITE)
+		flags |= S2_FLAG_WRITE;
+	if (!(mem->access_flags & JAILHOUSE_MEM_EXECUTE))
+		flags |= PAGE_FLAG_XN;
+	return flags;
+}
+
+int arch_map_memory_region(struct cell *cell,
+			   const struct jailhouse_memory *mem)
+{
+	return page_map_create(cell->s2.root_table, mem->phys_start,
+			       mem->size, mem->virt_start, s2_page_flags(mem),
+			       S2_TABLE_FLAGS, PAGE_DIR_LEVELS, s2_huge_pages,
+			       PAGE_MAP_NON_COHERENT);
+}
+
+void arch_unmap_memory_region(struct cell *cell,
+			      const struct jailhouse_memory *mem)
+{
+	page_map_destroy(cell->s2.root_table, mem->virt_start, mem->size,
+			 S2_TABLE_FLAGS, PAGE_DIR_LEVELS,
+			 PAGE_MAP_NON_COHERENT);
+}
+
+int s2_cell_init(struct cell *cell)
+{
+	const struct jailhouse_memory *mem =
+		jailhouse_cell_mem_regions(cell->config);
+	unsigned int n;
+	int err;
+
+	if (cell->id >= NUM_VMIDS) {
+		printk("ERROR: no VMID for cell %d\n", cell->id);
+		return -ERANGE;
+	}
+	cell->s2.vmid = cell->id;
+
+	cell->s2.root_table = page_alloc(numa_pool(cell->numa_node), 1);
+	if (!cell->s2.root_table)
+		return -ENOMEM;
+
+	for (n = 0; n < cell->config->num_memory_regions; n++, mem++) {
+		err = arch_map_memory_region(cell, mem);
+		if (err)
+			goto error_unmap;
+	}
+
+	return 0;
+
+error_unmap:
+	while (n-- > 0)
+		arch_unmap_memory_region(cell, --mem);
+	page_free(numa_pool(cell->numa_node), cell->s2.root_table, 1);
+	return err;
+}
+
+/* regions have to be unmapped already so that all tables are released */
+void s2_cell_exit(struct cell *cell)
+{
+	page_free(numa_pool(cell->numa_node), cell->s2.root_table, 1);
+}
+
+/* to be called on the CPU that enters the cell */
+void s2_cpu_enter_cell(struct cell *cell)
+{
+	asm volatile("mcr p15, 4, %0, c2, c1, 2	@ VTCR"
+		     : : "r" (VTCR_CELL));
+	write_vttbr(s2_vttbr(cell));
+}
+
+int arch_cell_create(struct per_cpu *cpu_data, struct cell *cell)
+{
+	return s2_cell_init(cell);
+}
+
+int arch_cell_commit(struct per_cpu *cpu_data, struct cell *cell)
+{
+	struct jailhouse_memory range;
+	unsigned int pos = 0;
+	int err = 0;
+
+	/* like on x86, keep unmapping if splitting blocks fails */
+	while (cell_next_phys_range(cell, &pos, 0, &range))
+		if (page_map_destroy(linux_cell.s2.root_table,
+				     range.phys_start, range.size,
+				     S2_TABLE_FLAGS, PAGE_DIR_LEVELS,
+				     PAGE_MAP_NON_COHERENT) < 0)
+			err = -ENOMEM;
+
+	return err;
+}
+
+void arch_cell_destroy(struct per_cpu *cpu_data, struct cell *cell)
+{
+	s2_cell_exit(cell);
+}
+
+void arch_config_commit(struct per_cpu *cpu_data, struct cell *cell_added)
+{
+	s2_flush_cell_tlb(&linux_cell);
+	/* the VMID may have been used by a destroyed cell before */
+	if (cell_added)
+		s2_flush_cell_tlb(cell_added);
+}
+
+void arch_cell_cpus_changed(struct cell *cell)
+{
+}
+
+void arch_get_mem_usage(struct cell *cell, struct jailhouse_mem_info *info)
+{
+	info->page_tables = page_map_count_tables(cell->s2.root_table,
+						  PAGE_DIR_LEVELS);
+}
+
+/* ARMv7 does not maintain access flags of stage-2 entries in hardware */
+int arch_cell_scan_working_set(struct per_cpu *cpu_data, struct cell *cell,
+			       struct jailhouse_working_set *ws)
+{
+	return -ENOSYS;
+}
@@ -19,8 +19,17 @@
 #include <jailhouse/cell-config.h>
 
 struct cell {
+	struct {
+		/* level-1 stage-2 table, VTTBR points to it */
+		pgd_t *root_table;
+		/* equals the cell ID */
+		u8 vmid;
+	} s2;
+
 	unsigned int id;
 	unsigned int data_pages;
+	/* node of all cell CPUs, NUMA_NO_NODE if they are spread */
+	unsigned int numa_node;
 	struct jailhouse_cell_desc *config;
 
 	struct cpu_set *cpu_set;
@@ -28,7 +37,22 @@ struct cell {
 
 	unsigned long page_offset;
 
-	struct cell *next;
+	/* memory regions of the config, sorted by physical start address */
+	const struct jailhouse_memory **sorted_mem_regions;
+
+	/* page table high-water marks, sampled on reconfigurations */
+	unsigned int page_tables_peak;
+	unsigned int dma_page_tables_peak;
+
+	/* emulated MMIO regions, sorted by start address */
+	struct mmio_region *mmio_regions;
+	unsigned int num_mmio_regions;
+
+	/* inter-cell shared memory endpoints, see shmem.c */
+	struct shmem_endpoint *shmem_endpoints;
+
+	/* chain of the cell name hash */
+	struct cell *hash_next;
 };
 
 extern struct cell linux_cell;
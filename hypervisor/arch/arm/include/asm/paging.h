@@ -19,22 +19,61 @@
 #define PAGE_SIZE		4096
 #define PAGE_MASK		~(PAGE_SIZE - 1)
 
-#define PAGE_DIR_LEVELS		4
+/*
+ * LPAE long-descriptor format with a 32-bit input address space, used both
+ * for the Hyp stage-1 tables and the stage-2 tables of the cells: translation
+ * starts at level 1 (4 entries of 1G), blocks are possible at levels 1 and 2.
+ * The generic pud is level 1, pmd level 2 and pte level 3.
+ */
+#define PAGE_DIR_LEVELS		3
+
+/* input address range of the stage-2 tables */
+#define GUEST_PHYS_ADDR_LIMIT	(1ULL << 32)
 
 #define PAGE_TABLE_OFFS_MASK	0x00000ff8UL
 #define PAGE_ADDR_MASK		0xfffff000UL
 #define PAGE_OFFS_MASK		0x00000fffUL
+#define HUGEPAGE_SIZE		(2 * 1024 * 1024UL)
 #define HUGEPAGE_ADDR_MASK	0xffe00000UL
 #define HUGEPAGE_OFFS_MASK	0x001fffffUL
+#define HUGEPAGE_1G_SIZE	(1024 * 1024 * 1024UL)
+#define HUGEPAGE_1G_ADDR_MASK	0xc0000000UL
+#define HUGEPAGE_1G_OFFS_MASK	0x3fffffffUL
 
-#define PAGE_FLAG_PRESENT	0x01
-#define PAGE_FLAG_RW		0x02
-#define PAGE_FLAG_SUPERVISOR	0x04
-#define PAGE_FLAG_UNCACHED	0x10
+#define PAGE_DESC_TYPE_MASK	0x3ULL
+#define PAGE_DESC_BLOCK		0x1ULL
+#define PAGE_DESC_TABLE		0x3ULL
+#define PAGE_DESC_PAGE		0x3ULL
+#define PAGE_DESC_ATTR_MASK	0xffcULL
+#define PAGE_DESC_XN		(1ULL << 54)
 
-#define PAGE_DEFAULT_FLAGS	(PAGE_FLAG_PRESENT | PAGE_FLAG_RW | \
-				 PAGE_FLAG_SUPERVISOR)
-#define PAGE_READONLY_FLAGS	(PAGE_FLAG_PRESENT | PAGE_FLAG_SUPERVISOR)
+/*
+ * Page flags are the lower attributes of the descriptors, bits 11:2. Bit 0
+ * selects a valid entry, bit 1 stands for the execute-never bit 54 of the
+ * upper attributes which does not fit into an unsigned long.
+ */
+#define PAGE_FLAG_PRESENT	0x001
+#define PAGE_FLAG_XN		0x002
+#define PAGE_FLAG_SH_INNER	0x300
+#define PAGE_FLAG_AF		0x400
+
+/* Hyp stage 1, attribute indexes refer to HMAIR0 */
+#define PAGE_FLAG_ATTRIDX(n)	((n) << 2)
+#define PAGE_FLAG_AP1		0x040	/* SBO in Hyp mode */
+#define PAGE_FLAG_RDONLY	0x080
+#define PAGE_FLAG_UNCACHED	PAGE_FLAG_ATTRIDX(1)
+
+/* stage 2 */
+#define S2_FLAG_MEMATTR_DEVICE	0x004
+#define S2_FLAG_MEMATTR_NORMAL	0x03c	/* inner/outer write-back */
+#define S2_FLAG_READ		0x040
+#define S2_FLAG_WRITE		0x080
+
+#define PAGE_TABLE_FLAGS_MASK	0
+
+#define PAGE_DEFAULT_FLAGS	(PAGE_FLAG_PRESENT | PAGE_FLAG_AF | \
+				 PAGE_FLAG_SH_INNER | PAGE_FLAG_AP1)
+#define PAGE_READONLY_FLAGS	(PAGE_DEFAULT_FLAGS | PAGE_FLAG_RDONLY)
 #define PAGE_NONPRESENT_FLAGS	0
 
 #define INVALID_PHYS_ADDR	(~0UL)
@@ -47,14 +86,29 @@
 
 #ifndef __ASSEMBLY__
 
-typedef unsigned long pgd_t;
-typedef unsigned long pud_t;
-typedef unsigned long pmd_t;
-typedef unsigned long pte_t;
+typedef u64 pgd_t;
+typedef u64 pud_t;
+typedef u64 pmd_t;
+typedef u64 pte_t;
+
+static inline u64 page_desc(unsigned long addr, unsigned long flags, u64 type)
+{
+	if (!(flags & PAGE_FLAG_PRESENT))
+		return 0;
+	return addr | (flags & PAGE_DESC_ATTR_MASK) |
+		(flags & PAGE_FLAG_XN ? PAGE_DESC_XN : 0) | type;
+}
+
+static inline void *page_desc_table(u64 desc, unsigned long page_table_offset)
+{
+	return (void *)((unsigned long)(desc & PAGE_ADDR_MASK) +
+			page_table_offset);
+}
 
+/* no level 0 with a 32-bit input address */
 static inline bool pgd_valid(pgd_t *pgd)
 {
-	return *pgd & 1;
+	return false;
 }
 
 static inline pgd_t *pgd_offset(pgd_t *page_table, unsigned long addr)
@@ -64,12 +118,10 @@ static inline pgd_t *pgd_offset(pgd_t *page_table, unsigned long addr)
 
 static inline void set_pgd(pgd_t *pgd, unsigned long addr, unsigned long flags)
 {
-	*pgd = (addr & PAGE_ADDR_MASK) | flags;
 }
 
 static inline void clear_pgd(pgd_t *pgd)
 {
-	*pgd = 0;
 }
 
 static inline bool pud_valid(pud_t *pud)
@@ -85,12 +137,24 @@ static inline pud_t *pud4l_offset(pgd_t *pgd, unsigned long page_table_offset,
 
 static inline pud_t *pud3l_offset(pgd_t *page_table, unsigned long addr)
 {
-	return NULL;
+	return page_table + (addr >> 30);
+}
+
+static inline bool pud_is_hugepage(pud_t *pud)
+{
+	return (*pud & PAGE_DESC_TYPE_MASK) == PAGE_DESC_BLOCK;
 }
 
 static inline void set_pud(pud_t *pud, unsigned long addr, unsigned long flags)
 {
-	*pud = (addr & PAGE_ADDR_MASK) | flags;
+	*pud = page_desc(addr & PAGE_ADDR_MASK, flags & PAGE_FLAG_PRESENT,
+			 PAGE_DESC_TABLE);
+}
+
+static inline void set_pud_hugepage(pud_t *pud, unsigned long addr,
+				    unsigned long flags)
+{
+	*pud = page_desc(addr & HUGEPAGE_1G_ADDR_MASK, flags, PAGE_DESC_BLOCK);
 }
 
 static inline void clear_pud(pud_t *pud)
@@ -105,18 +169,26 @@ static inline bool pmd_valid(pmd_t *pmd)
 
 static inline bool pmd_is_hugepage(pmd_t *pmd)
 {
-	return *pmd & (1 << 7);
+	return (*pmd & PAGE_DESC_TYPE_MASK) == PAGE_DESC_BLOCK;
 }
 
 static inline pmd_t *pmd_offset(pud_t *pud, unsigned long page_table_offset,
 				unsigned long addr)
 {
-	return NULL;
+	return (pmd_t *)page_desc_table(*pud, page_table_offset) +
+		((addr >> 21) & 0x1ff);
 }
 
 static inline void set_pmd(pmd_t *pmd, unsigned long addr, unsigned long flags)
 {
-	*pmd = (addr & PAGE_ADDR_MASK) | flags;
+	*pmd = page_desc(addr & PAGE_ADDR_MASK, flags & PAGE_FLAG_PRESENT,
+			 PAGE_DESC_TABLE);
+}
+
+static inline void set_pmd_hugepage(pmd_t *pmd, unsigned long addr,
+				    unsigned long flags)
+{
+	*pmd = page_desc(addr & HUGEPAGE_ADDR_MASK, flags, PAGE_DESC_BLOCK);
 }
 
 static inline void clear_pmd(pmd_t *pmd)
@@ -132,12 +204,13 @@ static inline bool pte_valid(pte_t *pte)
 static inline pte_t *pte_offset(pmd_t *pmd, unsigned long page_table_offset,
 				unsigned long addr)
 {
-	return NULL;
+	return (pte_t *)page_desc_table(*pmd, page_table_offset) +
+		((addr >> 12) & 0x1ff);
 }
 
 static inline void set_pte(pte_t *pte, unsigned long addr, unsigned long flags)
 {
-	*pte = (addr & PAGE_ADDR_MASK) | flags;
+	*pte = page_desc(addr & PAGE_ADDR_MASK, flags, PAGE_DESC_PAGE);
 }
 
 static inline void clear_pte(pte_t *pte)
@@ -156,20 +229,27 @@ static inline unsigned long phys_address_hugepage(pmd_t *pmd,
 	return (*pmd & HUGEPAGE_ADDR_MASK) + (addr & HUGEPAGE_OFFS_MASK);
 }
 
-static inline bool pud_empty(pgd_t *pgd, unsigned long page_table_offset)
+static inline unsigned long phys_address_hugepage_1g(pud_t *pud,
+						     unsigned long addr)
 {
-	pud_t *pud = (pud_t *)((*pgd & PAGE_ADDR_MASK) + page_table_offset);
-	int n;
+	return (*pud & HUGEPAGE_1G_ADDR_MASK) + (addr & HUGEPAGE_1G_OFFS_MASK);
+}
 
-	for (n = 0; n < PAGE_SIZE / sizeof(pud_t); n++, pud++)
-		if (pud_valid(pud))
-			return false;
+/* converts a block descriptor back into page flags */
+static inline unsigned long hugepage_flags(u64 entry)
+{
+	return PAGE_FLAG_PRESENT | (entry & PAGE_DESC_ATTR_MASK) |
+		(entry & PAGE_DESC_XN ? PAGE_FLAG_XN : 0);
+}
+
+static inline bool pud_empty(pgd_t *pgd, unsigned long page_table_offset)
+{
 	return true;
 }
 
 static inline bool pmd_empty(pud_t *pud, unsigned long page_table_offset)
 {
-	pmd_t *pmd = (pmd_t *)((*pud & PAGE_ADDR_MASK) + page_table_offset);
+	pmd_t *pmd = page_desc_table(*pud, page_table_offset);
 	int n;
 
 	for (n = 0; n < PAGE_SIZE / sizeof(pmd_t); n++, pmd++)
@@ -180,7 +260,7 @@ static inline bool pmd_empty(pud_t *pud, unsigned long page_table_offset)
 
 static inline bool pt_empty(pmd_t *pmd, unsigned long page_table_offset)
 {
-	pte_t *pte = (pte_t *)((*pmd & PAGE_ADDR_MASK) + page_table_offset);
+	pte_t *pte = page_desc_table(*pmd, page_table_offset);
 	int n;
 
 	for (n = 0; n < PAGE_SIZE / sizeof(pte_t); n++, pte++)
@@ -189,12 +269,43 @@ static inline bool pt_empty(pmd_t *pmd, unsigned long page_table_offset)
 	return true;
 }
 
+/* Hyp stage-1 TLB */
 static inline void flush_tlb(void)
 {
+	asm volatile("mcr p15, 4, %0, c8, c7, 0	@ TLBIALLH\n\t"
+		     "dsb\n\t"
+		     "isb" : : "r" (0) : "memory");
 }
 
+static inline void flush_tlb_page(unsigned long addr)
+{
+	asm volatile("mcr p15, 4, %0, c8, c7, 1	@ TLBIMVAH\n\t"
+		     "dsb\n\t"
+		     "isb" : : "r" (addr & PAGE_MASK) : "memory");
+}
+
+/* cleans table updates to the point of coherency with the table walker */
 static inline void flush_cache(void *addr, long size)
 {
+	unsigned long line, ctr, end = (unsigned long)addr + size;
+
+	asm volatile("mrc p15, 0, %0, c0, c0, 1	@ CTR" : "=r" (ctr));
+	line = 4 << ((ctr >> 16) & 0xf);
+
+	for (addr = (void *)((unsigned long)addr & ~(line - 1));
+	     (unsigned long)addr < end; addr += line)
+		asm volatile("mcr p15, 0, %0, c7, c10, 1	@ DCCMVAC"
+			     : : "r" (addr) : "memory");
+	asm volatile("dsb" : : : "memory");
+}
+
+static inline void clear_pages(void *addr, unsigned long num)
+{
+	unsigned long *p = addr;
+	unsigned long n;
+
+	for (n = 0; n < num * PAGE_SIZE / sizeof(*p); n++)
+		p[n] = 0;
 }
 
 #endif /* !__ASSEMBLY__ */
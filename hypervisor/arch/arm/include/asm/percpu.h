@@ -48,6 +48,8 @@ struct per_cpu {
 	int sipi_vector;
 	bool flush_caches;
 	bool shutdown_cpu;
+
+	struct jailhouse_cpu_stats *stats;
 } __attribute__((aligned(PAGE_SIZE)));
 
 static inline struct per_cpu *per_cpu(unsigned int cpu)
@@ -57,6 +59,11 @@ static inline struct per_cpu *per_cpu(unsigned int cpu)
 	return (struct per_cpu *)(__page_pool + (cpu << PERCPU_SIZE_SHIFT));
 }
 
+static inline struct per_cpu *this_cpu_data(void)
+{
+	return per_cpu(0);
+}
+
 /* Validate defines */
 #define CHECK_ASSUMPTION(assume)	((void)sizeof(char[1 - 2*!(assume)]))
 
@@ -26,6 +26,11 @@ static inline void memory_barrier(void)
 {
 }
 
+static inline unsigned long read_tsc(void)
+{
+	return 0;
+}
+
 #endif /* !__ASSEMBLY__ */
 
 #endif /* !_JAILHOUSE_ASM_PROCESSOR_H */
@@ -10,23 +10,74 @@
  * the COPYING file in the top-level directory.
  */
 
+#ifndef _JAILHOUSE_ASM_SPINLOCK_H
+#define _JAILHOUSE_ASM_SPINLOCK_H
+
 #include <asm/bitops.h>
 #include <asm/processor.h>
 
+#ifdef CONFIG_SPINLOCK_STATS
+struct spinlock_stats {
+	unsigned long acquired;
+	unsigned long contended;
+};
+
+#define SPINLOCK_STATS		struct spinlock_stats stats;
+#define spin_lock_account(lock, waited)			\
+	do {						\
+		(lock)->stats.acquired++;		\
+		if (waited)				\
+			(lock)->stats.contended++;	\
+	} while (0)
+#else
+#define SPINLOCK_STATS
+#define spin_lock_account(lock, waited)	((void)(waited))
+#endif
+
+/* ticket lock, granted in FIFO order */
 typedef struct {
-	unsigned long state;
+	union {
+		u32 head_tail;
+		struct {
+			u16 owner;
+			u16 next;
+		} tickets;
+	};
+	SPINLOCK_STATS
 } spinlock_t;
 
 #define DEFINE_SPINLOCK(name)	spinlock_t (name)
 
 static inline void spin_lock(spinlock_t *lock)
 {
-//	while (test_and_set_bit(0, &lock->state))
-//		cpu_relax();
+	u32 old, new, failed;
+	bool waited = false;
+
+	asm volatile(
+		"1:	ldrex	%0, [%3]\n"
+		"	add	%1, %0, %4\n"
+		"	strex	%2, %1, [%3]\n"
+		"	teq	%2, #0\n"
+		"	bne	1b"
+		: "=&r" (old), "=&r" (new), "=&r" (failed)
+		: "r" (&lock->head_tail), "I" (1 << 16)
+		: "cc");
+
+	while (*(volatile u16 *)&lock->tickets.owner != (u16)(old >> 16)) {
+		waited = true;
+		asm volatile("wfe");
+	}
+	asm volatile("dmb" : : : "memory");
+
+	spin_lock_account(lock, waited);
 }
 
 static inline void spin_unlock(spinlock_t *lock)
 {
-//	asm volatile("": : :"memory");
-//	clear_bit(0, &lock->state);
+	asm volatile("dmb" : : : "memory");
+	lock->tickets.owner++;
+	/* wake up waiters sleeping in wfe */
+	asm volatile("dsb\n\tsev" : : : "memory");
 }
+
+#endif /* !_JAILHOUSE_ASM_SPINLOCK_H */
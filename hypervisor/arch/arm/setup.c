@@ -11,10 +11,11 @@
  */
 
 #include <jailhouse/entry.h>
+#include <asm/control.h>
 
 int arch_init_early(struct cell *linux_cell)
 {
-	return -ENOSYS;
+	return s2_cell_init(linux_cell);
 }
 
 int arch_cpu_init(struct per_cpu *cpu_data)
@@ -45,17 +46,18 @@ void arch_dbg_write_init(void) {}
 int phys_processor_id(void) { return 0; }
 void arch_suspend_cpu(unsigned int cpu_id) {}
 void arch_resume_cpu(unsigned int cpu_id) {}
+void arch_suspend_cpus(struct cpu_set *cpu_set, int exception) {}
+void arch_resume_cpus(struct cpu_set *cpu_set, int exception) {}
 void arch_reset_cpu(unsigned int cpu_id) {}
 void arch_park_cpu(unsigned int cpu_id) {}
+void arch_reset_cpus(struct cpu_set *cpu_set, int exception) {}
+void arch_park_cpus(struct cpu_set *cpu_set, int exception) {}
 void arch_shutdown_cpu(unsigned int cpu_id) {}
-int arch_cell_create(struct per_cpu *cpu_data, struct cell *new_cell)
-{ return -ENOSYS; }
-int arch_map_memory_region(struct cell *cell,
-			   const struct jailhouse_memory *mem)
-{ return -ENOSYS; }
-void arch_unmap_memory_region(struct cell *cell,
-			      const struct jailhouse_memory *mem) {}
-void arch_cell_destroy(struct per_cpu *cpu_data, struct cell *new_cell) {}
+void arch_send_irq(unsigned int cpu_id, unsigned int vector) {}
+const struct jailhouse_dma_faults *arch_get_dma_faults(unsigned int unit)
+{ return NULL; }
 void *memcpy(void *dest, const void *src, unsigned long n) { return NULL; }
 void arch_dbg_write(const char *msg) {}
+unsigned int arch_dbg_write_nowait(const char *msg, unsigned int len)
+{ return len; }
 void arch_shutdown(void) {}
@@ -15,25 +15,18 @@
 #include <jailhouse/printk.h>
 #include <jailhouse/control.h>
 #include <jailhouse/mmio.h>
+#include <jailhouse/string.h>
+#include <jailhouse/trace.h>
 #include <asm/apic.h>
 #include <asm/bitops.h>
 #include <asm/fault.h>
-#include <asm/spinlock.h>
 #include <asm/vmx.h>
 
 bool using_x2apic;
 
 static u8 apic_to_cpu_id[] = { [0 ... APIC_MAX_PHYS_ID] = APIC_INVALID_ID };
-static DEFINE_SPINLOCK(wait_lock);
 static void *xapic_page;
 
-static struct {
-	u32 (*read)(unsigned int reg);
-	u32 (*read_id)(void);
-	void (*write)(unsigned int reg, u32 val);
-	void (*send_ipi)(u32 apic_id, u32 icr_lo);
-} apic_ops;
-
 static u32 read_xapic(unsigned int reg)
 {
 	return *(volatile u32 *)(xapic_page + (reg << 4));
@@ -78,9 +71,38 @@ static void send_x2apic_ipi(u32 apic_id, u32 icr_lo)
 		  ((unsigned long)apic_id) << 32 | icr_lo);
 }
 
+/*
+ * The hot paths below take the APIC mode as a constant and are instantiated
+ * once per mode, so they run without indirect calls or mode tests. Other
+ * callers pass using_x2apic.
+ */
+static inline __attribute__((always_inline)) u32
+apic_read(bool x2apic, unsigned int reg)
+{
+	return x2apic ? read_x2apic(reg) : read_xapic(reg);
+}
+
+static inline __attribute__((always_inline)) void
+apic_write(bool x2apic, unsigned int reg, u32 val)
+{
+	if (x2apic)
+		write_x2apic(reg, val);
+	else
+		write_xapic(reg, val);
+}
+
+static inline __attribute__((always_inline)) void
+apic_send_ipi(bool x2apic, u32 apic_id, u32 icr_lo)
+{
+	if (x2apic)
+		send_x2apic_ipi(apic_id, icr_lo);
+	else
+		send_xapic_ipi(apic_id, icr_lo);
+}
+
 int phys_processor_id(void)
 {
-	return apic_ops.read_id();
+	return using_x2apic ? read_x2apic_id() : read_xapic_id();
 }
 
 int apic_cpu_init(struct per_cpu *cpu_data)
@@ -89,36 +111,52 @@ int apic_cpu_init(struct per_cpu *cpu_data)
 	unsigned int cpu_id = cpu_data->cpu_id;
 	u32 ldr;
 
-	printk("(APIC ID %d) ", apic_id);
-
 	if (apic_id > APIC_MAX_PHYS_ID)
 		return -ERANGE;
 	if (apic_to_cpu_id[apic_id] != APIC_INVALID_ID)
 		return -EBUSY;
 	/* only flat mode with LDR corresponding to logical ID supported */
 	if (!using_x2apic) {
-		ldr = apic_ops.read(APIC_REG_LDR);
-		if (apic_ops.read(APIC_REG_DFR) != 0xffffffff ||
+		ldr = read_xapic(APIC_REG_LDR);
+		if (read_xapic(APIC_REG_DFR) != 0xffffffff ||
 		    (ldr != 0 && ldr != 1UL << (cpu_id + 24)))
 			return -EINVAL;
 	}
 
+	/* the logical destinations of Linux are set up in arch_init_late */
 	apic_to_cpu_id[apic_id] = cpu_id;
 	cpu_data->apic_id = apic_id;
 	return 0;
 }
 
+/* to be called when the CPU set of the cell changed */
+void apic_cell_update(struct cell *cell)
+{
+	unsigned int apic_id, cpu_id;
+
+	memset(cell->apic_logical_dest, 0, sizeof(cell->apic_logical_dest));
+
+	for (apic_id = 0; apic_id <= APIC_MAX_PHYS_ID; apic_id++) {
+		cpu_id = apic_to_cpu_id[apic_id];
+		if (cpu_id == APIC_INVALID_ID ||
+		    cpu_id > cell->cpu_set->max_cpu_id ||
+		    !test_bit(cpu_id, cell->cpu_set->bitmap))
+			continue;
+		if (using_x2apic)
+			cell->apic_logical_dest[apic_id >>
+						X2APIC_CLUSTER_ID_SHIFT] |=
+				1 << (apic_id & X2APIC_CLUSTER_CPU_MASK);
+		else if (cpu_id < 8)
+			cell->apic_logical_dest[0] |= 1 << cpu_id;
+	}
+}
+
 int apic_init(void)
 {
 	unsigned long apicbase = read_msr(MSR_IA32_APICBASE);
 	int err;
 
 	if (apicbase & APIC_BASE_EXTD) {
-		/* set programmatically to enable address fixup */
-		apic_ops.read = read_x2apic;
-		apic_ops.read_id = read_x2apic_id;
-		apic_ops.write = write_x2apic;
-		apic_ops.send_ipi = send_x2apic_ipi;
 		using_x2apic = true;
 	} else if (apicbase & APIC_BASE_EN) {
 		xapic_page = page_alloc(&remap_pool, 1);
@@ -128,13 +166,9 @@ int apic_init(void)
 				      (unsigned long)xapic_page,
 				      PAGE_DEFAULT_FLAGS | PAGE_FLAG_UNCACHED,
 				      PAGE_DEFAULT_FLAGS, PAGE_DIR_LEVELS,
-				      PAGE_MAP_NON_COHERENT);
+				      PAGE_MAP_NO_HUGE, PAGE_MAP_NON_COHERENT);
 		if (err)
 			return err;
-		apic_ops.read = read_xapic;
-		apic_ops.read_id = read_xapic_id;
-		apic_ops.write = write_xapic;
-		apic_ops.send_ipi = send_xapic_ipi;
 	} else
 		return -EIO;
 
@@ -145,32 +179,46 @@ int apic_init(void)
 
 static void apic_send_nmi_ipi(struct per_cpu *target_data)
 {
-	apic_ops.send_ipi(target_data->apic_id,
-			  APIC_ICR_DLVR_NMI |
-			  APIC_ICR_DEST_PHYSICAL |
-			  APIC_ICR_LV_ASSERT |
-			  APIC_ICR_TM_EDGE |
-			  APIC_ICR_SH_NONE);
+	apic_send_ipi(using_x2apic, target_data->apic_id,
+		      APIC_ICR_DLVR_NMI |
+		      APIC_ICR_DEST_PHYSICAL |
+		      APIC_ICR_LV_ASSERT |
+		      APIC_ICR_TM_EDGE |
+		      APIC_ICR_SH_NONE);
 }
 
-void arch_suspend_cpu(unsigned int cpu_id)
+static void apic_request_stop(struct per_cpu *target_data)
 {
-	struct per_cpu *target_data = per_cpu(cpu_id);
-	bool target_stopped;
-
-	spin_lock(&wait_lock);
+	/* the locked bit operation orders the flag against the test */
+	set_bit(APIC_EVENT_STOP, &target_data->events);
+	if (!target_data->cpu_stopped)
+		apic_send_nmi_ipi(target_data);
+}
 
-	target_data->stop_cpu = true;
-	target_stopped = target_data->cpu_stopped;
+static void apic_wait_stopped(struct per_cpu *target_data)
+{
+	while (!target_data->cpu_stopped)
+		cpu_relax();
+}
 
-	spin_unlock(&wait_lock);
+void arch_suspend_cpu(unsigned int cpu_id)
+{
+	trace_event(JAILHOUSE_TRACE_SUSPEND_CPU, cpu_id);
+	apic_request_stop(per_cpu(cpu_id));
+	apic_wait_stopped(per_cpu(cpu_id));
+}
 
-	if (!target_stopped) {
-		apic_send_nmi_ipi(target_data);
+/* signal all CPUs first so that their NMI round-trips overlap */
+void arch_suspend_cpus(struct cpu_set *cpu_set, int exception)
+{
+	unsigned int cpu;
 
-		while (!target_data->cpu_stopped)
-			cpu_relax();
+	for_each_cpu_except(cpu, cpu_set, exception) {
+		trace_event(JAILHOUSE_TRACE_SUSPEND_CPU, cpu);
+		apic_request_stop(per_cpu(cpu));
 	}
+	for_each_cpu_except(cpu, cpu_set, exception)
+		apic_wait_stopped(per_cpu(cpu));
 }
 
 void arch_resume_cpu(unsigned int cpu_id)
@@ -178,30 +226,117 @@ void arch_resume_cpu(unsigned int cpu_id)
 	/* make any state changes visible before releasing the CPU */
 	memory_barrier();
 
-	per_cpu(cpu_id)->stop_cpu = false;
+	trace_event(JAILHOUSE_TRACE_RESUME_CPU, cpu_id);
+	clear_bit(APIC_EVENT_STOP, &per_cpu(cpu_id)->events);
+}
+
+void arch_resume_cpus(struct cpu_set *cpu_set, int exception)
+{
+	unsigned int cpu;
+
+	/* make any state changes visible before releasing the CPUs */
+	memory_barrier();
+
+	for_each_cpu_except(cpu, cpu_set, exception) {
+		trace_event(JAILHOUSE_TRACE_RESUME_CPU, cpu);
+		clear_bit(APIC_EVENT_STOP, &per_cpu(cpu)->events);
+	}
 }
 
 /* target cpu has to be stopped */
 void arch_reset_cpu(unsigned int cpu_id)
 {
-	per_cpu(cpu_id)->wait_for_sipi = true;
 	per_cpu(cpu_id)->sipi_vector = APIC_BSP_PSEUDO_SIPI;
+	set_bit(APIC_EVENT_WAIT_SIPI, &per_cpu(cpu_id)->events);
+	set_bit(APIC_EVENT_SIPI, &per_cpu(cpu_id)->events);
 
 	arch_resume_cpu(cpu_id);
 }
 
-/* target cpu has to be stopped */
+/* target cpu has to be stopped, it is stopped again on return */
 void arch_park_cpu(unsigned int cpu_id)
 {
-	per_cpu(cpu_id)->init_signaled = true;
+	set_bit(APIC_EVENT_INIT, &per_cpu(cpu_id)->events);
 
 	arch_resume_cpu(cpu_id);
+
+	/* a stop request must not overtake the INIT */
+	while (test_bit(APIC_EVENT_INIT, &per_cpu(cpu_id)->events))
+		cpu_relax();
+
+	arch_suspend_cpu(cpu_id);
+}
+
+/*
+ * Target cpus have to be stopped. Like on real hardware, only the first cpu
+ * of the set boots, the others wait for INIT/SIPI from it.
+ */
+void arch_reset_cpus(struct cpu_set *cpu_set, int exception)
+{
+	unsigned int boot_cpu = next_cpu(-1, cpu_set, -1);
+	unsigned int cpu;
+
+	for_each_cpu_except(cpu, cpu_set, exception) {
+		if (cpu != boot_cpu) {
+			set_bit(APIC_EVENT_INIT, &per_cpu(cpu)->events);
+			continue;
+		}
+		per_cpu(cpu)->sipi_vector = APIC_BSP_PSEUDO_SIPI;
+		set_bit(APIC_EVENT_WAIT_SIPI, &per_cpu(cpu)->events);
+		set_bit(APIC_EVENT_SIPI, &per_cpu(cpu)->events);
+	}
+
+	arch_resume_cpus(cpu_set, exception);
+}
+
+/*
+ * Target cpus have to be stopped. They are parked in parallel and stopped
+ * again on return, so the caller can rely on the INIT having taken effect.
+ */
+void arch_park_cpus(struct cpu_set *cpu_set, int exception)
+{
+	unsigned int cpu;
+
+	for_each_cpu_except(cpu, cpu_set, exception)
+		set_bit(APIC_EVENT_INIT, &per_cpu(cpu)->events);
+
+	arch_resume_cpus(cpu_set, exception);
+
+	/* a stop request must not overtake the INIT */
+	for_each_cpu_except(cpu, cpu_set, exception)
+		while (test_bit(APIC_EVENT_INIT, &per_cpu(cpu)->events))
+			cpu_relax();
+
+	arch_suspend_cpus(cpu_set, exception);
+}
+
+/*
+ * The target CPU runs its cell's guest with interrupts passed through, so
+ * the vector is delivered directly without a VM exit.
+ */
+void arch_send_irq(unsigned int cpu_id, unsigned int vector)
+{
+	u32 icr_lo = (vector & APIC_ICR_VECTOR_MASK) | APIC_ICR_DLVR_FIXED |
+		APIC_ICR_DEST_PHYSICAL | APIC_ICR_LV_ASSERT |
+		APIC_ICR_TM_EDGE | APIC_ICR_SH_NONE;
+	u32 icr_hi;
+
+	if (using_x2apic) {
+		send_x2apic_ipi(per_cpu(cpu_id)->apic_id, icr_lo);
+	} else {
+		/* the guest may have prepared a destination already */
+		icr_hi = read_xapic(APIC_REG_ICR_HI);
+		send_xapic_ipi(per_cpu(cpu_id)->apic_id, icr_lo);
+		write_xapic(APIC_REG_ICR_HI, icr_hi);
+	}
+
+	this_cpu_data()->stats->interrupts++;
 }
 
 void arch_shutdown_cpu(unsigned int cpu_id)
 {
 	arch_suspend_cpu(cpu_id);
-	per_cpu(cpu_id)->shutdown_cpu = true;
+	set_bit(APIC_EVENT_SHUTDOWN, &per_cpu(cpu_id)->events);
 	arch_resume_cpu(cpu_id);
 	/*
 	 * Note: The caller has to ensure that the target CPU has enough time
@@ -218,20 +353,21 @@ void apic_nmi_handler(struct per_cpu *cpu_data)
 
 void apic_irq_handler(struct per_cpu *cpu_data)
 {
-	apic_ops.write(APIC_REG_EOI, APIC_EOI_ACK);
+	apic_write(using_x2apic, APIC_REG_EOI, APIC_EOI_ACK);
 }
 
 static void apic_mask_lvt(unsigned int reg)
 {
-	unsigned int val = apic_ops.read(reg);
+	unsigned int val = apic_read(using_x2apic, reg);
 
 	if (!(val & APIC_LVT_MASKED))
-		apic_ops.write(reg, val | APIC_LVT_MASKED);
+		apic_write(using_x2apic, reg, val | APIC_LVT_MASKED);
 }
 
 static void apic_clear(void)
 {
-	unsigned int maxlvt = (apic_ops.read(APIC_REG_LVR) >> 16) & 0xff;
+	unsigned int maxlvt =
+		(apic_read(using_x2apic, APIC_REG_LVR) >> 16) & 0xff;
 	int n;
 
 	apic_mask_lvt(APIC_REG_LVTERR);
@@ -246,10 +382,10 @@ static void apic_clear(void)
 	apic_mask_lvt(APIC_REG_LVT1);
 
 	for (n = APIC_NUM_INT_REGS-1; n >= 0; n--)
-		while (apic_ops.read(APIC_REG_ISR0 + n) != 0)
-			apic_ops.write(APIC_REG_EOI, APIC_EOI_ACK);
+		while (apic_read(using_x2apic, APIC_REG_ISR0 + n) != 0)
+			apic_write(using_x2apic, APIC_REG_EOI, APIC_EOI_ACK);
 
-	apic_ops.write(APIC_REG_TPR, 0);
+	apic_write(using_x2apic, APIC_REG_TPR, 0);
 	enable_irq();
 	cpu_relax();
 	disable_irq();
@@ -257,14 +393,13 @@ static void apic_clear(void)
 
 int apic_handle_events(struct per_cpu *cpu_data)
 {
+	volatile unsigned long *events = &cpu_data->events;
 	int sipi_vector = -1;
-
-	spin_lock(&wait_lock);
+	unsigned long start;
 
 	do {
-		if (cpu_data->init_signaled) {
-			cpu_data->init_signaled = false;
-			cpu_data->wait_for_sipi = true;
+		if (test_and_clear_bit(APIC_EVENT_INIT, events)) {
+			set_bit(APIC_EVENT_WAIT_SIPI, events);
 			sipi_vector = -1;
 			apic_clear();
 			vmx_cpu_park();
@@ -272,36 +407,40 @@ int apic_handle_events(struct per_cpu *cpu_data)
 		}
 
 		cpu_data->cpu_stopped = true;
+		start = read_tsc();
+		do {
+			while (test_bit(APIC_EVENT_STOP, events))
+				cpu_relax();
+
+			if (test_bit(APIC_EVENT_SHUTDOWN, events)) {
+				apic_clear();
+				vmx_cpu_exit(cpu_data);
+				asm volatile("hlt");
+			}
 
-		spin_unlock(&wait_lock);
-
-		while (cpu_data->stop_cpu)
-			cpu_relax();
-
-		if (cpu_data->shutdown_cpu) {
-			apic_clear();
-			vmx_cpu_exit(cpu_data);
-			asm volatile("hlt");
-		}
-
-		spin_lock(&wait_lock);
-
-		cpu_data->cpu_stopped = false;
-
-		if (cpu_data->wait_for_sipi) {
-			cpu_data->wait_for_sipi = false;
+			cpu_data->cpu_stopped = false;
+			memory_barrier();
+			/*
+			 * A stop request that saw us still stopped did not
+			 * send an NMI, so we have to check again.
+			 */
+			if (!test_bit(APIC_EVENT_STOP, events))
+				break;
+			cpu_data->cpu_stopped = true;
+		} while (1);
+		cpu_data->stats->suspended_cycles += read_tsc() - start;
+
+		/* a SIPI only counts if we are still waiting for it */
+		if (test_and_clear_bit(APIC_EVENT_SIPI, events) &&
+		    test_and_clear_bit(APIC_EVENT_WAIT_SIPI, events))
 			sipi_vector = cpu_data->sipi_vector;
-		}
-	} while (cpu_data->init_signaled);
+	} while (test_bit(APIC_EVENT_INIT, events));
 
-	if (cpu_data->flush_caches) {
-		cpu_data->flush_caches = false;
+	if (test_and_clear_bit(APIC_EVENT_FLUSH_CACHES, events)) {
 		flush_tlb();
-		vmx_invept();
+		vmx_invept(cpu_data->cell);
 	}
 
-	spin_unlock(&wait_lock);
-
 	return sipi_vector;
 }
 
@@ -331,12 +470,11 @@ static void apic_validate_ipi_mode(struct per_cpu *cpu_data, u32 lo_val)
 	}
 }
 
-static void apic_deliver_ipi(struct per_cpu *cpu_data,
-			     unsigned int target_cpu_id,
-			     u32 orig_icr_hi, u32 icr_lo)
+static inline __attribute__((always_inline)) void
+apic_deliver_ipi(bool x2apic, struct per_cpu *cpu_data,
+		 unsigned int target_cpu_id, u32 orig_icr_hi, u32 icr_lo)
 {
 	struct per_cpu *target_data;
-	bool send_nmi;
 
 	if (target_cpu_id == APIC_INVALID_ID ||
 	    !test_bit(target_cpu_id, cpu_data->cell->cpu_set->bitmap)) {
@@ -348,41 +486,38 @@ static void apic_deliver_ipi(struct per_cpu *cpu_data,
 
 	target_data = per_cpu(target_cpu_id);
 
+	cpu_data->stats->ipis++;
+	trace_event(JAILHOUSE_TRACE_IPI,
+		    (target_cpu_id << 16) | (icr_lo & 0xffff));
+
 	switch (icr_lo & APIC_ICR_DLVR_MASK) {
 	case APIC_ICR_DLVR_NMI:
 		/* TODO: must be sent via hypervisor */
 		printk("Ignoring NMI IPI\n");
 		return;
 	case APIC_ICR_DLVR_INIT:
+		if (!test_bit(APIC_EVENT_WAIT_SIPI, &target_data->events)) {
+			set_bit(APIC_EVENT_INIT, &target_data->events);
+			apic_send_nmi_ipi(target_data);
+		}
+		return;
 	case APIC_ICR_DLVR_SIPI:
-		send_nmi = false;
-
-		spin_lock(&wait_lock);
-
-		if ((icr_lo & APIC_ICR_DLVR_MASK) == APIC_ICR_DLVR_INIT) {
-			if (!target_data->wait_for_sipi) {
-				target_data->init_signaled = true;
-				send_nmi = true;
-			}
-		} else if (target_data->wait_for_sipi) {
+		if (test_bit(APIC_EVENT_WAIT_SIPI, &target_data->events)) {
+			/* the vector is published by setting the event bit */
 			target_data->sipi_vector =
 				icr_lo & APIC_ICR_VECTOR_MASK;
-			send_nmi = true;
-		}
-
-		spin_unlock(&wait_lock);
-
-		if (send_nmi)
+			set_bit(APIC_EVENT_SIPI, &target_data->events);
 			apic_send_nmi_ipi(target_data);
+		}
 		return;
 	}
 
-	apic_ops.send_ipi(target_data->apic_id, icr_lo);
+	apic_send_ipi(x2apic, target_data->apic_id, icr_lo);
 }
 
-static void apic_deliver_logical_dest_ipi(struct per_cpu *cpu_data,
-					  unsigned long dest, u32 lo_val,
-					  u32 hi_val)
+static inline __attribute__((always_inline)) void
+apic_deliver_logical_dest_ipi(bool x2apic, struct per_cpu *cpu_data,
+			      unsigned long dest, u32 lo_val, u32 hi_val)
 {
 	unsigned int target_cpu_id;
 	unsigned int logical_id;
@@ -390,60 +525,135 @@ static void apic_deliver_logical_dest_ipi(struct per_cpu *cpu_data,
 	unsigned long dest_mask;
 	unsigned int apic_id;
 
-	if (using_x2apic) {
+	if (x2apic) {
 		cluster_id = (dest & X2APIC_DEST_CLUSTER_ID_MASK) >>
 			X2APIC_DEST_CLUSTER_ID_SHIFT;
-		dest_mask = ~(dest & X2APIC_DEST_LOGICAL_ID_MASK);
+		dest_mask = dest & X2APIC_DEST_LOGICAL_ID_MASK;
+	} else {
+		cluster_id = 0;
+		dest_mask = dest;
+	}
+
+	/*
+	 * Fixed multicasts within the cell are forwarded as they are, the
+	 * host uses the same logical addressing as the guest.
+	 */
+	if ((lo_val & APIC_ICR_DLVR_MASK) == APIC_ICR_DLVR_FIXED &&
+	    cluster_id < X2APIC_NUM_CLUSTERS && dest_mask != 0 &&
+	    (dest_mask & ~cpu_data->cell->apic_logical_dest[cluster_id]) == 0) {
+		/* the trace only names the first target */
+		target_cpu_id = ffz(~dest_mask);
+		if (x2apic)
+			target_cpu_id = apic_to_cpu_id[target_cpu_id |
+				(cluster_id << X2APIC_CLUSTER_ID_SHIFT)];
+		cpu_data->stats->ipis++;
+		trace_event(JAILHOUSE_TRACE_IPI,
+			    (target_cpu_id << 16) | (lo_val & 0xffff));
+		apic_send_ipi(x2apic, dest, lo_val | APIC_ICR_DEST_LOGICAL);
+		return;
+	}
+
+	if (x2apic) {
+		dest_mask = ~dest_mask;
 		while (dest_mask != ~0UL) {
 			logical_id = ffz(dest_mask);
 			dest_mask |= 1UL << logical_id;
 			apic_id = logical_id |
 				(cluster_id << X2APIC_CLUSTER_ID_SHIFT);
 			target_cpu_id = apic_to_cpu_id[apic_id];
-			apic_deliver_ipi(cpu_data, target_cpu_id, hi_val,
-					 lo_val);
+			apic_deliver_ipi(x2apic, cpu_data, target_cpu_id,
+					 hi_val, lo_val);
 		}
 	} else {
-		dest_mask = ~dest;
+		dest_mask = ~dest_mask;
 		while (dest_mask != ~0UL) {
 			target_cpu_id = ffz(dest_mask);
 			dest_mask |= 1UL << target_cpu_id;
-			apic_deliver_ipi(cpu_data, target_cpu_id, hi_val,
-					 lo_val);
+			apic_deliver_ipi(x2apic, cpu_data, target_cpu_id,
+					 hi_val, lo_val);
 		}
 	}
 }
 
-void apic_handle_icr_write(struct per_cpu *cpu_data, u32 lo_val, u32 hi_val)
+/*
+ * Fixed IPIs to a single, physically addressed CPU of the own cell are the
+ * bulk (rescheduling, function calls, TLB shootdowns). Forward them without
+ * the generic validation and dispatching. Everything else, including
+ * destinations outside the cell, takes the slow path.
+ */
+static inline __attribute__((always_inline)) bool
+apic_send_fixed_ipi_fast(bool x2apic, struct per_cpu *cpu_data, u32 lo_val,
+			 u32 hi_val)
+{
+	unsigned long dest = x2apic ? hi_val : hi_val >> 24;
+	unsigned int target_cpu_id;
+
+	if ((lo_val & (APIC_ICR_DLVR_MASK | APIC_ICR_DEST_LOGICAL |
+		       APIC_ICR_SH_MASK)) != APIC_ICR_DLVR_FIXED ||
+	    dest > APIC_MAX_PHYS_ID)
+		return false;
+
+	target_cpu_id = apic_to_cpu_id[dest];
+	if (target_cpu_id == APIC_INVALID_ID ||
+	    !test_bit(target_cpu_id, cpu_data->cell->cpu_set->bitmap))
+		return false;
+
+	cpu_data->stats->ipis++;
+	trace_event(JAILHOUSE_TRACE_IPI,
+		    (target_cpu_id << 16) | (lo_val & 0xffff));
+	apic_send_ipi(x2apic, dest, lo_val);
+	return true;
+}
+
+static inline __attribute__((always_inline)) void
+apic_handle_icr_write(bool x2apic, struct per_cpu *cpu_data, u32 lo_val,
+		      u32 hi_val)
 {
 	unsigned int target_cpu_id;
 	unsigned long dest;
 
+	if (apic_send_fixed_ipi_fast(x2apic, cpu_data, lo_val, hi_val))
+		return;
+
 	apic_validate_ipi_mode(cpu_data, lo_val);
 
 	if ((lo_val & APIC_ICR_SH_MASK) == APIC_ICR_SH_SELF) {
-		apic_ops.write(APIC_REG_ICR, (lo_val & APIC_ICR_VECTOR_MASK) |
-					     APIC_ICR_DLVR_FIXED |
-					     APIC_ICR_TM_EDGE |
-					     APIC_ICR_SH_SELF);
+		apic_write(x2apic, APIC_REG_ICR,
+			   (lo_val & APIC_ICR_VECTOR_MASK) |
+			   APIC_ICR_DLVR_FIXED |
+			   APIC_ICR_TM_EDGE |
+			   APIC_ICR_SH_SELF);
 		return;
 	}
 
 	dest = hi_val;
-	if (!using_x2apic)
+	if (!x2apic)
 		dest >>= 24;
 
 	if (lo_val & APIC_ICR_DEST_LOGICAL) {
 		lo_val &= ~APIC_ICR_DEST_LOGICAL;
-		apic_deliver_logical_dest_ipi(cpu_data, dest, lo_val, hi_val);
+		apic_deliver_logical_dest_ipi(x2apic, cpu_data, dest, lo_val,
+					      hi_val);
 	} else {
 		target_cpu_id = APIC_INVALID_ID;
 		if (dest <= APIC_MAX_PHYS_ID)
 			target_cpu_id = apic_to_cpu_id[dest];
-		apic_deliver_ipi(cpu_data, target_cpu_id, hi_val, lo_val);
+		apic_deliver_ipi(x2apic, cpu_data, target_cpu_id, hi_val,
+				 lo_val);
 	}
 }
 
+static void xapic_handle_icr_write(struct per_cpu *cpu_data, u32 lo_val,
+				   u32 hi_val)
+{
+	apic_handle_icr_write(false, cpu_data, lo_val, hi_val);
+}
+
+void x2apic_handle_icr_write(struct per_cpu *cpu_data, u32 lo_val, u32 hi_val)
+{
+	apic_handle_icr_write(true, cpu_data, lo_val, hi_val);
+}
+
 unsigned int apic_mmio_access(struct registers *guest_regs,
 			      struct per_cpu *cpu_data, unsigned long rip,
 			      unsigned long page_table_addr, unsigned int reg,
@@ -463,8 +673,8 @@ unsigned int apic_mmio_access(struct registers *guest_regs,
 	if (is_write) {
 		val = ((unsigned long *)guest_regs)[access.reg];
 		if (reg == APIC_REG_ICR) {
-			apic_handle_icr_write(cpu_data, val,
-					      apic_ops.read(APIC_REG_ICR_HI));
+			xapic_handle_icr_write(cpu_data, val,
+					       read_xapic(APIC_REG_ICR_HI));
 		} else if (reg == APIC_REG_LDR &&
 			 val != 1UL << (cpu_data->cpu_id + 24)) {
 			panic_printk("FATAL: Unsupported change to LDR: %x\n",
@@ -475,14 +685,20 @@ unsigned int apic_mmio_access(struct registers *guest_regs,
 				     val);
 			return 0;
 		} else
-			apic_ops.write(reg, val);
+			write_xapic(reg, val);
 	} else {
-		val = apic_ops.read(reg);
+		val = read_xapic(reg);
 		((unsigned long *)guest_regs)[access.reg] = val;
 	}
 	return access.inst_len;
 }
 
+/* the value written to EOI is ignored, so no decoding needed */
+void xapic_handle_eoi(void)
+{
+	write_xapic(APIC_REG_EOI, APIC_EOI_ACK);
+}
+
 void x2apic_handle_write(struct registers *guest_regs)
 {
 	u32 reg = guest_regs->rcx;
@@ -491,7 +707,7 @@ void x2apic_handle_write(struct registers *guest_regs)
 		/* TODO: emulate */
 		printk("Unhandled x2APIC self IPI write\n");
 	else
-		apic_ops.write(reg - MSR_X2APIC_BASE, guest_regs->rax);
+		write_x2apic(reg - MSR_X2APIC_BASE, guest_regs->rax);
 }
 
 void x2apic_handle_read(struct registers *guest_regs)
@@ -499,9 +715,9 @@ void x2apic_handle_read(struct registers *guest_regs)
 	u32 reg = guest_regs->rcx;
 
 	guest_regs->rax &= ~0xffffffffUL;
-	guest_regs->rax |= apic_ops.read(reg - MSR_X2APIC_BASE);
+	guest_regs->rax |= read_x2apic(reg - MSR_X2APIC_BASE);
 
 	guest_regs->rdx &= ~0xffffffffUL;
 	if (reg == MSR_X2APIC_ICR)
-		guest_regs->rdx |= apic_ops.read(reg - MSR_X2APIC_BASE + 1);
+		guest_regs->rdx |= read_x2apic(reg - MSR_X2APIC_BASE + 1);
 }
@@ -0,0 +1,224 @@
+/*
+ * Jailhouse, a Linux-based partitioning hypervisor
+ *
+ * Copyright (c) Siemens AG, 2013
+ *
+ * Authors:
+ *  Jan Kiszka <jan.kiszka@siemens.com>
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.  See
+ * the COPYING file in the top-level directory.
+ */
+
+#include <jailhouse/control.h>
+#include <jailhouse/entry.h>
+#include <jailhouse/printk.h>
+#include <asm/cat.h>
+#include <asm/percpu.h>
+#include <asm/processor.h>
+
+/*
+ * Cells with a cache mask or an MBA delay get the class of service (CLOS)
+ * that matches their ID, all others share CLOS 0 with Linux. Cache masks of
+ * cells must not overlap. Their ways are removed from CLOS 0, which keeps
+ * the largest contiguous run of the remaining ways of the Linux mask, and
+ * are returned on destruction. The classes are programmed by each CPU when
+ * it enters its cell, CLOS 0 also by the CPU reconfiguring cells. Writes of
+ * cells to the allocation MSRs are ignored, only the RMID of
+ * IA32_PQR_ASSOC is left under their control for monitoring.
+ */
+
+#define X86_FEATURE_RDT_A	(1 << 15)	/* CPUID 7, EBX */
+
+#define CPUID_10_L3_CAT		(1 << 1)
+#define CPUID_10_MBA		(1 << 3)
+
+#define PQR_ASSOC_RMID_MASK	0x3ff
+
+static unsigned int cat_num_clos, mba_num_clos;
+static u32 cat_full_mask, mba_max_delay;
+/* ways owned by cells other than Linux and the resulting mask of CLOS 0 */
+static u32 cat_cells_mask, cat_linux_mask;
+
+static void cpuid_subleaf(u32 op, u32 index, u32 *eax, u32 *ebx, u32 *ecx,
+			  u32 *edx)
+{
+	*eax = op;
+	*ecx = index;
+	__cpuid(eax, ebx, ecx, edx);
+}
+
+void cat_init(void)
+{
+	u32 eax, ebx, ecx, edx;
+
+	if (!(cpuid_ebx(7) & X86_FEATURE_RDT_A))
+		return;
+
+	cpuid_subleaf(0x10, 0, &eax, &ebx, &ecx, &edx);
+	if (ebx & CPUID_10_L3_CAT) {
+		cpuid_subleaf(0x10, 1, &eax, &ebx, &ecx, &edx);
+		cat_full_mask = (1UL << ((eax & 0x1f) + 1)) - 1;
+		cat_num_clos = (edx & 0xffff) + 1;
+		cat_linux_mask = cat_full_mask;
+		printk("CAT: %d classes of service, mask %x\n", cat_num_clos,
+		       cat_full_mask);
+		/* restore ebx of subleaf 0 for the MBA test */
+		cpuid_subleaf(0x10, 0, &eax, &ebx, &ecx, &edx);
+	}
+	if (ebx & CPUID_10_MBA) {
+		cpuid_subleaf(0x10, 3, &eax, &ebx, &ecx, &edx);
+		mba_max_delay = (eax & 0xfff) + 1;
+		mba_num_clos = (edx & 0xffff) + 1;
+		printk("MBA: %d classes of service, maximum delay %d\n",
+		       mba_num_clos, mba_max_delay);
+	}
+}
+
+bool cat_msr_owned(u32 msr)
+{
+	if (cat_num_clos == 0 && mba_num_clos == 0)
+		return false;
+	if (msr == MSR_IA32_PQR_ASSOC)
+		return true;
+	if (msr == MSR_IA32_L3_QOS_CFG)
+		return cat_num_clos > 0;
+	if (msr >= MSR_IA32_L3_MASK_0 &&
+	    msr < MSR_IA32_L3_MASK_0 + cat_num_clos)
+		return true;
+	return msr >= MSR_IA32_MBA_THRTL_0 &&
+		msr < MSR_IA32_MBA_THRTL_0 + mba_num_clos;
+}
+
+static bool cat_mask_contiguous(u32 mask)
+{
+	while (!(mask & 1))
+		mask >>= 1;
+	return (mask & (mask + 1)) == 0;
+}
+
+static u32 cat_largest_run(u32 mask)
+{
+	unsigned int n, len = 0, best_len = 0;
+	u32 run = 0, best = 0;
+
+	for (n = 0; n < 32; n++) {
+		if (!(mask & (1U << n))) {
+			run = len = 0;
+			continue;
+		}
+		run |= 1U << n;
+		if (++len > best_len) {
+			best = run;
+			best_len = len;
+		}
+	}
+	return best;
+}
+
+static u32 cat_linux_ways(u32 cells_mask)
+{
+	u32 mask = linux_cell.config->cache_mask;
+
+	return cat_largest_run((mask ? mask : cat_full_mask) & ~cells_mask);
+}
+
+static void cat_set_class(unsigned int clos, u32 mask, u32 delay)
+{
+	if (clos < cat_num_clos)
+		write_msr(MSR_IA32_L3_MASK_0 + clos,
+			  mask ? mask : cat_full_mask);
+	if (clos < mba_num_clos)
+		write_msr(MSR_IA32_MBA_THRTL_0 + clos, delay);
+}
+
+static void cat_update_linux_class(u32 cells_mask)
+{
+	cat_cells_mask = cells_mask;
+	cat_linux_mask = cat_linux_ways(cells_mask);
+	cat_set_class(0, cat_linux_mask, linux_cell.config->mba_delay);
+}
+
+int cat_cell_init(struct cell *cell)
+{
+	u32 mask = cell->config->cache_mask;
+	u32 delay = cell->config->mba_delay;
+
+	cell->clos = 0;
+	if (mask == 0 && delay == 0)
+		return 0;
+
+	if (mask != 0 &&
+	    (cell->id >= cat_num_clos || (mask & ~cat_full_mask) ||
+	     !cat_mask_contiguous(mask))) {
+		printk("ERROR: cannot apply cache mask %x to cell %d\n",
+		       mask, cell->id);
+		return -EINVAL;
+	}
+	if (delay != 0 && (cell->id >= mba_num_clos || delay > mba_max_delay)) {
+		printk("ERROR: cannot apply MBA delay %d to cell %d\n",
+		       delay, cell->id);
+		return -EINVAL;
+	}
+
+	if (cell != &linux_cell && mask != 0) {
+		if (mask & cat_cells_mask) {
+			printk("ERROR: cache mask %x of cell %d overlaps with "
+			       "other cells\n", mask, cell->id);
+			return -EBUSY;
+		}
+		if (cat_linux_ways(cat_cells_mask | mask) == 0) {
+			printk("ERROR: cache mask %x leaves no ways to Linux\n",
+			       mask);
+			return -EBUSY;
+		}
+		cat_update_linux_class(cat_cells_mask | mask);
+	} else if (cell == &linux_cell && cat_num_clos > 0) {
+		/* programmed as the CPUs enter Linux */
+		cat_linux_mask = cat_linux_ways(0);
+	}
+
+	cell->clos = cell->id;
+	return 0;
+}
+
+void cat_cell_exit(struct cell *cell)
+{
+	if (cell->clos != 0 && cell->config->cache_mask != 0)
+		cat_update_linux_class(cat_cells_mask &
+				       ~cell->config->cache_mask);
+}
+
+/* to be called on the CPU that enters the cell */
+void cat_cpu_init(struct per_cpu *cpu_data)
+{
+	struct cell *cell = cpu_data->cell;
+
+	if (cat_num_clos == 0 && mba_num_clos == 0)
+		return;
+
+	/* CLOS 0 belongs to Linux, others only to the cell of that ID */
+	cat_set_class(0, cat_linux_mask, linux_cell.config->mba_delay);
+	if (cell->clos != 0)
+		cat_set_class(cell->clos, cell->config->cache_mask,
+			      cell->config->mba_delay);
+
+	write_msr(MSR_IA32_PQR_ASSOC, (unsigned long)cell->clos << 32);
+}
+
+void cat_cpu_exit(struct per_cpu *cpu_data)
+{
+	if (cat_num_clos == 0 && mba_num_clos == 0)
+		return;
+
+	cat_set_class(0, 0, 0);
+	write_msr(MSR_IA32_PQR_ASSOC, 0);
+}
+
+void cat_msr_write(struct registers *guest_regs, struct per_cpu *cpu_data)
+{
+	if (guest_regs->rcx == MSR_IA32_PQR_ASSOC)
+		write_msr(MSR_IA32_PQR_ASSOC,
+			  ((unsigned long)cpu_data->cell->clos << 32) |
+			  (guest_regs->rax & PQR_ASSOC_RMID_MASK));
+}
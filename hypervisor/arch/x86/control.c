@@ -11,36 +11,71 @@
  */
 
 #include <jailhouse/control.h>
+#include <jailhouse/paging.h>
+#include <asm/apic.h>
+#include <asm/bitops.h>
+#include <asm/cat.h>
+#include <asm/time.h>
 #include <asm/vmx.h>
 #include <asm/vtd.h>
 
-static void flush_linux_cpu_caches(struct per_cpu *cpu_data)
+static void flush_cell_cpu_caches(struct cell *cell,
+				  struct per_cpu *cpu_data)
 {
 	unsigned int cpu;
 
-	for_each_cpu_except(cpu, linux_cell.cpu_set, cpu_data->cpu_id)
-		per_cpu(cpu)->flush_caches = true;
+	for_each_cpu_except(cpu, cell->cpu_set, cpu_data->cpu_id)
+		set_bit(APIC_EVENT_FLUSH_CACHES, &per_cpu(cpu)->events);
 }
 
 int arch_cell_create(struct per_cpu *cpu_data, struct cell *cell)
 {
 	int err;
 
-	/* TODO: Implement proper roll-backs on errors */
+	err = cat_cell_init(cell);
+	if (err)
+		return err;
+
+	apic_cell_update(cell);
 
-	vmx_linux_cell_shrink(cell->config);
-	flush_linux_cpu_caches(cpu_data);
 	err = vmx_cell_init(cell);
 	if (err)
-		return err;
+		goto error_cat_exit;
+
+	err = time_cell_init(cell);
+	if (err)
+		goto error_vmx_exit;
 
-	vtd_linux_cell_shrink(cell->config);
 	err = vtd_cell_init(cell);
 	if (err)
-		vmx_cell_exit(cell);
+		goto error_time_exit;
+
+	return 0;
+
+error_time_exit:
+	time_cell_exit(cell);
+error_vmx_exit:
+	vmx_cell_exit(cell);
+error_cat_exit:
+	cat_cell_exit(cell);
 	return err;
 }
 
+int arch_cell_commit(struct per_cpu *cpu_data, struct cell *cell)
+{
+	int err;
+
+	err = vmx_linux_cell_shrink(cell);
+	if (err)
+		return err;
+
+	err = vtd_linux_cell_shrink(cell);
+	if (err)
+		return err;
+
+	return vtd_cell_assign(cell);
+}
+
 int arch_map_memory_region(struct cell *cell,
 			   const struct jailhouse_memory *mem)
 {
@@ -66,8 +101,52 @@ void arch_unmap_memory_region(struct cell *cell,
 void arch_cell_destroy(struct per_cpu *cpu_data, struct cell *cell)
 {
 	vtd_cell_exit(cell);
+	time_cell_exit(cell);
 	vmx_cell_exit(cell);
-	flush_linux_cpu_caches(cpu_data);
+	cat_cell_exit(cell);
+}
+
+void arch_config_commit(struct per_cpu *cpu_data, struct cell *cell_added)
+{
+	apic_cell_update(&linux_cell);
+	flush_cell_cpu_caches(&linux_cell, cpu_data);
+	vmx_invept(&linux_cell);
+	vtd_config_commit(cell_added);
+}
+
+/* the cell is suspended */
+void arch_cell_cpus_changed(struct cell *cell)
+{
+	apic_cell_update(cell);
+}
+
+void arch_get_mem_usage(struct cell *cell, struct jailhouse_mem_info *info)
+{
+	info->page_tables = page_map_count_tables(cell->vmx.ept,
+						  PAGE_DIR_LEVELS);
+	vtd_get_mem_usage(cell, info);
+}
+
+/* the CPUs of the cell are suspended if the bits are to be cleared */
+int arch_cell_scan_working_set(struct per_cpu *cpu_data, struct cell *cell,
+			       struct jailhouse_working_set *ws)
+{
+	int err;
+
+	err = vmx_cell_scan_working_set(cell, ws);
+	if (err || !(ws->flags & JAILHOUSE_WS_CLEAR))
+		return err;
+
+	/* processed by the suspended CPUs when they resume */
+	flush_cell_cpu_caches(cell, cpu_data);
+	if (cpu_data->cell == cell)
+		vmx_invept(cell);
+	return 0;
+}
+
+const struct jailhouse_dma_faults *arch_get_dma_faults(unsigned int unit)
+{
+	return vtd_get_faults(unit);
 }
 
 void arch_shutdown(void)
@@ -0,0 +1,193 @@
+/*
+ * Jailhouse, a Linux-based partitioning hypervisor
+ *
+ * Copyright (c) Siemens AG, 2013
+ *
+ * Authors:
+ *  Jan Kiszka <jan.kiszka@siemens.com>
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.  See
+ * the COPYING file in the top-level directory.
+ */
+
+#include <jailhouse/printk.h>
+#include <jailhouse/string.h>
+#include <asm/cpuid.h>
+#include <asm/percpu.h>
+#include <asm/processor.h>
+
+#define CPUID_MAX_BASIC_LEAF		0x1f
+#define CPUID_MAX_EXTENDED_LEAF		0x80000008
+
+#define CPUID_1_ECX_OSXSAVE		(1 << 27)
+#define CPUID_4_TYPE_MASK		0x1f
+#define CPUID_B_TYPE_MASK		0xff00
+
+static struct cpuid_entry *cpuid_cache_add(struct cpuid_cache *cache,
+					   u32 function, u32 index)
+{
+	struct cpuid_entry *entry;
+
+	if (cache->entries >= CPUID_CACHE_ENTRIES)
+		return NULL;
+
+	entry = &cache->entry[cache->entries++];
+	entry->function = function;
+	entry->index = index;
+	entry->regs[0] = function;
+	entry->regs[2] = index == CPUID_NO_INDEX ? 0 : index;
+	__cpuid(&entry->regs[0], &entry->regs[1], &entry->regs[2],
+		&entry->regs[3]);
+
+	return entry;
+}
+
+static void cpuid_cache_add_leaf(struct cpuid_cache *cache, u32 function)
+{
+	struct cpuid_entry *entry;
+	u64 xsave_features;
+	u32 index;
+
+	switch (function) {
+	case 0x04:
+		/* enumerated until a null cache type is reported */
+		index = 0;
+		do
+			entry = cpuid_cache_add(cache, function, index++);
+		while (entry && entry->regs[0] & CPUID_4_TYPE_MASK);
+		break;
+	case 0x0b:
+	case 0x1f:
+		/* enumerated until an invalid level type is reported */
+		index = 0;
+		do
+			entry = cpuid_cache_add(cache, function, index++);
+		while (entry && entry->regs[2] & CPUID_B_TYPE_MASK);
+		break;
+	case 0x07:
+	case 0x14:
+	case 0x17:
+	case 0x18:
+		/* subleaf 0 reports the number of further subleaves */
+		entry = cpuid_cache_add(cache, function, 0);
+		for (index = 1; entry && index <= entry->regs[0]; index++)
+			cpuid_cache_add(cache, function, index);
+		break;
+	case 0x0d:
+		/* subleaves 0 and 1, then one per supported state component */
+		entry = cpuid_cache_add(cache, function, 0);
+		if (!entry)
+			break;
+		xsave_features = entry->regs[0] |
+			((u64)entry->regs[3] << 32);
+		entry = cpuid_cache_add(cache, function, 1);
+		if (!entry)
+			break;
+		xsave_features |= entry->regs[2] | ((u64)entry->regs[3] << 32);
+		for (index = 2; index < 64; index++)
+			if (xsave_features & (1UL << index))
+				cpuid_cache_add(cache, function, index);
+		break;
+	case 0x0f:
+	case 0x10:
+		for (index = 0; index < 4; index++)
+			cpuid_cache_add(cache, function, index);
+		break;
+	default:
+		cpuid_cache_add(cache, function, CPUID_NO_INDEX);
+		break;
+	}
+}
+
+void cpuid_cache_init(struct per_cpu *cpu_data)
+{
+	struct cpuid_cache *cache = &cpu_data->cpuid_cache;
+	u32 function;
+
+	cache->entries = 0;
+	cache->max_basic = cpuid_eax(0);
+	cache->max_extended = cpuid_eax(0x80000000);
+
+	for (function = 0; function <= cache->max_basic &&
+	     function <= CPUID_MAX_BASIC_LEAF; function++)
+		cpuid_cache_add_leaf(cache, function);
+	for (function = 0x80000000; function <= cache->max_extended &&
+	     function <= CPUID_MAX_EXTENDED_LEAF; function++)
+		cpuid_cache_add_leaf(cache, function);
+
+	if (cache->entries == CPUID_CACHE_ENTRIES)
+		printk("WARNING: CPUID cache of CPU %d exhausted\n",
+		       cpu_data->cpu_id);
+}
+
+/* The XSAVE area sizes reported by leaf 0xd depend on XCR0. */
+void cpuid_cache_update_xsave(struct per_cpu *cpu_data)
+{
+	struct cpuid_cache *cache = &cpu_data->cpuid_cache;
+	struct cpuid_entry *entry;
+	unsigned int n;
+
+	for (n = 0, entry = cache->entry; n < cache->entries; n++, entry++)
+		if (entry->function == 0x0d && entry->index <= 1) {
+			entry->regs[0] = entry->function;
+			entry->regs[2] = entry->index;
+			__cpuid(&entry->regs[0], &entry->regs[1],
+				&entry->regs[2], &entry->regs[3]);
+		}
+}
+
+static const struct cpuid_entry *
+cpuid_cache_lookup(struct cpuid_cache *cache, u32 function, u32 index)
+{
+	const struct cpuid_entry *entry = cache->entry;
+	unsigned int n;
+
+	for (n = 0; n < cache->entries; n++, entry++)
+		if (entry->function == function &&
+		    (entry->index == CPUID_NO_INDEX || entry->index == index))
+			return entry;
+	return NULL;
+}
+
+void cpuid_emulate(struct per_cpu *cpu_data, struct registers *guest_regs,
+		   unsigned long guest_cr4)
+{
+	const struct jailhouse_cell_desc *config = cpu_data->cell->config;
+	const struct jailhouse_cpuid_override *override =
+		jailhouse_cell_cpuid_overrides(config);
+	struct cpuid_cache *cache = &cpu_data->cpuid_cache;
+	u32 function = guest_regs->rax, index = guest_regs->rcx;
+	const struct cpuid_entry *entry;
+	u32 regs[4];
+	unsigned int n, r;
+
+	/* out-of-range leaves report the highest basic leaf */
+	if ((function > cache->max_basic && function < 0x80000000) ||
+	    function > cache->max_extended)
+		function = cache->max_basic;
+
+	entry = cpuid_cache_lookup(cache, function, index);
+	if (entry)
+		memcpy(regs, entry->regs, sizeof(regs));
+	else
+		memset(regs, 0, sizeof(regs));
+
+	if (function == 0x01) {
+		regs[2] &= ~CPUID_1_ECX_OSXSAVE;
+		if (guest_cr4 & X86_CR4_OSXSAVE)
+			regs[2] |= CPUID_1_ECX_OSXSAVE;
+	}
+
+	for (n = 0; n < config->num_cpuid_overrides; n++, override++)
+		if (override->function == function &&
+		    (override->index == JAILHOUSE_CPUID_INDEX_ANY ||
+		     override->index == index))
+			for (r = 0; r < 4; r++)
+				regs[r] = (regs[r] & ~override->clear[r]) |
+					override->set[r];
+
+	guest_regs->rax = regs[0];
+	guest_regs->rbx = regs[1];
+	guest_regs->rcx = regs[2];
+	guest_regs->rdx = regs[3];
+}
@@ -22,12 +22,17 @@
 #define  UART_TX		0x0
 #define  UART_DLL		0x0
 #define  UART_DLM		0x1
+#define  UART_FCR		0x2
+#define  UART_FCR_FIFO_EN	0x07
 #define  UART_LCR		0x3
 #define  UART_LCR_8N1		0x03
 #define  UART_LCR_DLAB		0x80
 #define  UART_LSR		0x5
 #define  UART_LSR_THRE		0x20
 
+/* bytes that can be written when THRE is set, 16550 FIFO */
+#define UART_TX_FIFO_SIZE	16
+
 void arch_dbg_write_init(void)
 {
 	outb(UART_LCR_DLAB, UART_BASE + UART_LCR);
@@ -38,6 +43,7 @@ void arch_dbg_write_init(void)
 #endif
 	outb(0, UART_BASE + UART_DLM);
 	outb(UART_LCR_8N1, UART_BASE + UART_LCR);
+	outb(UART_FCR_FIFO_EN, UART_BASE + UART_FCR);
 }
 
 void arch_dbg_write(const char *msg)
@@ -55,3 +61,15 @@ void arch_dbg_write(const char *msg)
 		outb(c, UART_BASE + UART_TX);
 	}
 }
+
+unsigned int arch_dbg_write_nowait(const char *msg, unsigned int len)
+{
+	unsigned int n;
+
+	if (!(inb(UART_BASE + UART_LSR) & UART_LSR_THRE))
+		return 0;
+
+	for (n = 0; n < len && n < UART_TX_FIFO_SIZE; n++)
+		outb(msg[n], UART_BASE + UART_TX);
+	return n;
+}
@@ -69,24 +69,37 @@
 #define X2APIC_DEST_CLUSTER_ID_SHIFT	16
 
 #define X2APIC_CLUSTER_ID_SHIFT		4
+#define X2APIC_CLUSTER_CPU_MASK		0xf
 
 #define APIC_BSP_PSEUDO_SIPI		0x100
 
+/* bits in per_cpu.events, only modified with atomic bit operations */
+#define APIC_EVENT_STOP			0
+#define APIC_EVENT_INIT			1
+#define APIC_EVENT_SIPI			2
+#define APIC_EVENT_WAIT_SIPI		3
+#define APIC_EVENT_FLUSH_CACHES		4
+#define APIC_EVENT_SHUTDOWN		5
+
 extern bool using_x2apic;
 
 int apic_init(void);
 int apic_cpu_init(struct per_cpu *cpu_data);
+void apic_cell_update(struct cell *cell);
 
 void apic_nmi_handler(struct per_cpu *cpu_data);
 void apic_irq_handler(struct per_cpu *cpu_data);
 int apic_handle_events(struct per_cpu *cpu_data);
 
-void apic_handle_icr_write(struct per_cpu *cpu_data, u32 lo_val, u32 hi_val);
+void x2apic_handle_icr_write(struct per_cpu *cpu_data, u32 lo_val,
+			     u32 hi_val);
 
 unsigned int apic_mmio_access(struct registers *guest_regs,
 			      struct per_cpu *cpu_data, unsigned long rip,
 			      unsigned long page_table_addr, unsigned int reg,
 			      bool is_write);
 
+void xapic_handle_eoi(void);
+
 void x2apic_handle_write(struct registers *guest_regs);
 void x2apic_handle_read(struct registers *guest_regs);
@@ -82,9 +82,20 @@ static inline int test_and_set_bit(int nr, volatile unsigned long *addr)
 {
 	int oldbit;
 
-	asm volatile("lock bts %2,%1\n\t"
+	asm volatile("lock btsq %2,%1\n\t"
 		     "sbb %0,%0" : "=r" (oldbit), BITOP_ADDR(addr)
-		     : "Ir" (nr) : "memory");
+		     : "Ir" ((long)nr) : "memory");
+
+	return oldbit;
+}
+
+static inline int test_and_clear_bit(int nr, volatile unsigned long *addr)
+{
+	int oldbit;
+
+	asm volatile("lock btrq %2,%1\n\t"
+		     "sbb %0,%0" : "=r" (oldbit), BITOP_ADDR(addr)
+		     : "Ir" ((long)nr) : "memory");
 
 	return oldbit;
 }
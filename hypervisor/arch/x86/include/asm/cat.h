@@ -0,0 +1,30 @@
+/*
+ * Jailhouse, a Linux-based partitioning hypervisor
+ *
+ * Copyright (c) Siemens AG, 2013
+ *
+ * Authors:
+ *  Jan Kiszka <jan.kiszka@siemens.com>
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.  See
+ * the COPYING file in the top-level directory.
+ */
+
+#ifndef _JAILHOUSE_ASM_CAT_H
+#define _JAILHOUSE_ASM_CAT_H
+
+#include <asm/types.h>
+
+struct cell;
+struct per_cpu;
+struct registers;
+
+void cat_init(void);
+bool cat_msr_owned(u32 msr);
+int cat_cell_init(struct cell *cell);
+void cat_cell_exit(struct cell *cell);
+void cat_cpu_init(struct per_cpu *cpu_data);
+void cat_cpu_exit(struct per_cpu *cpu_data);
+void cat_msr_write(struct registers *guest_regs, struct per_cpu *cpu_data);
+
+#endif /* !_JAILHOUSE_ASM_CAT_H */
@@ -18,19 +18,32 @@
 
 #include <jailhouse/cell-config.h>
 
+/* x2APIC clusters covered by physical IDs up to APIC_MAX_PHYS_ID */
+#define X2APIC_NUM_CLUSTERS	16
+
 struct cell {
 	struct {
 		/* should be first as it requires page alignment */
 		u8 __attribute__((aligned(PAGE_SIZE))) io_bitmap[2*PAGE_SIZE];
+		u8 __attribute__((aligned(PAGE_SIZE))) msr_bitmap[PAGE_SIZE];
 		pgd_t *ept;
 	} vmx;
 
 	struct {
 		pgd_t *page_table;
+		bool irq_remapped;
 	} vtd;
 
+	/* logical APIC IDs of the cell CPUs, per x2APIC cluster or, in xAPIC
+	 * flat mode, in entry 0 */
+	u16 apic_logical_dest[X2APIC_NUM_CLUSTERS];
+
 	unsigned int id;
 	unsigned int data_pages;
+	/* class of service for cache and memory bandwidth allocation */
+	unsigned int clos;
+	/* node of all configured cell CPUs, NUMA_NO_NODE if they are spread */
+	unsigned int numa_node;
 	struct jailhouse_cell_desc *config;
 
 	struct cpu_set *cpu_set;
@@ -38,7 +51,22 @@ struct cell {
 
 	unsigned long page_offset;
 
-	struct cell *next;
+	/* memory regions of the config, sorted by physical start address */
+	const struct jailhouse_memory **sorted_mem_regions;
+
+	/* page table high-water marks, sampled on reconfigurations */
+	unsigned int page_tables_peak;
+	unsigned int dma_page_tables_peak;
+
+	/* emulated MMIO regions, sorted by start address */
+	struct mmio_region *mmio_regions;
+	unsigned int num_mmio_regions;
+
+	/* inter-cell shared memory endpoints, see shmem.c */
+	struct shmem_endpoint *shmem_endpoints;
+
+	/* chain of the cell name hash */
+	struct cell *hash_next;
 };
 
 extern struct cell linux_cell;
@@ -0,0 +1,43 @@
+/*
+ * Jailhouse, a Linux-based partitioning hypervisor
+ *
+ * Copyright (c) Siemens AG, 2013
+ *
+ * Authors:
+ *  Jan Kiszka <jan.kiszka@siemens.com>
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.  See
+ * the COPYING file in the top-level directory.
+ */
+
+#ifndef _JAILHOUSE_ASM_CPUID_H
+#define _JAILHOUSE_ASM_CPUID_H
+
+#include <asm/types.h>
+
+#define CPUID_CACHE_ENTRIES		96
+/* for leaves that do not evaluate ECX */
+#define CPUID_NO_INDEX			0xffffffff
+
+struct cpuid_entry {
+	u32 function;
+	u32 index;
+	u32 regs[4];
+};
+
+struct cpuid_cache {
+	unsigned int entries;
+	u32 max_basic;
+	u32 max_extended;
+	struct cpuid_entry entry[CPUID_CACHE_ENTRIES];
+};
+
+struct per_cpu;
+struct registers;
+
+void cpuid_cache_init(struct per_cpu *cpu_data);
+void cpuid_cache_update_xsave(struct per_cpu *cpu_data);
+void cpuid_emulate(struct per_cpu *cpu_data, struct registers *guest_regs,
+		   unsigned long guest_cr4);
+
+#endif /* !_JAILHOUSE_ASM_CPUID_H */
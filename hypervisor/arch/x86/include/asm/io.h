@@ -23,3 +23,10 @@ static inline u8 inb(u16 port)
 	asm volatile("inb %1,%0" : "=a" (v) : "dN" (port));
 	return v;
 }
+
+static inline u32 inl(u16 port)
+{
+	u32 v;
+	asm volatile("inl %1,%0" : "=a" (v) : "dN" (port));
+	return v;
+}
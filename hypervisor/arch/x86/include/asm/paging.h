@@ -21,15 +21,27 @@
 
 #define PAGE_DIR_LEVELS		4
 
+/* input address range of 4-level EPT */
+#define GUEST_PHYS_ADDR_LIMIT	(1ULL << 48)
+
 #define PAGE_TABLE_OFFS_MASK	0x0000000000000ff8UL
 #define PAGE_ADDR_MASK		0x000ffffffffff000UL
 #define PAGE_OFFS_MASK		0x0000000000000fffUL
+#define HUGEPAGE_SIZE		(2 * 1024 * 1024UL)
 #define HUGEPAGE_ADDR_MASK	0x000fffffffe00000UL
 #define HUGEPAGE_OFFS_MASK	0x00000000001fffffUL
+#define HUGEPAGE_1G_SIZE	(1024 * 1024 * 1024UL)
+#define HUGEPAGE_1G_ADDR_MASK	0x000fffffc0000000UL
+#define HUGEPAGE_1G_OFFS_MASK	0x000000003fffffffUL
 
 #define PAGE_FLAG_PRESENT	0x01
 #define PAGE_FLAG_RW		0x02
 #define PAGE_FLAG_UNCACHED	0x10
+#define PAGE_FLAG_HUGE		0x80
+
+/* Permissions (P/RW/US, EPT: R/W/X, VT-d: R/W) a page table has to grant
+ * when it replaces a large page. */
+#define PAGE_TABLE_FLAGS_MASK	0x07
 
 #define PAGE_DEFAULT_FLAGS	(PAGE_FLAG_PRESENT | PAGE_FLAG_RW )
 #define PAGE_READONLY_FLAGS	PAGE_FLAG_PRESENT
@@ -91,11 +103,22 @@ static inline pud_t *pud3l_offset(pgd_t *page_table, unsigned long addr)
 			 ((addr >> 27) & PAGE_TABLE_OFFS_MASK));
 }
 
+static inline bool pud_is_hugepage(pud_t *pud)
+{
+	return *pud & PAGE_FLAG_HUGE;
+}
+
 static inline void set_pud(pud_t *pud, unsigned long addr, unsigned long flags)
 {
 	*pud = (addr & PAGE_ADDR_MASK) | flags;
 }
 
+static inline void set_pud_hugepage(pud_t *pud, unsigned long addr,
+				    unsigned long flags)
+{
+	*pud = (addr & HUGEPAGE_1G_ADDR_MASK) | flags | PAGE_FLAG_HUGE;
+}
+
 static inline void clear_pud(pud_t *pud)
 {
 	*pud = 0;
@@ -108,7 +131,7 @@ static inline bool pmd_valid(pmd_t *pmd)
 
 static inline bool pmd_is_hugepage(pmd_t *pmd)
 {
-	return *pmd & (1 << 7);
+	return *pmd & PAGE_FLAG_HUGE;
 }
 
 static inline pmd_t *pmd_offset(pud_t *pud, unsigned long page_table_offset,
@@ -125,6 +148,12 @@ static inline void set_pmd(pmd_t *pmd, unsigned long addr, unsigned long flags)
 	*pmd = (addr & PAGE_ADDR_MASK) | flags;
 }
 
+static inline void set_pmd_hugepage(pmd_t *pmd, unsigned long addr,
+				    unsigned long flags)
+{
+	*pmd = (addr & HUGEPAGE_ADDR_MASK) | flags | PAGE_FLAG_HUGE;
+}
+
 static inline void clear_pmd(pmd_t *pmd)
 {
 	*pmd = 0;
@@ -165,6 +194,18 @@ static inline unsigned long phys_address_hugepage(pmd_t *pmd,
 	return (*pmd & HUGEPAGE_ADDR_MASK) + (addr & HUGEPAGE_OFFS_MASK);
 }
 
+static inline unsigned long phys_address_hugepage_1g(pud_t *pud,
+						     unsigned long addr)
+{
+	return (*pud & HUGEPAGE_1G_ADDR_MASK) + (addr & HUGEPAGE_1G_OFFS_MASK);
+}
+
+/* leaf flags of a large page entry, usable for the next smaller page size */
+static inline unsigned long hugepage_flags(unsigned long entry)
+{
+	return entry & ~PAGE_ADDR_MASK & ~PAGE_FLAG_HUGE;
+}
+
 static inline bool pud_empty(pgd_t *pgd, unsigned long page_table_offset)
 {
 	pud_t *pud = (pud_t *)((*pgd & PAGE_ADDR_MASK) + page_table_offset);
@@ -206,6 +247,11 @@ static inline void flush_tlb(void)
 	write_cr4(cr4);
 }
 
+static inline void flush_tlb_page(unsigned long addr)
+{
+	asm volatile("invlpg (%0)" : : "r" (addr) : "memory");
+}
+
 extern unsigned long cache_line_size;
 
 static inline void flush_cache(void *addr, long size)
@@ -214,6 +260,16 @@ static inline void flush_cache(void *addr, long size)
 		asm volatile("clflush %0" : "+m" (*(char *)addr));
 }
 
+static inline void clear_pages(void *addr, unsigned long num)
+{
+	unsigned long qwords = num * PAGE_SIZE / 8;
+
+	asm volatile("rep stosq"
+		: "+D" (addr), "+c" (qwords)
+		: "a" (0UL)
+		: "memory");
+}
+
 #endif /* !__ASSEMBLY__ */
 
 #endif /* !_JAILHOUSE_ASM_PAGING_H */
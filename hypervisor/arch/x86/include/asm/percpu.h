@@ -20,7 +20,7 @@
 #define NUM_ENTRY_REGS			6
 
 /* Keep in sync with struct per_cpu! */
-#define PERCPU_SIZE_SHIFT		14
+#define PERCPU_SIZE_SHIFT		13
 #define PERCPU_STACK_END		PAGE_SIZE
 #define PERCPU_LINUX_SP			PERCPU_STACK_END
 #define PERCPU_CPU_ID			(PERCPU_LINUX_SP + 8)
@@ -28,6 +28,7 @@
 #ifndef __ASSEMBLY__
 
 #include <asm/cell.h>
+#include <asm/cpuid.h>
 
 struct vmcs {
 	u32 revision_id:31;
@@ -36,16 +37,52 @@ struct vmcs {
 	u64 data[(PAGE_SIZE - 4 - 4) / 8];
 } __attribute__((packed));
 
+#define MMIO_CACHE_ENTRIES	16
+#define MMIO_MAX_INST_LEN	8
+
+/* decoded MMIO instruction, validated against the code bytes on use */
+struct mmio_cache_entry {
+	unsigned long page_table;
+	unsigned long pc;
+	u8 inst[MMIO_MAX_INST_LEN];
+	u8 inst_len;
+	u8 size;
+	u8 reg;
+	bool does_write;
+};
+
+/*
+ * Fields the owning CPU uses on every VM exit come first, then the events
+ * other CPUs post and poll on their own cache line, then state that is only
+ * touched on setup, shutdown or rare exits.
+ */
 struct per_cpu {
 	/* Keep these three in sync with defines above! */
 	u8 stack[PAGE_SIZE];
 	unsigned long linux_sp;
 	unsigned int cpu_id;
 
-	u32 apic_id;
+	u32 pin_based_ctrl;
 	struct cell *cell;
+	/* VM exit fields, read on first use and valid until the next exit */
+	struct {
+		unsigned int valid;
+		u32 inst_len;
+		unsigned long rip;
+		unsigned long qualification;
+	} vmexit;
+	/* in the statistics area, only written by the owning CPU */
+	struct jailhouse_cpu_stats *stats;
+	/* TSC at the last VM entry */
+	unsigned long entry_tsc;
+
+	/* pending requests and SIPI wait state, see APIC_EVENT_* */
+	volatile unsigned long events __attribute__((aligned(CACHE_LINE_SIZE)));
+	volatile bool cpu_stopped;
+	int sipi_vector;
 
-	struct desc_table_reg linux_gdtr;
+	struct desc_table_reg linux_gdtr
+		__attribute__((aligned(CACHE_LINE_SIZE)));
 	struct desc_table_reg linux_idtr;
 	unsigned long linux_reg[NUM_ENTRY_REGS];
 	unsigned long linux_ip;
@@ -62,17 +99,16 @@ struct per_cpu {
 	unsigned long linux_sysenter_esp;
 	bool initialized;
 	enum { VMXOFF = 0, VMXON, VMCS_READY } vmx_state;
+	/* read by the senders of IPIs */
+	u32 apic_id;
 
-	volatile bool stop_cpu;
-	volatile bool wait_for_sipi;
-	volatile bool cpu_stopped;
-	bool init_signaled;
-	int sipi_vector;
-	bool flush_caches;
-	bool shutdown_cpu;
+	struct cpuid_cache cpuid_cache;
 
-	struct vmcs vmxon_region __attribute__((aligned(PAGE_SIZE)));
-	struct vmcs vmcs __attribute__((aligned(PAGE_SIZE)));
+	struct mmio_cache_entry mmio_cache[MMIO_CACHE_ENTRIES];
+
+	/* from the pool of the CPU's NUMA node */
+	struct vmcs *vmxon_region;
+	struct vmcs *vmcs;
 } __attribute__((aligned(PAGE_SIZE)));
 
 static inline struct per_cpu *per_cpu(unsigned int cpu)
@@ -87,6 +123,15 @@ static inline struct per_cpu *per_cpu(unsigned int cpu)
 	return cpu_data;
 }
 
+static inline struct per_cpu *this_cpu_data(void)
+{
+	unsigned long rsp;
+
+	/* we always run on the stack at the beginning of struct per_cpu */
+	asm volatile("mov %%rsp,%0" : "=r" (rsp));
+	return per_cpu((rsp - (unsigned long)per_cpu(0)) >> PERCPU_SIZE_SHIFT);
+}
+
 /* Validate defines */
 #define CHECK_ASSUMPTION(assume)	((void)sizeof(char[1 - 2*!(assume)]))
 
@@ -100,6 +145,17 @@ static inline void __check_assumptions(void)
 			 PERCPU_LINUX_SP);
 	CHECK_ASSUMPTION(__builtin_offsetof(struct per_cpu, cpu_id) ==
 			 PERCPU_CPU_ID);
+
+	/* exit path fields share the line following the stack */
+	CHECK_ASSUMPTION(__builtin_offsetof(struct per_cpu, entry_tsc) +
+			 sizeof(cpu_data.entry_tsc) <=
+			 PERCPU_STACK_END + CACHE_LINE_SIZE);
+	/* remotely written fields have their line to themselves */
+	CHECK_ASSUMPTION(__builtin_offsetof(struct per_cpu, events) %
+			 CACHE_LINE_SIZE == 0);
+	CHECK_ASSUMPTION(__builtin_offsetof(struct per_cpu, linux_gdtr) ==
+			 __builtin_offsetof(struct per_cpu, events) +
+			 CACHE_LINE_SIZE);
 }
 #endif /* !__ASSEMBLY__ */
 
@@ -15,6 +15,8 @@
 
 #include <asm/types.h>
 
+#define CACHE_LINE_SIZE					64
+
 #define X86_FEATURE_VMX					(1 << 5)
 
 #define X86_RFLAGS_VM					(1 << 17)
@@ -27,6 +29,7 @@
 
 #define X86_CR4_PGE					0x00000080
 #define X86_CR4_VMXE					0x00002000
+#define X86_CR4_OSXSAVE					0x00040000
 
 #define X86_XCR0_FP					0x00000001
 
@@ -55,6 +58,12 @@
 #define MSR_X2APIC_ICR					0x00000830
 #define MSR_X2APIC_SELF_IPI				0x0000083f
 #define MSR_X2APIC_END					MSR_X2APIC_SELF_IPI
+#define MSR_IA32_L3_QOS_CFG				0x00000c81
+#define MSR_IA32_PQR_ASSOC				0x00000c8f
+#define MSR_IA32_L3_MASK_0				0x00000c90
+#define MSR_IA32_L3_MASK_END				0x00000d4f
+#define MSR_IA32_MBA_THRTL_0				0x00000d50
+#define MSR_IA32_MBA_THRTL_END				0x00000d8f
 #define MSR_EFER					0xc0000080
 #define MSR_FS_BASE					0xc0000100
 #define MSR_GS_BASE					0xc0000101
@@ -77,12 +86,16 @@
 #define X86_INST_LEN_VMCALL				3
 #define X86_INST_LEN_MOV_TO_CR				3
 #define X86_INST_LEN_XSETBV				3
+#define X86_INST_LEN_HLT				1
+#define X86_INST_LEN_MONITOR				3
+#define X86_INST_LEN_MWAIT				3
 
 #define X86_OP_REGR_PREFIX				0x44
 #define X86_OP_MOV_TO_MEM				0x89
 #define X86_OP_MOV_FROM_MEM				0x8b
 
 #define NMI_VECTOR					2
+#define GP_VECTOR					13
 
 #define DESC_PRESENT					(1UL << (15 + 32))
 #define DESC_CODE_DATA					(1UL << (12 + 32))
@@ -203,6 +216,14 @@ static inline void write_cr4(unsigned long val)
 	asm volatile("mov %0,%%cr4" : : "r" (val), "m" (__force_order));
 }
 
+static inline unsigned long read_tsc(void)
+{
+	u32 low, high;
+
+	asm volatile("rdtsc" : "=a" (low), "=d" (high));
+	return low | ((unsigned long)high << 32);
+}
+
 static inline unsigned long read_msr(unsigned int msr)
 {
 	u32 low, high;
@@ -10,23 +10,178 @@
  * the COPYING file in the top-level directory.
  */
 
+#ifndef _JAILHOUSE_ASM_SPINLOCK_H
+#define _JAILHOUSE_ASM_SPINLOCK_H
+
 #include <asm/bitops.h>
 #include <asm/processor.h>
 
+/*
+ * Locks are granted in FIFO order. The default are ticket locks, which are
+ * small and cheap when uncontended. CONFIG_MCS_SPINLOCKS selects queued
+ * locks where every waiter spins on its own cache line, avoiding the
+ * invalidation storm of ticket locks under heavy contention.
+ * CONFIG_SPINLOCK_STATS adds acquisition and contention counters.
+ */
+
+#ifdef CONFIG_SPINLOCK_STATS
+struct spinlock_stats {
+	unsigned long acquired;
+	unsigned long contended;
+};
+
+#define SPINLOCK_STATS		struct spinlock_stats stats;
+#define spin_lock_account(lock, waited)			\
+	do {						\
+		(lock)->stats.acquired++;		\
+		if (waited)				\
+			(lock)->stats.contended++;	\
+	} while (0)
+#else
+#define SPINLOCK_STATS
+#define spin_lock_account(lock, waited)	((void)(waited))
+#endif
+
+#ifndef CONFIG_MCS_SPINLOCKS
+
 typedef struct {
-	unsigned long state;
+	union {
+		u32 head_tail;
+		struct {
+			u16 owner;
+			u16 next;
+		} tickets;
+	};
+	SPINLOCK_STATS
 } spinlock_t;
 
 #define DEFINE_SPINLOCK(name)	spinlock_t (name)
 
 static inline void spin_lock(spinlock_t *lock)
 {
-	while (test_and_set_bit(0, &lock->state))
+	u32 ticket = 1 << 16;
+	bool waited = false;
+
+	asm volatile("lock xaddl %0,%1"
+		: "+r" (ticket), "+m" (lock->head_tail)
+		: : "memory", "cc");
+
+	while (*(volatile u16 *)&lock->tickets.owner !=
+	       (u16)(ticket >> 16)) {
+		waited = true;
 		cpu_relax();
+	}
+	asm volatile("": : :"memory");
+
+	spin_lock_account(lock, waited);
 }
 
 static inline void spin_unlock(spinlock_t *lock)
 {
+	/* only the owner writes this half, no lock prefix required */
+	asm volatile("incw %0"
+		: "+m" (lock->tickets.owner) : : "memory", "cc");
+}
+
+#else /* CONFIG_MCS_SPINLOCKS */
+
+/*
+ * K42 variant of the MCS lock: the queue node of a waiter lives on its
+ * stack and is only needed until the lock is acquired, so the spinlock_t
+ * API stays unchanged. The lock itself serves as queue node of the owner,
+ * tail pointing to it means "held, no waiters".
+ */
+struct mcs_node {
+	struct mcs_node *volatile tail;
+	struct mcs_node *volatile next;
+};
+
+#define MCS_WAITING		((struct mcs_node *)1)
+
+typedef struct {
+	struct mcs_node node;
+	SPINLOCK_STATS
+} spinlock_t;
+
+#define DEFINE_SPINLOCK(name)	spinlock_t (name)
+
+static inline struct mcs_node *
+mcs_cmpxchg(struct mcs_node *volatile *ptr, struct mcs_node *old,
+	    struct mcs_node *new)
+{
+	struct mcs_node *prev;
+
+	asm volatile("lock cmpxchgq %2,%1"
+		: "=a" (prev), "+m" (*ptr)
+		: "r" (new), "0" (old)
+		: "memory", "cc");
+	return prev;
+}
+
+static inline void spin_lock(spinlock_t *lock)
+{
+	struct mcs_node *lock_node = &lock->node;
+	struct mcs_node *prev, *succ;
+	struct mcs_node self;
+	bool waited = false;
+
+	while (1) {
+		prev = lock_node->tail;
+		if (!prev) {
+			if (mcs_cmpxchg(&lock_node->tail, NULL,
+					lock_node) == NULL)
+				break;
+			continue;
+		}
+
+		self.tail = MCS_WAITING;
+		self.next = NULL;
+		if (mcs_cmpxchg(&lock_node->tail, prev, &self) != prev)
+			continue;
+
+		waited = true;
+		prev->next = &self;
+		while (self.tail == MCS_WAITING)
+			cpu_relax();
+
+		/* we own the lock, move our successor link into it */
+		succ = self.next;
+		if (!succ) {
+			lock_node->next = NULL;
+			if (mcs_cmpxchg(&lock_node->tail, &self,
+					lock_node) != &self) {
+				/* someone is just queuing up behind us */
+				while (!(succ = self.next))
+					cpu_relax();
+				lock_node->next = succ;
+			}
+		} else
+			lock_node->next = succ;
+		break;
+	}
 	asm volatile("": : :"memory");
-	clear_bit(0, &lock->state);
+
+	spin_lock_account(lock, waited);
+}
+
+static inline void spin_unlock(spinlock_t *lock)
+{
+	struct mcs_node *lock_node = &lock->node;
+	struct mcs_node *succ;
+
+	asm volatile("": : :"memory");
+
+	succ = lock_node->next;
+	if (!succ) {
+		if (mcs_cmpxchg(&lock_node->tail, lock_node, NULL) ==
+		    lock_node)
+			return;
+		while (!(succ = lock_node->next))
+			cpu_relax();
+	}
+	succ->tail = NULL;
 }
+
+#endif /* CONFIG_MCS_SPINLOCKS */
+
+#endif /* !_JAILHOUSE_ASM_SPINLOCK_H */
@@ -0,0 +1,22 @@
+/*
+ * Jailhouse, a Linux-based partitioning hypervisor
+ *
+ * Copyright (c) Siemens AG, 2013
+ *
+ * Authors:
+ *  Jan Kiszka <jan.kiszka@siemens.com>
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.  See
+ * the COPYING file in the top-level directory.
+ */
+
+#ifndef _JAILHOUSE_ASM_TIME_H
+#define _JAILHOUSE_ASM_TIME_H
+
+struct cell;
+
+int time_init(void);
+int time_cell_init(struct cell *cell);
+void time_cell_exit(struct cell *cell);
+
+#endif /* !_JAILHOUSE_ASM_TIME_H */
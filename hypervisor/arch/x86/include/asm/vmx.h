@@ -188,13 +188,18 @@ enum vmcs_field {
 #define PIN_BASED_NMI_EXITING			0x00000008
 #define PIN_BASED_VMX_PREEMPTION_TIMER		0x00000040
 
+#define CPU_BASED_HLT_EXITING			0x00000080
+#define CPU_BASED_MWAIT_EXITING			0x00000400
 #define CPU_BASED_USE_IO_BITMAPS		0x02000000
 #define CPU_BASED_USE_MSR_BITMAPS		0x10000000
+#define CPU_BASED_MONITOR_EXITING		0x20000000
 #define CPU_BASED_ACTIVATE_SECONDARY_CONTROLS	0x80000000
 
 #define SECONDARY_EXEC_VIRTUALIZE_APIC_ACCESSES	0x00000001
 #define SECONDARY_EXEC_ENABLE_EPT		0x00000002
+#define SECONDARY_EXEC_ENABLE_VPID		0x00000020
 #define SECONDARY_EXEC_UNRESTRICTED_GUEST	0x00000080
+#define SECONDARY_EXEC_PAUSE_LOOP_EXITING	0x00000400
 
 #define VM_EXIT_HOST_ADDR_SPACE_SIZE		0x00000200
 #define VM_EXIT_SAVE_IA32_EFER			0x00100000
@@ -206,6 +211,9 @@ enum vmcs_field {
 #define VMX_MISC_ACTIVITY_HLT			0x00000040
 
 #define INTR_INFO_UNBLOCK_NMI			0x1000
+#define INTR_INFO_DELIVER_CODE			0x0800
+#define INTR_INFO_TYPE_HARD_EXCEPTION		0x0300
+#define INTR_INFO_VALID				0x80000000
 
 #define EXIT_REASONS_FAILED_VMENTRY		0x80000000
 
@@ -259,14 +267,23 @@ enum vmcs_field {
 #define EPT_FLAG_WRITE				0x002
 #define EPT_FLAG_EXECUTE			0x004
 #define EPT_FLAG_WB_TYPE			0x030
+#define EPT_FLAG_ACCESSED			0x100
+#define EPT_FLAG_DIRTY				0x200
+
+#define EPT_ACCESSED_BIT			8
+#define EPT_DIRTY_BIT				9
 
 #define EPT_TYPE_UNCACHEABLE			0
 #define EPT_TYPE_WRITEBACK			6
 #define EPT_PAGE_WALK_LEN			((4-1) << 3)
+#define EPT_AD_ENABLE				(1UL << 6)
 
 #define EPT_PAGE_WALK_4				(1UL << 6)
 #define EPTP_WB					(1UL << 14)
+#define EPT_2M_PAGES				(1UL << 16)
+#define EPT_1G_PAGES				(1UL << 17)
 #define EPT_INVEPT				(1UL << 20)
+#define EPT_AD_BITS				(1UL << 21)
 #define EPT_INVEPT_SINGLE			(1UL << 25)
 #define EPT_INVEPT_GLOBAL			(1UL << 26)
 #define EPT_MANDATORY_FEATURES			(EPT_PAGE_WALK_4 | EPTP_WB | \
@@ -275,20 +292,39 @@ enum vmcs_field {
 #define VMX_INVEPT_SINGLE			1
 #define VMX_INVEPT_GLOBAL			2
 
+#define VPID_INVVPID				(1UL << 32)
+#define VPID_INVVPID_SINGLE			(1UL << 41)
+#define VPID_INVVPID_ALL			(1UL << 42)
+
+#define VMX_INVVPID_SINGLE			1
+#define VMX_INVVPID_ALL				2
+
+/* VM exit fields cached in per_cpu.vmexit */
+#define VMX_EXIT_RIP				0x1
+#define VMX_EXIT_INST_LEN			0x2
+#define VMX_EXIT_QUALIFICATION			0x4
+
 #define APIC_ACCESS_OFFET_MASK			0x00000fff
 #define APIC_ACCESS_TYPE_MASK			0x0000f000
 #define APIC_ACCESS_TYPE_LINEAR_READ		0x00000000
 #define APIC_ACCESS_TYPE_LINEAR_WRITE		0x00001000
 
+#define EPT_VIOLATION_WRITE			0x00000002
+#define EPT_VIOLATION_FETCH			0x00000004
+
+extern unsigned long ept_huge_pages;
+
 void vmx_init(void);
 
 int vmx_cell_init(struct cell *cell);
-void vmx_linux_cell_shrink(struct jailhouse_cell_desc *config);
+int vmx_linux_cell_shrink(struct cell *cell);
 int vmx_map_memory_region(struct cell *cell,
 			  const struct jailhouse_memory *mem);
 void vmx_unmap_memory_region(struct cell *cell,
 			     const struct jailhouse_memory *mem);
 void vmx_cell_exit(struct cell *cell);
+int vmx_cell_scan_working_set(struct cell *cell,
+			      struct jailhouse_working_set *ws);
 
 int vmx_cpu_init(struct per_cpu *cpu_data);
 void vmx_cpu_exit(struct per_cpu *cpu_data);
@@ -297,7 +333,7 @@ void __attribute__((noreturn)) vmx_cpu_activate_vmm(struct per_cpu *cpu_data);
 void vmx_handle_exit(struct registers *guest_regs, struct per_cpu *cpu_data);
 void vmx_entry_failure(struct per_cpu *cpu_data);
 
-void vmx_invept(void);
+void vmx_invept(struct cell *cell);
 
 void vmx_schedule_vmexit(struct per_cpu *cpu_data);
 void vmx_cpu_park(void);
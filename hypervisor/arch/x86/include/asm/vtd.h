@@ -60,6 +60,15 @@ struct vtd_entry {
 	u64 hi_word;
 };
 
+#define VTD_IRTE_PRESENT		0x00000001
+#define VTD_IRTE_TM_LEVEL		0x00000010
+#define VTD_IRTE_VECTOR_SHIFT		16
+#define VTD_IRTE_DEST_SHIFT		32
+#define VTD_IRTE_XAPIC_DEST_SHIFT	40
+#define VTD_IRTE_SVT_VERIFY_SID		0x00040000
+
+#define VTD_IR_ENTRIES			(PAGE_SIZE / sizeof(struct vtd_entry))
+
 #define VTD_PAGE_READ			0x00000001
 #define VTD_PAGE_WRITE			0x00000002
 
@@ -71,44 +80,118 @@ struct vtd_entry {
 # define VTD_CAP_SAGAW48		0x00000400
 # define VTD_CAP_SAGAW57		0x00000800
 # define VTD_CAP_SAGAW64		0x00001000
+# define VTD_CAP_FRO_MASK		0x00000003ff000000UL
+# define VTD_CAP_FRO_SHIFT		24
+# define VTD_CAP_SLLPS2M		0x0000000400000000UL
+# define VTD_CAP_SLLPS1G		0x0000000800000000UL
+# define VTD_CAP_PSI			0x0000008000000000UL
+# define VTD_CAP_NFR_MASK		0x0000ff0000000000UL
+# define VTD_CAP_NFR_SHIFT		40
+# define VTD_CAP_MAMV_MASK		0x003f000000000000UL
+# define VTD_CAP_MAMV_SHIFT		48
 #define VTD_ECAP_REG			0x10
+# define VTD_ECAP_C			0x00000001
+# define VTD_ECAP_QI			0x00000002
+# define VTD_ECAP_IR			0x00000008
+# define VTD_ECAP_EIM			0x00000010
 # define VTD_ECAP_IRO_MASK		0x0003ff00
 # define VTD_ECAP_IRO_SHIFT		8
 #define VTD_GCMD_REG			0x18
+# define VTD_GCMD_CFI			0x00800000
+# define VTD_GCMD_SIRTP			0x01000000
+# define VTD_GCMD_IRE			0x02000000
+# define VTD_GCMD_QIE			0x04000000
 # define VTD_GCMD_SRTP			0x40000000
 # define VTD_GCMD_TE			0x80000000
 #define VTD_GSTS_REG			0x1C
+# define VTD_GSTS_CFIS			0x00800000
+# define VTD_GSTS_IRTPS			0x01000000
+# define VTD_GSTS_IRES			0x02000000
+# define VTD_GSTS_QIES			0x04000000
 # define VTD_GSTS_SRTP			0x40000000
 # define VTD_GSTS_TES			0x80000000
+# define VTD_GSTS_PERSISTENT		(VTD_GSTS_TES | VTD_GSTS_QIES | \
+					 VTD_GSTS_IRES | VTD_GSTS_CFIS)
 #define VTD_RTADDR_REG			0x20
 #define VTD_CCMD_REG			0x28
-# define VTD_CCMD_CIRG_GLOBAL		0x2000000000000000UL
-# define VTD_CCMD_CIRG_DOMAIN		0x4000000000000000UL
-# define VTD_CCMD_CIRG_DEVICE		0x6000000000000000UL
+# define VTD_CCMD_CIRG_SHIFT		61
 # define VTD_CCMD_ICC			0x8000000000000000UL
+#define VTD_FSTS_REG			0x34
+# define VTD_FSTS_PFO			0x00000001
+# define VTD_FSTS_PPF			0x00000002
+# define VTD_FSTS_FRI_MASK		0x0000ff00
+# define VTD_FSTS_FRI_SHIFT		8
+#define VTD_FECTL_REG			0x38
+# define VTD_FECTL_IM			0x80000000
 #define VTD_PMEN_REG			0x64
 #define VTD_PLMBASE_REG			0x68
 #define VTD_PLMLIMIT_REG		0x6C
 #define VTD_PHMBASE_REG			0x70
 #define VTD_PHMLIMIT_REG		0x78
+#define VTD_IQH_REG			0x80
+#define VTD_IQT_REG			0x88
+# define VTD_IQT_QT_MASK		0x000000000007fff0UL
+# define VTD_IQT_QT_SHIFT		4
+#define VTD_IQA_REG			0x90
+# define VTD_IQA_QS_4K			0x00000000
+#define VTD_IRTA_REG			0xB8
+# define VTD_IRTA_EIME			0x00000800
+# define VTD_IRTA_SIZE_256		0x00000007
 
+#define VTD_IVA_REG			0x00
+# define VTD_IVA_AM_MASK		0x0000003f
 #define VTD_IOTLB_REG			0x08
 # define VTD_IOTLB_DID_SHIFT		32
 # define VTD_IOTLB_DW			0x0001000000000000UL
 # define VTD_IOTLB_DR			0x0002000000000000UL
-# define VTD_IOTLB_IIRG_GLOBAL		0x2000000000000000UL
-# define VTD_IOTLB_IIRG_DOMAIN		0x4000000000000000UL
-# define VTD_IOTLB_IIRG_PAGE		0x6000000000000000UL
+# define VTD_IOTLB_IIRG_SHIFT		60
 # define VTD_IOTLB_IVT			0x8000000000000000UL
 
+#define VTD_FRCD_LO_REG			0x00
+# define VTD_FRCD_LO_FI_MASK		0xfffffffffffff000UL
+#define VTD_FRCD_HI_REG			0x08
+# define VTD_FRCD_HI_SID_MASK		0x000000000000ffffUL
+# define VTD_FRCD_HI_FR_MASK		0x000000ff00000000UL
+# define VTD_FRCD_HI_FR_SHIFT		32
+# define VTD_FRCD_HI_TYPE_READ		0x4000000000000000UL
+# define VTD_FRCD_HI_F			0x8000000000000000UL
+
+/* invalidation granularities, shared by registers and queue descriptors */
+#define VTD_INV_GLOBAL			1
+#define VTD_INV_DOMAIN			2
+#define VTD_INV_LOCAL			3
+
+#define VTD_INV_QUEUE_ENTRIES		(PAGE_SIZE / sizeof(struct vtd_entry))
+/* beyond this, invalidating the whole domain is cheaper */
+#define VTD_MAX_PAGE_INV		32
+
+#define VTD_REQ_CC			0x00000001
+#define VTD_REQ_IOTLB			0x00000002
+# define VTD_REQ_IOTLB_DW		0x00000040
+# define VTD_REQ_IOTLB_DR		0x00000080
+#define VTD_REQ_IEC			0x00000004
+#define VTD_REQ_INV_WAIT		0x00000005
+# define VTD_REQ_INV_WAIT_SW		0x00000020
+# define VTD_REQ_INV_WAIT_FN		0x00000040
+# define VTD_REQ_INV_WAIT_DATA_SHIFT	32
+#define VTD_REQ_GRAN_SHIFT		4
+#define VTD_REQ_DID_SHIFT		16
+
 int vtd_init(void);
 
 int vtd_cell_init(struct cell *cell);
-void vtd_linux_cell_shrink(struct jailhouse_cell_desc *config);
+int vtd_cell_assign(struct cell *cell);
+int vtd_linux_cell_shrink(struct cell *cell);
 int vtd_map_memory_region(struct cell *cell,
 			  const struct jailhouse_memory *mem);
 void vtd_unmap_memory_region(struct cell *cell,
 			     const struct jailhouse_memory *mem);
 void vtd_cell_exit(struct cell *cell);
 
+void vtd_get_mem_usage(struct cell *cell, struct jailhouse_mem_info *info);
+
+void vtd_config_commit(struct cell *cell_added);
+
+const struct jailhouse_dma_faults *vtd_get_faults(unsigned int unit);
+
 void vtd_shutdown(void);
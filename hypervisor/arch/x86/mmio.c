@@ -13,7 +13,7 @@
 #include <jailhouse/mmio.h>
 #include <jailhouse/paging.h>
 #include <jailhouse/printk.h>
-#include <asm/spinlock.h>
+#include <jailhouse/string.h>
 #include <asm/fault.h>
 
 struct modrm {
@@ -28,8 +28,6 @@ struct sib {
 	u8 ss:2;
 } __attribute__((packed));
 
-static DEFINE_SPINLOCK(mmio_lock);
-
 /* If current_page is non-NULL, pc must have been increased exactly by 1. */
 static u8 *map_code_page(struct per_cpu *cpu_data, unsigned long pc,
 			 unsigned long page_table_addr, u8 *current_page)
@@ -43,16 +41,43 @@ static u8 *map_code_page(struct per_cpu *cpu_data, unsigned long pc,
 					 PAGE_READONLY_FLAGS);
 }
 
+static struct mmio_cache_entry *
+mmio_cache_slot(struct per_cpu *cpu_data, unsigned long pc)
+{
+	return &cpu_data->mmio_cache[(pc ^ (pc >> 8)) % MMIO_CACHE_ENTRIES];
+}
+
+/*
+ * The foreign mapping window used for reading guest code is per CPU, so no
+ * locking is required. Decoding results are cached per CPU and revalidated
+ * against the current instruction bytes, which covers code modifications
+ * as well as changes of the guest or EPT mappings.
+ */
 struct mmio_access mmio_parse(struct per_cpu *cpu_data, unsigned long pc,
 			      unsigned long page_table_addr, bool is_write)
 {
+	struct mmio_cache_entry *cached = mmio_cache_slot(cpu_data, pc);
 	struct mmio_access access = { .inst_len = 0 };
 	bool has_regr, has_modrm, does_write;
+	unsigned long start_pc = pc;
 	struct modrm modrm;
 	struct sib sib;
-	u8 *page = NULL;
+	u8 *page;
 
-	spin_lock(&mmio_lock);
+	page = map_code_page(cpu_data, pc, page_table_addr, NULL);
+	if (!page)
+		goto error_nopage;
+
+	if (cached->pc == pc && cached->page_table == page_table_addr &&
+	    cached->inst_len > 0 &&
+	    memcmp(cached->inst, &page[pc & PAGE_OFFS_MASK],
+		   cached->inst_len) == 0) {
+		access.inst_len = cached->inst_len;
+		access.size = cached->size;
+		access.reg = cached->reg;
+		does_write = cached->does_write;
+		goto check_direction;
+	}
 
 	access.inst_len = 0;
 	has_regr = false;
@@ -124,11 +149,25 @@ restart:
 			access.reg = 15 - modrm.reg;
 	}
 
+	/* Only cache instructions that do not cross a page boundary, then
+	 * page still maps all of their bytes. */
+	if ((start_pc & PAGE_OFFS_MASK) + access.inst_len <= PAGE_SIZE &&
+	    access.inst_len <= MMIO_MAX_INST_LEN) {
+		cached->inst_len = 0;
+		memcpy(cached->inst, &page[start_pc & PAGE_OFFS_MASK],
+		       access.inst_len);
+		cached->page_table = page_table_addr;
+		cached->pc = start_pc;
+		cached->size = access.size;
+		cached->reg = access.reg;
+		cached->does_write = does_write;
+		cached->inst_len = access.inst_len;
+	}
+
+check_direction:
 	if (does_write != is_write)
 		goto error_inconsitent;
 
-unlock_out:
-	spin_unlock(&mmio_lock);
 	return access;
 
 error_nopage:
@@ -144,5 +183,5 @@ error_inconsitent:
 		     is_write ? "write" : "read");
 error:
 	access.inst_len = 0;
-	goto unlock_out;
+	return access;
 }
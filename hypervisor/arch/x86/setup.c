@@ -17,6 +17,9 @@
 #include <jailhouse/processor.h>
 #include <asm/apic.h>
 #include <asm/bitops.h>
+#include <asm/cat.h>
+#include <asm/spinlock.h>
+#include <asm/time.h>
 #include <asm/vmx.h>
 #include <asm/vtd.h>
 
@@ -47,6 +50,9 @@ extern u8 irq_entry[];
 unsigned long cache_line_size;
 static u32 idt[NUM_IDT_DESC * 4];
 
+/* all CPUs load the same TSS descriptor during their parallel setup */
+static DEFINE_SPINLOCK(tss_lock);
+
 static void set_idt_int_gate(unsigned int vector, unsigned long entry)
 {
 	idt[vector * 4] = (entry & 0xffff) | ((GDT_DESC_CODE * 8) << 16);
@@ -79,13 +85,22 @@ int arch_init_early(struct cell *linux_cell)
 	for (vector = IRQ_DESC_START; vector < NUM_IDT_DESC; vector++)
 		set_idt_int_gate(vector, (unsigned long)irq_entry);
 
+	cat_init();
 	vmx_init();
 
+	err = time_init();
+	if (err)
+		return err;
+
+	err = cat_cell_init(linux_cell);
+	if (err)
+		return err;
+
 	err = vmx_cell_init(linux_cell);
 	if (err)
 		return err;
 
-	return 0;
+	return time_cell_init(linux_cell);
 }
 
 static void read_descriptor(struct per_cpu *cpu_data, struct segment *seg)
@@ -181,8 +196,10 @@ int arch_cpu_init(struct per_cpu *cpu_data)
 		: : "r" (0));
 
 	/* clear TSS busy flag set by previous loading, then set TR */
+	spin_lock(&tss_lock);
 	gdt[GDT_DESC_TSS] &= ~TSS_BUSY_FLAG;
 	asm volatile("ltr %%ax" : : "a" (GDT_DESC_TSS * 8));
+	spin_unlock(&tss_lock);
 
 	/* swap IDTR */
 	read_idtr(&cpu_data->linux_idtr);
@@ -217,6 +234,9 @@ int arch_init_late(struct cell *linux_cell)
 {
 	int err;
 
+	/* all CPUs have registered their APIC IDs by now */
+	apic_cell_update(linux_cell);
+
 	err = vtd_init();
 	if (err)
 		return err;
@@ -225,6 +245,10 @@ int arch_init_late(struct cell *linux_cell)
 	if (err)
 		return err;
 
+	err = vtd_cell_assign(linux_cell);
+	if (err)
+		return err;
+
 	return 0;
 }
 
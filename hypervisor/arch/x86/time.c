@@ -0,0 +1,175 @@
+/*
+ * Jailhouse, a Linux-based partitioning hypervisor
+ *
+ * Copyright (c) Siemens AG, 2013
+ *
+ * Authors:
+ *  Jan Kiszka <jan.kiszka@siemens.com>
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.  See
+ * the COPYING file in the top-level directory.
+ */
+
+#include <jailhouse/acpi.h>
+#include <jailhouse/entry.h>
+#include <jailhouse/paging.h>
+#include <jailhouse/printk.h>
+#include <asm/io.h>
+#include <asm/processor.h>
+#include <asm/time.h>
+#include <asm/vmx.h>
+
+/*
+ * The TSC is calibrated once during setup, using CPUID leaf 0x15 if it
+ * reports the crystal frequency, otherwise the ACPI PM timer. The result is
+ * published in a single time page that is mapped read-only into every cell
+ * that configures a time_page_address, so cells can convert TSC values
+ * without calibrating themselves.
+ */
+
+#define NS_PER_MSEC		1000000UL
+
+/* CPUID 0x80000007, EDX */
+#define X86_FEATURE_INVARIANT_TSC	(1 << 8)
+
+#define FADT_PM_TMR_BLK		76
+#define PM_TIMER_HZ		3579545UL
+#define PM_TIMER_MASK		0xffffff
+#define PM_TIMER_PROBE_LOOPS	1000
+
+#define CALIBRATION_MSEC	50
+
+static struct jailhouse_time_page *time_page;
+
+static unsigned long tsc_khz_from_cpuid(void)
+{
+	u32 eax, ebx, ecx, edx;
+
+	if (cpuid_eax(0) < 0x15)
+		return 0;
+
+	cpuid(0x15, &eax, &ebx, &ecx, &edx);
+	if (eax == 0 || ebx == 0 || ecx == 0)
+		return 0;
+	return (unsigned long)ecx * ebx / eax / 1000;
+}
+
+static unsigned long tsc_khz_from_pm_timer(void)
+{
+	const struct acpi_table_header *fadt = acpi_find_table("FACP", NULL);
+	unsigned long tsc_start, tsc_end;
+	u32 pm_start, pm_ticks;
+	unsigned int loops;
+	u16 port;
+
+	if (!fadt || fadt->length < FADT_PM_TMR_BLK + sizeof(u32))
+		return 0;
+	port = *(const u32 *)((const u8 *)fadt + FADT_PM_TMR_BLK);
+	if (port == 0)
+		return 0;
+
+	/* don't wait forever for a timer that does not tick */
+	pm_start = inl(port);
+	for (loops = 0; inl(port) == pm_start; loops++) {
+		if (loops == PM_TIMER_PROBE_LOOPS)
+			return 0;
+		cpu_relax();
+	}
+
+	pm_start = inl(port);
+	tsc_start = read_tsc();
+	do {
+		pm_ticks = (inl(port) - pm_start) & PM_TIMER_MASK;
+	} while (pm_ticks < PM_TIMER_HZ * CALIBRATION_MSEC / 1000);
+	tsc_end = read_tsc();
+
+	return (tsc_end - tsc_start) * PM_TIMER_HZ / (pm_ticks * 1000UL);
+}
+
+static void time_page_publish(unsigned long tsc_khz)
+{
+	unsigned int shift = 32;
+
+	/* largest shift that keeps the multiplier within 32 bits */
+	while (shift > 0 && (NS_PER_MSEC << shift) / tsc_khz > 0xffffffffUL)
+		shift--;
+
+	time_page->seq++;
+	memory_barrier();
+	time_page->tsc_khz = tsc_khz;
+	time_page->tsc_to_ns_mult = (NS_PER_MSEC << shift) / tsc_khz;
+	time_page->tsc_to_ns_shift = shift;
+	memory_barrier();
+	time_page->seq++;
+	time_page->magic = JAILHOUSE_TIME_PAGE_MAGIC;
+}
+
+int time_init(void)
+{
+	unsigned long tsc_khz;
+	u32 eax, ebx, ecx, edx;
+
+	time_page = page_alloc(&mem_pool, 1);
+	if (!time_page)
+		return -ENOMEM;
+
+	tsc_khz = tsc_khz_from_cpuid();
+	if (tsc_khz == 0)
+		tsc_khz = tsc_khz_from_pm_timer();
+	if (tsc_khz == 0) {
+		/* cells find the page without magic and calibrate again */
+		printk("WARNING: TSC calibration failed\n");
+		return 0;
+	}
+
+	cpuid(0x80000007, &eax, &ebx, &ecx, &edx);
+	if (!(edx & X86_FEATURE_INVARIANT_TSC))
+		printk("WARNING: TSC is not invariant\n");
+
+	printk("TSC frequency: %lu kHz\n", tsc_khz);
+	time_page_publish(tsc_khz);
+
+	return 0;
+}
+
+static void time_page_region(struct cell *cell, struct jailhouse_memory *mem)
+{
+	mem->phys_start = page_map_hvirt2phys(time_page);
+	mem->virt_start = cell->config->time_page_address;
+	mem->size = PAGE_SIZE;
+	mem->access_flags = JAILHOUSE_MEM_READ;
+}
+
+/* the page is not visible to DMA, so only the EPT is touched */
+int time_cell_init(struct cell *cell)
+{
+	unsigned long address = cell->config->time_page_address;
+	const struct jailhouse_memory *mem =
+		jailhouse_cell_mem_regions(cell->config);
+	struct jailhouse_memory page;
+	unsigned int n;
+
+	if (address == 0)
+		return 0;
+	if (address & ~PAGE_MASK)
+		return -EINVAL;
+
+	for (n = 0; n < cell->config->num_memory_regions; n++, mem++)
+		if (address + PAGE_SIZE > mem->virt_start &&
+		    address < mem->virt_start + mem->size)
+			return -EINVAL;
+
+	time_page_region(cell, &page);
+	return vmx_map_memory_region(cell, &page);
+}
+
+void time_cell_exit(struct cell *cell)
+{
+	struct jailhouse_memory page;
+
+	if (cell->config->time_page_address == 0)
+		return;
+
+	time_page_region(cell, &page);
+	vmx_unmap_memory_region(cell, &page);
+}
@@ -17,14 +17,20 @@
 #include <jailhouse/string.h>
 #include <jailhouse/control.h>
 #include <jailhouse/hypercall.h>
+#include <jailhouse/mmio.h>
+#include <jailhouse/trace.h>
 #include <asm/apic.h>
+#include <asm/cat.h>
 #include <asm/fault.h>
 #include <asm/vmx.h>
 
+#define ARRAY_SIZE(a)	(sizeof(a) / sizeof((a)[0]))
+
 static const struct segment invalid_seg = {
 	.access_rights = 0x10000
 };
 
+/* default MSR bitmap, also the template for the x2APIC range of all cells */
 static u8 __attribute__((aligned(PAGE_SIZE))) msr_bitmap[][0x2000/8] = {
 	[ VMX_MSR_BITMAP_0000_READ ] = {
 		[      0/8 ...  0x7ff/8 ] = 0,
@@ -57,13 +63,19 @@ static u8 __attribute__((aligned(PAGE_SIZE))) msr_bitmap[][0x2000/8] = {
 static u8 __attribute__((aligned(PAGE_SIZE))) apic_access_page[PAGE_SIZE];
 
 static unsigned int vmx_true_msr_offs;
+unsigned long ept_huge_pages;
+static unsigned long invept_type;
+/* INVVPID type to use, 0 if VPIDs are not used */
+static unsigned long invvpid_type;
+static bool ple_supported;
+static bool ept_ad_bits;
 
 static bool vmxon(struct per_cpu *cpu_data)
 {
 	unsigned long vmxon_addr;
 	u8 ok;
 
-	vmxon_addr = page_map_hvirt2phys(&cpu_data->vmxon_region);
+	vmxon_addr = page_map_hvirt2phys(cpu_data->vmxon_region);
 	asm volatile(
 		"vmxon (%1)\n\t"
 		"seta %0"
@@ -75,7 +87,7 @@ static bool vmxon(struct per_cpu *cpu_data)
 
 static bool vmcs_clear(struct per_cpu *cpu_data)
 {
-	unsigned long vmcs_addr = page_map_hvirt2phys(&cpu_data->vmcs);
+	unsigned long vmcs_addr = page_map_hvirt2phys(cpu_data->vmcs);
 	u8 ok;
 
 	asm volatile(
@@ -89,7 +101,7 @@ static bool vmcs_clear(struct per_cpu *cpu_data)
 
 static bool vmcs_load(struct per_cpu *cpu_data)
 {
-	unsigned long vmcs_addr = page_map_hvirt2phys(&cpu_data->vmcs);
+	unsigned long vmcs_addr = page_map_hvirt2phys(cpu_data->vmcs);
 	u8 ok;
 
 	asm volatile(
@@ -146,8 +158,60 @@ static bool vmcs_write32(unsigned long field, u32 value)
 	return vmcs_write64(field, value);
 }
 
+/* cache and memory bandwidth allocation is owned by the hypervisor */
+static void vmx_intercept_alloc_msrs(u8 (*bitmap)[0x2000/8])
+{
+	u32 msr;
+
+	for (msr = MSR_IA32_L3_QOS_CFG; msr <= MSR_IA32_MBA_THRTL_END; msr++)
+		if (cat_msr_owned(msr))
+			bitmap[VMX_MSR_BITMAP_0000_WRITE][msr / 8] |=
+				1 << (msr % 8);
+}
+
 void vmx_init(void)
 {
+	unsigned long ept_cap;
+
+	/* Probe for large EPT pages, VPIDs and PLE. Missing VMX or EPT support is
+	 * reported by vmx_cpu_init. */
+	if ((cpuid_ecx(1) & X86_FEATURE_VMX) &&
+	    ((read_msr(MSR_IA32_VMX_PROCBASED_CTLS) >> 32) &
+	     CPU_BASED_ACTIVATE_SECONDARY_CONTROLS) &&
+	    ((read_msr(MSR_IA32_VMX_PROCBASED_CTLS2) >> 32) &
+	     SECONDARY_EXEC_ENABLE_EPT)) {
+		if (read_msr(MSR_IA32_VMX_BASIC) & (1UL << 55))
+			vmx_true_msr_offs = MSR_IA32_VMX_TRUE_PINBASED_CTLS -
+				MSR_IA32_VMX_PINBASED_CTLS;
+
+		ept_cap = read_msr(MSR_IA32_VMX_EPT_VPID_CAP);
+		if (ept_cap & EPT_2M_PAGES)
+			ept_huge_pages |= PAGE_MAP_HUGE_2M;
+		if (ept_cap & EPT_1G_PAGES)
+			ept_huge_pages |= PAGE_MAP_HUGE_1G;
+		if (ept_cap & EPT_AD_BITS)
+			ept_ad_bits = true;
+
+		if (ept_cap & EPT_INVEPT_SINGLE)
+			invept_type = VMX_INVEPT_SINGLE;
+		else
+			invept_type = VMX_INVEPT_GLOBAL;
+
+		if ((read_msr(MSR_IA32_VMX_PROCBASED_CTLS2) >> 32) &
+		    SECONDARY_EXEC_ENABLE_VPID && ept_cap & VPID_INVVPID) {
+			if (ept_cap & VPID_INVVPID_SINGLE)
+				invvpid_type = VMX_INVVPID_SINGLE;
+			else if (ept_cap & VPID_INVVPID_ALL)
+				invvpid_type = VMX_INVVPID_ALL;
+		}
+
+		if ((read_msr(MSR_IA32_VMX_PROCBASED_CTLS2) >> 32) &
+		    SECONDARY_EXEC_PAUSE_LOOP_EXITING)
+			ple_supported = true;
+	}
+
+	vmx_intercept_alloc_msrs(msr_bitmap);
+
 	if (!using_x2apic)
 		return;
 
@@ -174,16 +238,69 @@ int vmx_map_memory_region(struct cell *cell,
 
 	return page_map_create(cell->vmx.ept, mem->phys_start, mem->size,
 			       mem->virt_start, page_flags, table_flags,
-			       PAGE_DIR_LEVELS, PAGE_MAP_NON_COHERENT);
+			       PAGE_DIR_LEVELS, ept_huge_pages,
+			       PAGE_MAP_NON_COHERENT);
 }
 
 void vmx_unmap_memory_region(struct cell *cell,
 			     const struct jailhouse_memory *mem)
 {
 	page_map_destroy(cell->vmx.ept, mem->virt_start, mem->size,
+			 EPT_FLAG_READ | EPT_FLAG_WRITE | EPT_FLAG_EXECUTE,
 			 PAGE_DIR_LEVELS, PAGE_MAP_NON_COHERENT);
 }
 
+static int vmx_cell_init_msr_bitmap(struct cell *cell)
+{
+	const struct jailhouse_msr_range *range =
+		jailhouse_cell_msr_ranges(cell->config);
+	u8 (*bitmap)[0x2000/8] = (u8 (*)[0x2000/8])cell->vmx.msr_bitmap;
+	unsigned int n, idx;
+	u32 msr, offset;
+
+	if (cell->config->num_msr_ranges == 0) {
+		memcpy(bitmap, msr_bitmap, sizeof(cell->vmx.msr_bitmap));
+		return 0;
+	}
+
+	/* intercept everything except for the listed ranges, unhandled
+	 * accesses raise #GP in the guest */
+	memset(bitmap, -1, sizeof(cell->vmx.msr_bitmap));
+
+	for (n = 0; n < cell->config->num_msr_ranges; n++, range++) {
+		if (range->base < 0x2000)
+			idx = VMX_MSR_BITMAP_0000_READ;
+		else if (range->base >= 0xc0000000 &&
+			 range->base < 0xc0002000)
+			idx = VMX_MSR_BITMAP_C000_READ;
+		else
+			return -EINVAL;
+		offset = range->base & 0x1fff;
+		if (range->count > 0x2000 - offset ||
+		    range->flags & ~(JAILHOUSE_MSR_READ | JAILHOUSE_MSR_WRITE))
+			return -EINVAL;
+
+		for (msr = offset; msr < offset + range->count; msr++) {
+			if (range->flags & JAILHOUSE_MSR_READ)
+				bitmap[idx][msr / 8] &= ~(1 << (msr % 8));
+			if (range->flags & JAILHOUSE_MSR_WRITE)
+				bitmap[idx + 2][msr / 8] &= ~(1 << (msr % 8));
+		}
+	}
+
+	/* the x2APIC is never under control of the configuration */
+	memcpy(&bitmap[VMX_MSR_BITMAP_0000_READ][MSR_X2APIC_BASE/8],
+	       &msr_bitmap[VMX_MSR_BITMAP_0000_READ][MSR_X2APIC_BASE/8],
+	       (MSR_X2APIC_END - MSR_X2APIC_BASE + 1)/8);
+	memcpy(&bitmap[VMX_MSR_BITMAP_0000_WRITE][MSR_X2APIC_BASE/8],
+	       &msr_bitmap[VMX_MSR_BITMAP_0000_WRITE][MSR_X2APIC_BASE/8],
+	       (MSR_X2APIC_END - MSR_X2APIC_BASE + 1)/8);
+	/* neither are the allocation MSRs */
+	vmx_intercept_alloc_msrs(bitmap);
+
+	return 0;
+}
+
 int vmx_cell_init(struct cell *cell)
 {
 	struct jailhouse_cell_desc *config = cell->config;
@@ -194,8 +311,11 @@ int vmx_cell_init(struct cell *cell)
 	int n, err;
 	u32 size;
 
+	if (config->flags & ~JAILHOUSE_CELL_VALID_FLAGS)
+		return -EINVAL;
+
 	/* build root cell EPT */
-	cell->vmx.ept = page_alloc(&mem_pool, 1);
+	cell->vmx.ept = page_alloc(numa_pool(cell->numa_node), 1);
 	if (!cell->vmx.ept)
 		return -ENOMEM;
 
@@ -211,7 +331,13 @@ int vmx_cell_init(struct cell *cell)
 			      PAGE_SIZE, XAPIC_BASE,
 			      EPT_FLAG_READ|EPT_FLAG_WRITE|EPT_FLAG_WB_TYPE,
 			      EPT_FLAG_READ|EPT_FLAG_WRITE,
-			      PAGE_DIR_LEVELS, PAGE_MAP_NON_COHERENT);
+			      PAGE_DIR_LEVELS, PAGE_MAP_NO_HUGE,
+			      PAGE_MAP_NON_COHERENT);
+	if (err)
+		/* FIXME: release vmx.ept */
+		return err;
+
+	err = vmx_cell_init_msr_bitmap(cell);
 	if (err)
 		/* FIXME: release vmx.ept */
 		return err;
@@ -229,25 +355,31 @@ int vmx_cell_init(struct cell *cell)
 	return 0;
 }
 
-void vmx_linux_cell_shrink(struct jailhouse_cell_desc *config)
+int vmx_linux_cell_shrink(struct cell *cell)
 {
-	const struct jailhouse_memory *mem =
-		jailhouse_cell_mem_regions(config);
+	struct jailhouse_cell_desc *config = cell->config;
 	const u8 *pio_bitmap = jailhouse_cell_pio_bitmap(config);
 	u32 pio_bitmap_size = config->pio_bitmap_size;
+	struct jailhouse_memory range;
+	unsigned int pos = 0;
+	int err = 0;
 	u8 *b;
-	int n;
 
-	for (n = 0; n < config->num_memory_regions; n++, mem++)
-		page_map_destroy(linux_cell.vmx.ept, mem->phys_start,
-				 mem->size, PAGE_DIR_LEVELS,
-				 PAGE_MAP_NON_COHERENT);
+	/* Splitting large pages may fail, but the regions are unmapped
+	 * nevertheless. Keep going and report the error afterwards. */
+	while (cell_next_phys_range(cell, &pos, 0, &range))
+		if (page_map_destroy(linux_cell.vmx.ept, range.phys_start,
+				     range.size, EPT_FLAG_READ |
+				     EPT_FLAG_WRITE | EPT_FLAG_EXECUTE,
+				     PAGE_DIR_LEVELS,
+				     PAGE_MAP_NON_COHERENT) < 0)
+			err = -ENOMEM;
 
 	for (b = linux_cell.vmx.io_bitmap; pio_bitmap_size > 0;
 	     b++, pio_bitmap++, pio_bitmap_size--)
 		*b |= ~*pio_bitmap;
 
-	vmx_invept();
+	return err;
 }
 
 void vmx_cell_exit(struct cell *cell)
@@ -260,7 +392,8 @@ void vmx_cell_exit(struct cell *cell)
 	u8 *b;
 
 	page_map_destroy(cell->vmx.ept, XAPIC_BASE, PAGE_SIZE,
-			 PAGE_DIR_LEVELS, PAGE_MAP_NON_COHERENT);
+			 EPT_FLAG_READ | EPT_FLAG_WRITE, PAGE_DIR_LEVELS,
+			 PAGE_MAP_NON_COHERENT);
 
 	if (linux_cell.config->pio_bitmap_size < pio_bitmap_size)
 		pio_bitmap_size = linux_cell.config->pio_bitmap_size;
@@ -269,32 +402,84 @@ void vmx_cell_exit(struct cell *cell)
 	     b++, pio_bitmap++, linux_pio_bitmap++, pio_bitmap_size--)
 		*b &= *pio_bitmap | *linux_pio_bitmap;
 
-	page_free(&mem_pool, cell->vmx.ept, 1);
+	page_free(numa_pool(cell->numa_node), cell->vmx.ept, 1);
+}
+
+static unsigned long vmx_eptp(struct cell *cell)
+{
+	return page_map_hvirt2phys(cell->vmx.ept) | EPT_TYPE_WRITEBACK |
+		EPT_PAGE_WALK_LEN | (ept_ad_bits ? EPT_AD_ENABLE : 0);
+}
+
+static void vmx_scan_ept_entry(void *entry, unsigned long size, void *arg)
+{
+	unsigned long *ept_entry = entry;
+	struct jailhouse_working_set *ws = arg;
+
+	ws->mapped += size;
+	if (!(*ept_entry & (EPT_FLAG_ACCESSED | EPT_FLAG_DIRTY)))
+		return;
+
+	if (*ept_entry & EPT_FLAG_ACCESSED)
+		ws->accessed += size;
+	if (*ept_entry & EPT_FLAG_DIRTY)
+		ws->dirty += size;
+
+	/* the CPU may set the bits concurrently */
+	if (ws->flags & JAILHOUSE_WS_CLEAR) {
+		clear_bit(EPT_ACCESSED_BIT, ept_entry);
+		clear_bit(EPT_DIRTY_BIT, ept_entry);
+	}
+}
+
+/* The caller has to flush the EPT-derived translations if bits are cleared. */
+int vmx_cell_scan_working_set(struct cell *cell,
+			      struct jailhouse_working_set *ws)
+{
+	const struct jailhouse_memory *mem =
+		jailhouse_cell_mem_regions(cell->config);
+	unsigned int n;
+
+	if (!ept_ad_bits)
+		return -ENOSYS;
+
+	ws->mapped = ws->accessed = ws->dirty = 0;
+
+	if (ws->size > 0) {
+		page_map_walk(cell->vmx.ept, ws->start, ws->size,
+			      PAGE_DIR_LEVELS, vmx_scan_ept_entry, ws);
+		return 0;
+	}
+
+	for (n = 0; n < cell->config->num_memory_regions; n++, mem++)
+		page_map_walk(cell->vmx.ept, mem->virt_start, mem->size,
+			      PAGE_DIR_LEVELS, vmx_scan_ept_entry, ws);
+	return 0;
 }
 
-void vmx_invept(void)
+/*
+ * Invalidates the EPT-derived translations of the given cell on the local
+ * CPU. Only if the CPU lacks single-context support, all translations are
+ * dropped.
+ */
+void vmx_invept(struct cell *cell)
 {
-	unsigned long ept_cap = read_msr(MSR_IA32_VMX_EPT_VPID_CAP);
 	struct {
 		u64 eptp;
 		u64 reserved;
 	} descriptor;
-	u64 type;
 	u8 ok;
 
+	trace_event(JAILHOUSE_TRACE_INVEPT, cell->id);
+
+	descriptor.eptp = invept_type == VMX_INVEPT_SINGLE ?
+		vmx_eptp(cell) : 0;
 	descriptor.reserved = 0;
-	if (ept_cap & EPT_INVEPT_SINGLE) {
-		type = VMX_INVEPT_SINGLE;
-		descriptor.eptp = vmcs_read64(EPT_POINTER);
-	} else {
-		type = VMX_INVEPT_GLOBAL;
-		descriptor.eptp = 0;
-	}
 	asm volatile(
 		"invept (%1),%2\n\t"
 		"seta %0\n\t"
 		: "=qm" (ok)
-		: "r" (&descriptor), "r" (type)
+		: "r" (&descriptor), "r" (invept_type)
 		: "memory", "cc");
 
 	if (!ok) {
@@ -333,6 +518,8 @@ static bool vmx_set_guest_cr(int cr, unsigned long val)
 
 static bool vmx_set_cell_config(struct cell *cell)
 {
+	struct jailhouse_cell_desc *config = cell->config;
+	u32 proc_ctrl, proc_ctrl2;
 	u8 *io_bitmap;
 	bool ok = true;
 
@@ -341,13 +528,68 @@ static bool vmx_set_cell_config(struct cell *cell)
 	ok &= vmcs_write64(IO_BITMAP_B,
 			   page_map_hvirt2phys(io_bitmap + PAGE_SIZE));
 
-	ok &= vmcs_write64(EPT_POINTER,
-			   page_map_hvirt2phys(cell->vmx.ept) |
-			   EPT_TYPE_WRITEBACK | EPT_PAGE_WALK_LEN);
+	ok &= vmcs_write64(MSR_BITMAP,
+			   page_map_hvirt2phys(cell->vmx.msr_bitmap));
+
+	ok &= vmcs_write64(EPT_POINTER, vmx_eptp(cell));
+
+	/* VPID 0 is reserved for VMX root operation */
+	if (invvpid_type)
+		ok &= vmcs_write16(VIRTUAL_PROCESSOR_ID, cell->id + 1);
+
+	/* idle and spin policy, by default the guest runs without exits */
+	proc_ctrl = vmcs_read32(CPU_BASED_VM_EXEC_CONTROL);
+	proc_ctrl &= ~(CPU_BASED_HLT_EXITING | CPU_BASED_MWAIT_EXITING |
+		       CPU_BASED_MONITOR_EXITING);
+	if (config->flags & JAILHOUSE_CELL_HLT_EXITING)
+		proc_ctrl |= CPU_BASED_HLT_EXITING;
+	if (config->flags & JAILHOUSE_CELL_MWAIT_EXITING)
+		proc_ctrl |= CPU_BASED_MWAIT_EXITING |
+			CPU_BASED_MONITOR_EXITING;
+	ok &= vmcs_write32(CPU_BASED_VM_EXEC_CONTROL, proc_ctrl);
+
+	proc_ctrl2 = vmcs_read32(SECONDARY_VM_EXEC_CONTROL);
+	proc_ctrl2 &= ~SECONDARY_EXEC_PAUSE_LOOP_EXITING;
+	/* PLE is only used for accounting, ignore it if unsupported */
+	if (config->ple_window && ple_supported) {
+		proc_ctrl2 |= SECONDARY_EXEC_PAUSE_LOOP_EXITING;
+		ok &= vmcs_write32(PLE_GAP, config->ple_gap);
+		ok &= vmcs_write32(PLE_WINDOW, config->ple_window);
+	}
+	ok &= vmcs_write32(SECONDARY_VM_EXEC_CONTROL, proc_ctrl2);
 
 	return ok;
 }
 
+/*
+ * Flushes the local guest TLB entries of a VPID. Needed whenever a CPU
+ * starts to use a VPID: INVEPT on reconfigurations only reaches the CPUs
+ * that are in the affected cell at that time.
+ */
+static void vmx_invvpid(u16 vpid)
+{
+	struct {
+		u64 vpid;
+		u64 linear_address;
+	} descriptor;
+	u8 ok;
+
+	descriptor.vpid = vpid;
+	descriptor.linear_address = 0;
+	asm volatile(
+		"invvpid (%1),%2\n\t"
+		"seta %0\n\t"
+		: "=qm" (ok)
+		: "r" (&descriptor), "r" (invvpid_type)
+		: "memory", "cc");
+
+	if (!ok) {
+		panic_printk("FATAL: invvpid failed, error %d\n",
+			     vmcs_read32(VM_INSTRUCTION_ERROR));
+		panic_stop(NULL);
+	}
+}
+
 static bool vmx_set_guest_segment(const struct segment *seg,
 				  unsigned long selector_field)
 {
@@ -444,6 +686,7 @@ static bool vmcs_setup(struct per_cpu *cpu_data)
 
 	val = read_msr(MSR_IA32_VMX_PINBASED_CTLS + vmx_true_msr_offs);
 	val |= PIN_BASED_NMI_EXITING;
+	cpu_data->pin_based_ctrl = val;
 	ok &= vmcs_write32(PIN_BASED_VM_EXEC_CONTROL, val);
 
 	ok &= vmcs_write32(VMX_PREEMPTION_TIMER_VALUE, 0);
@@ -453,11 +696,11 @@ static bool vmcs_setup(struct per_cpu *cpu_data)
 		CPU_BASED_ACTIVATE_SECONDARY_CONTROLS;
 	ok &= vmcs_write32(CPU_BASED_VM_EXEC_CONTROL, val);
 
-	ok &= vmcs_write64(MSR_BITMAP, page_map_hvirt2phys(msr_bitmap));
-
 	val = read_msr(MSR_IA32_VMX_PROCBASED_CTLS2);
 	val |= SECONDARY_EXEC_VIRTUALIZE_APIC_ACCESSES |
 		SECONDARY_EXEC_ENABLE_EPT | SECONDARY_EXEC_UNRESTRICTED_GUEST;
+	if (invvpid_type)
+		val |= SECONDARY_EXEC_ENABLE_VPID;
 	ok &= vmcs_write32(SECONDARY_VM_EXEC_CONTROL, val);
 
 	ok &= vmcs_write64(APIC_ACCESS_ADDR,
@@ -492,8 +735,10 @@ int vmx_cpu_init(struct per_cpu *cpu_data)
 	unsigned long vmx_proc_ctrl, vmx_proc_ctrl2, ept_cap;
 	unsigned long vmx_pin_ctrl, feature_ctrl, mask;
 	unsigned long vmx_basic;
+	struct page_pool *pool;
 	unsigned long cr4;
 	u32 revision_id;
+	int err;
 
 	if (!(cpuid_ecx(1) & X86_FEATURE_VMX))
 		return -ENODEV;
@@ -512,10 +757,6 @@ int vmx_cpu_init(struct per_cpu *cpu_data)
 	if (((vmx_basic >> 50) & 0xf) != EPT_TYPE_WRITEBACK)
 		return -EIO;
 
-	if (vmx_basic & (1UL << 55))
-		vmx_true_msr_offs = MSR_IA32_VMX_TRUE_PINBASED_CTLS -
-			MSR_IA32_VMX_PINBASED_CTLS;
-
 	/* require NMI exiting and preemption timer support */
 	vmx_pin_ctrl = read_msr(MSR_IA32_VMX_PINBASED_CTLS +
 				vmx_true_msr_offs) >> 32;
@@ -545,11 +786,21 @@ int vmx_cpu_init(struct per_cpu *cpu_data)
 	if (!(read_msr(MSR_IA32_VMX_MISC) & VMX_MISC_ACTIVITY_HLT))
 		return -EIO;
 
+	pool = numa_pool(cpu_numa_node(cpu_data->cpu_id));
+	cpu_data->vmxon_region = page_alloc(pool, 1);
+	cpu_data->vmcs = page_alloc(pool, 1);
+	if (!cpu_data->vmxon_region || !cpu_data->vmcs) {
+		err = -ENOMEM;
+		goto error_free;
+	}
+
 	revision_id = (u32)vmx_basic;
-	cpu_data->vmxon_region.revision_id = revision_id;
-	cpu_data->vmxon_region.shadow_indicator = 0;
-	cpu_data->vmcs.revision_id = revision_id;
-	cpu_data->vmcs.shadow_indicator = 0;
+	cpu_data->vmxon_region->revision_id = revision_id;
+	cpu_data->vmxon_region->shadow_indicator = 0;
+	cpu_data->vmcs->revision_id = revision_id;
+	cpu_data->vmcs->shadow_indicator = 0;
+
+	cpuid_cache_init(cpu_data);
 
 	// TODO: validate CR0
 
@@ -559,8 +810,10 @@ int vmx_cpu_init(struct per_cpu *cpu_data)
 		FEATURE_CONTROL_VMXON_ENABLED_OUTSIDE_SMX;
 
 	if ((feature_ctrl & mask) != mask) {
-		if (feature_ctrl & FEATURE_CONTROL_LOCKED)
-			return -ENODEV;
+		if (feature_ctrl & FEATURE_CONTROL_LOCKED) {
+			err = -ENODEV;
+			goto error_free;
+		}
 
 		feature_ctrl |= mask;
 		write_msr(MSR_IA32_FEATURE_CONTROL, feature_ctrl);
@@ -570,20 +823,40 @@ int vmx_cpu_init(struct per_cpu *cpu_data)
 	// TODO: validate CR4
 
 	if (!vmxon(cpu_data))  {
-		write_cr4(cr4);
-		return -EIO;
+		err = -EIO;
+		goto error_restore_cr4;
 	}
 
 	cpu_data->vmx_state = VMXON;
 
 	if (!vmcs_clear(cpu_data) ||
 	    !vmcs_load(cpu_data) ||
-	    !vmcs_setup(cpu_data))
-		return -EIO;
+	    !vmcs_setup(cpu_data)) {
+		err = -EIO;
+		goto error_vmxoff;
+	}
 
 	cpu_data->vmx_state = VMCS_READY;
 
+	/* there may be leftovers from a previous hypervisor session */
+	if (invvpid_type)
+		vmx_invvpid(cpu_data->cell->id + 1);
+
+	cat_cpu_init(cpu_data);
+
 	return 0;
+
+error_vmxoff:
+	cpu_data->vmx_state = VMXOFF;
+	asm volatile("vmxoff" : : : "cc");
+error_restore_cr4:
+	write_cr4(cr4);
+error_free:
+	page_free(pool, cpu_data->vmcs, 1);
+	page_free(pool, cpu_data->vmxon_region, 1);
+	cpu_data->vmcs = NULL;
+	cpu_data->vmxon_region = NULL;
+	return err;
 }
 
 void vmx_cpu_exit(struct per_cpu *cpu_data)
@@ -591,6 +864,8 @@ void vmx_cpu_exit(struct per_cpu *cpu_data)
 	if (cpu_data->vmx_state == VMXOFF)
 		return;
 
+	cat_cpu_exit(cpu_data);
+
 	cpu_data->vmx_state = VMXOFF;
 	vmcs_clear(cpu_data);
 	asm volatile("vmxoff" : : : "cc");
@@ -599,6 +874,8 @@ void vmx_cpu_exit(struct per_cpu *cpu_data)
 
 void vmx_cpu_activate_vmm(struct per_cpu *cpu_data)
 {
+	cpu_data->entry_tsc = read_tsc();
+
 	/* We enter Linux at the point arch_entry would return to as well.
 	 * rax is cleared to signal success to the caller. */
 	asm volatile(
@@ -698,6 +975,7 @@ static void vmx_cpu_reset(struct registers *guest_regs,
 		sipi_vector = 0xf0;
 	}
 	ok &= vmcs_write64(GUEST_RIP, val);
+	cpu_data->vmexit.valid = 0;
 
 	ok &= vmcs_write16(GUEST_CS_SELECTOR, sipi_vector << 8);
 	ok &= vmcs_write64(GUEST_CS_BASE, sipi_vector << 12);
@@ -762,6 +1040,15 @@ static void vmx_cpu_reset(struct registers *guest_regs,
 
 	ok &= vmx_set_cell_config(cpu_data->cell);
 
+	/* The VPID and the EPT root may have been used by a previous cell.
+	 * INVVPID covers mappings tagged with the VPID, INVEPT the
+	 * guest-physical ones. */
+	if (invvpid_type)
+		vmx_invvpid(cpu_data->cell->id + 1);
+	vmx_invept(cpu_data->cell);
+
+	cat_cpu_init(cpu_data);
+
 	memset(guest_regs, 0, sizeof(*guest_regs));
 
 	if (!ok) {
@@ -772,14 +1059,11 @@ static void vmx_cpu_reset(struct registers *guest_regs,
 
 void vmx_schedule_vmexit(struct per_cpu *cpu_data)
 {
-	u32 pin_based_ctrl;
-
 	if (!cpu_data->vmx_state == VMCS_READY)
 		return;
 
-	pin_based_ctrl = vmcs_read32(PIN_BASED_VM_EXEC_CONTROL);
-	pin_based_ctrl |= PIN_BASED_VMX_PREEMPTION_TIMER;
-	vmcs_write32(PIN_BASED_VM_EXEC_CONTROL, pin_based_ctrl);
+	vmcs_write32(PIN_BASED_VM_EXEC_CONTROL,
+		     cpu_data->pin_based_ctrl | PIN_BASED_VMX_PREEMPTION_TIMER);
 }
 
 void vmx_cpu_park(void)
@@ -788,17 +1072,54 @@ void vmx_cpu_park(void)
 	vmcs_write32(GUEST_ACTIVITY_STATE, GUEST_ACTIVITY_HLT);
 }
 
-static void vmx_disable_preemption_timer(void)
+static void vmx_disable_preemption_timer(struct per_cpu *cpu_data)
+{
+	vmcs_write32(PIN_BASED_VM_EXEC_CONTROL, cpu_data->pin_based_ctrl);
+}
+
+static unsigned long vmx_exit_rip(struct per_cpu *cpu_data)
+{
+	if (!(cpu_data->vmexit.valid & VMX_EXIT_RIP)) {
+		cpu_data->vmexit.rip = vmcs_read64(GUEST_RIP);
+		cpu_data->vmexit.valid |= VMX_EXIT_RIP;
+	}
+	return cpu_data->vmexit.rip;
+}
+
+static unsigned int vmx_exit_inst_len(struct per_cpu *cpu_data)
+{
+	if (!(cpu_data->vmexit.valid & VMX_EXIT_INST_LEN)) {
+		cpu_data->vmexit.inst_len =
+			vmcs_read32(VM_EXIT_INSTRUCTION_LEN);
+		cpu_data->vmexit.valid |= VMX_EXIT_INST_LEN;
+	}
+	return cpu_data->vmexit.inst_len;
+}
+
+static unsigned long vmx_exit_qualification(struct per_cpu *cpu_data)
 {
-	u32 pin_based_ctrl = vmcs_read32(PIN_BASED_VM_EXEC_CONTROL);
+	if (!(cpu_data->vmexit.valid & VMX_EXIT_QUALIFICATION)) {
+		cpu_data->vmexit.qualification =
+			vmcs_read64(EXIT_QUALIFICATION);
+		cpu_data->vmexit.valid |= VMX_EXIT_QUALIFICATION;
+	}
+	return cpu_data->vmexit.qualification;
+}
 
-	pin_based_ctrl &= ~PIN_BASED_VMX_PREEMPTION_TIMER;
-	vmcs_write32(PIN_BASED_VM_EXEC_CONTROL, pin_based_ctrl);
+static void vmx_skip_emulated_instruction(struct per_cpu *cpu_data,
+					  unsigned int inst_len)
+{
+	cpu_data->vmexit.rip = vmx_exit_rip(cpu_data) + inst_len;
+	vmcs_write64(GUEST_RIP, cpu_data->vmexit.rip);
 }
 
-static void vmx_skip_emulated_instruction(unsigned int inst_len)
+/* the faulting instruction is not skipped */
+static void vmx_inject_gp(void)
 {
-	vmcs_write64(GUEST_RIP, vmcs_read64(GUEST_RIP) + inst_len);
+	vmcs_write32(VM_ENTRY_EXCEPTION_ERROR_CODE, 0);
+	vmcs_write32(VM_ENTRY_INTR_INFO_FIELD,
+		     GP_VECTOR | INTR_INFO_TYPE_HARD_EXCEPTION |
+		     INTR_INFO_DELIVER_CODE | INTR_INFO_VALID);
 }
 
 static void update_efer(void)
@@ -817,7 +1138,7 @@ static void update_efer(void)
 static void vmx_handle_hypercall(struct registers *guest_regs,
 				 struct per_cpu *cpu_data)
 {
-	vmx_skip_emulated_instruction(X86_INST_LEN_VMCALL);
+	vmx_skip_emulated_instruction(cpu_data, X86_INST_LEN_VMCALL);
 
 	if ((!(vmcs_read64(GUEST_IA32_EFER) & EFER_LMA) &&
 	     vmcs_read64(GUEST_RFLAGS) & X86_RFLAGS_VM) ||
@@ -838,19 +1159,62 @@ static void vmx_handle_hypercall(struct registers *guest_regs,
 	case JAILHOUSE_HC_CELL_DESTROY:
 		guest_regs->rax = cell_destroy(cpu_data, guest_regs->rdi);
 		break;
+	case JAILHOUSE_HC_CELL_RESTART:
+		guest_regs->rax = cell_restart(cpu_data, guest_regs->rdi,
+					       guest_regs->rsi);
+		break;
+	case JAILHOUSE_HC_CELL_GET_MEM_INFO:
+		guest_regs->rax = cell_get_mem_info(cpu_data, guest_regs->rdi,
+						    guest_regs->rsi);
+		break;
+	case JAILHOUSE_HC_CPU_GET_STATS:
+		guest_regs->rax = cpu_get_stats(cpu_data, guest_regs->rdi,
+						guest_regs->rsi);
+		break;
+	case JAILHOUSE_HC_DMA_GET_FAULTS:
+		guest_regs->rax = dma_get_faults(cpu_data, guest_regs->rdi,
+						 guest_regs->rsi);
+		break;
+	case JAILHOUSE_HC_CPU_GET_LOG:
+		guest_regs->rax = cpu_get_log(cpu_data, guest_regs->rdi,
+					      guest_regs->rsi);
+		break;
+	case JAILHOUSE_HC_CPU_GET_TRACE:
+		guest_regs->rax = cpu_get_trace(cpu_data, guest_regs->rdi,
+						guest_regs->rsi);
+		break;
+	case JAILHOUSE_HC_TRACE_SET_EVENTS:
+		guest_regs->rax = trace_set_events(cpu_data, guest_regs->rdi);
+		break;
+	case JAILHOUSE_HC_GET_STATS_AREA:
+		guest_regs->rax = stats_get_area(cpu_data);
+		break;
+	case JAILHOUSE_HC_CELL_GET_WORKING_SET:
+		guest_regs->rax = cell_get_working_set(cpu_data,
+						       guest_regs->rdi,
+						       guest_regs->rsi);
+		break;
+	case JAILHOUSE_HC_CELL_ADD_CPU:
+		guest_regs->rax = cell_add_cpu(cpu_data, guest_regs->rdi,
+					       guest_regs->rsi);
+		break;
+	case JAILHOUSE_HC_CELL_REMOVE_CPU:
+		guest_regs->rax = cell_remove_cpu(cpu_data, guest_regs->rdi,
+						  guest_regs->rsi);
+		break;
 	default:
 		printk("CPU %d: Unknown vmcall %d, RIP: %p\n",
 		       cpu_data->cpu_id, guest_regs->rax,
-		       vmcs_read64(GUEST_RIP) - X86_INST_LEN_VMCALL);
+		       vmx_exit_rip(cpu_data) - X86_INST_LEN_VMCALL);
 		guest_regs->rax = -ENOSYS;
 		break;
 	}
 }
 
-static bool vmx_handle_cr(struct registers *guest_regs,
-			  struct per_cpu *cpu_data)
+static int vmx_handle_cr(struct registers *guest_regs,
+			 struct per_cpu *cpu_data)
 {
-	u64 exit_qualification = vmcs_read64(EXIT_QUALIFICATION);
+	u64 exit_qualification = vmx_exit_qualification(cpu_data);
 	unsigned long cr, reg, val;
 
 	cr = exit_qualification & 0xf;
@@ -864,12 +1228,13 @@ static bool vmx_handle_cr(struct registers *guest_regs,
 			val = ((unsigned long *)guest_regs)[15 - reg];
 
 		if (cr == 0 || cr == 4) {
-			vmx_skip_emulated_instruction(X86_INST_LEN_MOV_TO_CR);
+			vmx_skip_emulated_instruction(cpu_data,
+						      X86_INST_LEN_MOV_TO_CR);
 			/* TODO: check for #GP reasons */
 			vmx_set_guest_cr(cr, val);
 			if (cr == 0 && val & X86_CR0_PG)
 				update_efer();
-			return true;
+			return JAILHOUSE_EXIT_STAT_CR;
 		}
 		break;
 	default:
@@ -877,18 +1242,18 @@ static bool vmx_handle_cr(struct registers *guest_regs,
 	}
 	panic_printk("FATAL: Unhandled CR access, qualification %x\n",
 		     exit_qualification);
-	return false;
+	return -1;
 }
 
-static bool vmx_handle_apic_access(struct registers *guest_regs,
-				   struct per_cpu *cpu_data)
+static int vmx_handle_apic_access(struct registers *guest_regs,
+				  struct per_cpu *cpu_data)
 {
 	unsigned int inst_len, offset;
 	unsigned long page_table_addr;
 	u64 qualification;
 	bool is_write;
 
-	qualification = vmcs_read64(EXIT_QUALIFICATION);
+	qualification = vmx_exit_qualification(cpu_data);
 
 	switch (qualification & APIC_ACCESS_TYPE_MASK) {
 	case APIC_ACCESS_TYPE_LINEAR_READ:
@@ -898,21 +1263,29 @@ static bool vmx_handle_apic_access(struct registers *guest_regs,
 		if (offset & 0x00f)
 			break;
 
+		/* EOIs are the hot path under interrupt load */
+		if (is_write && (offset >> 4) == APIC_REG_EOI) {
+			xapic_handle_eoi();
+			vmx_skip_emulated_instruction(cpu_data,
+					vmx_exit_inst_len(cpu_data));
+			return JAILHOUSE_EXIT_STAT_APIC_ACCESS;
+		}
+
 		page_table_addr = vmcs_read64(GUEST_CR3) & PAGE_ADDR_MASK;
 
 		inst_len = apic_mmio_access(guest_regs, cpu_data,
-					    vmcs_read64(GUEST_RIP),
+					    vmx_exit_rip(cpu_data),
 					    page_table_addr, offset >> 4,
 					    is_write);
 		if (!inst_len)
-			return false;
+			return -1;
 
-		vmx_skip_emulated_instruction(inst_len);
-		return true;
+		vmx_skip_emulated_instruction(cpu_data, inst_len);
+		return JAILHOUSE_EXIT_STAT_APIC_ACCESS;
 	}
 	panic_printk("FATAL: Unhandled APIC access, "
 		     "qualification %x\n", qualification);
-	return false;
+	return -1;
 }
 
 static void dump_vm_exit_details(u32 reason)
@@ -946,101 +1319,335 @@ static void dump_guest_regs(struct registers *guest_regs)
 	panic_printk("EFER: %p\n", vmcs_read64(GUEST_IA32_EFER));
 }
 
-void vmx_handle_exit(struct registers *guest_regs, struct per_cpu *cpu_data)
+struct vmx_msr_handler {
+	u32 first, last;
+	unsigned int stat;
+	void (*handle)(struct registers *guest_regs, struct per_cpu *cpu_data);
+};
+
+static void vmx_x2apic_read(struct registers *guest_regs,
+			    struct per_cpu *cpu_data)
+{
+	x2apic_handle_read(guest_regs);
+}
+
+static void vmx_x2apic_write(struct registers *guest_regs,
+			     struct per_cpu *cpu_data)
+{
+	x2apic_handle_write(guest_regs);
+}
+
+static inline void vmx_x2apic_icr_write(struct registers *guest_regs,
+				 struct per_cpu *cpu_data)
+{
+	x2apic_handle_icr_write(cpu_data, guest_regs->rax, guest_regs->rdx);
+}
+
+/* emulated MSRs, searched in order, first match wins */
+static const struct vmx_msr_handler msr_read_handlers[] = {
+	{ MSR_X2APIC_BASE, MSR_X2APIC_END,
+	  JAILHOUSE_EXIT_STAT_MSR_READ, vmx_x2apic_read },
+};
+
+static const struct vmx_msr_handler msr_write_handlers[] = {
+	{ MSR_X2APIC_BASE, MSR_X2APIC_END,
+	  JAILHOUSE_EXIT_STAT_MSR_WRITE, vmx_x2apic_write },
+	{ MSR_IA32_L3_QOS_CFG, MSR_IA32_L3_QOS_CFG,
+	  JAILHOUSE_EXIT_STAT_MSR_WRITE, cat_msr_write },
+	{ MSR_IA32_PQR_ASSOC, MSR_IA32_MBA_THRTL_END,
+	  JAILHOUSE_EXIT_STAT_MSR_WRITE, cat_msr_write },
+};
+
+static const struct vmx_msr_handler *
+vmx_find_msr_handler(const struct vmx_msr_handler *handler, unsigned int num,
+		     unsigned long msr)
+{
+	for (; num > 0; num--, handler++)
+		if (msr >= handler->first && msr <= handler->last)
+			return handler;
+	return NULL;
+}
+
+static void vmx_handle_events(struct registers *guest_regs,
+			      struct per_cpu *cpu_data)
 {
-	u32 reason = vmcs_read32(VM_EXIT_REASON);
 	int sipi_vector;
 
+	vmx_disable_preemption_timer(cpu_data);
+	sipi_vector = apic_handle_events(cpu_data);
+	if (sipi_vector >= 0) {
+		printk("CPU %d received SIPI, vector %x\n",
+		       cpu_data->cpu_id, sipi_vector);
+		vmx_cpu_reset(guest_regs, cpu_data, sipi_vector);
+	}
+}
+
+static int vmx_handle_preemption_timer(struct registers *guest_regs,
+				       struct per_cpu *cpu_data)
+{
+	vmx_handle_events(guest_regs, cpu_data);
+	return JAILHOUSE_EXIT_STAT_PREEMPTION_TIMER;
+}
+
+static int vmx_handle_nmi(struct registers *guest_regs,
+			  struct per_cpu *cpu_data)
+{
+	asm volatile("int %0" : : "i" (NMI_VECTOR));
+	vmx_handle_events(guest_regs, cpu_data);
+	return JAILHOUSE_EXIT_STAT_MANAGEMENT;
+}
+
+static int vmx_handle_cpuid(struct registers *guest_regs,
+			    struct per_cpu *cpu_data)
+{
+	vmx_skip_emulated_instruction(cpu_data, X86_INST_LEN_CPUID);
+	cpuid_emulate(cpu_data, guest_regs, vmcs_read64(GUEST_CR4));
+	return JAILHOUSE_EXIT_STAT_CPUID;
+}
+
+static int vmx_handle_vmcall(struct registers *guest_regs,
+			     struct per_cpu *cpu_data)
+{
+	vmx_handle_hypercall(guest_regs, cpu_data);
+	return JAILHOUSE_EXIT_STAT_VMCALL;
+}
+
+static int vmx_handle_msr_read(struct registers *guest_regs,
+			       struct per_cpu *cpu_data)
+{
+	const struct vmx_msr_handler *handler;
+
+	handler = vmx_find_msr_handler(msr_read_handlers,
+				       ARRAY_SIZE(msr_read_handlers),
+				       guest_regs->rcx);
+	if (handler) {
+		vmx_skip_emulated_instruction(cpu_data, X86_INST_LEN_RDMSR);
+		handler->handle(guest_regs, cpu_data);
+		return handler->stat;
+	}
+	/* denied by the cell's MSR ranges or not existing */
+	printk("CPU %d: denied MSR read %08x\n", cpu_data->cpu_id,
+	       guest_regs->rcx);
+	vmx_inject_gp();
+	return JAILHOUSE_EXIT_STAT_MANAGEMENT;
+}
+
+static int vmx_handle_msr_write(struct registers *guest_regs,
+				struct per_cpu *cpu_data)
+{
+	const struct vmx_msr_handler *handler;
+
+	/* the hottest write-intercepted MSR, checked before the table */
+	if (guest_regs->rcx == MSR_X2APIC_ICR) {
+		vmx_skip_emulated_instruction(cpu_data, X86_INST_LEN_WRMSR);
+		vmx_x2apic_icr_write(guest_regs, cpu_data);
+		return JAILHOUSE_EXIT_STAT_MSR_WRITE_ICR;
+	}
+	handler = vmx_find_msr_handler(msr_write_handlers,
+				       ARRAY_SIZE(msr_write_handlers),
+				       guest_regs->rcx);
+	if (handler) {
+		vmx_skip_emulated_instruction(cpu_data, X86_INST_LEN_WRMSR);
+		handler->handle(guest_regs, cpu_data);
+		return handler->stat;
+	}
+	/* denied by the cell's MSR ranges or not existing */
+	printk("CPU %d: denied MSR write %08x\n", cpu_data->cpu_id,
+	       guest_regs->rcx);
+	vmx_inject_gp();
+	return JAILHOUSE_EXIT_STAT_MANAGEMENT;
+}
+
+static int vmx_handle_xsetbv(struct registers *guest_regs,
+			     struct per_cpu *cpu_data)
+{
+	vmx_skip_emulated_instruction(cpu_data, X86_INST_LEN_XSETBV);
+	if (guest_regs->rax & X86_XCR0_FP &&
+	    (guest_regs->rax & ~cpuid_eax(0x0d)) == 0 &&
+	    guest_regs->rcx == 0 && guest_regs->rdx == 0) {
+		asm volatile(
+			"xsetbv"
+			: /* no output */
+			: "a" (guest_regs->rax), "c" (0), "d" (0));
+		cpuid_cache_update_xsave(cpu_data);
+		return JAILHOUSE_EXIT_STAT_XSETBV;
+	}
+	panic_printk("FATAL: Invalid xsetbv parameters: "
+		     "xcr[%d] = %08x:%08x\n", guest_regs->rcx,
+		     guest_regs->rdx, guest_regs->rax);
+	return -1;
+}
+
+static int vmx_handle_hlt(struct registers *guest_regs,
+			  struct per_cpu *cpu_data)
+{
+	u32 intr_state = vmcs_read32(GUEST_INTERRUPTIBILITY_INFO);
+
+	vmx_skip_emulated_instruction(cpu_data, X86_INST_LEN_HLT);
+	/* STI and MOV SS blocking ends with the skipped instruction */
+	if (intr_state & 3)
+		vmcs_write32(GUEST_INTERRUPTIBILITY_INFO, intr_state & ~3);
+	/* let the guest wait for its interrupt without further exits */
+	vmcs_write32(GUEST_ACTIVITY_STATE, GUEST_ACTIVITY_HLT);
+	return JAILHOUSE_EXIT_STAT_HLT;
+}
+
+static int vmx_handle_monitor(struct registers *guest_regs,
+			      struct per_cpu *cpu_data)
+{
+	vmx_skip_emulated_instruction(cpu_data, X86_INST_LEN_MONITOR);
+	return JAILHOUSE_EXIT_STAT_MWAIT;
+}
+
+static int vmx_handle_mwait(struct registers *guest_regs,
+			    struct per_cpu *cpu_data)
+{
+	/* MWAIT may always return early, so emulate it as NOP */
+	vmx_skip_emulated_instruction(cpu_data, X86_INST_LEN_MWAIT);
+	return JAILHOUSE_EXIT_STAT_MWAIT;
+}
+
+static int vmx_handle_pause(struct registers *guest_regs,
+			    struct per_cpu *cpu_data)
+{
+	/* only account the spinning vCPU, PAUSE is repeated on entry */
+	return JAILHOUSE_EXIT_STAT_PAUSE;
+}
+
+static int vmx_handle_ept_violation(struct registers *guest_regs,
+				    struct per_cpu *cpu_data)
+{
+	u64 qualification = vmx_exit_qualification(cpu_data);
+	u64 phys_addr = vmcs_read64(GUEST_PHYSICAL_ADDRESS);
+	bool is_write = !!(qualification & EPT_VIOLATION_WRITE);
+	const struct mmio_region *region;
+	struct mmio_access access;
+	unsigned long *reg;
+	unsigned long val;
+	int err;
+
+	region = mmio_region_lookup(cpu_data->cell, phys_addr);
+	if (!region || qualification & EPT_VIOLATION_FETCH) {
+		panic_printk("FATAL: Unhandled VM-Exit, reason %d, ",
+			     EXIT_REASON_EPT_VIOLATION);
+		dump_vm_exit_details(EXIT_REASON_EPT_VIOLATION);
+		return -1;
+	}
+
+	access = mmio_parse(cpu_data, vmx_exit_rip(cpu_data),
+			    vmcs_read64(GUEST_CR3) & PAGE_ADDR_MASK, is_write);
+	if (access.inst_len == 0)
+		return -1;
+
+	reg = &((unsigned long *)guest_regs)[access.reg];
+	val = 0;
+	if (is_write)
+		val = access.size == 4 ? (u32)*reg : *reg;
+	err = region->handler(cpu_data, region->arg,
+			      phys_addr - region->start, access.size, &val,
+			      is_write);
+	if (err) {
+		panic_printk("FATAL: MMIO access to %p failed, error %d\n",
+			     phys_addr, err);
+		return -1;
+	}
+	/* 32-bit loads zero-extend the destination register */
+	if (!is_write)
+		*reg = access.size == 4 ? (u32)val : val;
+
+	vmx_skip_emulated_instruction(cpu_data, access.inst_len);
+	return JAILHOUSE_EXIT_STAT_MMIO;
+}
+
+/*
+ * Exit handlers return the statistics slot to account the exit to, or -1 if
+ * the exit could not be handled.
+ */
+static int (* const exit_handlers[])(struct registers *guest_regs,
+				     struct per_cpu *cpu_data) = {
+	[EXIT_REASON_EXCEPTION_NMI]	= vmx_handle_nmi,
+	[EXIT_REASON_CPUID]		= vmx_handle_cpuid,
+	[EXIT_REASON_HLT]		= vmx_handle_hlt,
+	[EXIT_REASON_VMCALL]		= vmx_handle_vmcall,
+	[EXIT_REASON_CR_ACCESS]		= vmx_handle_cr,
+	[EXIT_REASON_MSR_READ]		= vmx_handle_msr_read,
+	[EXIT_REASON_MSR_WRITE]		= vmx_handle_msr_write,
+	[EXIT_REASON_MWAIT_INSTRUCTION]	= vmx_handle_mwait,
+	[EXIT_REASON_MONITOR_INSTRUCTION] = vmx_handle_monitor,
+	[EXIT_REASON_PAUSE_INSTRUCTION]	= vmx_handle_pause,
+	[EXIT_REASON_APIC_ACCESS]	= vmx_handle_apic_access,
+	[EXIT_REASON_EPT_VIOLATION]	= vmx_handle_ept_violation,
+	[EXIT_REASON_PREEMPTION_TIMER]	= vmx_handle_preemption_timer,
+	[EXIT_REASON_XSETBV]		= vmx_handle_xsetbv,
+};
+
+static unsigned int vmx_dispatch_exit(struct registers *guest_regs,
+				      struct per_cpu *cpu_data)
+{
+	u32 reason = vmcs_read32(VM_EXIT_REASON);
+	int stat;
+
+	cpu_data->vmexit.valid = 0;
+
 	if (reason & EXIT_REASONS_FAILED_VMENTRY) {
 		panic_printk("FATAL: VM-Entry failure, reason %d\n",
 			     (u16)reason);
 		goto dump_and_stop;
 	}
 
-	switch (reason) {
-	case EXIT_REASON_EXCEPTION_NMI:
-		asm volatile("int %0" : : "i" (NMI_VECTOR));
-		/* fall through */
-	case EXIT_REASON_PREEMPTION_TIMER:
-		vmx_disable_preemption_timer();
-		sipi_vector = apic_handle_events(cpu_data);
-		if (sipi_vector >= 0) {
-			printk("CPU %d received SIPI, vector %x\n",
-			       cpu_data->cpu_id, sipi_vector);
-			vmx_cpu_reset(guest_regs, cpu_data, sipi_vector);
-		}
-		return;
-	case EXIT_REASON_CPUID:
-		vmx_skip_emulated_instruction(X86_INST_LEN_CPUID);
-		guest_regs->rax &= 0xffffffff;
-		guest_regs->rbx &= 0xffffffff;
-		guest_regs->rcx &= 0xffffffff;
-		guest_regs->rdx &= 0xffffffff;
-		__cpuid((u32 *)&guest_regs->rax, (u32 *)&guest_regs->rbx,
-			(u32 *)&guest_regs->rcx, (u32 *)&guest_regs->rdx);
-		return;
-	case EXIT_REASON_VMCALL:
-		vmx_handle_hypercall(guest_regs, cpu_data);
-		return;
-	case EXIT_REASON_CR_ACCESS:
-		if (vmx_handle_cr(guest_regs, cpu_data))
-			return;
-		break;
-	case EXIT_REASON_MSR_READ:
-		vmx_skip_emulated_instruction(X86_INST_LEN_RDMSR);
-		if (guest_regs->rcx >= MSR_X2APIC_BASE &&
-		    guest_regs->rcx <= MSR_X2APIC_END) {
-			x2apic_handle_read(guest_regs);
-			return;
-		}
-		panic_printk("FATAL: Unhandled MSR read: %08x\n",
-			     guest_regs->rcx);
-		break;
-	case EXIT_REASON_MSR_WRITE:
-		vmx_skip_emulated_instruction(X86_INST_LEN_WRMSR);
-		if (guest_regs->rcx == MSR_X2APIC_ICR) {
-			apic_handle_icr_write(cpu_data, guest_regs->rax,
-					      guest_regs->rdx);
-			return;
-		}
-		if (guest_regs->rcx >= MSR_X2APIC_BASE &&
-		    guest_regs->rcx <= MSR_X2APIC_END) {
-			x2apic_handle_write(guest_regs);
-			return;
-		}
-		panic_printk("FATAL: Unhandled MSR write: %08x\n",
-			     guest_regs->rcx);
-		break;
-	case EXIT_REASON_APIC_ACCESS:
-		if (vmx_handle_apic_access(guest_regs, cpu_data))
-			return;
-		break;
-	case EXIT_REASON_XSETBV:
-		vmx_skip_emulated_instruction(X86_INST_LEN_XSETBV);
-		if (guest_regs->rax & X86_XCR0_FP &&
-		    (guest_regs->rax & ~cpuid_eax(0x0d)) == 0 &&
-		    guest_regs->rcx == 0 && guest_regs->rdx == 0) {
-			asm volatile(
-				"xsetbv"
-				: /* no output */
-				: "a" (guest_regs->rax), "c" (0), "d" (0));
-			return;
-		}
-		panic_printk("FATAL: Invalid xsetbv parameters: "
-			     "xcr[%d] = %08x:%08x\n", guest_regs->rcx,
-			     guest_regs->rdx, guest_regs->rax);
-		break;
-	default:
+	if (reason < ARRAY_SIZE(exit_handlers) && exit_handlers[reason]) {
+		stat = exit_handlers[reason](guest_regs, cpu_data);
+		if (stat >= 0)
+			return stat;
+	} else {
 		panic_printk("FATAL: Unhandled VM-Exit, reason %d, ",
 			     (u16)reason);
 		dump_vm_exit_details(reason);
-		break;
 	}
+
 dump_and_stop:
 	dump_guest_regs(guest_regs);
 	panic_stop(cpu_data);
 }
 
+/*
+ * Time between entry and exit counts as guest time, unless the CPU was
+ * parked waiting for SIPI. Time spent stopped in apic_handle_events is
+ * excluded from the hypervisor time and the exit statistics.
+ */
+void vmx_handle_exit(struct registers *guest_regs, struct per_cpu *cpu_data)
+{
+	struct jailhouse_cpu_stats *stats = cpu_data->stats;
+	unsigned long start = read_tsc(), cycles, suspended;
+	struct jailhouse_exit_stat *stat;
+	int stat_index;
+
+	if (test_bit(APIC_EVENT_WAIT_SIPI, &cpu_data->events))
+		stats->suspended_cycles += start - cpu_data->entry_tsc;
+	else
+		stats->guest_cycles += start - cpu_data->entry_tsc;
+	suspended = stats->suspended_cycles;
+
+	trace_event(JAILHOUSE_TRACE_VMEXIT, vmcs_read32(VM_EXIT_REASON));
+
+	stat_index = vmx_dispatch_exit(guest_regs, cpu_data);
+	stat = &stats->exit[stat_index];
+
+	suspended = stats->suspended_cycles - suspended;
+	cycles = read_tsc() - start - suspended;
+	stat->count++;
+	stat->cycles += cycles;
+	if (cycles > stat->max_cycles)
+		stat->max_cycles = cycles;
+
+	printk_drain();
+
+	trace_event(JAILHOUSE_TRACE_VMENTRY, stat_index);
+
+	cpu_data->entry_tsc = read_tsc();
+	stats->hypervisor_cycles += cpu_data->entry_tsc - start - suspended;
+}
+
 void vmx_entry_failure(struct per_cpu *cpu_data)
 {
 	panic_printk("FATAL: vmresume failed, error %d\n",
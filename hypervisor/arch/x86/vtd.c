@@ -9,19 +9,46 @@
  * This work is licensed under the terms of the GNU GPL, version 2.  See
  * the COPYING file in the top-level directory.
  */
+#include <jailhouse/control.h>
 
 #include <jailhouse/mmio.h>
 #include <jailhouse/paging.h>
 #include <jailhouse/printk.h>
+#include <jailhouse/trace.h>
+#include <asm/apic.h>
+#include <asm/bitops.h>
+#include <asm/vmx.h>
 #include <asm/vtd.h>
 
-/* TODO: Support multiple segments */
+struct vtd_unit {
+	void *reg_base;
+	/* shared by all units of the segment */
+	struct vtd_entry *root_table;
+	struct vtd_entry *inv_queue;
+	u16 segment;
+};
+
+/* the root entry table of segment 0 is part of the hypervisor image */
 static struct vtd_entry __attribute__((aligned(PAGE_SIZE)))
 	root_entry_table[256];
-static void *dmar_reg_base;
+static struct vtd_unit *dmar_unit;
 static unsigned int dmar_units;
 static unsigned int dmar_pt_levels;
 static unsigned int dmar_num_did = ~0U;
+static unsigned long dmar_huge_pages = PAGE_MAP_HUGE_2M | PAGE_MAP_HUGE_1G;
+static bool dmar_coherent = true;
+static unsigned int dmar_context_tables;
+static bool dmar_qi_supported = true;
+static u32 *dmar_inv_status;
+static bool dmar_ir_supported = true;
+static struct vtd_entry *dmar_irt;
+static struct jailhouse_dma_faults *dmar_faults;
+static unsigned long dmar_fault_polling;
+static bool dmar_page_inv = true;
+static unsigned int dmar_max_inv_mask = ~0U;
+static struct vtd_entry linux_page_inv[VTD_MAX_PAGE_INV];
+static unsigned int linux_num_page_inv;
+static bool linux_domain_inv;
 
 static void *vtd_iotlb_reg_base(void *reg_base)
 {
@@ -29,43 +56,497 @@ static void *vtd_iotlb_reg_base(void *reg_base)
 			    VTD_ECAP_IRO_MASK) >> VTD_ECAP_IRO_SHIFT) * 16;
 }
 
-static void vtd_flush_dmar_caches(void *reg_base, u64 ctx_scope,
-				  u64 iotlb_scope)
+static void *vtd_fault_reg_base(void *reg_base)
+{
+	return reg_base + ((mmio_read64(reg_base + VTD_CAP_REG) &
+			    VTD_CAP_FRO_MASK) >> VTD_CAP_FRO_SHIFT) * 16;
+}
+
+static unsigned int vtd_num_fault_records(void *reg_base)
+{
+	return ((mmio_read64(reg_base + VTD_CAP_REG) &
+		 VTD_CAP_NFR_MASK) >> VTD_CAP_NFR_SHIFT) + 1;
+}
+
+/*
+ * Issues the global command to all units first, then waits for the status
+ * to reflect it on each of them.
+ */
+static void vtd_update_gcmd(u32 cmd, u32 status)
+{
+	void *reg_base;
+	unsigned int n;
+	u32 gsts;
+
+	for (n = 0; n < dmar_units; n++) {
+		reg_base = dmar_unit[n].reg_base;
+		gsts = mmio_read32(reg_base + VTD_GSTS_REG);
+		mmio_write32(reg_base + VTD_GCMD_REG,
+			     (gsts & VTD_GSTS_PERSISTENT & ~status) | cmd);
+	}
+
+	for (n = 0; n < dmar_units; n++) {
+		reg_base = dmar_unit[n].reg_base;
+		if (cmd & status)
+			while (!(mmio_read32(reg_base + VTD_GSTS_REG) &
+				 status))
+				cpu_relax();
+		else
+			while (mmio_read32(reg_base + VTD_GSTS_REG) & status)
+				cpu_relax();
+	}
+}
+
+static struct vtd_entry *vtd_root_table(u16 segment)
+{
+	unsigned int n;
+
+	for (n = 0; n < dmar_units; n++)
+		if (dmar_unit[n].segment == segment)
+			return dmar_unit[n].root_table;
+	return NULL;
+}
+
+static void vtd_flush_dmar_caches(void *reg_base, unsigned int gran,
+				  unsigned int did)
 {
 	void *iotlb_reg_base;
 
-	mmio_write64(reg_base + VTD_CCMD_REG, ctx_scope | VTD_CCMD_ICC);
+	mmio_write64(reg_base + VTD_CCMD_REG,
+		     ((u64)gran << VTD_CCMD_CIRG_SHIFT) | VTD_CCMD_ICC | did);
 	while (mmio_read64(reg_base + VTD_CCMD_REG) & VTD_CCMD_ICC)
 		cpu_relax();
 
 	iotlb_reg_base = vtd_iotlb_reg_base(reg_base);
 	mmio_write64(iotlb_reg_base + VTD_IOTLB_REG,
-		     iotlb_scope | VTD_IOTLB_DW | VTD_IOTLB_DR |
-		     VTD_IOTLB_IVT);
+		     ((u64)gran << VTD_IOTLB_IIRG_SHIFT) |
+		     ((u64)did << VTD_IOTLB_DID_SHIFT) |
+		     VTD_IOTLB_DW | VTD_IOTLB_DR | VTD_IOTLB_IVT);
 	while (mmio_read64(iotlb_reg_base + VTD_IOTLB_REG) & VTD_IOTLB_IVT)
 		cpu_relax();
 }
 
-static void vtd_flush_domain_caches(unsigned int did)
+/*
+ * Queues the descriptors, followed by a wait descriptor that clears the
+ * unit's status word on completion. The queue is always drained before the
+ * next submission, so it cannot overflow.
+ */
+static void vtd_submit_inv(unsigned int unit, const struct vtd_entry *inv,
+			   unsigned int count)
+{
+	void *reg_base = dmar_unit[unit].reg_base;
+	struct vtd_entry *queue = dmar_unit[unit].inv_queue;
+	volatile u32 *status = &dmar_inv_status[unit];
+	unsigned int tail;
+
+	tail = (mmio_read64(reg_base + VTD_IQT_REG) & VTD_IQT_QT_MASK) >>
+		VTD_IQT_QT_SHIFT;
+
+	*status = 1;
+	while (count-- > 0) {
+		queue[tail] = *inv++;
+		flush_cache(&queue[tail], sizeof(*queue));
+		tail = (tail + 1) % VTD_INV_QUEUE_ENTRIES;
+	}
+	queue[tail].lo_word = VTD_REQ_INV_WAIT | VTD_REQ_INV_WAIT_SW |
+		VTD_REQ_INV_WAIT_FN;
+	queue[tail].hi_word = page_map_hvirt2phys((void *)status);
+	flush_cache(&queue[tail], sizeof(*queue));
+	tail = (tail + 1) % VTD_INV_QUEUE_ENTRIES;
+
+	mmio_write64(reg_base + VTD_IQT_REG, tail << VTD_IQT_QT_SHIFT);
+}
+
+static void vtd_wait_inv(unsigned int unit)
+{
+	volatile u32 *status = &dmar_inv_status[unit];
+
+	while (*status != 0)
+		cpu_relax();
+}
+
+/* Submits the requests to all units first, then waits for completion. */
+static void vtd_submit_inv_all(const struct vtd_entry *inv, unsigned int count)
+{
+	unsigned int n;
+
+	for (n = 0; n < dmar_units; n++)
+		vtd_submit_inv(n, inv, count);
+	for (n = 0; n < dmar_units; n++)
+		vtd_wait_inv(n);
+}
+
+/*
+ * Invalidates context caches and IOTLBs of all units. With queued
+ * invalidation, the requests are first submitted to every unit so that
+ * they are processed in parallel, then we wait for their completion.
+ */
+static void vtd_flush_caches(unsigned int gran, unsigned int did)
+{
+	struct vtd_entry inv[2];
+	unsigned int n;
+
+	trace_event(JAILHOUSE_TRACE_IOMMU_FLUSH, (gran << 16) | did);
+
+	if (!dmar_inv_status) {
+		for (n = 0; n < dmar_units; n++)
+			vtd_flush_dmar_caches(dmar_unit[n].reg_base, gran,
+					      did);
+		return;
+	}
+
+	inv[0].lo_word = VTD_REQ_CC | (gran << VTD_REQ_GRAN_SHIFT) |
+		(did << VTD_REQ_DID_SHIFT);
+	inv[0].hi_word = 0;
+	inv[1].lo_word = VTD_REQ_IOTLB | (gran << VTD_REQ_GRAN_SHIFT) |
+		VTD_REQ_IOTLB_DW | VTD_REQ_IOTLB_DR |
+		(did << VTD_REQ_DID_SHIFT);
+	inv[1].hi_word = 0;
+
+	vtd_submit_inv_all(inv, 2);
+}
+
+static void vtd_flush_iotlb_pages(unsigned int did,
+				  const struct vtd_entry *inv,
+				  unsigned int count)
+{
+	void *iotlb_reg_base;
+	unsigned int n, i;
+
+	if (!dmar_inv_status) {
+		for (n = 0; n < dmar_units; n++) {
+			iotlb_reg_base =
+				vtd_iotlb_reg_base(dmar_unit[n].reg_base);
+			for (i = 0; i < count; i++) {
+				mmio_write64(iotlb_reg_base + VTD_IVA_REG,
+					     inv[i].hi_word);
+				mmio_write64(iotlb_reg_base + VTD_IOTLB_REG,
+					((u64)VTD_INV_LOCAL <<
+					 VTD_IOTLB_IIRG_SHIFT) |
+					((u64)did << VTD_IOTLB_DID_SHIFT) |
+					VTD_IOTLB_DW | VTD_IOTLB_DR |
+					VTD_IOTLB_IVT);
+				while (mmio_read64(iotlb_reg_base +
+						   VTD_IOTLB_REG) &
+				       VTD_IOTLB_IVT)
+					cpu_relax();
+			}
+		}
+		return;
+	}
+
+	vtd_submit_inv_all(inv, count);
+}
+
+/*
+ * Records the invalidation of a range of Linux' DMA address space, split
+ * into naturally aligned power-of-two blocks as page-selective invalidation
+ * requires. Falls back to a domain-wide invalidation if that takes too many
+ * requests.
+ */
+static void vtd_linux_queue_inv(unsigned long start, unsigned long size)
+{
+	unsigned long end = PAGE_ALIGN(start + size);
+	unsigned int mask;
+
+	if (!dmar_page_inv)
+		linux_domain_inv = true;
+
+	start &= PAGE_MASK;
+	while (start < end && !linux_domain_inv) {
+		if (linux_num_page_inv == VTD_MAX_PAGE_INV) {
+			linux_domain_inv = true;
+			break;
+		}
+
+		for (mask = 0; mask < dmar_max_inv_mask; mask++)
+			if (start & (PAGE_SIZE << mask) ||
+			    start + (PAGE_SIZE << (mask + 1)) > end)
+				break;
+
+		linux_page_inv[linux_num_page_inv].lo_word = VTD_REQ_IOTLB |
+			(VTD_INV_LOCAL << VTD_REQ_GRAN_SHIFT) |
+			VTD_REQ_IOTLB_DW | VTD_REQ_IOTLB_DR |
+			(linux_cell.id << VTD_REQ_DID_SHIFT);
+		linux_page_inv[linux_num_page_inv].hi_word = start | mask;
+		linux_num_page_inv++;
+
+		start += PAGE_SIZE << mask;
+	}
+}
+
+static int vtd_init_inv_queues(void)
+{
+	struct vtd_unit *unit;
+	u32 *status;
+	unsigned int n;
+
+	/* status words of all units have to fit into a single page */
+	if (dmar_units > PAGE_SIZE / sizeof(u32))
+		return 0;
+
+	for (n = 0; n < dmar_units; n++) {
+		dmar_unit[n].inv_queue = page_alloc(&mem_pool, 1);
+		if (!dmar_unit[n].inv_queue)
+			return -ENOMEM;
+	}
+	status = page_alloc(&mem_pool, 1);
+	if (!status)
+		return -ENOMEM;
+
+	/* the queues must not be reprogrammed while enabled */
+	vtd_update_gcmd(0, VTD_GSTS_QIES);
+
+	for (n = 0, unit = dmar_unit; n < dmar_units; n++, unit++) {
+		mmio_write64(unit->reg_base + VTD_IQT_REG, 0);
+		mmio_write64(unit->reg_base + VTD_IQA_REG,
+			     page_map_hvirt2phys(unit->inv_queue) |
+			     VTD_IQA_QS_4K);
+	}
+
+	vtd_update_gcmd(VTD_GCMD_QIE, VTD_GSTS_QIES);
+	dmar_inv_status = status;
+
+	return 0;
+}
+
+static void vtd_flush_irq_cache(void)
+{
+	struct vtd_entry inv;
+
+	inv.lo_word = VTD_REQ_IEC;
+	inv.hi_word = 0;
+	vtd_submit_inv_all(&inv, 1);
+}
+
+/*
+ * Interrupt remapping requires queued invalidation. The table starts
+ * empty, Linux keeps using compatibility format MSIs.
+ */
+static int vtd_init_irq_remapping(void)
 {
-	u64 iotlb_scope = VTD_IOTLB_IIRG_DOMAIN |
-		((unsigned long)did << VTD_IOTLB_DID_SHIFT);
-	void *reg_base = dmar_reg_base;
 	unsigned int n;
 
-	for (n = 0; n < dmar_units; n++, reg_base += PAGE_SIZE)
-		vtd_flush_dmar_caches(reg_base, VTD_CCMD_CIRG_DOMAIN | did,
-				      iotlb_scope);
+	dmar_irt = page_alloc(&mem_pool, 1);
+	if (!dmar_irt)
+		return -ENOMEM;
+
+	for (n = 0; n < dmar_units; n++)
+		mmio_write64(dmar_unit[n].reg_base + VTD_IRTA_REG,
+			     page_map_hvirt2phys(dmar_irt) |
+			     (using_x2apic ? VTD_IRTA_EIME : 0) |
+			     VTD_IRTA_SIZE_256);
+	vtd_update_gcmd(VTD_GCMD_SIRTP, VTD_GSTS_IRTPS);
+
+	vtd_flush_irq_cache();
+
+	vtd_update_gcmd(VTD_GCMD_CFI, VTD_GSTS_CFIS);
+	vtd_update_gcmd(VTD_GCMD_IRE, VTD_GSTS_IRES);
+
+	return 0;
+}
+
+static void vtd_record_fault(struct jailhouse_dma_faults *faults,
+			     u64 address, u64 info)
+{
+	u16 source_id = info & VTD_FRCD_HI_SID_MASK;
+	struct jailhouse_dma_fault *record;
+	unsigned int n;
+
+	for (n = 0; n < JAILHOUSE_DMA_FAULT_DEVICES; n++)
+		if (faults->device[n].count == 0 ||
+		    faults->device[n].source_id == source_id) {
+			faults->device[n].source_id = source_id;
+			faults->device[n].count++;
+			break;
+		}
+
+	record = &faults->record[faults->total % JAILHOUSE_DMA_FAULT_RECORDS];
+	record->address = address;
+	record->source_id = source_id;
+	record->reason = (info & VTD_FRCD_HI_FR_MASK) >> VTD_FRCD_HI_FR_SHIFT;
+	record->flags = (info & VTD_FRCD_HI_TYPE_READ) ?
+		JAILHOUSE_DMA_FAULT_READ : 0;
+	record->seq = ++faults->total;
+
+	printk("DMAR fault %d: device %02x:%02x.%x, %s address %p\n",
+	       record->reason, source_id >> 8, (source_id >> 3) & 0x1f,
+	       source_id & 7, record->flags ? "read" : "write", address);
+}
+
+/*
+ * Fault events are not delivered to the hypervisor, so the recording
+ * registers are drained whenever the configuration changes or Linux asks
+ * for the faults. Only one CPU drains at a time, readers copy the records
+ * without locking and retry while the seq of the unit is odd or changed.
+ */
+static void vtd_poll_faults(void)
+{
+	void *reg_base, *fault_reg_base, *record;
+	unsigned int n, index, num_records;
+	u32 fsts;
+	u64 info;
+
+	if (!dmar_faults || test_and_set_bit(0, &dmar_fault_polling))
+		return;
+
+	for (n = 0; n < dmar_units; n++) {
+		reg_base = dmar_unit[n].reg_base;
+		fsts = mmio_read32(reg_base + VTD_FSTS_REG);
+		if (!(fsts & (VTD_FSTS_PPF | VTD_FSTS_PFO)))
+			continue;
+
+		dmar_faults[n].seq++;
+		memory_barrier();
+
+		fault_reg_base = vtd_fault_reg_base(reg_base);
+		num_records = vtd_num_fault_records(reg_base);
+		index = (fsts & VTD_FSTS_FRI_MASK) >> VTD_FSTS_FRI_SHIFT;
+		while (1) {
+			record = fault_reg_base + index * 16;
+			info = mmio_read64(record + VTD_FRCD_HI_REG);
+			if (!(info & VTD_FRCD_HI_F))
+				break;
+			vtd_record_fault(&dmar_faults[n],
+					 mmio_read64(record +
+						     VTD_FRCD_LO_REG) &
+					 VTD_FRCD_LO_FI_MASK, info);
+			mmio_write64(record + VTD_FRCD_HI_REG, VTD_FRCD_HI_F);
+			index = (index + 1) % num_records;
+		}
+
+		if (fsts & VTD_FSTS_PFO) {
+			dmar_faults[n].overflows++;
+			mmio_write32(reg_base + VTD_FSTS_REG, VTD_FSTS_PFO);
+		}
+
+		memory_barrier();
+		dmar_faults[n].seq++;
+	}
+
+	clear_bit(0, &dmar_fault_polling);
+}
+
+static bool vtd_drhd_valid(const struct acpi_dmar_table *dmar,
+			   const struct acpi_dmar_drhd *drhd)
+{
+	unsigned long offset = (void *)drhd - (void *)dmar;
+
+	return drhd->header.length >= sizeof(struct acpi_dmar_drhd) &&
+		offset + drhd->header.length <= dmar->header.length;
+}
+
+/* DRHD structures come first, returns NULL after the last one */
+static const struct acpi_dmar_drhd *
+vtd_next_drhd(const struct acpi_dmar_table *dmar,
+	      const struct acpi_dmar_drhd *drhd)
+{
+	drhd = (void *)drhd + drhd->header.length;
+	if ((void *)drhd - (void *)dmar >= dmar->header.length ||
+	    drhd->header.type != ACPI_DMAR_DRHD)
+		return NULL;
+	return drhd;
+}
+
+static int vtd_init_unit(struct vtd_unit *unit,
+			 const struct acpi_dmar_drhd *drhd)
+{
+	unsigned int pt_levels, num_did, inv_mask;
+	void *reg_base;
+	u64 caps, ecaps;
+	int err;
+
+	printk("Found DMAR @%p, segment %d\n", drhd->register_base_addr,
+	       drhd->segment);
+
+	reg_base = page_alloc(&remap_pool, 1);
+	if (!reg_base)
+		return -ENOMEM;
+
+	err = page_map_create(hv_page_table, drhd->register_base_addr,
+			      PAGE_SIZE, (unsigned long)reg_base,
+			      PAGE_DEFAULT_FLAGS | PAGE_FLAG_UNCACHED,
+			      PAGE_DEFAULT_FLAGS, PAGE_DIR_LEVELS,
+			      PAGE_MAP_NO_HUGE, PAGE_MAP_NON_COHERENT);
+	if (err)
+		return err;
+
+	unit->reg_base = reg_base;
+	unit->segment = drhd->segment;
+
+	caps = mmio_read64(reg_base + VTD_CAP_REG);
+	ecaps = mmio_read64(reg_base + VTD_ECAP_REG);
+
+	if (caps & VTD_CAP_SAGAW39)
+		pt_levels = 3;
+	else if (caps & VTD_CAP_SAGAW48)
+		pt_levels = 4;
+	else
+		return -EIO;
+
+	if (dmar_pt_levels > 0 && dmar_pt_levels != pt_levels)
+		return -EIO;
+	dmar_pt_levels = pt_levels;
+
+	if (caps & VTD_CAP_CM)
+		return -EIO;
+
+	/* We only support IOTLB and fault recording registers within the
+	 * first page. */
+	if (vtd_iotlb_reg_base(reg_base) >= reg_base + PAGE_SIZE ||
+	    vtd_fault_reg_base(reg_base) +
+	    vtd_num_fault_records(reg_base) * 16 > reg_base + PAGE_SIZE)
+		return -EIO;
+
+	/* fault events are polled, keep them away from Linux */
+	mmio_write32(reg_base + VTD_FECTL_REG, VTD_FECTL_IM);
+
+	if (mmio_read32(reg_base + VTD_GSTS_REG) &
+	    (VTD_GSTS_TES | VTD_GSTS_IRES))
+		return -EBUSY;
+
+	if (!(caps & VTD_CAP_SLLPS2M))
+		dmar_huge_pages &= ~PAGE_MAP_HUGE_2M;
+	if (!(caps & VTD_CAP_SLLPS1G))
+		dmar_huge_pages &= ~PAGE_MAP_HUGE_1G;
+	if (!(ecaps & VTD_ECAP_C))
+		dmar_coherent = false;
+	if (!(ecaps & VTD_ECAP_QI))
+		dmar_qi_supported = false;
+	if (!(ecaps & VTD_ECAP_IR) || (using_x2apic && !(ecaps & VTD_ECAP_EIM)))
+		dmar_ir_supported = false;
+
+	if (!(caps & VTD_CAP_PSI))
+		dmar_page_inv = false;
+	inv_mask = (caps & VTD_CAP_MAMV_MASK) >> VTD_CAP_MAMV_SHIFT;
+	if (inv_mask < dmar_max_inv_mask)
+		dmar_max_inv_mask = inv_mask;
+
+	num_did = 1 << (4 + (caps & VTD_CAP_NUM_DID_MASK) * 2);
+	if (num_did < dmar_num_did)
+		dmar_num_did = num_did;
+
+	/* units are initialized in order, so the search covers only the
+	 * preceding ones */
+	if (unit->segment == 0) {
+		unit->root_table = root_entry_table;
+	} else {
+		unit->root_table = vtd_root_table(unit->segment);
+		if (!unit->root_table) {
+			unit->root_table = page_alloc(&mem_pool, 1);
+			if (!unit->root_table)
+				return -ENOMEM;
+		}
+	}
+
+	return 0;
 }
 
 int vtd_init(void)
 {
 	const struct acpi_dmar_table *dmar;
 	const struct acpi_dmar_drhd *drhd;
-	unsigned int pt_levels, num_did;
-	void *reg_base = NULL;
-	unsigned long offset;
-	unsigned long caps;
+	unsigned int num_units = 0;
 	int err;
 
 	dmar = (struct acpi_dmar_table *)acpi_find_table("DMAR", NULL);
@@ -81,68 +562,41 @@ int vtd_init(void)
 	if (drhd->header.type != ACPI_DMAR_DRHD)
 		return -EIO;
 
-	offset = (void *)dmar->remap_structs - (void *)dmar;
-	do {
-		if (drhd->header.length < sizeof(struct acpi_dmar_drhd) ||
-		    offset + drhd->header.length > dmar->header.length)
-			return -EIO;
-
-		/* TODO: support multiple segments */
-		if (drhd->segment != 0)
+	for (; drhd; drhd = vtd_next_drhd(dmar, drhd)) {
+		if (!vtd_drhd_valid(dmar, drhd))
 			return -EIO;
+		num_units++;
+	}
 
-		printk("Found DMAR @%p\n", drhd->register_base_addr);
-
-		reg_base = page_alloc(&remap_pool, 1);
-		if (!reg_base)
-			return -ENOMEM;
-
-		if (dmar_units == 0)
-			dmar_reg_base = reg_base;
-		else if (reg_base != dmar_reg_base + dmar_units * PAGE_SIZE)
-			return -ENOMEM;
+	dmar_unit = page_alloc(&mem_pool,
+			       PAGE_ALIGN(num_units *
+					  sizeof(struct vtd_unit)) / PAGE_SIZE);
+	if (!dmar_unit)
+		return -ENOMEM;
 
-		err = page_map_create(hv_page_table, drhd->register_base_addr,
-				      PAGE_SIZE, (unsigned long)reg_base,
-				      PAGE_DEFAULT_FLAGS | PAGE_FLAG_UNCACHED,
-				      PAGE_DEFAULT_FLAGS, PAGE_DIR_LEVELS,
-				      PAGE_MAP_NON_COHERENT);
+	for (drhd = (struct acpi_dmar_drhd *)dmar->remap_structs; drhd;
+	     drhd = vtd_next_drhd(dmar, drhd)) {
+		err = vtd_init_unit(&dmar_unit[dmar_units], drhd);
 		if (err)
 			return err;
+		dmar_units++;
+	}
 
-		caps = mmio_read64(reg_base + VTD_CAP_REG);
-		if (caps & VTD_CAP_SAGAW39)
-			pt_levels = 3;
-		else if (caps & VTD_CAP_SAGAW48)
-			pt_levels = 4;
-		else
-			return -EIO;
-
-		if (dmar_pt_levels > 0 && dmar_pt_levels != pt_levels)
-			return -EIO;
-		dmar_pt_levels = pt_levels;
-
-		if (caps & VTD_CAP_CM)
-			return -EIO;
-
-		/* We only support IOTLB registers withing the first page. */
-		if (vtd_iotlb_reg_base(reg_base) >= reg_base + PAGE_SIZE)
-			return -EIO;
-
-		if (mmio_read32(reg_base + VTD_GSTS_REG) & VTD_GSTS_TES)
-			return -EBUSY;
-
-		num_did = 1 << (4 + (caps & VTD_CAP_NUM_DID_MASK) * 2);
-		if (num_did < dmar_num_did)
-			dmar_num_did = num_did;
+	dmar_faults = page_alloc(&mem_pool,
+				 PAGE_ALIGN(dmar_units *
+					    sizeof(struct jailhouse_dma_faults)) /
+				 PAGE_SIZE);
+	if (!dmar_faults)
+		return -ENOMEM;
 
-		dmar_units++;
+	if (dmar_qi_supported) {
+		err = vtd_init_inv_queues();
+		if (err)
+			return err;
+	}
 
-		offset += drhd->header.length;
-		drhd = (struct acpi_dmar_drhd *)
-			(((void *)drhd) + drhd->header.length);
-	} while (offset < dmar->header.length &&
-		 drhd->header.type == ACPI_DMAR_DRHD);
+	if (dmar_inv_status && dmar_ir_supported)
+		return vtd_init_irq_remapping();
 
 	return 0;
 }
@@ -150,12 +604,17 @@ int vtd_init(void)
 static bool vtd_add_device_to_cell(struct cell *cell,
 			           const struct jailhouse_pci_device *device)
 {
-	u64 root_entry_lo = root_entry_table[device->bus].lo_word;
+	struct vtd_entry *root_table = vtd_root_table(device->domain);
 	struct vtd_entry *context_entry_table, *context_entry;
+	u64 root_entry_lo;
 
-	printk("Adding PCI device %02x:%02x.%x to cell \"%s\"\n",
-	       device->bus, device->devfn >> 3, device->devfn & 7,
-	       cell->config->name);
+	printk("Adding PCI device %04x:%02x:%02x.%x to cell \"%s\"\n",
+	       device->domain, device->bus, device->devfn >> 3,
+	       device->devfn & 7, cell->config->name);
+
+	if (!root_table)
+		return false;
+	root_entry_lo = root_table[device->bus].lo_word;
 
 	if (root_entry_lo & VTD_ROOT_PRESENT) {
 		context_entry_table =
@@ -164,15 +623,14 @@ static bool vtd_add_device_to_cell(struct cell *cell,
 		context_entry_table = page_alloc(&mem_pool, 1);
 		if (!context_entry_table)
 			return false;
-		root_entry_table[device->bus].lo_word = VTD_ROOT_PRESENT |
+		dmar_context_tables++;
+		root_table[device->bus].lo_word = VTD_ROOT_PRESENT |
 			page_map_hvirt2phys(context_entry_table);
-		flush_cache(&root_entry_table[device->bus].lo_word,
-			    sizeof(u64));
+		flush_cache(&root_table[device->bus].lo_word, sizeof(u64));
 	}
 
 	context_entry = &context_entry_table[device->devfn];
-	context_entry->lo_word = VTD_CTX_PRESENT |
-		VTD_CTX_FPD | VTD_CTX_TTYPE_MLP_UNTRANS |
+	context_entry->lo_word = VTD_CTX_PRESENT | VTD_CTX_TTYPE_MLP_UNTRANS |
 		page_map_hvirt2phys(cell->vtd.page_table);
 	context_entry->hi_word =
 		(dmar_pt_levels == 3 ? VTD_CTX_AGAW_39 : VTD_CTX_AGAW_48) |
@@ -182,6 +640,120 @@ static bool vtd_add_device_to_cell(struct cell *cell,
 	return true;
 }
 
+/*
+ * The EPT can serve as second-level DMA page table if the units walk the
+ * same number of levels, understand all large pages the EPT uses and snoop
+ * page table updates (the EPT is not flushed from caches). The memory type
+ * bits of EPT entries are ignored by VT-d. As the EPT maps all regions of
+ * the cell, all of them must be DMA-capable.
+ */
+static bool vtd_can_share_ept(struct jailhouse_cell_desc *config)
+{
+	const struct jailhouse_memory *mem =
+		jailhouse_cell_mem_regions(config);
+	unsigned int n;
+
+	if (dmar_pt_levels != PAGE_DIR_LEVELS || !dmar_coherent ||
+	    (ept_huge_pages & ~dmar_huge_pages) != 0)
+		return false;
+
+	for (n = 0; n < config->num_memory_regions; n++, mem++)
+		if (!(mem->access_flags & JAILHOUSE_MEM_DMA))
+			return false;
+	return true;
+}
+
+/* Units snooping page-walks do not require page table flushes. */
+static enum page_map_coherent vtd_pt_coherency(void)
+{
+	return dmar_coherent ? PAGE_MAP_NON_COHERENT : PAGE_MAP_COHERENT;
+}
+
+static bool vtd_shares_ept(struct cell *cell)
+{
+	return cell->vtd.page_table == cell->vmx.ept;
+}
+
+static bool vtd_cell_owns_source(struct cell *cell, u16 source_id)
+{
+	const struct jailhouse_pci_device *dev =
+		jailhouse_cell_pci_devices(cell->config);
+	unsigned int n;
+
+	for (n = 0; n < cell->config->num_pci_devices; n++)
+		if ((dev[n].bus << 8 | dev[n].devfn) == source_id)
+			return true;
+	return false;
+}
+
+static int vtd_cell_add_irq_remaps(struct cell *cell)
+{
+	const struct jailhouse_irq_remap *remap =
+		jailhouse_cell_irq_remaps(cell->config);
+	unsigned int num_remaps = cell->config->num_irq_remaps;
+	struct vtd_entry *irte;
+	unsigned int n, i;
+	u32 apic_id;
+
+	if (num_remaps == 0)
+		return 0;
+	if (!dmar_irt)
+		return -ENODEV;
+
+	for (n = 0; n < num_remaps; n++) {
+		if (remap[n].handle >= VTD_IR_ENTRIES ||
+		    remap[n].flags & ~JAILHOUSE_IRQ_LEVEL ||
+		    remap[n].cpu > cell->cpu_set->max_cpu_id ||
+		    !test_bit(remap[n].cpu, cell->cpu_set->bitmap) ||
+		    !vtd_cell_owns_source(cell, remap[n].source_id))
+			return -EINVAL;
+		if (dmar_irt[remap[n].handle].lo_word & VTD_IRTE_PRESENT)
+			return -EBUSY;
+		for (i = 0; i < n; i++)
+			if (remap[i].handle == remap[n].handle)
+				return -EBUSY;
+	}
+
+	for (n = 0; n < num_remaps; n++, remap++) {
+		irte = &dmar_irt[remap->handle];
+		apic_id = per_cpu(remap->cpu)->apic_id;
+
+		irte->hi_word = remap->source_id | VTD_IRTE_SVT_VERIFY_SID;
+		irte->lo_word = VTD_IRTE_PRESENT |
+			((u64)remap->vector << VTD_IRTE_VECTOR_SHIFT) |
+			(using_x2apic ?
+			 (u64)apic_id << VTD_IRTE_DEST_SHIFT :
+			 (u64)(apic_id & 0xff) << VTD_IRTE_XAPIC_DEST_SHIFT);
+		if (remap->flags & JAILHOUSE_IRQ_LEVEL)
+			irte->lo_word |= VTD_IRTE_TM_LEVEL;
+		flush_cache(irte, sizeof(*irte));
+	}
+
+	vtd_flush_irq_cache();
+
+	return 0;
+}
+
+static void vtd_cell_remove_irq_remaps(struct cell *cell)
+{
+	const struct jailhouse_irq_remap *remap =
+		jailhouse_cell_irq_remaps(cell->config);
+	unsigned int n;
+
+	if (!cell->vtd.irq_remapped)
+		return;
+	cell->vtd.irq_remapped = false;
+
+	for (n = 0; n < cell->config->num_irq_remaps; n++, remap++) {
+		dmar_irt[remap->handle].lo_word = 0;
+		dmar_irt[remap->handle].hi_word = 0;
+		flush_cache(&dmar_irt[remap->handle],
+			    sizeof(struct vtd_entry));
+	}
+
+	vtd_flush_irq_cache();
+}
+
 int vtd_cell_init(struct cell *cell)
 {
 	struct jailhouse_cell_desc *config = cell->config;
@@ -189,7 +761,6 @@ int vtd_cell_init(struct cell *cell)
 		jailhouse_cell_mem_regions(config);
 	const struct jailhouse_pci_device *dev =
 		jailhouse_cell_pci_devices(cell->config);
-	void *reg_base = dmar_reg_base;
 	int n, err;
 
 	// HACK for QEMU
@@ -199,40 +770,68 @@ int vtd_cell_init(struct cell *cell)
 	if (cell->id >= dmar_num_did)
 		return -ERANGE;
 
-	cell->vtd.page_table = page_alloc(&mem_pool, 1);
-	if (!cell->vtd.page_table)
-		return -ENOMEM;
+	if (vtd_can_share_ept(config)) {
+		cell->vtd.page_table = cell->vmx.ept;
+	} else {
+		cell->vtd.page_table =
+			page_alloc(numa_pool(cell->numa_node), 1);
+		if (!cell->vtd.page_table)
+			return -ENOMEM;
 
-	for (n = 0; n < config->num_memory_regions; n++, mem++) {
-		err = vtd_map_memory_region(cell, mem);
-		if (err)
-			/* FIXME: release vtd.page_table */
-			return err;
+		for (n = 0; n < config->num_memory_regions; n++, mem++) {
+			err = vtd_map_memory_region(cell, mem);
+			if (err)
+				/* FIXME: release vtd.page_table */
+				return err;
+		}
 	}
 
+	for (n = 0; n < config->num_pci_devices; n++)
+		if (!vtd_root_table(dev[n].domain))
+			return -ENODEV;
+
+	return 0;
+}
+
+/*
+ * Hands the PCI devices and interrupt remappings over to the cell. Unlike
+ * vtd_cell_init, this modifies the shared tables, so the cells losing those
+ * resources have to be suspended.
+ */
+int vtd_cell_assign(struct cell *cell)
+{
+	struct jailhouse_cell_desc *config = cell->config;
+	const struct jailhouse_pci_device *dev =
+		jailhouse_cell_pci_devices(config);
+	int n, err;
+
+	// HACK for QEMU
+	if (dmar_units == 0)
+		return 0;
+
 	for (n = 0; n < config->num_pci_devices; n++)
 		if (!vtd_add_device_to_cell(cell, &dev[n]))
 			/* FIXME: release vtd.page_table,
 			 * revert device additions*/
 			return -ENOMEM;
 
-	if (!(mmio_read32(reg_base + VTD_GSTS_REG) & VTD_GSTS_TES))
-		for (n = 0; n < dmar_units; n++, reg_base += PAGE_SIZE) {
-			mmio_write64(reg_base + VTD_RTADDR_REG,
-				     page_map_hvirt2phys(root_entry_table));
-			mmio_write32(reg_base + VTD_GCMD_REG, VTD_GCMD_SRTP);
-			while (!(mmio_read32(reg_base + VTD_GSTS_REG) &
-				 VTD_GSTS_SRTP))
-				cpu_relax();
+	err = vtd_cell_add_irq_remaps(cell);
+	if (err)
+		/* FIXME: see above */
+		return err;
+	cell->vtd.irq_remapped = config->num_irq_remaps > 0;
 
-			vtd_flush_dmar_caches(reg_base, VTD_CCMD_CIRG_GLOBAL,
-					      VTD_IOTLB_IIRG_GLOBAL);
+	if (mmio_read32(dmar_unit[0].reg_base + VTD_GSTS_REG) & VTD_GSTS_TES)
+		return 0;
 
-			mmio_write32(reg_base + VTD_GCMD_REG, VTD_GCMD_TE);
-			while (!(mmio_read32(reg_base + VTD_GSTS_REG) &
-				 VTD_GSTS_TES))
-				cpu_relax();
-		}
+	for (n = 0; n < dmar_units; n++)
+		mmio_write64(dmar_unit[n].reg_base + VTD_RTADDR_REG,
+			     page_map_hvirt2phys(dmar_unit[n].root_table));
+	vtd_update_gcmd(VTD_GCMD_SRTP, VTD_GSTS_SRTP);
+
+	vtd_flush_caches(VTD_INV_GLOBAL, 0);
+
+	vtd_update_gcmd(VTD_GCMD_TE, VTD_GSTS_TES);
 
 	return 0;
 }
@@ -241,49 +840,74 @@ static void
 vtd_remove_device_from_cell(struct cell *cell,
 			    const struct jailhouse_pci_device *device)
 {
-	u64 root_entry_lo = root_entry_table[device->bus].lo_word;
-	struct vtd_entry *context_entry_table =
-		page_map_phys2hvirt(root_entry_lo & PAGE_MASK);
-	struct vtd_entry *context_entry = &context_entry_table[device->devfn];
+	struct vtd_entry *root_table = vtd_root_table(device->domain);
+	struct vtd_entry *context_entry_table, *context_entry;
 	unsigned int n;
 
+	if (!root_table ||
+	    !(root_table[device->bus].lo_word & VTD_ROOT_PRESENT))
+		return;
+
+	context_entry_table =
+		page_map_phys2hvirt(root_table[device->bus].lo_word &
+				    PAGE_MASK);
+	context_entry = &context_entry_table[device->devfn];
 	if (!(context_entry->lo_word & VTD_CTX_PRESENT))
 		return;
 
-	printk("Removing PCI device %02x:%02x.%x from cell \"%s\"\n",
-	       device->bus, device->devfn >> 3, device->devfn & 7,
-	       cell->config->name);
+	printk("Removing PCI device %04x:%02x:%02x.%x from cell \"%s\"\n",
+	       device->domain, device->bus, device->devfn >> 3,
+	       device->devfn & 7, cell->config->name);
 
 	context_entry->lo_word &= ~VTD_CTX_PRESENT;
 	flush_cache(&context_entry->lo_word, sizeof(u64));
 
+	/* context caches can only be invalidated domain-wide */
+	if (cell == &linux_cell)
+		linux_domain_inv = true;
+
 	for (n = 0; n < 256; n++)
 		if (context_entry_table[n].lo_word & VTD_CTX_PRESENT)
 			return;
 
-	root_entry_table[device->bus].lo_word &= ~VTD_ROOT_PRESENT;
-	flush_cache(&root_entry_table[device->bus].lo_word, sizeof(u64));
+	root_table[device->bus].lo_word &= ~VTD_ROOT_PRESENT;
+	flush_cache(&root_table[device->bus].lo_word, sizeof(u64));
 	page_free(&mem_pool, context_entry_table, 1);
+	dmar_context_tables--;
 }
 
-void vtd_linux_cell_shrink(struct jailhouse_cell_desc *config)
+int vtd_linux_cell_shrink(struct cell *cell)
 {
-	const struct jailhouse_memory *mem =
-		jailhouse_cell_mem_regions(config);
+	struct jailhouse_cell_desc *config = cell->config;
 	const struct jailhouse_pci_device *dev =
 		jailhouse_cell_pci_devices(config);
-	unsigned int n;
-
-	for (n = 0; n < config->num_memory_regions; n++, mem++)
-		if (mem->access_flags & JAILHOUSE_MEM_DMA)
-			page_map_destroy(linux_cell.vtd.page_table,
-					 mem->phys_start, mem->size,
-					 dmar_pt_levels, PAGE_MAP_COHERENT);
+	struct jailhouse_memory range;
+	unsigned int n, pos = 0;
+	int err = 0;
+
+	if (vtd_shares_ept(&linux_cell)) {
+		/* the EPT was shrunk by vmx_linux_cell_shrink */
+		while (cell_next_phys_range(cell, &pos, 0, &range))
+			vtd_linux_queue_inv(range.phys_start, range.size);
+	} else {
+		while (cell_next_phys_range(cell, &pos, JAILHOUSE_MEM_DMA,
+					    &range)) {
+			/* Splitting superpages may fail, but the regions are
+			 * unmapped nevertheless. */
+			if (page_map_destroy(linux_cell.vtd.page_table,
+					     range.phys_start, range.size,
+					     VTD_PAGE_READ | VTD_PAGE_WRITE,
+					     dmar_pt_levels,
+					     vtd_pt_coherency()) < 0)
+				err = -ENOMEM;
+			vtd_linux_queue_inv(range.phys_start, range.size);
+		}
+	}
 
 	for (n = 0; n < config->num_pci_devices; n++)
 		vtd_remove_device_from_cell(&linux_cell, &dev[n]);
 
-	vtd_flush_domain_caches(linux_cell.id);
+	return err;
 }
 
 int vtd_map_memory_region(struct cell *cell,
@@ -295,7 +919,7 @@ int vtd_map_memory_region(struct cell *cell,
 	if (dmar_units == 0)
 		return 0;
 
-	if (!(mem->access_flags & JAILHOUSE_MEM_DMA))
+	if (!(mem->access_flags & JAILHOUSE_MEM_DMA) || vtd_shares_ept(cell))
 		return 0;
 
 	if (mem->access_flags & JAILHOUSE_MEM_READ)
@@ -306,7 +930,8 @@ int vtd_map_memory_region(struct cell *cell,
 	return page_map_create(cell->vtd.page_table, mem->phys_start,
 			       mem->size, mem->virt_start, page_flags,
 			       VTD_PAGE_READ | VTD_PAGE_WRITE,
-			       dmar_pt_levels, PAGE_MAP_COHERENT);
+			       dmar_pt_levels, dmar_huge_pages,
+			       vtd_pt_coherency());
 }
 
 void vtd_unmap_memory_region(struct cell *cell,
@@ -316,9 +941,14 @@ void vtd_unmap_memory_region(struct cell *cell,
 	if (dmar_units == 0)
 		return;
 
-	if (mem->access_flags & JAILHOUSE_MEM_DMA)
+	if (mem->access_flags & JAILHOUSE_MEM_DMA && !vtd_shares_ept(cell))
 		page_map_destroy(cell->vtd.page_table, mem->virt_start,
-				 mem->size, dmar_pt_levels, PAGE_MAP_COHERENT);
+				 mem->size, VTD_PAGE_READ | VTD_PAGE_WRITE,
+				 dmar_pt_levels, vtd_pt_coherency());
+
+	/* other cells are flushed domain-wide on destruction */
+	if (cell == &linux_cell)
+		vtd_linux_queue_inv(mem->virt_start, mem->size);
 }
 
 static bool vtd_return_device_to_linux(const struct jailhouse_pci_device *dev)
@@ -342,6 +972,8 @@ void vtd_cell_exit(struct cell *cell)
 		jailhouse_cell_pci_devices(cell->config);
 	unsigned int n;
 
+	vtd_cell_remove_irq_remaps(cell);
+
 	for (n = 0; n < cell->config->num_pci_devices; n++) {
 		vtd_remove_device_from_cell(cell, &dev[n]);
 		if (!vtd_return_device_to_linux(&dev[n]))
@@ -349,20 +981,61 @@ void vtd_cell_exit(struct cell *cell)
 			       "Linux cell\n");
 	}
 
-	vtd_flush_domain_caches(cell->id);
-	vtd_flush_domain_caches(linux_cell.id);
+	/* the page table is released, so this cannot wait for commit */
+	vtd_flush_caches(VTD_INV_DOMAIN, cell->id);
 
-	page_free(&mem_pool, cell->vtd.page_table, 1);
+	if (!vtd_shares_ept(cell))
+		page_free(numa_pool(cell->numa_node), cell->vtd.page_table,
+			  1);
 }
 
-void vtd_shutdown(void)
+void vtd_get_mem_usage(struct cell *cell, struct jailhouse_mem_info *info)
 {
-	void *reg_base = dmar_reg_base;
-	unsigned int n;
+	/* the root entry table is part of the hypervisor image */
+	info->dma_context_tables = dmar_context_tables;
+	if (vtd_shares_ept(cell))
+		info->dma_page_tables = 0;
+	else
+		info->dma_page_tables =
+			page_map_count_tables(cell->vtd.page_table,
+					      dmar_pt_levels);
+}
 
-	for (n = 0; n < dmar_units; n++, reg_base += PAGE_SIZE) {
-		mmio_write32(reg_base + VTD_GCMD_REG, 0);
-		while (mmio_read32(reg_base + VTD_GSTS_REG) & VTD_GSTS_TES)
-			cpu_relax();
+void vtd_config_commit(struct cell *cell_added)
+{
+	/* report faults that accumulated up to the reconfiguration */
+	vtd_poll_faults();
+
+	if (linux_domain_inv)
+		vtd_flush_caches(VTD_INV_DOMAIN, linux_cell.id);
+	else if (linux_num_page_inv > 0)
+		vtd_flush_iotlb_pages(linux_cell.id, linux_page_inv,
+				      linux_num_page_inv);
+	linux_domain_inv = false;
+	linux_num_page_inv = 0;
+
+	if (cell_added)
+		vtd_flush_caches(VTD_INV_DOMAIN, cell_added->id);
+}
+
+const struct jailhouse_dma_faults *vtd_get_faults(unsigned int unit)
+{
+	if (unit >= dmar_units)
+		return NULL;
+
+	vtd_poll_faults();
+	dmar_faults[unit].num_units = dmar_units;
+	return &dmar_faults[unit];
+}
+
+void vtd_shutdown(void)
+{
+	vtd_update_gcmd(0, VTD_GSTS_TES);
+	/* one command per GCMD write, like on enabling */
+	if (dmar_irt) {
+		vtd_update_gcmd(0, VTD_GSTS_IRES);
+		vtd_update_gcmd(0, VTD_GSTS_CFIS);
 	}
+	if (dmar_inv_status)
+		vtd_update_gcmd(0, VTD_GSTS_QIES);
 }
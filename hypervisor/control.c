@@ -12,16 +12,34 @@
 
 #include <jailhouse/entry.h>
 #include <jailhouse/control.h>
+#include <jailhouse/mmio.h>
 #include <jailhouse/printk.h>
 #include <jailhouse/paging.h>
+#include <jailhouse/processor.h>
+#include <jailhouse/shmem.h>
 #include <jailhouse/string.h>
+#include <jailhouse/trace.h>
 #include <asm/bitops.h>
 #include <asm/spinlock.h>
 
+#define MAX_CELLS		JAILHOUSE_MAX_CELLS
+#define CELL_NAME_HASH_SIZE	64
+
 struct jailhouse_system *system_config;
 
 static DEFINE_SPINLOCK(shutdown_lock);
 
+/* Cells by ID, which also serves as VPID and DMA domain ID. Updates are
+ * serialized by cell_reconfiguring and done with the Linux cell suspended. */
+static struct cell *cell_table[MAX_CELLS];
+static unsigned long cell_id_bitmap[MAX_CELLS / BITS_PER_LONG];
+static struct cell *cell_name_hash[CELL_NAME_HASH_SIZE];
+
+/* set while a cell is created or destroyed */
+static unsigned long cell_reconfiguring;
+
+static struct jailhouse_stats *stats_area;
+
 unsigned int next_cpu(unsigned int cpu, struct cpu_set *cpu_set, int exception)
 {
 	do
@@ -31,36 +49,144 @@ unsigned int next_cpu(unsigned int cpu, struct cpu_set *cpu_set, int exception)
 	return cpu;
 }
 
-static void cell_suspend(struct cell *cell, struct per_cpu *cpu_data)
+/* updates are serialized by cell_reconfiguring */
+static void stats_begin_update(void)
+{
+	stats_area->seq++;
+	memory_barrier();
+}
+
+static void stats_end_update(void)
 {
+	memory_barrier();
+	stats_area->seq++;
+}
+
+/* to be called between stats_begin/end_update or before Linux can read */
+void stats_update_cell(struct cell *cell, unsigned int state)
+{
+	struct jailhouse_cell_status *status =
+		&jailhouse_stats_cells(stats_area)[cell->id];
 	unsigned int cpu;
 
-	for_each_cpu_except(cpu, cell->cpu_set, cpu_data->cpu_id)
-		arch_suspend_cpu(cpu);
+	memset(status, 0, sizeof(*status));
+	if (state == JAILHOUSE_CELL_STATE_NONE)
+		return;
+
+	memcpy(status->name, cell->config->name, JAILHOUSE_CELL_NAME_MAXLEN);
+	status->state = state;
+	for_each_cpu(cpu, cell->cpu_set)
+		status->num_cpus++;
+}
+
+/* refreshes the CPU count, a parked cell stays parked */
+static void stats_update_cell_cpus(struct cell *cell)
+{
+	stats_update_cell(cell,
+			  jailhouse_stats_cells(stats_area)[cell->id].state);
+}
+
+static void cell_suspend(struct cell *cell, struct per_cpu *cpu_data)
+{
+	arch_suspend_cpus(cell->cpu_set, cpu_data->cpu_id);
 	printk("Suspended cell \"%s\"\n", cell->config->name);
 }
 
 static void cell_resume(struct per_cpu *cpu_data)
 {
-	unsigned int cpu;
-
-	for_each_cpu_except(cpu, cpu_data->cell->cpu_set, cpu_data->cpu_id)
-		arch_resume_cpu(cpu);
+	arch_resume_cpus(cpu_data->cell->cpu_set, cpu_data->cpu_id);
 }
 
 static unsigned int get_free_cell_id(void)
 {
-	unsigned int id = 0;
-	struct cell *cell;
+	unsigned int n;
+
+	for (n = 0; n < MAX_CELLS / BITS_PER_LONG; n++)
+		if (cell_id_bitmap[n] != ~0UL)
+			return n * BITS_PER_LONG + ffz(cell_id_bitmap[n]);
+	return MAX_CELLS;
+}
+
+static unsigned int cell_name_hash_index(const char *name)
+{
+	unsigned int hash = 2166136261U;
+
+	/* FNV-1a */
+	while (*name)
+		hash = (hash ^ *name++) * 16777619U;
+	return hash % CELL_NAME_HASH_SIZE;
+}
 
-retry:
-	for (cell = &linux_cell; cell; cell = cell->next)
-		if (cell->id == id) {
-			id++;
-			goto retry;
+void cell_register(struct cell *cell)
+{
+	unsigned int index = cell_name_hash_index(cell->config->name);
+
+	set_bit(cell->id, cell_id_bitmap);
+	cell_table[cell->id] = cell;
+
+	cell->hash_next = cell_name_hash[index];
+	cell_name_hash[index] = cell;
+}
+
+static void cell_unregister(struct cell *cell)
+{
+	struct cell **link =
+		&cell_name_hash[cell_name_hash_index(cell->config->name)];
+
+	while (*link != cell)
+		link = &(*link)->hash_next;
+	*link = cell->hash_next;
+
+	cell_table[cell->id] = NULL;
+	clear_bit(cell->id, cell_id_bitmap);
+}
+
+static void destroy_cpu_set(struct cell *cell)
+{
+	if (cell->cpu_set != &cell->small_cpu_set)
+		page_free(&mem_pool, cell->cpu_set, 1);
+}
+
+static bool mem_region_before(const struct jailhouse_memory *a,
+			      const struct jailhouse_memory *b)
+{
+	return a->phys_start < b->phys_start;
+}
+
+/* heapsort, configurations may come with hundreds of small regions */
+static void sort_mem_regions(const struct jailhouse_memory **mem,
+			     unsigned int num)
+{
+	const struct jailhouse_memory *tmp;
+	unsigned int start, end, root, child;
+
+	for (start = num / 2, end = num; end > 1; ) {
+		if (start > 0) {
+			start--;
+		} else {
+			end--;
+			tmp = mem[end];
+			mem[end] = mem[0];
+			mem[0] = tmp;
 		}
 
-	return id;
+		for (root = start; (child = 2 * root + 1) < end; root = child) {
+			if (child + 1 < end &&
+			    mem_region_before(mem[child], mem[child + 1]))
+				child++;
+			if (!mem_region_before(mem[root], mem[child]))
+				break;
+			tmp = mem[root];
+			mem[root] = mem[child];
+			mem[child] = tmp;
+		}
+	}
+}
+
+static unsigned int sorted_mem_regions_pages(struct cell *cell)
+{
+	return PAGE_ALIGN(cell->config->num_memory_regions *
+			  sizeof(*cell->sorted_mem_regions)) / PAGE_SIZE;
 }
 
 int cell_init(struct cell *cell, bool copy_cpu_set)
@@ -71,8 +197,12 @@ int cell_init(struct cell *cell, bool copy_cpu_set)
 	const struct jailhouse_memory *config_ram =
 		jailhouse_cell_mem_regions(cell->config);
 	struct cpu_set *cpu_set;
+	unsigned int n, node;
 
+	/* the ID is only taken on cell_register */
 	cell->id = get_free_cell_id();
+	if (cell->id >= MAX_CELLS)
+		return -ENOSPC;
 
 	if (cpu_set_size > PAGE_SIZE)
 		return -EINVAL;
@@ -91,22 +221,91 @@ int cell_init(struct cell *cell, bool copy_cpu_set)
 	if (copy_cpu_set)
 		memcpy(cell->cpu_set->bitmap, config_cpu_set, cpu_set_size);
 
+	/* page tables go to the node of the CPUs if they share one,
+	 * NUMA_NO_NODE + 1 stands for "no CPU seen yet". Linux keeps
+	 * NUMA_NO_NODE, its tables were built by arch_init_early already. */
+	node = NUMA_NO_NODE + 1;
+	for (n = 0; n < cpu_set_size * 8 && cell != &linux_cell; n++) {
+		if (!test_bit(n, config_cpu_set))
+			continue;
+		if (node > NUMA_NO_NODE)
+			node = cpu_numa_node(n);
+		else if (cpu_numa_node(n) != node)
+			node = NUMA_NO_NODE;
+	}
+	cell->numa_node = node > NUMA_NO_NODE ? NUMA_NO_NODE : node;
+
 	cell->page_offset = config_ram->phys_start;
 
+	/* the first region keeps its special role in the config, so sort an
+	 * index instead of the regions themselves */
+	cell->sorted_mem_regions = NULL;
+	if (cell->config->num_memory_regions > 0) {
+		cell->sorted_mem_regions =
+			page_alloc(&mem_pool, sorted_mem_regions_pages(cell));
+		if (!cell->sorted_mem_regions) {
+			destroy_cpu_set(cell);
+			return -ENOMEM;
+		}
+		for (n = 0; n < cell->config->num_memory_regions; n++)
+			cell->sorted_mem_regions[n] = &config_ram[n];
+		sort_mem_regions(cell->sorted_mem_regions,
+				 cell->config->num_memory_regions);
+	}
+
 	return 0;
 }
 
-static void destroy_cpu_set(struct cell *cell)
+static void cell_exit(struct cell *cell)
 {
-	if (cell->cpu_set != &cell->small_cpu_set)
-		page_free(&mem_pool, cell->cpu_set, 1);
+	page_free(&mem_pool, cell->sorted_mem_regions,
+		  sorted_mem_regions_pages(cell));
+	destroy_cpu_set(cell);
+}
+
+/*
+ * Returns the next maximal physical range that is covered by those memory
+ * regions of the cell that have all the given access flags set. Ranges are
+ * returned in ascending order, *pos has to be 0 on the first call.
+ */
+bool cell_next_phys_range(struct cell *cell, unsigned int *pos,
+			  u32 access_flags, struct jailhouse_memory *range)
+{
+	unsigned int num = cell->config->num_memory_regions;
+	const struct jailhouse_memory *mem;
+	unsigned long end;
+
+	while (*pos < num) {
+		mem = cell->sorted_mem_regions[(*pos)++];
+		if ((mem->access_flags & access_flags) != access_flags)
+			continue;
+
+		range->phys_start = mem->phys_start;
+		end = mem->phys_start + mem->size;
+
+		for (; *pos < num; (*pos)++) {
+			mem = cell->sorted_mem_regions[*pos];
+			if (mem->phys_start > end)
+				break;
+			if ((mem->access_flags & access_flags) ==
+			    access_flags && mem->phys_start + mem->size > end)
+				end = mem->phys_start + mem->size;
+		}
+
+		range->size = end - range->phys_start;
+		range->virt_start = range->phys_start;
+		range->access_flags = access_flags;
+		return true;
+	}
+	return false;
 }
 
 static struct cell *cell_find(const char *name)
 {
 	struct cell *cell;
 
-	for (cell = &linux_cell; cell; cell = cell->next)
+	for (cell = cell_name_hash[cell_name_hash_index(name)]; cell;
+	     cell = cell->hash_next)
 		if (strcmp(cell->config->name, name) == 0)
 			break;
 	return cell;
@@ -132,67 +331,199 @@ int check_mem_regions(const struct jailhouse_cell_desc *config)
 	return 0;
 }
 
-int cell_create(struct per_cpu *cpu_data, unsigned long config_address)
+static void cell_sample_mem_usage(struct cell *cell,
+				  struct jailhouse_mem_info *info)
+{
+	memset(info, 0, sizeof(*info));
+	arch_get_mem_usage(cell, info);
+
+	if (info->page_tables > cell->page_tables_peak)
+		cell->page_tables_peak = info->page_tables;
+	if (info->dma_page_tables > cell->dma_page_tables_peak)
+		cell->dma_page_tables_peak = info->dma_page_tables;
+}
+
+static bool address_in_region(unsigned long addr,
+			      const struct jailhouse_memory *region)
+{
+	return addr >= region->phys_start &&
+	       addr < (region->phys_start + region->size);
+}
+
+static void remap_range_to_linux(const struct jailhouse_memory *range)
+{
+	if (range->size > 0 &&
+	    arch_map_memory_region(&linux_cell, range) != 0)
+		printk("WARNING: Failed to re-assign memory region "
+		       "to Linux cell\n");
+}
+
+/*
+ * Merges the sorted regions of both cells in a single sweep. Overlaps that
+ * are contiguous in Linux' guest-physical space with identical access are
+ * combined, so that each is re-mapped by a single, possibly huge, mapping.
+ */
+static void remap_to_linux(struct cell *cell)
+{
+	const struct jailhouse_memory **linux_mem =
+		linux_cell.sorted_mem_regions;
+	unsigned int num_linux_mem = linux_cell.config->num_memory_regions;
+	struct jailhouse_memory range, overlap, pending;
+	unsigned int pos = 0, first = 0, n;
+	unsigned long start, end;
+
+	pending.size = 0;
+
+	while (cell_next_phys_range(cell, &pos, 0, &range)) {
+		/* Linux regions ending before this range are done */
+		while (first < num_linux_mem &&
+		       linux_mem[first]->phys_start + linux_mem[first]->size <=
+		       range.phys_start)
+			first++;
+
+		for (n = first; n < num_linux_mem &&
+		     linux_mem[n]->phys_start < range.phys_start + range.size;
+		     n++) {
+			start = range.phys_start;
+			if (linux_mem[n]->phys_start > start)
+				start = linux_mem[n]->phys_start;
+			end = range.phys_start + range.size;
+			if (linux_mem[n]->phys_start + linux_mem[n]->size < end)
+				end = linux_mem[n]->phys_start +
+					linux_mem[n]->size;
+			if (end <= start)
+				continue;
+
+			overlap.phys_start = start;
+			overlap.size = end - start;
+			overlap.virt_start = linux_mem[n]->virt_start +
+				start - linux_mem[n]->phys_start;
+			overlap.access_flags = linux_mem[n]->access_flags;
+
+			if (pending.size > 0 &&
+			    pending.phys_start + pending.size == start &&
+			    pending.virt_start + pending.size ==
+			    overlap.virt_start &&
+			    pending.access_flags == overlap.access_flags) {
+				pending.size += overlap.size;
+			} else {
+				remap_range_to_linux(&pending);
+				pending = overlap;
+			}
+		}
+	}
+
+	remap_range_to_linux(&pending);
+}
+
+static void cell_return_memory(struct cell *cell)
+{
+	const struct jailhouse_memory *mem =
+		jailhouse_cell_mem_regions(cell->config);
+	unsigned int n;
+
+	/* also releases the page tables of the cell */
+	for (n = 0; n < cell->config->num_memory_regions; n++, mem++)
+		arch_unmap_memory_region(cell, mem);
+
+	remap_to_linux(cell);
+}
+
+/*
+ * Copies from Linux memory through the foreign mapping window, a chunk of
+ * the window size at a time. This keeps the size of data unlimited.
+ */
+static int copy_from_linux(struct per_cpu *cpu_data, void *dst,
+			   unsigned long address, unsigned long size)
 {
 	unsigned long mapping_addr = FOREIGN_MAPPING_BASE +
 		cpu_data->cpu_id * PAGE_SIZE * NUM_FOREIGN_PAGES;
-	unsigned long cfg_header_size, cfg_total_size;
-	struct jailhouse_cell_desc *cfg;
+	unsigned long offset, chunk;
+	int err;
+
+	while (size > 0) {
+		offset = address & ~PAGE_MASK;
+		chunk = NUM_FOREIGN_PAGES * PAGE_SIZE - offset;
+		if (chunk > size)
+			chunk = size;
+
+		err = page_map_create(hv_page_table, address & PAGE_MASK,
+				      offset + chunk, mapping_addr,
+				      PAGE_READONLY_FLAGS, PAGE_DEFAULT_FLAGS,
+				      PAGE_DIR_LEVELS, PAGE_MAP_NO_HUGE,
+				      PAGE_MAP_NON_COHERENT);
+		if (err)
+			return err;
+
+		memcpy(dst, (void *)(mapping_addr + offset), chunk);
+
+		dst += chunk;
+		address += chunk;
+		size -= chunk;
+	}
+
+	return 0;
+}
+
+/*
+ * Cells are created in two phases. The new cell's private state, i.e. its
+ * page tables and bitmaps, is built while Linux keeps running. Linux is only
+ * suspended to hand over memory, devices and CPUs.
+ */
+int cell_create(struct per_cpu *cpu_data, unsigned long config_address)
+{
+	struct jailhouse_cell_desc cfg_header;
+	struct jailhouse_mem_info mem_info;
 	struct cpu_set *shrinking_set;
+	unsigned long cfg_total_size;
 	unsigned int cell_pages, cpu;
-	struct cell *cell, *last;
+	struct cell *cell;
 	int err;
 
 	/* We do not support creation over non-Linux cells so far. */
 	if (cpu_data->cell != &linux_cell)
 		return -EPERM;
 
-	cell_suspend(&linux_cell, cpu_data);
+	if (test_and_set_bit(0, &cell_reconfiguring))
+		return -EBUSY;
 
-	cfg_header_size = (config_address & ~PAGE_MASK) +
-		sizeof(struct jailhouse_cell_desc);
-
-	err = page_map_create(hv_page_table, config_address & PAGE_MASK,
-			      cfg_header_size, mapping_addr,
-			      PAGE_READONLY_FLAGS, PAGE_DEFAULT_FLAGS,
-			      PAGE_DIR_LEVELS, PAGE_MAP_NON_COHERENT);
+	err = copy_from_linux(cpu_data, &cfg_header, config_address,
+			      sizeof(cfg_header));
 	if (err)
-		goto resume_out;
+		goto out;
 
-	cfg = (struct jailhouse_cell_desc *)(mapping_addr +
-					     (config_address & ~PAGE_MASK));
-	cfg_total_size = jailhouse_cell_config_size(cfg);
-	if (cfg_total_size > NUM_FOREIGN_PAGES * PAGE_SIZE) {
-		err = -E2BIG;
-		goto resume_out;
-	}
-
-	if (cell_find(cfg->name)) {
+	cfg_header.name[JAILHOUSE_CELL_NAME_MAXLEN] = 0;
+	if (cell_find(cfg_header.name)) {
 		err = -EEXIST;
-		goto resume_out;
+		goto out;
 	}
 
-	err = page_map_create(hv_page_table, config_address & PAGE_MASK,
-			      cfg_total_size, mapping_addr,
-			      PAGE_READONLY_FLAGS, PAGE_DEFAULT_FLAGS,
-			      PAGE_DIR_LEVELS, PAGE_MAP_NON_COHERENT);
-	if (err)
-		goto resume_out;
-
-	err = check_mem_regions(cfg);
-	if (err)
-		goto resume_out;
-
+	cfg_total_size = jailhouse_cell_config_size(&cfg_header);
 	cell_pages = PAGE_ALIGN(sizeof(*cell) + cfg_total_size) / PAGE_SIZE;
 	cell = page_alloc(&mem_pool, cell_pages);
 	if (!cell) {
 		err = -ENOMEM;
-		goto resume_out;
+		goto out;
 	}
 
 	cell->data_pages = cell_pages;
 	cell->config = ((void *)cell) + sizeof(*cell);
-	memcpy(cell->config, cfg, cfg_total_size);
+
+	/* Linux may still modify its copy, so only validate ours */
+	err = copy_from_linux(cpu_data, cell->config, config_address,
+			      cfg_total_size);
+	if (err)
+		goto err_free_cell;
+
+	if (jailhouse_cell_config_size(cell->config) != cfg_total_size ||
+	    strcmp(cell->config->name, cfg_header.name) != 0) {
+		err = -EINVAL;
+		goto err_free_cell;
+	}
+
+	err = check_mem_regions(cell->config);
+	if (err)
+		goto err_free_cell;
 
 	err = cell_init(cell, true);
 	if (err)
@@ -202,7 +533,7 @@ int cell_create(struct per_cpu *cpu_data, unsigned long config_address)
 	if (cpu_data->cpu_id <= cell->cpu_set->max_cpu_id &&
 	    test_bit(cpu_data->cpu_id, cell->cpu_set->bitmap)) {
 		err = -EBUSY;
-		goto err_free_cpu_set;
+		goto err_cell_exit;
 	}
 
 	shrinking_set = cpu_data->cell->cpu_set;
@@ -210,102 +541,94 @@ int cell_create(struct per_cpu *cpu_data, unsigned long config_address)
 	/* shrinking set must be super-set of new cell's cpu set */
 	if (shrinking_set->max_cpu_id < cell->cpu_set->max_cpu_id) {
 		err = -EINVAL;
-		goto err_free_cpu_set;
+		goto err_cell_exit;
 	}
 	for_each_cpu(cpu, cell->cpu_set)
 		if (!test_bit(cpu, shrinking_set->bitmap)) {
 			err = -EINVAL;
-			goto err_free_cpu_set;
+			goto err_cell_exit;
 		}
 
+	err = arch_cell_create(cpu_data, cell);
+	if (err)
+		goto err_cell_exit;
+
+	cell_suspend(&linux_cell, cpu_data);
+
+	/* Linux devices may walk its old DMA tables until the commit */
+	page_pool_defer_frees();
+
+	err = arch_cell_commit(cpu_data, cell);
+	if (err)
+		goto err_cell_destroy;
+
+	err = shmem_cell_init(cell);
+	if (err)
+		goto err_cell_destroy;
+
 	for_each_cpu(cpu, cell->cpu_set)
 		clear_bit(cpu, shrinking_set->bitmap);
 
-	err = arch_cell_create(cpu_data, cell);
-	if (err)
-		goto err_restore_cpu_set;
+	arch_config_commit(cpu_data, cell);
+	page_pool_release_deferred();
+
+	cell_sample_mem_usage(&linux_cell, &mem_info);
+	cell_sample_mem_usage(cell, &mem_info);
 
-	last = &linux_cell;
-	while (last->next)
-		last = last->next;
-	last->next = cell;
+	cell_register(cell);
+	shmem_cell_activate(cell);
 
 	/* update cell references and clean up before releasing the cpus of
 	 * the new cell */
-	for_each_cpu(cpu, cell->cpu_set)
+	stats_begin_update();
+	for_each_cpu(cpu, cell->cpu_set) {
 		per_cpu(cpu)->cell = cell;
+		per_cpu(cpu)->stats->cell_id = cell->id;
+	}
+	stats_update_cell(&linux_cell, JAILHOUSE_CELL_STATE_RUNNING);
+	stats_update_cell(cell, JAILHOUSE_CELL_STATE_RUNNING);
+	stats_end_update();
 
 	printk("Created cell \"%s\"\n", cell->config->name);
+	trace_event(JAILHOUSE_TRACE_CELL_CREATE, cell->id);
 
 	page_map_dump_stats("after cell creation");
 
-	for_each_cpu(cpu, cell->cpu_set)
-		arch_reset_cpu(cpu);
+	arch_reset_cpus(cell->cpu_set, cpu_data->cpu_id);
 
 resume_out:
 	cell_resume(cpu_data);
+out:
+	clear_bit(0, &cell_reconfiguring);
 
 	return err;
 
-err_restore_cpu_set:
-	for_each_cpu(cpu, cell->cpu_set)
-		set_bit(cpu, shrinking_set->bitmap);
-err_free_cpu_set:
-	destroy_cpu_set(cell);
-err_free_cell:
+err_cell_destroy:
+	/* Linux may have lost mappings and devices already */
+	cell_return_memory(cell);
+	arch_cell_destroy(cpu_data, cell);
+	mmio_cell_exit(cell);
+	arch_config_commit(cpu_data, NULL);
+	page_pool_release_deferred();
+	cell_exit(cell);
 	page_free(&mem_pool, cell, cell_pages);
 	goto resume_out;
-}
-
-static bool address_in_region(unsigned long addr,
-			      const struct jailhouse_memory *region)
-{
-	return addr >= region->phys_start &&
-	       addr < (region->phys_start + region->size);
-}
-
-static void remap_to_linux(const struct jailhouse_memory *mem)
-{
-	const struct jailhouse_memory *linux_mem =
-		jailhouse_cell_mem_regions(linux_cell.config);
-	struct jailhouse_memory overlap;
-	int n;
-
-	for (n = 0; n < linux_cell.config->num_memory_regions;
-	     n++, linux_mem++) {
-		if (address_in_region(mem->phys_start, linux_mem)) {
-			overlap.phys_start = mem->phys_start;
-			overlap.size = linux_mem->size -
-				(overlap.phys_start - linux_mem->phys_start);
-			if (overlap.size > mem->size)
-				overlap.size = mem->size;
-		} else if (address_in_region(linux_mem->phys_start, mem)) {
-			overlap.phys_start = linux_mem->phys_start;
-			overlap.size = mem->size -
-				(overlap.phys_start - mem->phys_start);
-			if (overlap.size > linux_mem->size)
-				overlap.size = linux_mem->size;
-		} else
-			continue;
-
-		overlap.virt_start = linux_mem->virt_start +
-			overlap.phys_start - linux_mem->phys_start;
-		overlap.access_flags = linux_mem->access_flags;
 
-		if (arch_map_memory_region(&linux_cell, &overlap) != 0)
-			printk("WARNING: Failed to re-assign memory region "
-			       "to Linux cell\n");
-	}
+err_cell_exit:
+	cell_exit(cell);
+err_free_cell:
+	page_free(&mem_pool, cell, cell_pages);
+	goto out;
 }
 
 int cell_destroy(struct per_cpu *cpu_data, unsigned long name_address)
 {
 	unsigned long mapping_addr = FOREIGN_MAPPING_BASE +
 		cpu_data->cpu_id * PAGE_SIZE * NUM_FOREIGN_PAGES;
-	const struct jailhouse_memory *mem;
-	struct cell *cell, *previous;
+	struct jailhouse_mem_info mem_info;
+	struct cell *cell;
 	unsigned long name_size;
-	unsigned int cpu, n;
+	unsigned int cpu;
 	const char *name;
 	int err = 0;
 
@@ -315,6 +638,9 @@ int cell_destroy(struct per_cpu *cpu_data, unsigned long name_address)
 	if (cpu_data->cell != &linux_cell)
 		return -EPERM;
 
+	if (test_and_set_bit(0, &cell_reconfiguring))
+		return -EBUSY;
+
 	cell_suspend(&linux_cell, cpu_data);
 
 	name_size = (name_address & ~PAGE_MASK) + JAILHOUSE_CELL_NAME_MAXLEN;
@@ -322,7 +648,7 @@ int cell_destroy(struct per_cpu *cpu_data, unsigned long name_address)
 	err = page_map_create(hv_page_table, name_address & PAGE_MASK,
 			      name_size, mapping_addr, PAGE_READONLY_FLAGS,
 			      PAGE_DEFAULT_FLAGS, PAGE_DIR_LEVELS,
-			      PAGE_MAP_NON_COHERENT);
+			      PAGE_MAP_NO_HUGE, PAGE_MAP_NON_COHERENT);
 	if (err)
 		goto resume_out;
 
@@ -342,34 +668,693 @@ int cell_destroy(struct per_cpu *cpu_data, unsigned long name_address)
 
 	cell_suspend(cell, cpu_data);
 
-	printk("Closing cell \"%s\"\n", name);
+	printk("Closing cell \"%s\", parking its CPUs\n", name);
+	trace_event(JAILHOUSE_TRACE_CELL_DESTROY, cell->id);
 
-	for_each_cpu(cpu, cell->cpu_set) {
-		printk(" Parking CPU %d\n", cpu);
-		arch_park_cpu(cpu);
+	arch_park_cpus(cell->cpu_set, cpu_data->cpu_id);
+
+	/* peers must not ring CPUs that are handed back to Linux */
+	shmem_cell_exit(cell);
 
+	/* the CPUs are resumed as part of Linux */
+	stats_begin_update();
+	for_each_cpu(cpu, cell->cpu_set) {
 		set_bit(cpu, linux_cell.cpu_set->bitmap);
 		per_cpu(cpu)->cell = &linux_cell;
+		per_cpu(cpu)->stats->cell_id = linux_cell.id;
 	}
+	stats_update_cell(&linux_cell, JAILHOUSE_CELL_STATE_RUNNING);
+	stats_update_cell(cell, JAILHOUSE_CELL_STATE_NONE);
+	stats_end_update();
 
-	mem = jailhouse_cell_mem_regions(cell->config);
-	for (n = 0; n < cell->config->num_memory_regions; n++, mem++) {
-		arch_unmap_memory_region(cell, mem);
-		remap_to_linux(mem);
-	}
+	page_pool_defer_frees();
+
+	cell_return_memory(cell);
 
 	arch_cell_destroy(cpu_data, cell);
+	mmio_cell_exit(cell);
 
-	previous = &linux_cell;
-	while (previous->next != cell)
-		previous = previous->next;
-	previous->next = cell->next;
+	arch_config_commit(cpu_data, NULL);
+	page_pool_release_deferred();
 
+	cell_sample_mem_usage(&linux_cell, &mem_info);
+
+	cell_unregister(cell);
+
+	cell_exit(cell);
 	page_free(&mem_pool, cell, cell->data_pages);
 	page_map_dump_stats("after cell destruction");
 
 resume_out:
 	cell_resume(cpu_data);
+	clear_bit(0, &cell_reconfiguring);
+
+	return err;
+}
+
+static bool linux_ram_accessible(unsigned long addr, unsigned long size,
+				 unsigned long access_flags)
+{
+	const struct jailhouse_memory *mem =
+		jailhouse_cell_mem_regions(linux_cell.config);
+	unsigned int n;
+
+	for (n = 0; n < linux_cell.config->num_memory_regions; n++, mem++)
+		if ((mem->access_flags & access_flags) == access_flags &&
+		    address_in_region(addr, mem) &&
+		    address_in_region(addr + size - 1, mem))
+			return true;
+	return false;
+}
+
+/* The first two foreign pages are left for mapping request arguments. */
+static int copy_to_linux(struct per_cpu *cpu_data, unsigned long address,
+			 const void *src, unsigned long size)
+{
+	unsigned long mapping_addr = FOREIGN_MAPPING_BASE +
+		(cpu_data->cpu_id * NUM_FOREIGN_PAGES + 2) * PAGE_SIZE;
+	unsigned long map_size = (address & ~PAGE_MASK) + size;
+	int err;
+
+	if (map_size > (NUM_FOREIGN_PAGES - 2) * PAGE_SIZE ||
+	    !linux_ram_accessible(address, size, JAILHOUSE_MEM_WRITE))
+		return -EINVAL;
+
+	err = page_map_create(hv_page_table, address & PAGE_MASK, map_size,
+			      mapping_addr, PAGE_DEFAULT_FLAGS,
+			      PAGE_DEFAULT_FLAGS, PAGE_DIR_LEVELS,
+			      PAGE_MAP_NO_HUGE, PAGE_MAP_NON_COHERENT);
+	if (err)
+		return err;
+
+	memcpy((void *)(mapping_addr + (address & ~PAGE_MASK)), src, size);
+
+	return 0;
+}
+
+/* pages of the image list read at once */
+#define IMAGE_PAGE_BATCH	32
+
+/*
+ * Linux passes the image page by page, so it needs no physically contiguous
+ * buffer. The list is read in batches via copy_from_linux, each page is
+ * copied through the foreign pages behind those of the arguments.
+ */
+static int cell_load_image(struct per_cpu *cpu_data, struct cell *cell,
+			   const struct jailhouse_cell_image *image)
+{
+	unsigned long source_mapping = FOREIGN_MAPPING_BASE +
+		(cpu_data->cpu_id * NUM_FOREIGN_PAGES + 2) * PAGE_SIZE;
+	unsigned long target_mapping = source_mapping + PAGE_SIZE;
+	const struct jailhouse_memory *ram =
+		jailhouse_cell_mem_regions(cell->config);
+	unsigned long list = image->page_list_address;
+	unsigned long size = image->size;
+	unsigned long num_pages, n, batch, target, chunk;
+	u64 pages[IMAGE_PAGE_BATCH], source;
+	int err;
+
+	num_pages = (size + PAGE_SIZE - 1) / PAGE_SIZE;
+	if (size == 0 || image->target_address >= ram->size ||
+	    size > ram->size - image->target_address ||
+	    !linux_ram_accessible(list, num_pages * sizeof(u64),
+				  JAILHOUSE_MEM_READ))
+		return -EINVAL;
+
+	target = ram->phys_start + image->target_address;
+
+	for (n = 0; n < num_pages; n++) {
+		if (n % IMAGE_PAGE_BATCH == 0) {
+			batch = num_pages - n;
+			if (batch > IMAGE_PAGE_BATCH)
+				batch = IMAGE_PAGE_BATCH;
+			err = copy_from_linux(cpu_data, pages,
+					      list + n * sizeof(u64),
+					      batch * sizeof(u64));
+			if (err)
+				return err;
+		}
+
+		source = pages[n % IMAGE_PAGE_BATCH];
+		if ((source & ~PAGE_MASK) ||
+		    !linux_ram_accessible(source, PAGE_SIZE,
+					  JAILHOUSE_MEM_READ))
+			return -EINVAL;
+
+		chunk = size > PAGE_SIZE ? PAGE_SIZE : size;
+
+		err = page_map_create(hv_page_table, source, PAGE_SIZE,
+				      source_mapping, PAGE_READONLY_FLAGS,
+				      PAGE_DEFAULT_FLAGS, PAGE_DIR_LEVELS,
+				      PAGE_MAP_NO_HUGE, PAGE_MAP_NON_COHERENT);
+		if (err)
+			return err;
+
+		err = page_map_create(hv_page_table, target & PAGE_MASK,
+				      (target & ~PAGE_MASK) + chunk,
+				      target_mapping, PAGE_DEFAULT_FLAGS,
+				      PAGE_DEFAULT_FLAGS, PAGE_DIR_LEVELS,
+				      PAGE_MAP_NO_HUGE, PAGE_MAP_NON_COHERENT);
+		if (err)
+			return err;
+
+		memcpy((void *)(target_mapping + (target & ~PAGE_MASK)),
+		       (void *)source_mapping, chunk);
+
+		target += chunk;
+		size -= chunk;
+	}
+
+	return 0;
+}
+
+/*
+ * Restarts a cell in place: page tables, devices and interrupt remappings
+ * are kept, only the CPUs are parked and reset. If image_address is
+ * non-zero, the referenced jailhouse_cell_image is loaded in between.
+ */
+int cell_restart(struct per_cpu *cpu_data, unsigned long name_address,
+		 unsigned long image_address)
+{
+	unsigned long mapping_addr = FOREIGN_MAPPING_BASE +
+		cpu_data->cpu_id * PAGE_SIZE * NUM_FOREIGN_PAGES;
+	struct jailhouse_cell_image image;
+	unsigned long name_size;
+	struct cell *cell;
+	int err;
+
+	if (cpu_data->cell != &linux_cell)
+		return -EPERM;
+
+	if (test_and_set_bit(0, &cell_reconfiguring))
+		return -EBUSY;
+
+	name_size = (name_address & ~PAGE_MASK) + JAILHOUSE_CELL_NAME_MAXLEN;
+
+	err = page_map_create(hv_page_table, name_address & PAGE_MASK,
+			      name_size, mapping_addr, PAGE_READONLY_FLAGS,
+			      PAGE_DEFAULT_FLAGS, PAGE_DIR_LEVELS,
+			      PAGE_MAP_NO_HUGE, PAGE_MAP_NON_COHERENT);
+	if (err)
+		goto out;
+
+	cell = cell_find((const char *)(mapping_addr +
+					(name_address & ~PAGE_MASK)));
+	if (!cell) {
+		err = -ENOENT;
+		goto out;
+	}
+
+	/* Linux cell cannot be restarted */
+	if (cell == &linux_cell) {
+		err = -EINVAL;
+		goto out;
+	}
+
+	if (image_address) {
+		err = page_map_create(hv_page_table, image_address & PAGE_MASK,
+				      (image_address & ~PAGE_MASK) +
+				      sizeof(image), mapping_addr,
+				      PAGE_READONLY_FLAGS, PAGE_DEFAULT_FLAGS,
+				      PAGE_DIR_LEVELS, PAGE_MAP_NO_HUGE,
+				      PAGE_MAP_NON_COHERENT);
+		if (err)
+			goto out;
+
+		memcpy(&image,
+		       (void *)(mapping_addr + (image_address & ~PAGE_MASK)),
+		       sizeof(image));
+	}
+
+	/* Linux keeps running, only the restarted cell is stopped */
+	cell_suspend(cell, cpu_data);
+
+	printk("Restarting cell \"%s\"\n", cell->config->name);
+	trace_event(JAILHOUSE_TRACE_CELL_RESTART, cell->id);
+
+	arch_park_cpus(cell->cpu_set, cpu_data->cpu_id);
+
+	if (image_address) {
+		err = cell_load_image(cpu_data, cell, &image);
+		if (err) {
+			/* leave the cell parked, it has no valid image */
+			stats_begin_update();
+			stats_update_cell(cell, JAILHOUSE_CELL_STATE_PARKED);
+			stats_end_update();
+			arch_resume_cpus(cell->cpu_set, cpu_data->cpu_id);
+			goto out;
+		}
+	}
+
+	stats_begin_update();
+	stats_update_cell(cell, JAILHOUSE_CELL_STATE_RUNNING);
+	stats_end_update();
+
+	arch_reset_cpus(cell->cpu_set, cpu_data->cpu_id);
+
+out:
+	clear_bit(0, &cell_reconfiguring);
+
+	return err;
+}
+
+int cell_get_mem_info(struct per_cpu *cpu_data, unsigned long name_address,
+		      unsigned long info_address)
+{
+	unsigned long mapping_addr = FOREIGN_MAPPING_BASE +
+		cpu_data->cpu_id * PAGE_SIZE * NUM_FOREIGN_PAGES;
+	char name[JAILHOUSE_CELL_NAME_MAXLEN + 1];
+	struct jailhouse_mem_info info;
+	unsigned long name_size;
+	struct cell *cell;
+	int err;
+
+	if (cpu_data->cell != &linux_cell)
+		return -EPERM;
+
+	name_size = (name_address & ~PAGE_MASK) + JAILHOUSE_CELL_NAME_MAXLEN;
+
+	err = page_map_create(hv_page_table, name_address & PAGE_MASK,
+			      name_size, mapping_addr, PAGE_READONLY_FLAGS,
+			      PAGE_DEFAULT_FLAGS, PAGE_DIR_LEVELS,
+			      PAGE_MAP_NO_HUGE, PAGE_MAP_NON_COHERENT);
+	if (err)
+		return err;
+
+	memcpy(name, (const char *)(mapping_addr + (name_address & ~PAGE_MASK)),
+	       JAILHOUSE_CELL_NAME_MAXLEN);
+	name[JAILHOUSE_CELL_NAME_MAXLEN] = 0;
+
+	cell = cell_find(name);
+	if (!cell)
+		return -ENOENT;
+
+	cell_sample_mem_usage(cell, &info);
+
+	info.mem_pool_pages = mem_pool.pages;
+	info.mem_pool_used = mem_pool.used_pages;
+	info.mem_pool_peak = mem_pool.peak_used_pages;
+	info.remap_pool_pages = remap_pool.pages;
+	info.remap_pool_used = remap_pool.used_pages;
+	info.remap_pool_peak = remap_pool.peak_used_pages;
+
+	info.cell_data = cell->data_pages;
+	info.cpu_set = cell->cpu_set == &cell->small_cpu_set ? 0 : 1;
+	info.page_tables_peak = cell->page_tables_peak;
+	info.dma_page_tables_peak = cell->dma_page_tables_peak;
+
+	return copy_to_linux(cpu_data, info_address, &info, sizeof(info));
+}
+
+int cell_get_working_set(struct per_cpu *cpu_data, unsigned long name_address,
+			 unsigned long ws_address)
+{
+	char name[JAILHOUSE_CELL_NAME_MAXLEN + 1];
+	struct jailhouse_working_set ws;
+	struct cell *cell;
+	bool clear;
+	int err;
+
+	if (cpu_data->cell != &linux_cell)
+		return -EPERM;
+
+	err = copy_from_linux(cpu_data, name, name_address,
+			      JAILHOUSE_CELL_NAME_MAXLEN);
+	if (err)
+		return err;
+	name[JAILHOUSE_CELL_NAME_MAXLEN] = 0;
+
+	err = copy_from_linux(cpu_data, &ws, ws_address, sizeof(ws));
+	if (err)
+		return err;
+	if (ws.flags & ~JAILHOUSE_WS_VALID_FLAGS)
+		return -EINVAL;
+	/* the walk must neither wrap nor alias beyond the table range */
+	if (ws.size != 0 && (ws.start >= GUEST_PHYS_ADDR_LIMIT ||
+			     ws.size > GUEST_PHYS_ADDR_LIMIT - ws.start))
+		return -EINVAL;
+	clear = ws.flags & JAILHOUSE_WS_CLEAR;
+
+	/* keeps the cell from being destroyed during the scan */
+	if (test_and_set_bit(0, &cell_reconfiguring))
+		return -EBUSY;
+
+	cell = cell_find(name);
+	if (!cell) {
+		err = -ENOENT;
+		goto out;
+	}
+
+	/* clearing requires to flush the cached translations of all CPUs */
+	if (clear)
+		arch_suspend_cpus(cell->cpu_set, cpu_data->cpu_id);
+	err = arch_cell_scan_working_set(cpu_data, cell, &ws);
+	if (clear)
+		arch_resume_cpus(cell->cpu_set, cpu_data->cpu_id);
+
+	if (!err)
+		err = copy_to_linux(cpu_data, ws_address, &ws, sizeof(ws));
+
+out:
+	clear_bit(0, &cell_reconfiguring);
+
+	return err;
+}
+
+/* interrupts of a cell only go to CPUs named in its configuration */
+static bool cell_cpu_is_irq_target(struct cell *cell, unsigned int cpu_id)
+{
+	const struct jailhouse_irq_remap *remap =
+		jailhouse_cell_irq_remaps(cell->config);
+	const struct jailhouse_shmem *shmem =
+		jailhouse_cell_shmem(cell->config);
+	unsigned int n;
+
+	for (n = 0; n < cell->config->num_irq_remaps; n++)
+		if (remap[n].cpu == cpu_id)
+			return true;
+	for (n = 0; n < cell->config->num_shmem; n++)
+		if (shmem[n].vector != 0 && shmem[n].cpu == cpu_id)
+			return true;
+	return false;
+}
+
+/*
+ * Moves a CPU between Linux and another cell while both keep running. Only
+ * CPUs of the cell's configuration can be assigned, so page tables stay on
+ * the node chosen at creation and every CPU can be returned on destruction.
+ * The CPU is parked and waits for INIT/SIPI from its new owner, just like
+ * the secondary CPUs of a freshly created cell.
+ */
+static int cell_move_cpu(struct per_cpu *cpu_data, unsigned long name_address,
+			 unsigned long cpu_id, bool add)
+{
+	const unsigned long *config_cpu_set;
+	char name[JAILHOUSE_CELL_NAME_MAXLEN + 1];
+	struct cell *cell, *from, *to;
+	int err;
+
+	if (cpu_data->cell != &linux_cell)
+		return -EPERM;
+
+	err = copy_from_linux(cpu_data, name, name_address,
+			      JAILHOUSE_CELL_NAME_MAXLEN);
+	if (err)
+		return err;
+	name[JAILHOUSE_CELL_NAME_MAXLEN] = 0;
+
+	if (test_and_set_bit(0, &cell_reconfiguring))
+		return -EBUSY;
+
+	cell = cell_find(name);
+	if (!cell) {
+		err = -ENOENT;
+		goto out;
+	}
+
+	config_cpu_set = jailhouse_cell_cpu_set(cell->config);
+	from = add ? &linux_cell : cell;
+	to = add ? cell : &linux_cell;
+
+	if (cell == &linux_cell || cpu_id == cpu_data->cpu_id ||
+	    cpu_id >= cell->config->cpu_set_size * 8 ||
+	    !test_bit(cpu_id, config_cpu_set) ||
+	    cpu_id > from->cpu_set->max_cpu_id ||
+	    !test_bit(cpu_id, from->cpu_set->bitmap)) {
+		err = -EINVAL;
+		goto out;
+	}
+
+	/* the cell keeps at least one CPU and all its interrupt targets */
+	if ((!add && next_cpu(-1, cell->cpu_set, cpu_id) >
+		     cell->cpu_set->max_cpu_id) ||
+	    cell_cpu_is_irq_target(from, cpu_id)) {
+		err = -EBUSY;
+		goto out;
+	}
+
+	cell_suspend(&linux_cell, cpu_data);
+	cell_suspend(cell, cpu_data);
+
+	arch_park_cpu(cpu_id);
+
+	stats_begin_update();
+	clear_bit(cpu_id, from->cpu_set->bitmap);
+	set_bit(cpu_id, to->cpu_set->bitmap);
+	per_cpu(cpu_id)->cell = to;
+	per_cpu(cpu_id)->stats->cell_id = to->id;
+	stats_update_cell_cpus(from);
+	stats_update_cell_cpus(to);
+	stats_end_update();
+
+	arch_cell_cpus_changed(from);
+	arch_cell_cpus_changed(to);
+
+	printk("Moved CPU %d to cell \"%s\"\n", cpu_id, to->config->name);
+	trace_event(JAILHOUSE_TRACE_CPU_MOVE, cpu_id << 16 | to->id);
+
+	arch_resume_cpus(cell->cpu_set, cpu_data->cpu_id);
+	cell_resume(cpu_data);
+
+out:
+	clear_bit(0, &cell_reconfiguring);
+
+	return err;
+}
+
+/* Linux has to offline the CPU before */
+int cell_add_cpu(struct per_cpu *cpu_data, unsigned long name_address,
+		 unsigned long cpu_id)
+{
+	return cell_move_cpu(cpu_data, name_address, cpu_id, true);
+}
+
+/* Linux can online the CPU afterwards */
+int cell_remove_cpu(struct per_cpu *cpu_data, unsigned long name_address,
+		    unsigned long cpu_id)
+{
+	return cell_move_cpu(cpu_data, name_address, cpu_id, false);
+}
+
+/*
+ * The statistics area is mapped read-only into Linux at its physical
+ * address, so monitors can sample it and the cell status without issuing
+ * hypercalls.
+ */
+int stats_init(void)
+{
+	unsigned int num_cpus = hypervisor_header.possible_cpus;
+	unsigned long size = PAGE_ALIGN(jailhouse_stats_size(num_cpus));
+	struct jailhouse_memory mem;
+	int err;
+
+	stats_area = page_alloc(&mem_pool, size / PAGE_SIZE);
+	if (!stats_area)
+		return -ENOMEM;
+
+	memset(stats_area, 0, size);
+	stats_area->version = JAILHOUSE_STATS_VERSION;
+	stats_area->num_cpus = num_cpus;
+	stats_area->max_cells = JAILHOUSE_MAX_CELLS;
+
+	mem.phys_start = page_map_hvirt2phys(stats_area);
+	mem.virt_start = mem.phys_start;
+	mem.size = size;
+	mem.access_flags = JAILHOUSE_MEM_READ;
+	err = arch_map_memory_region(&linux_cell, &mem);
+	if (err)
+		return err;
+
+	page_pool_publish_stats(&mem_pool, &stats_area->mem_pool);
+	page_pool_publish_stats(&remap_pool, &stats_area->remap_pool);
+
+	return 0;
+}
+
+struct jailhouse_cpu_stats *cpu_stats(unsigned int cpu_id)
+{
+	return &stats_area->cpu[cpu_id];
+}
+
+/* returns the page frame number of the statistics area */
+int stats_get_area(struct per_cpu *cpu_data)
+{
+	if (cpu_data->cell != &linux_cell)
+		return -EPERM;
+
+	return page_map_hvirt2phys(stats_area) / PAGE_SIZE;
+}
+
+int cpu_get_stats(struct per_cpu *cpu_data, unsigned long cpu_id,
+		  unsigned long stats_address)
+{
+	if (cpu_data->cell != &linux_cell)
+		return -EPERM;
+
+	if (cpu_id >= hypervisor_header.possible_cpus)
+		return -EINVAL;
+
+	/* the target CPU may update its counters while we copy them */
+	return copy_to_linux(cpu_data, stats_address, cpu_stats(cpu_id),
+			     sizeof(struct jailhouse_cpu_stats));
+}
+
+/*
+ * The target CPU logs without synchronizing with us, so bytes that it may
+ * have overwritten during the copy are dropped from the returned range.
+ */
+/* copies bytes [start, end) of a ring buffer of size bytes to Linux */
+static int copy_ring_to_linux(struct per_cpu *cpu_data, unsigned long address,
+			      const void *ring, unsigned long size,
+			      unsigned long start, unsigned long end)
+{
+	unsigned long offset, len;
+	int err;
+
+	for (; start < end; start += len) {
+		offset = start % size;
+		len = end - start;
+		if (len > size - offset)
+			len = size - offset;
+		err = copy_to_linux(cpu_data, address + offset,
+				    (const u8 *)ring + offset, len);
+		if (err)
+			return err;
+	}
+	return 0;
+}
+
+int cpu_get_log(struct per_cpu *cpu_data, unsigned long cpu_id,
+		unsigned long log_address)
+{
+	unsigned long data_address =
+		log_address + sizeof(struct jailhouse_log_position);
+	struct jailhouse_log_position pos;
+	unsigned long start, end, head, tail;
+	const char *data;
+	int err;
+
+	if (cpu_data->cell != &linux_cell)
+		return -EPERM;
+
+	if (cpu_id >= hypervisor_header.possible_cpus)
+		return -EINVAL;
+
+	err = copy_from_linux(cpu_data, &pos, log_address, sizeof(pos));
+	if (err)
+		return err;
+
+	data = printk_log_data(cpu_id, &end, &tail);
+	if (!data)
+		return -ENOSYS;
+
+	start = pos.start;
+	if (start > end || tail - start > JAILHOUSE_LOG_SIZE)
+		start = tail > JAILHOUSE_LOG_SIZE ?
+			tail - JAILHOUSE_LOG_SIZE : 0;
+	if (start > end)
+		start = end;
+
+	err = copy_ring_to_linux(cpu_data, data_address, data,
+				 JAILHOUSE_LOG_SIZE, start, end);
+	if (err)
+		return err;
+
+	/* the owner may have reserved and overwritten bytes beyond end */
+	printk_log_data(cpu_id, &head, &tail);
+	if (tail - start > JAILHOUSE_LOG_SIZE)
+		start = tail - JAILHOUSE_LOG_SIZE;
+	if (start > end)
+		start = end;
+
+	pos.start = start;
+	pos.end = end;
+	return copy_to_linux(cpu_data, log_address, &pos, sizeof(pos));
+}
+
+int cpu_get_trace(struct per_cpu *cpu_data, unsigned long cpu_id,
+		  unsigned long trace_address)
+{
+	const unsigned long event_size = sizeof(struct jailhouse_trace_event);
+	const struct jailhouse_trace_event *events;
+	struct jailhouse_log_position pos;
+	unsigned long start, end, head;
+	int err;
+
+	if (cpu_data->cell != &linux_cell)
+		return -EPERM;
+
+	if (cpu_id >= hypervisor_header.possible_cpus)
+		return -EINVAL;
+
+	err = copy_from_linux(cpu_data, &pos, trace_address, sizeof(pos));
+	if (err)
+		return err;
+
+	/* nothing recorded while tracing was never enabled */
+	events = trace_data(cpu_id, &end);
+	if (!events) {
+		pos.start = pos.end = 0;
+		return copy_to_linux(cpu_data, trace_address, &pos,
+				     sizeof(pos));
+	}
+
+	start = pos.start;
+	if (start > end || end - start > JAILHOUSE_TRACE_EVENTS)
+		start = end > JAILHOUSE_TRACE_EVENTS ?
+			end - JAILHOUSE_TRACE_EVENTS : 0;
+
+	err = copy_ring_to_linux(cpu_data, trace_address + sizeof(pos),
+				 events, JAILHOUSE_TRACE_EVENTS * event_size,
+				 start * event_size, end * event_size);
+	if (err)
+		return err;
+
+	/* the slot at head may be under rewrite as well */
+	trace_data(cpu_id, &head);
+	if (head - start >= JAILHOUSE_TRACE_EVENTS)
+		start = head - JAILHOUSE_TRACE_EVENTS + 1;
+	if (start > end)
+		start = end;
+
+	pos.start = start;
+	pos.end = end;
+	return copy_to_linux(cpu_data, trace_address, &pos, sizeof(pos));
+}
+
+int trace_set_events(struct per_cpu *cpu_data, unsigned long mask)
+{
+	if (cpu_data->cell != &linux_cell)
+		return -EPERM;
+
+	if (mask & ~JAILHOUSE_TRACE_ALL)
+		return -EINVAL;
+
+	return trace_set_mask(mask);
+}
+
+int dma_get_faults(struct per_cpu *cpu_data, unsigned long unit,
+		   unsigned long faults_address)
+{
+	const struct jailhouse_dma_faults *faults;
+	u32 seq;
+	int err;
+
+	if (cpu_data->cell != &linux_cell)
+		return -EPERM;
+
+	faults = arch_get_dma_faults(unit);
+	if (!faults)
+		return -EINVAL;
+
+	/* other CPUs may record new faults while we copy them */
+	do {
+		seq = faults->seq;
+		memory_barrier();
+		err = copy_to_linux(cpu_data, faults_address, faults,
+				    sizeof(struct jailhouse_dma_faults));
+		memory_barrier();
+	} while (!err && ((seq & 1) || faults->seq != seq));
 
 	return err;
 }
@@ -377,9 +1362,9 @@ resume_out:
 int shutdown(struct per_cpu *cpu_data)
 {
 	static bool shutdown_started;
-	struct cell *cell = linux_cell.next;
 	unsigned int this_cpu = cpu_data->cpu_id;
-	unsigned int cpu;
+	unsigned int cpu, id;
+	struct cell *cell;
 
 	// TODO: access control
 
@@ -394,21 +1379,31 @@ int shutdown(struct per_cpu *cpu_data)
 
 		printk("Shutting down hypervisor\n");
 
-		while (cell) {
+		for (id = 0; id < MAX_CELLS; id++) {
+			cell = cell_table[id];
+			if (!cell || cell == &linux_cell)
+				continue;
+
 			printk(" Closing cell \"%s\"\n", cell->config->name);
 
 			for_each_cpu(cpu, cell->cpu_set) {
 				printk("  Releasing CPU %d\n", cpu);
 				arch_shutdown_cpu(cpu);
 			}
-			cell = cell->next;
 		}
 
+#ifdef CONFIG_SPINLOCK_STATS
+		printk_lock_print_stats();
+		spin_lock_print_stats("mem_pool", &mem_pool.lock);
+		spin_lock_print_stats("remap_pool", &remap_pool.lock);
+#endif
+
 		printk(" Closing Linux cell \"%s\"\n",
 		       linux_cell.config->name);
 		arch_shutdown();
 	}
 	printk("  Releasing CPU %d\n", this_cpu);
+	printk_flush();
 
 	spin_unlock(&shutdown_lock);
 
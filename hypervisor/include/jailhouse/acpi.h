@@ -24,5 +24,6 @@ struct acpi_table_header {
 	u32 asl_compiler_revision;
 };
 
+void acpi_init(void);
 const struct acpi_table_header *
 acpi_find_table(char name[4], const struct acpi_table_header *start);
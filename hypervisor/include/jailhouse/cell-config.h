@@ -24,10 +24,31 @@ struct jailhouse_cell_desc {
 	__u32 pio_bitmap_size;
 
 	__u32 num_pci_devices;
+	__u32 num_cpuid_overrides;
+	__u32 num_msr_ranges;
+	__u32 num_irq_remaps;
 
-	__u32 padding[3];
+	__u32 flags;
+	/* pause-loop exiting, disabled if ple_window is 0 */
+	__u32 ple_gap;
+	__u32 ple_window;
+	__u32 num_shmem;
+
+	/* L3 cache ways (contiguous), all ways if 0 */
+	__u32 cache_mask;
+	/* memory bandwidth throttling, 0 for none */
+	__u32 mba_delay;
+
+	/* guest-physical address of the time page, not mapped if 0 */
+	__u64 time_page_address;
 };
 
+#define JAILHOUSE_CELL_HLT_EXITING	0x0001
+#define JAILHOUSE_CELL_MWAIT_EXITING	0x0002
+
+#define JAILHOUSE_CELL_VALID_FLAGS	(JAILHOUSE_CELL_HLT_EXITING | \
+					 JAILHOUSE_CELL_MWAIT_EXITING)
+
 #define JAILHOUSE_MEM_READ		0x0001
 #define JAILHOUSE_MEM_WRITE		0x0002
 #define JAILHOUSE_MEM_EXECUTE		0x0004
@@ -60,12 +81,340 @@ struct jailhouse_pci_device {
 	__u8 devfn;
 } __attribute__((packed));
 
+#define JAILHOUSE_CPUID_INDEX_ANY	0xffffffff
+
+/* reported value per register (eax..edx): (native & ~clear) | set */
+struct jailhouse_cpuid_override {
+	__u32 function;
+	__u32 index;
+	__u32 clear[4];
+	__u32 set[4];
+};
+
+#define JAILHOUSE_MSR_READ		0x0001
+#define JAILHOUSE_MSR_WRITE		0x0002
+
+/* MSRs base..base+count-1 are accessed without interception */
+struct jailhouse_msr_range {
+	__u32 base;
+	__u32 count;
+	__u32 flags;
+	__u32 padding;
+};
+
+#define JAILHOUSE_IRQ_LEVEL		0x01
+
+/*
+ * MSIs the device source_id (bus << 8 | devfn) sends in remappable format
+ * with the given handle are delivered with vector to the cell CPU.
+ */
+struct jailhouse_irq_remap {
+	__u16 handle;
+	__u16 source_id;
+	__u16 cpu;
+	__u8 vector;
+	__u8 flags;
+};
+
+/*
+ * Endpoint of an inter-cell shared memory channel, peers use the same id.
+ * Writing the doorbell register makes all peers receive their vector on
+ * their notification cpu. Endpoints with vector 0 are not notified, their
+ * cell has to poll.
+ */
+#define JAILHOUSE_SHMEM_DOORBELL	0x0
+
+struct jailhouse_shmem {
+	__u64 phys_start;
+	__u64 virt_start;
+	__u64 size;
+	/* guest-physical, must not overlap memory regions of the cell */
+	__u64 doorbell_address;
+	__u32 id;
+	/* JAILHOUSE_MEM_READ and/or JAILHOUSE_MEM_WRITE */
+	__u32 flags;
+	__u32 cpu;
+	__u8 vector;
+	__u8 padding[3];
+};
+
+#define JAILHOUSE_MAX_NUMA_NODES	4
+
+/*
+ * Additional hypervisor memory, unused if size is 0. It holds the VMX
+ * regions of the node's CPUs and the page tables of cells that only run on
+ * them. Linux has to leave it alone like the hypervisor memory.
+ */
+struct jailhouse_numa_node {
+	__u64 phys_start;
+	__u64 size;
+	/* bit n set for CPU n */
+	__u64 cpus;
+};
+
 struct jailhouse_system {
 	struct jailhouse_memory hypervisor_memory;
 	struct jailhouse_memory config_memory;
+	struct jailhouse_numa_node numa_nodes[JAILHOUSE_MAX_NUMA_NODES];
 	struct jailhouse_cell_desc system;
 };
 
+/* image reloaded on cell restart, copied from Linux RAM by the hypervisor */
+struct jailhouse_cell_image {
+	/* physical address of a contiguous Linux array of __u64 page
+	 * addresses, only the last image page may be partially used */
+	__u64 page_list_address;
+	__u64 size;
+	/* offset into the first memory region of the cell */
+	__u64 target_address;
+};
+
+/* memory usage report, all values in pages */
+struct jailhouse_mem_info {
+	/* hypervisor-wide */
+	__u32 mem_pool_pages;
+	__u32 mem_pool_used;
+	__u32 mem_pool_peak;
+	__u32 remap_pool_pages;
+	__u32 remap_pool_used;
+	__u32 remap_pool_peak;
+	__u32 dma_context_tables;
+
+	/* queried cell */
+	__u32 cell_data;
+	__u32 cpu_set;
+	__u32 page_tables;
+	__u32 page_tables_peak;
+	__u32 dma_page_tables;
+	__u32 dma_page_tables_peak;
+
+	__u32 padding[3];
+};
+
+#define JAILHOUSE_WS_CLEAR		0x0001
+
+#define JAILHOUSE_WS_VALID_FLAGS	JAILHOUSE_WS_CLEAR
+
+/*
+ * Working set of a cell according to the accessed and dirty bits of its
+ * second-level page table, in bytes of guest-physical memory. Accesses are
+ * tracked per leaf mapping, i.e. possibly per huge page. A size of 0 scans
+ * all memory regions of the cell. JAILHOUSE_WS_CLEAR resets the bits after
+ * reading them, starting a new sampling interval.
+ */
+struct jailhouse_working_set {
+	/* input */
+	__u64 start;
+	__u64 size;
+	__u32 flags;
+	__u32 padding;
+
+	/* output */
+	__u64 mapped;
+	__u64 accessed;
+	__u64 dirty;
+};
+
+#define JAILHOUSE_TIME_PAGE_MAGIC	0x656d6954	/* "Time" */
+
+/*
+ * Time page, mapped read-only into cells with a time_page_address. The magic
+ * is only set if the hypervisor could calibrate the TSC. Then
+ * ns = (tsc * tsc_to_ns_mult) >> tsc_to_ns_shift, computed with a 128-bit
+ * product. Readers retry while seq is odd or changes during the read.
+ */
+struct jailhouse_time_page {
+	__u32 magic;
+	volatile __u32 seq;
+	__u64 tsc_khz;
+	__u32 tsc_to_ns_mult;
+	__u32 tsc_to_ns_shift;
+};
+
+/* VM exit statistics, collected per CPU */
+#define JAILHOUSE_EXIT_STAT_MANAGEMENT		0
+#define JAILHOUSE_EXIT_STAT_CPUID		1
+#define JAILHOUSE_EXIT_STAT_CR			2
+#define JAILHOUSE_EXIT_STAT_MSR_READ		3
+#define JAILHOUSE_EXIT_STAT_MSR_WRITE		4
+#define JAILHOUSE_EXIT_STAT_MSR_WRITE_ICR	5
+#define JAILHOUSE_EXIT_STAT_APIC_ACCESS		6
+#define JAILHOUSE_EXIT_STAT_XSETBV		7
+#define JAILHOUSE_EXIT_STAT_VMCALL		8
+#define JAILHOUSE_EXIT_STAT_HLT			9
+#define JAILHOUSE_EXIT_STAT_MWAIT		10
+#define JAILHOUSE_EXIT_STAT_PAUSE		11
+#define JAILHOUSE_EXIT_STAT_MMIO		12
+#define JAILHOUSE_EXIT_STAT_PREEMPTION_TIMER	13
+#define JAILHOUSE_NUM_EXIT_STATS		14
+
+struct jailhouse_exit_stat {
+	__u64 count;
+	/* TSC cycles spent in the hypervisor handling the exits */
+	__u64 cycles;
+	__u64 max_cycles;
+};
+
+struct jailhouse_cpu_stats {
+	struct jailhouse_exit_stat exit[JAILHOUSE_NUM_EXIT_STATS];
+	/* IPIs forwarded on behalf of the guest */
+	__u64 ipis;
+	/* interrupts sent by the hypervisor, i.e. doorbells */
+	__u64 interrupts;
+	/*
+	 * TSC cycles in the guest, in the hypervisor and suspended, i.e.
+	 * stopped for reconfigurations or parked while waiting for SIPI
+	 */
+	__u64 guest_cycles;
+	__u64 hypervisor_cycles;
+	__u64 suspended_cycles;
+	/* cell owning the CPU */
+	__u32 cell_id;
+	__u32 padding;
+} __attribute__((aligned(64)));
+
+/* hypervisor page pool usage, in pages */
+struct jailhouse_pool_stats {
+	__u32 pages;
+	__u32 used;
+	__u32 peak;
+	__u32 padding;
+};
+
+#define JAILHOUSE_MAX_CELLS		256
+
+#define JAILHOUSE_CELL_STATE_NONE	0	/* unused cell ID */
+#define JAILHOUSE_CELL_STATE_RUNNING	1
+#define JAILHOUSE_CELL_STATE_PARKED	2	/* failed restart */
+
+struct jailhouse_cell_status {
+	char name[JAILHOUSE_CELL_NAME_MAXLEN+1];
+	__u32 state;
+	__u32 num_cpus;
+	__u32 padding[2];
+};
+
+#define JAILHOUSE_STATS_VERSION		3
+
+/*
+ * Statistics and status area, mapped read-only into the root cell. The
+ * cells, indexed by ID, follow the CPUs, see jailhouse_stats_cells. They
+ * and the cell_id of the CPUs only change under the seqlock, i.e. readers
+ * retry while seq is odd or changes during the read. Counters are updated
+ * in place without synchronization, so they are sampled individually.
+ */
+struct jailhouse_stats {
+	__u32 version;
+	__u32 num_cpus;
+	volatile __u32 seq;
+	__u32 max_cells;
+	struct jailhouse_pool_stats mem_pool;
+	struct jailhouse_pool_stats remap_pool;
+	struct jailhouse_cpu_stats cpu[];
+};
+
+static inline unsigned long
+jailhouse_stats_size(unsigned int num_cpus)
+{
+	return sizeof(struct jailhouse_stats) +
+		num_cpus * sizeof(struct jailhouse_cpu_stats) +
+		JAILHOUSE_MAX_CELLS * sizeof(struct jailhouse_cell_status);
+}
+
+static inline struct jailhouse_cell_status *
+jailhouse_stats_cells(const struct jailhouse_stats *stats)
+{
+	return (struct jailhouse_cell_status *)&stats->cpu[stats->num_cpus];
+}
+
+/* hypervisor log, kept per CPU in a ring of JAILHOUSE_LOG_SIZE bytes */
+#define JAILHOUSE_LOG_SIZE			8192
+
+struct jailhouse_log_position {
+	/* in: first byte requested, out: first byte returned */
+	__u64 start;
+	/* out: bytes logged so far */
+	__u64 end;
+};
+
+/* byte at position pos is stored in data[pos % JAILHOUSE_LOG_SIZE] */
+struct jailhouse_cpu_log {
+	struct jailhouse_log_position pos;
+	char data[JAILHOUSE_LOG_SIZE];
+};
+
+/*
+ * hypervisor trace, kept per CPU in a ring of JAILHOUSE_TRACE_EVENTS
+ * records, the meaning of arg depends on the event type
+ */
+#define JAILHOUSE_TRACE_EVENTS			2048
+
+#define JAILHOUSE_TRACE_VMEXIT			0	/* exit reason */
+#define JAILHOUSE_TRACE_VMENTRY			1	/* exit stat index */
+#define JAILHOUSE_TRACE_IPI			2	/* CPU << 16 | ICR lo */
+#define JAILHOUSE_TRACE_SUSPEND_CPU		3	/* CPU */
+#define JAILHOUSE_TRACE_RESUME_CPU		4	/* CPU */
+#define JAILHOUSE_TRACE_INVEPT			5	/* cell ID */
+#define JAILHOUSE_TRACE_IOMMU_FLUSH		6	/* gran << 16 | DID */
+#define JAILHOUSE_TRACE_CELL_CREATE		7	/* cell ID */
+#define JAILHOUSE_TRACE_CELL_DESTROY		8	/* cell ID */
+#define JAILHOUSE_TRACE_CELL_RESTART		9	/* cell ID */
+#define JAILHOUSE_TRACE_CPU_MOVE		10	/* CPU << 16 | cell ID */
+#define JAILHOUSE_TRACE_NUM_EVENTS		11
+
+#define JAILHOUSE_TRACE_ALL	((1UL << JAILHOUSE_TRACE_NUM_EVENTS) - 1)
+
+struct jailhouse_trace_event {
+	/* TSC */
+	__u64 timestamp;
+	__u32 arg;
+	__u16 type;
+	__u16 cpu_id;
+};
+
+/*
+ * positions count events, the one at position pos is stored in
+ * events[pos % JAILHOUSE_TRACE_EVENTS]
+ */
+struct jailhouse_cpu_trace {
+	struct jailhouse_log_position pos;
+	struct jailhouse_trace_event events[JAILHOUSE_TRACE_EVENTS];
+};
+
+/* DMA remapping faults, collected per IOMMU unit */
+#define JAILHOUSE_DMA_FAULT_RECORDS		32
+#define JAILHOUSE_DMA_FAULT_DEVICES		32
+
+#define JAILHOUSE_DMA_FAULT_READ		0x01
+
+struct jailhouse_dma_fault {
+	__u64 address;
+	/* number of the fault, record is unused or overwritten if not
+	 * within the last JAILHOUSE_DMA_FAULT_RECORDS of total */
+	__u32 seq;
+	__u16 source_id;
+	__u8 reason;
+	__u8 flags;
+};
+
+struct jailhouse_dma_device_faults {
+	__u16 source_id;
+	__u16 padding;
+	__u32 count;
+};
+
+struct jailhouse_dma_faults {
+	__u32 num_units;
+	__u32 total;
+	/* fault recording overflows, faults lost by the hardware */
+	__u32 overflows;
+	/* odd while new faults are recorded */
+	__u32 seq;
+	struct jailhouse_dma_device_faults device[JAILHOUSE_DMA_FAULT_DEVICES];
+	/* ring, fault seq is stored at index (seq - 1) % RECORDS */
+	struct jailhouse_dma_fault record[JAILHOUSE_DMA_FAULT_RECORDS];
+};
+
 static inline __u32
 jailhouse_cell_config_size(struct jailhouse_cell_desc *cell)
 {
@@ -74,7 +423,12 @@ jailhouse_cell_config_size(struct jailhouse_cell_desc *cell)
 		cell->num_memory_regions * sizeof(struct jailhouse_memory) +
 		cell->num_irq_lines * sizeof(struct jailhouse_irq_line) +
 		cell->pio_bitmap_size +
-		cell->num_pci_devices * sizeof(struct jailhouse_pci_device);
+		cell->num_pci_devices * sizeof(struct jailhouse_pci_device) +
+		cell->num_cpuid_overrides *
+		sizeof(struct jailhouse_cpuid_override) +
+		cell->num_msr_ranges * sizeof(struct jailhouse_msr_range) +
+		cell->num_irq_remaps * sizeof(struct jailhouse_irq_remap) +
+		cell->num_shmem * sizeof(struct jailhouse_shmem);
 }
 
 static inline __u32
@@ -82,6 +436,7 @@ jailhouse_system_config_size(struct jailhouse_system *system)
 {
 	return sizeof(system->hypervisor_memory) +
 		sizeof(system->config_memory) +
+		sizeof(system->numa_nodes) +
 		jailhouse_cell_config_size(&system->system);
 }
 
@@ -118,4 +473,57 @@ jailhouse_cell_pci_devices(const struct jailhouse_cell_desc *cell)
 		cell->pio_bitmap_size);
 }
 
+static inline const struct jailhouse_cpuid_override *
+jailhouse_cell_cpuid_overrides(const struct jailhouse_cell_desc *cell)
+{
+	return (const struct jailhouse_cpuid_override *)((void *)cell +
+		sizeof(struct jailhouse_cell_desc) + cell->cpu_set_size +
+		cell->num_memory_regions * sizeof(struct jailhouse_memory) +
+		cell->num_irq_lines * sizeof(struct jailhouse_irq_line) +
+		cell->pio_bitmap_size +
+		cell->num_pci_devices * sizeof(struct jailhouse_pci_device));
+}
+
+static inline const struct jailhouse_msr_range *
+jailhouse_cell_msr_ranges(const struct jailhouse_cell_desc *cell)
+{
+	return (const struct jailhouse_msr_range *)((void *)cell +
+		sizeof(struct jailhouse_cell_desc) + cell->cpu_set_size +
+		cell->num_memory_regions * sizeof(struct jailhouse_memory) +
+		cell->num_irq_lines * sizeof(struct jailhouse_irq_line) +
+		cell->pio_bitmap_size +
+		cell->num_pci_devices * sizeof(struct jailhouse_pci_device) +
+		cell->num_cpuid_overrides *
+		sizeof(struct jailhouse_cpuid_override));
+}
+
+static inline const struct jailhouse_irq_remap *
+jailhouse_cell_irq_remaps(const struct jailhouse_cell_desc *cell)
+{
+	return (const struct jailhouse_irq_remap *)((void *)cell +
+		sizeof(struct jailhouse_cell_desc) + cell->cpu_set_size +
+		cell->num_memory_regions * sizeof(struct jailhouse_memory) +
+		cell->num_irq_lines * sizeof(struct jailhouse_irq_line) +
+		cell->pio_bitmap_size +
+		cell->num_pci_devices * sizeof(struct jailhouse_pci_device) +
+		cell->num_cpuid_overrides *
+		sizeof(struct jailhouse_cpuid_override) +
+		cell->num_msr_ranges * sizeof(struct jailhouse_msr_range));
+}
+
+static inline const struct jailhouse_shmem *
+jailhouse_cell_shmem(const struct jailhouse_cell_desc *cell)
+{
+	return (const struct jailhouse_shmem *)((void *)cell +
+		sizeof(struct jailhouse_cell_desc) + cell->cpu_set_size +
+		cell->num_memory_regions * sizeof(struct jailhouse_memory) +
+		cell->num_irq_lines * sizeof(struct jailhouse_irq_line) +
+		cell->pio_bitmap_size +
+		cell->num_pci_devices * sizeof(struct jailhouse_pci_device) +
+		cell->num_cpuid_overrides *
+		sizeof(struct jailhouse_cpuid_override) +
+		cell->num_msr_ranges * sizeof(struct jailhouse_msr_range) +
+		cell->num_irq_remaps * sizeof(struct jailhouse_irq_remap));
+}
+
 #endif /* !_JAILHOUSE_CELL_CONFIG_H */
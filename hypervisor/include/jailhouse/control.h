@@ -33,17 +33,48 @@ unsigned int next_cpu(unsigned int cpu, struct cpu_set *cpu_set,
 
 int check_mem_regions(const struct jailhouse_cell_desc *config);
 int cell_init(struct cell *cell, bool copy_cpu_set);
+void cell_register(struct cell *cell);
+bool cell_next_phys_range(struct cell *cell, unsigned int *pos,
+			  u32 access_flags, struct jailhouse_memory *range);
 
 int cell_create(struct per_cpu *cpu_data, unsigned long config_address);
 int cell_destroy(struct per_cpu *cpu_data, unsigned long name_address);
+int cell_restart(struct per_cpu *cpu_data, unsigned long name_address,
+		 unsigned long image_address);
+int cell_get_mem_info(struct per_cpu *cpu_data, unsigned long name_address,
+		      unsigned long info_address);
+int cell_get_working_set(struct per_cpu *cpu_data, unsigned long name_address,
+			 unsigned long ws_address);
+int cell_add_cpu(struct per_cpu *cpu_data, unsigned long name_address,
+		 unsigned long cpu_id);
+int cell_remove_cpu(struct per_cpu *cpu_data, unsigned long name_address,
+		    unsigned long cpu_id);
+int stats_init(void);
+void stats_update_cell(struct cell *cell, unsigned int state);
+struct jailhouse_cpu_stats *cpu_stats(unsigned int cpu_id);
+int stats_get_area(struct per_cpu *cpu_data);
+int cpu_get_stats(struct per_cpu *cpu_data, unsigned long cpu_id,
+		  unsigned long stats_address);
+int dma_get_faults(struct per_cpu *cpu_data, unsigned long unit,
+		   unsigned long faults_address);
+int cpu_get_log(struct per_cpu *cpu_data, unsigned long cpu_id,
+		unsigned long log_address);
+int cpu_get_trace(struct per_cpu *cpu_data, unsigned long cpu_id,
+		  unsigned long trace_address);
+int trace_set_events(struct per_cpu *cpu_data, unsigned long mask);
 
 int shutdown(struct per_cpu *cpu_data);
 
 void arch_suspend_cpu(unsigned int cpu_id);
 void arch_resume_cpu(unsigned int cpu_id);
+void arch_suspend_cpus(struct cpu_set *cpu_set, int exception);
+void arch_resume_cpus(struct cpu_set *cpu_set, int exception);
 void arch_reset_cpu(unsigned int cpu_id);
 void arch_park_cpu(unsigned int cpu_id);
+void arch_reset_cpus(struct cpu_set *cpu_set, int exception);
+void arch_park_cpus(struct cpu_set *cpu_set, int exception);
 void arch_shutdown_cpu(unsigned int cpu_id);
+void arch_send_irq(unsigned int cpu_id, unsigned int vector);
 
 int arch_map_memory_region(struct cell *cell,
 			   const struct jailhouse_memory *mem);
@@ -51,6 +82,13 @@ void arch_unmap_memory_region(struct cell *cell,
 			      const struct jailhouse_memory *mem);
 
 int arch_cell_create(struct per_cpu *cpu_data, struct cell *cell);
+int arch_cell_commit(struct per_cpu *cpu_data, struct cell *cell);
 void arch_cell_destroy(struct per_cpu *cpu_data, struct cell *cell);
+void arch_config_commit(struct per_cpu *cpu_data, struct cell *cell_added);
+void arch_cell_cpus_changed(struct cell *cell);
+void arch_get_mem_usage(struct cell *cell, struct jailhouse_mem_info *info);
+int arch_cell_scan_working_set(struct per_cpu *cpu_data, struct cell *cell,
+			       struct jailhouse_working_set *ws);
+const struct jailhouse_dma_faults *arch_get_dma_faults(unsigned int unit);
 
 void arch_shutdown(void);
@@ -15,3 +15,14 @@
 #define JAILHOUSE_HC_DISABLE		0
 #define JAILHOUSE_HC_CELL_CREATE	1
 #define JAILHOUSE_HC_CELL_DESTROY	2
+#define JAILHOUSE_HC_CELL_GET_MEM_INFO	3
+#define JAILHOUSE_HC_CPU_GET_STATS	4
+#define JAILHOUSE_HC_DMA_GET_FAULTS	5
+#define JAILHOUSE_HC_CELL_RESTART	6
+#define JAILHOUSE_HC_CPU_GET_LOG	7
+#define JAILHOUSE_HC_CPU_GET_TRACE	8
+#define JAILHOUSE_HC_TRACE_SET_EVENTS	9
+#define JAILHOUSE_HC_GET_STATS_AREA	10
+#define JAILHOUSE_HC_CELL_GET_WORKING_SET	11
+#define JAILHOUSE_HC_CELL_ADD_CPU		12
+#define JAILHOUSE_HC_CELL_REMOVE_CPU		13
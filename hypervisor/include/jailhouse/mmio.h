@@ -38,5 +38,28 @@ static inline void mmio_write64(void *address, u64 value)
 	*(volatile u64 *)address = value;
 }
 
+/*
+ * Emulates an access to an MMIO region. offset is relative to the region
+ * start, value holds the data to write or receives the data read. Returns 0
+ * on success, a negative error code stops the accessing CPU.
+ */
+typedef int (*mmio_handler)(struct per_cpu *cpu_data, void *arg,
+			    unsigned long offset, unsigned int size,
+			    unsigned long *value, bool is_write);
+
+struct mmio_region {
+	unsigned long start;
+	unsigned long size;
+	mmio_handler handler;
+	void *arg;
+};
+
 struct mmio_access mmio_parse(struct per_cpu *cpu_data, unsigned long pc,
 			      unsigned long page_table_addr, bool is_write);
+
+int mmio_region_register(struct cell *cell, unsigned long start,
+			 unsigned long size, mmio_handler handler, void *arg);
+void mmio_region_unregister(struct cell *cell, unsigned long start);
+const struct mmio_region *mmio_region_lookup(const struct cell *cell,
+					     unsigned long addr);
+void mmio_cell_exit(struct cell *cell);
@@ -13,15 +13,50 @@
 #include <jailhouse/entry.h>
 #include <asm/types.h>
 #include <asm/paging.h>
+#include <asm/spinlock.h>
 
 #define PAGE_ALIGN(s)		((s + PAGE_SIZE-1) & PAGE_MASK)
 
+/* largest block the buddy allocator manages: 2^18 pages */
+#define PAGE_POOL_MAX_ORDER	18
+
+struct page_frame {
+	u32 next;
+	u32 prev;
+};
+
+struct jailhouse_pool_stats;
+
 struct page_pool {
+	spinlock_t lock;
 	void *base_address;
 	unsigned long pages;
 	unsigned long used_pages;
-	unsigned long *used_bitmap;
+	unsigned long peak_used_pages;
+	struct page_frame *frames;
+	u8 *frame_order;
+	u32 free_list[PAGE_POOL_MAX_ORDER + 1];
+	unsigned long free_blocks;
+	/* pages freed during a reconfiguration, see page_pool_defer_frees */
+	u32 deferred;
 	unsigned long flags;
+	/* mirror of the usage counters, if published */
+	struct jailhouse_pool_stats *stats;
+};
+
+/* page sizes page_map_create may use in addition to PAGE_SIZE */
+#define PAGE_MAP_NO_HUGE	0
+#define PAGE_MAP_HUGE_2M	0x1
+#define PAGE_MAP_HUGE_1G	0x2
+
+#define PAGE_MAGAZINE_SIZE	16
+#define PAGE_MAGAZINE_BATCH	8
+
+struct page_magazine {
+	void *pages[PAGE_MAGAZINE_SIZE];
+	unsigned int count;
+	unsigned long hits;
+	unsigned long misses;
 };
 
 enum page_map_coherent {
@@ -29,13 +64,24 @@ enum page_map_coherent {
 	PAGE_MAP_NON_COHERENT,
 };
 
+/* no node-local memory, allocations fall back to mem_pool */
+#define NUMA_NO_NODE		JAILHOUSE_MAX_NUMA_NODES
+
 extern struct page_pool mem_pool;
 extern struct page_pool remap_pool;
+extern struct page_pool numa_pools[JAILHOUSE_MAX_NUMA_NODES];
 
 extern pgd_t *hv_page_table;
 
 void *page_alloc(struct page_pool *pool, unsigned int num);
 void page_free(struct page_pool *pool, void *first_page, unsigned int num);
+void page_pool_publish_stats(struct page_pool *pool,
+			     struct jailhouse_pool_stats *stats);
+void page_pool_defer_frees(void);
+void page_pool_release_deferred(void);
+
+struct page_pool *numa_pool(unsigned int node);
+unsigned int cpu_numa_node(unsigned int cpu);
 
 static inline unsigned long page_map_hvirt2phys(void *hvirt)
 {
@@ -50,10 +96,18 @@ static inline void *page_map_phys2hvirt(unsigned long phys)
 int page_map_create(pgd_t *page_table, unsigned long phys, unsigned long size,
 		    unsigned long virt, unsigned long page_flags,
 		    unsigned long table_flags, unsigned int levels,
-		    enum page_map_coherent coherent);
-void page_map_destroy(pgd_t *page_table, unsigned long virt,
-		      unsigned long size, unsigned int levels,
-		      enum page_map_coherent coherent);
+		    unsigned long huge_pages, enum page_map_coherent coherent);
+int page_map_destroy(pgd_t *page_table, unsigned long virt,
+		     unsigned long size, unsigned long table_flags,
+		     unsigned int levels, enum page_map_coherent coherent);
+
+unsigned long page_map_count_tables(pgd_t *page_table, unsigned int levels);
+
+/* called for each present leaf entry with the size it maps within the range */
+typedef void (*page_map_walk_fn)(void *entry, unsigned long size, void *arg);
+
+void page_map_walk(pgd_t *page_table, unsigned long virt, unsigned long size,
+		   unsigned int levels, page_map_walk_fn fn, void *arg);
 
 void *page_map_get_foreign_page(unsigned int mapping_region,
 				unsigned long page_table_paddr,
@@ -15,9 +15,22 @@
 extern volatile unsigned long panic_in_progress;
 extern unsigned int panic_cpu;
 
+int printk_init(void);
 void printk(const char *fmt, ...);
+void printk_drain(void);
+void printk_flush(void);
+const char *printk_log_data(unsigned int cpu_id, unsigned long *head,
+			    unsigned long *tail);
 
 void panic_printk(const char *fmt, ...);
 
+#ifdef CONFIG_SPINLOCK_STATS
+#include <asm/spinlock.h>
+
+void spin_lock_print_stats(const char *name, spinlock_t *lock);
+void printk_lock_print_stats(void);
+#endif
+
 void arch_dbg_write_init(void);
 void arch_dbg_write(const char *msg);
+unsigned int arch_dbg_write_nowait(const char *msg, unsigned int len);
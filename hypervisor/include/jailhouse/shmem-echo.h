@@ -0,0 +1,39 @@
+/*
+ * Jailhouse, a Linux-based partitioning hypervisor
+ *
+ * Copyright (c) Siemens AG, 2013
+ *
+ * Authors:
+ *  Jan Kiszka <jan.kiszka@siemens.com>
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.  See
+ * the COPYING file in the top-level directory.
+ */
+
+#ifndef _JAILHOUSE_SHMEM_ECHO_H
+#define _JAILHOUSE_SHMEM_ECHO_H
+
+/*
+ * Ping-pong protocol at the start of an inter-cell shared memory region,
+ * used to measure doorbell round trips. The initiator sets up the magic,
+ * then advances ping and rings the doorbell. The responder copies ping to
+ * pong and rings back. Includers provide the __u8/__u32 types.
+ */
+
+#define JAILHOUSE_ECHO_MAGIC		0x6f686345	/* "Echo" */
+#define JAILHOUSE_ECHO_CACHELINE	64
+
+struct jailhouse_echo {
+	__u32 magic;
+	__u8 padding0[JAILHOUSE_ECHO_CACHELINE - sizeof(__u32)];
+
+	/* written by the initiator */
+	volatile __u32 ping;
+	__u8 padding1[JAILHOUSE_ECHO_CACHELINE - sizeof(__u32)];
+
+	/* written by the responder */
+	volatile __u32 pong;
+	__u8 padding2[JAILHOUSE_ECHO_CACHELINE - sizeof(__u32)];
+} __attribute__((aligned(JAILHOUSE_ECHO_CACHELINE)));
+
+#endif /* !_JAILHOUSE_SHMEM_ECHO_H */
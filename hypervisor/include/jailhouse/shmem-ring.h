@@ -0,0 +1,242 @@
+/*
+ * Jailhouse, a Linux-based partitioning hypervisor
+ *
+ * Copyright (c) Siemens AG, 2013
+ *
+ * Authors:
+ *  Jan Kiszka <jan.kiszka@siemens.com>
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.  See
+ * the COPYING file in the top-level directory.
+ */
+
+#ifndef _JAILHOUSE_SHMEM_RING_H
+#define _JAILHOUSE_SHMEM_RING_H
+
+/*
+ * Message ring at the start of an inter-cell shared memory region. It is
+ * used by the Linux driver, inmates and user space alike, so includers
+ * provide the __u8/__u32 types.
+ *
+ * The ring header is followed by num_slots slots of slot_size bytes each.
+ * Producers claim slots by advancing prod_reserve, fill them in place and
+ * publish them in claim order by advancing prod_head. The consumer works on
+ * published slots in place and hands them back by advancing cons_tail.
+ * Indices are free-running, num_slots is a power of two. Claiming and
+ * handing back batches of slots amortizes the index updates.
+ *
+ * A side that runs out of work announces this in its waiting flag and
+ * re-checks the ring before sleeping. The other side only rings the
+ * doorbell if it finds the flag set, clearing it in the same step.
+ */
+
+#define JAILHOUSE_RING_MAGIC		0x676e6952	/* "Ring" */
+#define JAILHOUSE_RING_CACHELINE	64
+
+/* multiple producers, they serialize on prod_reserve and prod_head */
+#define JAILHOUSE_RING_MPSC		0x0001
+
+struct jailhouse_ring {
+	/* constant after setup */
+	__u32 magic;
+	__u32 flags;
+	__u32 num_slots;
+	__u32 slot_size;
+	__u8 padding0[JAILHOUSE_RING_CACHELINE - 4 * sizeof(__u32)];
+
+	/* written by producers */
+	__u32 prod_head;
+	__u32 prod_reserve;
+	__u32 prod_waiting;
+	__u8 padding1[JAILHOUSE_RING_CACHELINE - 3 * sizeof(__u32)];
+
+	/* written by the consumer */
+	__u32 cons_tail;
+	__u32 cons_waiting;
+	__u8 padding2[JAILHOUSE_RING_CACHELINE - 2 * sizeof(__u32)];
+} __attribute__((aligned(JAILHOUSE_RING_CACHELINE)));
+
+struct jailhouse_ring_slot {
+	__u32 len;
+	__u32 flags;
+	__u8 data[];
+};
+
+#define jailhouse_ring_load(ptr)	__atomic_load_n(ptr, __ATOMIC_ACQUIRE)
+#define jailhouse_ring_store(ptr, val)	\
+	__atomic_store_n(ptr, val, __ATOMIC_RELEASE)
+
+/*
+ * Sets up a ring covering size bytes with slot_size being a multiple of the
+ * cache line size. Returns the number of slots, 0 if the parameters are
+ * invalid.
+ */
+static inline __u32
+jailhouse_ring_init(struct jailhouse_ring *ring, unsigned long size,
+		    __u32 slot_size, __u32 flags)
+{
+	unsigned long slots;
+	__u32 num_slots = 1;
+
+	if (size < sizeof(*ring) || slot_size == 0 ||
+	    slot_size % JAILHOUSE_RING_CACHELINE != 0)
+		return 0;
+
+	slots = (size - sizeof(*ring)) / slot_size;
+	if (slots == 0)
+		return 0;
+	while (num_slots <= slots / 2 && num_slots < 0x80000000)
+		num_slots *= 2;
+
+	ring->flags = flags;
+	ring->num_slots = num_slots;
+	ring->slot_size = slot_size;
+	ring->prod_head = ring->prod_reserve = ring->prod_waiting = 0;
+	ring->cons_tail = ring->cons_waiting = 0;
+	jailhouse_ring_store(&ring->magic, JAILHOUSE_RING_MAGIC);
+
+	return num_slots;
+}
+
+/* checks a ring set up by the peer against the region size */
+static inline int
+jailhouse_ring_valid(const struct jailhouse_ring *ring, unsigned long size)
+{
+	return jailhouse_ring_load(&ring->magic) == JAILHOUSE_RING_MAGIC &&
+		ring->num_slots != 0 &&
+		(ring->num_slots & (ring->num_slots - 1)) == 0 &&
+		ring->slot_size != 0 &&
+		ring->slot_size % JAILHOUSE_RING_CACHELINE == 0 &&
+		size >= sizeof(*ring) &&
+		(size - sizeof(*ring)) / ring->slot_size >= ring->num_slots;
+}
+
+static inline struct jailhouse_ring_slot *
+jailhouse_ring_slot(struct jailhouse_ring *ring, __u32 index)
+{
+	return (struct jailhouse_ring_slot *)((__u8 *)(ring + 1) +
+		(unsigned long)(index & (ring->num_slots - 1)) *
+		ring->slot_size);
+}
+
+static inline __u32
+jailhouse_ring_payload_size(const struct jailhouse_ring *ring)
+{
+	return ring->slot_size - sizeof(struct jailhouse_ring_slot);
+}
+
+/* number of slots that can be claimed */
+static inline __u32 jailhouse_ring_space(struct jailhouse_ring *ring)
+{
+	return ring->num_slots -
+		(__atomic_load_n(&ring->prod_reserve, __ATOMIC_RELAXED) -
+		 jailhouse_ring_load(&ring->cons_tail));
+}
+
+/*
+ * Claims up to max slots for filling, the first one is returned in *first.
+ * Returns the number of claimed slots.
+ */
+static inline __u32
+jailhouse_ring_reserve(struct jailhouse_ring *ring, __u32 *first, __u32 max)
+{
+	__u32 reserve, count;
+
+	reserve = __atomic_load_n(&ring->prod_reserve, __ATOMIC_RELAXED);
+	do {
+		/* pairs with the release of the consumer */
+		count = ring->num_slots -
+			(reserve - jailhouse_ring_load(&ring->cons_tail));
+		if (count > max)
+			count = max;
+		if (count == 0)
+			return 0;
+		if (!(ring->flags & JAILHOUSE_RING_MPSC)) {
+			__atomic_store_n(&ring->prod_reserve, reserve + count,
+					 __ATOMIC_RELAXED);
+			break;
+		}
+	} while (!__atomic_compare_exchange_n(&ring->prod_reserve, &reserve,
+					      reserve + count, 0,
+					      __ATOMIC_RELAXED,
+					      __ATOMIC_RELAXED));
+
+	*first = reserve;
+	return count;
+}
+
+/*
+ * Publishes filled slots. With multiple producers, this waits for earlier
+ * claims to be published first. Returns non-zero if the consumer went idle
+ * and has to be notified via the doorbell.
+ */
+static inline int
+jailhouse_ring_commit(struct jailhouse_ring *ring, __u32 first, __u32 count)
+{
+	if (ring->flags & JAILHOUSE_RING_MPSC)
+		while (jailhouse_ring_load(&ring->prod_head) != first)
+			__asm__ __volatile__("" : : : "memory");
+
+	jailhouse_ring_store(&ring->prod_head, first + count);
+
+	/* orders the publication against the test of the waiting flag */
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	return __atomic_load_n(&ring->cons_waiting, __ATOMIC_RELAXED) &&
+		__atomic_exchange_n(&ring->cons_waiting, 0, __ATOMIC_SEQ_CST);
+}
+
+/*
+ * Returns the number of published slots that the consumer can process,
+ * starting at *first.
+ */
+static inline __u32
+jailhouse_ring_peek(struct jailhouse_ring *ring, __u32 *first)
+{
+	__u32 tail = __atomic_load_n(&ring->cons_tail, __ATOMIC_RELAXED);
+	__u32 count = jailhouse_ring_load(&ring->prod_head) - tail;
+
+	*first = tail;
+	/* do not trust a broken peer */
+	return count > ring->num_slots ? ring->num_slots : count;
+}
+
+/*
+ * Hands processed slots back to the producers. Returns non-zero if a
+ * producer went idle and has to be notified via the doorbell.
+ */
+static inline int jailhouse_ring_release(struct jailhouse_ring *ring,
+					 __u32 count)
+{
+	jailhouse_ring_store(&ring->cons_tail,
+			     __atomic_load_n(&ring->cons_tail,
+					     __ATOMIC_RELAXED) + count);
+
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	return __atomic_load_n(&ring->prod_waiting, __ATOMIC_RELAXED) &&
+		__atomic_exchange_n(&ring->prod_waiting, 0, __ATOMIC_SEQ_CST);
+}
+
+/* Returns non-zero if the consumer may now sleep until notified. */
+static inline int jailhouse_ring_consumer_idle(struct jailhouse_ring *ring)
+{
+	__atomic_store_n(&ring->cons_waiting, 1, __ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&ring->prod_head, __ATOMIC_SEQ_CST) ==
+	    __atomic_load_n(&ring->cons_tail, __ATOMIC_RELAXED))
+		return 1;
+	__atomic_store_n(&ring->cons_waiting, 0, __ATOMIC_RELAXED);
+	return 0;
+}
+
+/* Returns non-zero if a producer may now sleep until notified. */
+static inline int jailhouse_ring_producer_idle(struct jailhouse_ring *ring)
+{
+	__atomic_store_n(&ring->prod_waiting, 1, __ATOMIC_SEQ_CST);
+	if (ring->num_slots ==
+	    __atomic_load_n(&ring->prod_reserve, __ATOMIC_RELAXED) -
+	    __atomic_load_n(&ring->cons_tail, __ATOMIC_SEQ_CST))
+		return 1;
+	__atomic_store_n(&ring->prod_waiting, 0, __ATOMIC_RELAXED);
+	return 0;
+}
+
+#endif /* !_JAILHOUSE_SHMEM_RING_H */
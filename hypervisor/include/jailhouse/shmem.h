@@ -0,0 +1,26 @@
+/*
+ * Jailhouse, a Linux-based partitioning hypervisor
+ *
+ * Copyright (c) Siemens AG, 2013
+ *
+ * Authors:
+ *  Jan Kiszka <jan.kiszka@siemens.com>
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.  See
+ * the COPYING file in the top-level directory.
+ */
+
+#include <asm/cell.h>
+
+/* vector 0..31 are exceptions */
+#define SHMEM_MIN_VECTOR	32
+
+struct shmem_endpoint {
+	struct cell *cell;
+	const struct jailhouse_shmem *config;
+	struct shmem_endpoint *next;
+};
+
+int shmem_cell_init(struct cell *cell);
+void shmem_cell_activate(struct cell *cell);
+void shmem_cell_exit(struct cell *cell);
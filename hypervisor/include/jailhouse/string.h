@@ -12,5 +12,8 @@
 
 void *memcpy(void *d, const void *s, unsigned long n);
 void *memset(void *s, int c, unsigned long n);
+void *memmove(void *d, const void *s, unsigned long n);
+int memcmp(const void *s1, const void *s2, unsigned long n);
 
+unsigned long strlen(const char *s);
 int strcmp(const char *s1, const char *s2);
@@ -0,0 +1,38 @@
+/*
+ * Jailhouse, a Linux-based partitioning hypervisor
+ *
+ * Copyright (c) Siemens AG, 2013
+ *
+ * Authors:
+ *  Jan Kiszka <jan.kiszka@siemens.com>
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.  See
+ * the COPYING file in the top-level directory.
+ */
+
+#include <asm/types.h>
+#include <jailhouse/cell-config.h>
+
+/*
+ * Events not in CONFIG_TRACE_EVENTS are compiled out. The others cost a
+ * test of trace_mask until Linux enables them at runtime.
+ */
+#ifndef CONFIG_TRACE_EVENTS
+#define CONFIG_TRACE_EVENTS	JAILHOUSE_TRACE_ALL
+#endif
+
+extern volatile unsigned long trace_mask;
+
+/* arg is only evaluated if the event is enabled */
+#define trace_event(type, arg)						\
+	do {								\
+		if ((CONFIG_TRACE_EVENTS & (1UL << (type))) &&		\
+		    (trace_mask & (1UL << (type))))			\
+			__trace_event(type, arg);			\
+	} while (0)
+
+void __trace_event(unsigned int type, unsigned long arg);
+
+int trace_set_mask(unsigned long mask);
+const struct jailhouse_trace_event *trace_data(unsigned int cpu_id,
+					       unsigned long *head);
@@ -22,6 +22,39 @@ void *memset(void *s, int c, unsigned long n)
 	return s;
 }
 
+void *memmove(void *d, const void *s, unsigned long n)
+{
+	const u8 *src = s;
+	u8 *dst = d;
+
+	if (dst <= src)
+		while (n-- > 0)
+			*dst++ = *src++;
+	else
+		while (n-- > 0)
+			dst[n] = src[n];
+	return d;
+}
+
+int memcmp(const void *s1, const void *s2, unsigned long n)
+{
+	const u8 *p1 = s1, *p2 = s2;
+
+	for (; n > 0; n--, p1++, p2++)
+		if (*p1 != *p2)
+			return *p1 - *p2;
+	return 0;
+}
+
+unsigned long strlen(const char *s)
+{
+	const char *p = s;
+
+	while (*p)
+		p++;
+	return p - s;
+}
+
 int strcmp(const char *s1, const char *s2)
 {
 	while (*s1 == *s2) {
@@ -0,0 +1,114 @@
+/*
+ * Jailhouse, a Linux-based partitioning hypervisor
+ *
+ * Copyright (c) Siemens AG, 2013
+ *
+ * Authors:
+ *  Jan Kiszka <jan.kiszka@siemens.com>
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.  See
+ * the COPYING file in the top-level directory.
+ */
+
+#include <jailhouse/mmio.h>
+#include <jailhouse/paging.h>
+#include <jailhouse/string.h>
+#include <asm/cell.h>
+
+/*
+ * The regions of a cell are kept sorted by start address in a single page,
+ * allocated on first registration. Registrations have to be done while the
+ * CPUs of the cell are not running, i.e. during cell creation or with the
+ * cell suspended.
+ */
+
+#define MMIO_MAX_REGIONS	(PAGE_SIZE / sizeof(struct mmio_region))
+
+static int mmio_region_index(const struct cell *cell, unsigned long addr)
+{
+	int first = 0, last = (int)cell->num_mmio_regions - 1, n;
+	const struct mmio_region *region;
+
+	while (first <= last) {
+		n = (first + last) / 2;
+		region = &cell->mmio_regions[n];
+		if (addr < region->start)
+			last = n - 1;
+		else if (addr >= region->start + region->size)
+			first = n + 1;
+		else
+			return n;
+	}
+	/* not found, encode the insertion point */
+	return -first - 1;
+}
+
+int mmio_region_register(struct cell *cell, unsigned long start,
+			 unsigned long size, mmio_handler handler, void *arg)
+{
+	struct mmio_region *region;
+	int n;
+
+	if (size == 0 || start + size < start)
+		return -EINVAL;
+
+	if (!cell->mmio_regions) {
+		cell->mmio_regions = page_alloc(&mem_pool, 1);
+		if (!cell->mmio_regions)
+			return -ENOMEM;
+	}
+	if (cell->num_mmio_regions >= MMIO_MAX_REGIONS)
+		return -ENOMEM;
+
+	n = mmio_region_index(cell, start);
+	if (n >= 0)
+		return -EBUSY;
+	n = -n - 1;
+
+	/* the successor must not start inside the new region */
+	if (n < cell->num_mmio_regions &&
+	    cell->mmio_regions[n].start < start + size)
+		return -EBUSY;
+
+	region = &cell->mmio_regions[n];
+	memmove(region + 1, region,
+		(cell->num_mmio_regions - n) * sizeof(*region));
+	region->start = start;
+	region->size = size;
+	region->handler = handler;
+	region->arg = arg;
+	cell->num_mmio_regions++;
+
+	return 0;
+}
+
+void mmio_region_unregister(struct cell *cell, unsigned long start)
+{
+	struct mmio_region *region;
+	int n;
+
+	n = mmio_region_index(cell, start);
+	if (n < 0 || cell->mmio_regions[n].start != start)
+		return;
+
+	region = &cell->mmio_regions[n];
+	cell->num_mmio_regions--;
+	memmove(region, region + 1,
+		(cell->num_mmio_regions - n) * sizeof(*region));
+}
+
+const struct mmio_region *mmio_region_lookup(const struct cell *cell,
+					     unsigned long addr)
+{
+	int n = mmio_region_index(cell, addr);
+
+	return n >= 0 ? &cell->mmio_regions[n] : NULL;
+}
+
+void mmio_cell_exit(struct cell *cell)
+{
+	if (cell->mmio_regions)
+		page_free(&mem_pool, cell->mmio_regions, 1);
+	cell->mmio_regions = NULL;
+	cell->num_mmio_regions = 0;
+}
@@ -12,14 +12,14 @@
 
 #include <jailhouse/paging.h>
 #include <jailhouse/printk.h>
-#include <jailhouse/string.h>
 #include <jailhouse/control.h>
-#include <asm/bitops.h>
 
 #define BITS_PER_PAGE		(PAGE_SIZE * 8)
 
-#define INVALID_PAGE_NR		(~0UL)
+#define INVALID_PAGE_NR		(~0U)
+#define FRAME_NOT_FREE		0xff
 
+/* Free pages of such pools are always zero, page_alloc relies on this. */
 #define PAGE_SCRUB_ON_FREE	0x1
 
 extern u8 __start[], __page_pool[];
@@ -29,78 +29,325 @@ struct page_pool remap_pool = {
 	.base_address = (void *)REMAP_BASE_ADDR,
 	.pages = BITS_PER_PAGE * NUM_REMAP_BITMAP_PAGES,
 };
+struct page_pool numa_pools[JAILHOUSE_MAX_NUMA_NODES];
 
 pgd_t *hv_page_table;
 
-static unsigned long find_next_free_page(struct page_pool *pool,
-					 unsigned long start)
+static struct page_magazine *magazines;
+static bool defer_frees;
+
+/*
+ * The pools are managed by a buddy allocator. Its metadata is kept outside
+ * of the managed pages as the remap pool is not backed by memory: per page,
+ * the free list links and the order of the free block it heads (or
+ * FRAME_NOT_FREE).
+ */
+static unsigned long page_pool_meta_pages(unsigned long pages)
+{
+	return (pages * (sizeof(struct page_frame) + 1) + PAGE_SIZE - 1) /
+		PAGE_SIZE;
+}
+
+static void free_list_add(struct page_pool *pool, unsigned long nr,
+			  unsigned int order)
+{
+	u32 head = pool->free_list[order];
+
+	pool->frames[nr].next = head;
+	pool->frames[nr].prev = INVALID_PAGE_NR;
+	if (head != INVALID_PAGE_NR)
+		pool->frames[head].prev = nr;
+	pool->free_list[order] = nr;
+	pool->frame_order[nr] = order;
+	pool->free_blocks++;
+}
+
+static void free_list_del(struct page_pool *pool, unsigned long nr,
+			  unsigned int order)
+{
+	struct page_frame *frame = &pool->frames[nr];
+
+	if (frame->prev != INVALID_PAGE_NR)
+		pool->frames[frame->prev].next = frame->next;
+	else
+		pool->free_list[order] = frame->next;
+	if (frame->next != INVALID_PAGE_NR)
+		pool->frames[frame->next].prev = frame->prev;
+	pool->frame_order[nr] = FRAME_NOT_FREE;
+	pool->free_blocks--;
+}
+
+static void free_block(struct page_pool *pool, unsigned long nr,
+		       unsigned int order)
+{
+	unsigned long buddy;
+
+	while (order < PAGE_POOL_MAX_ORDER) {
+		buddy = nr ^ (1UL << order);
+		if (buddy >= pool->pages || pool->frame_order[buddy] != order)
+			break;
+		free_list_del(pool, buddy, order);
+		nr &= ~(1UL << order);
+		order++;
+	}
+	free_list_add(pool, nr, order);
+}
+
+static void page_pool_update_stats(struct page_pool *pool)
+{
+	if (pool->stats) {
+		pool->stats->used = pool->used_pages;
+		pool->stats->peak = pool->peak_used_pages;
+	}
+}
+
+/* Return an arbitrary range to the pool as naturally aligned blocks. */
+static void free_range(struct page_pool *pool, unsigned long nr,
+		       unsigned long num)
 {
-	unsigned long start_mask =
-		~0UL >> (BITS_PER_LONG - (start % BITS_PER_LONG));
-	unsigned long bmp_pos, bmp_val, page_nr;
+	unsigned int order;
 
-	if (start >= pool->pages)
-		return INVALID_PAGE_NR;
+	pool->used_pages -= num;
+	/* also covers allocations, they end with returning their rest */
+	page_pool_update_stats(pool);
 
-	for (bmp_pos = start / BITS_PER_LONG;
-	     bmp_pos < pool->pages / BITS_PER_LONG; bmp_pos++) {
-		bmp_val = pool->used_bitmap[bmp_pos] | start_mask;
-		start_mask = 0;
-		if (bmp_val != ~0UL) {
-			page_nr = ffz(bmp_val) + bmp_pos * BITS_PER_LONG;
-			if (page_nr >= pool->pages)
+	while (num > 0) {
+		for (order = 0; order < PAGE_POOL_MAX_ORDER; order++)
+			if (nr & (1UL << order) || (2UL << order) > num)
 				break;
-			return page_nr;
-		}
+		free_block(pool, nr, order);
+		nr += 1UL << order;
+		num -= 1UL << order;
 	}
+}
 
-	return INVALID_PAGE_NR;
+static void page_pool_init(struct page_pool *pool, void *meta,
+			   unsigned long reserved_pages)
+{
+	unsigned int order;
+	unsigned long n;
+
+	pool->frames = meta;
+	pool->frame_order = meta + pool->pages * sizeof(struct page_frame);
+	for (n = 0; n < pool->pages; n++)
+		pool->frame_order[n] = FRAME_NOT_FREE;
+	for (order = 0; order <= PAGE_POOL_MAX_ORDER; order++)
+		pool->free_list[order] = INVALID_PAGE_NR;
+	pool->free_blocks = 0;
+	pool->deferred = INVALID_PAGE_NR;
+
+	pool->used_pages = pool->pages;
+	free_range(pool, reserved_pages, pool->pages - reserved_pages);
+	pool->peak_used_pages = pool->used_pages;
 }
 
-void *page_alloc(struct page_pool *pool, unsigned int num)
+static void *__page_alloc(struct page_pool *pool, unsigned int num)
 {
-	unsigned long start, last, next;
-	unsigned int allocated;
+	unsigned int order = 0, n;
+	unsigned long nr;
 
-	start = find_next_free_page(pool, 0);
-	if (start == INVALID_PAGE_NR)
+	if (num == 0)
 		return NULL;
 
-restart:
-	for (allocated = 1, last = start; allocated < num;
-	     allocated++, last = next) {
-		next = find_next_free_page(pool, last + 1);
-		if (next == INVALID_PAGE_NR)
-			return NULL;
-		if (next != last + 1) {
-			start = next;
-			goto restart;
-		}
+	while ((1UL << order) < num)
+		order++;
+
+	for (n = order; n <= PAGE_POOL_MAX_ORDER; n++)
+		if (pool->free_list[n] != INVALID_PAGE_NR)
+			break;
+	if (n > PAGE_POOL_MAX_ORDER)
+		return NULL;
+
+	nr = pool->free_list[n];
+	free_list_del(pool, nr, n);
+
+	/* split down to the requested order, keeping the lower half */
+	while (n > order) {
+		n--;
+		free_list_add(pool, nr + (1UL << n), n);
 	}
 
-	for (allocated = 0; allocated < num; allocated++)
-		set_bit(start + allocated, pool->used_bitmap);
+	pool->used_pages += 1UL << order;
+	if (pool->used_pages > pool->peak_used_pages)
+		pool->peak_used_pages = pool->used_pages;
+	free_range(pool, nr + num, (1UL << order) - num);
+
+	return pool->base_address + nr * PAGE_SIZE;
+}
+
+void *page_alloc(struct page_pool *pool, unsigned int num)
+{
+	void *page;
 
-	pool->used_pages += num;
+	spin_lock(&pool->lock);
+	page = __page_alloc(pool, num);
+	spin_unlock(&pool->lock);
 
-	return pool->base_address + start * PAGE_SIZE;
+	return page;
 }
 
 void page_free(struct page_pool *pool, void *page, unsigned int num)
 {
-	unsigned long page_nr;
+	unsigned long nr;
 
-	if (!page)
+	if (!page || num == 0)
 		return;
 
-	while (num-- > 0) {
-		if (pool->flags & PAGE_SCRUB_ON_FREE)
-			memset(page, 0, PAGE_SIZE);
-		page_nr = (page - pool->base_address) / PAGE_SIZE;
-		clear_bit(page_nr, pool->used_bitmap);
-		pool->used_pages--;
-		page += PAGE_SIZE;
+	if (pool->flags & PAGE_SCRUB_ON_FREE)
+		clear_pages(page, num);
+
+	nr = (page - pool->base_address) / PAGE_SIZE;
+
+	spin_lock(&pool->lock);
+	if (defer_frees) {
+		/* the links of allocated frames are unused */
+		pool->frames[nr].next = pool->deferred;
+		pool->frames[nr].prev = num;
+		pool->deferred = nr;
+	} else {
+		free_range(pool, nr, num);
+	}
+	spin_unlock(&pool->lock);
+}
+
+/*
+ * Page tables unlinked during a reconfiguration may still be walked via
+ * stale IOMMU or TLB entries until the configuration is committed. Until
+ * then, freed pages are kept off the free lists so that they cannot be
+ * reused for other tables or data.
+ */
+void page_pool_defer_frees(void)
+{
+	defer_frees = true;
+}
+
+static void release_deferred(struct page_pool *pool)
+{
+	unsigned long nr, num;
+
+	spin_lock(&pool->lock);
+	while (pool->deferred != INVALID_PAGE_NR) {
+		nr = pool->deferred;
+		num = pool->frames[nr].prev;
+		pool->deferred = pool->frames[nr].next;
+		free_range(pool, nr, num);
 	}
+	spin_unlock(&pool->lock);
+}
+
+/* to be called once the commit has invalidated all caches */
+void page_pool_release_deferred(void)
+{
+	unsigned int node;
+
+	defer_frees = false;
+
+	release_deferred(&mem_pool);
+	release_deferred(&remap_pool);
+	for (node = 0; node < JAILHOUSE_MAX_NUMA_NODES; node++)
+		if (numa_pools[node].pages > 0)
+			release_deferred(&numa_pools[node]);
+}
+
+void page_pool_publish_stats(struct page_pool *pool,
+			     struct jailhouse_pool_stats *stats)
+{
+	spin_lock(&pool->lock);
+	stats->pages = pool->pages;
+	pool->stats = stats;
+	page_pool_update_stats(pool);
+	spin_unlock(&pool->lock);
+}
+
+struct page_pool *numa_pool(unsigned int node)
+{
+	if (node < JAILHOUSE_MAX_NUMA_NODES && numa_pools[node].pages > 0)
+		return &numa_pools[node];
+	return &mem_pool;
+}
+
+unsigned int cpu_numa_node(unsigned int cpu)
+{
+	unsigned int node;
+
+	for (node = 0; node < JAILHOUSE_MAX_NUMA_NODES; node++)
+		if (numa_pools[node].pages > 0 && cpu < 64 &&
+		    system_config->numa_nodes[node].cpus & (1UL << cpu))
+			return node;
+	return NUMA_NO_NODE;
+}
+
+static struct page_pool *page_pool_of(void *page)
+{
+	struct page_pool *pool;
+
+	for (pool = numa_pools; pool < &numa_pools[JAILHOUSE_MAX_NUMA_NODES];
+	     pool++)
+		if (page >= pool->base_address &&
+		    page < pool->base_address + pool->pages * PAGE_SIZE)
+			return pool;
+	return &mem_pool;
+}
+
+/*
+ * Page table pages come from the pool of the table root, so tables of a
+ * node-local root stay on that node. For mem_pool, they are taken via
+ * per-CPU magazines so that the pool lock is only acquired once per
+ * PAGE_MAGAZINE_BATCH pages. Pages in a magazine are scrubbed like free
+ * pages of the pool.
+ */
+static void *page_table_alloc(pgd_t *page_table)
+{
+	struct page_pool *pool = page_pool_of(page_table);
+	struct page_magazine *mag;
+	void *page;
+
+	if (pool != &mem_pool || !magazines)
+		return page_alloc(pool, 1);
+
+	mag = &magazines[this_cpu_data()->cpu_id];
+	if (mag->count > 0) {
+		mag->hits++;
+		return mag->pages[--mag->count];
+	}
+
+	mag->misses++;
+	spin_lock(&mem_pool.lock);
+	while (mag->count < PAGE_MAGAZINE_BATCH) {
+		page = __page_alloc(&mem_pool, 1);
+		if (!page)
+			break;
+		mag->pages[mag->count++] = page;
+	}
+	spin_unlock(&mem_pool.lock);
+
+	if (mag->count == 0)
+		return NULL;
+	return mag->pages[--mag->count];
+}
+
+static void page_table_free(void *page)
+{
+	struct page_pool *pool = page_pool_of(page);
+	struct page_magazine *mag;
+
+	if (pool != &mem_pool || !magazines || defer_frees) {
+		page_free(pool, page, 1);
+		return;
+	}
+
+	mag = &magazines[this_cpu_data()->cpu_id];
+	clear_pages(page, 1);
+
+	if (mag->count == PAGE_MAGAZINE_SIZE) {
+		spin_lock(&mem_pool.lock);
+		while (mag->count > PAGE_MAGAZINE_SIZE - PAGE_MAGAZINE_BATCH)
+			free_range(&mem_pool,
+				   (mag->pages[--mag->count] -
+				    mem_pool.base_address) / PAGE_SIZE, 1);
+		spin_unlock(&mem_pool.lock);
+	}
+	mag->pages[mag->count++] = page;
 }
 
 static void flush_page_table(void *addr, unsigned long size,
@@ -110,24 +357,121 @@ static void flush_page_table(void *addr, unsigned long size,
 		flush_cache(addr, size);
 }
 
+static void flush_hv_tlb(pgd_t *page_table, unsigned long virt,
+			 unsigned long size)
+{
+	if (page_table != hv_page_table)
+		return;
+	if (size == PAGE_SIZE)
+		flush_tlb_page(virt);
+	else
+		flush_tlb();
+}
+
+static unsigned long page_span(unsigned long virt, unsigned long size,
+			       unsigned long page_size)
+{
+	unsigned long span = page_size - (virt & (page_size - 1));
+
+	return span < size ? span : size;
+}
+
+static bool hugepage_fits(unsigned long phys, unsigned long virt,
+			  unsigned long size, unsigned long page_size)
+{
+	return ((phys | virt) & (page_size - 1)) == 0 && size >= page_size;
+}
+
+static void free_pt_table(pmd_t *pmd, unsigned long offs)
+{
+	page_table_free(pte_offset(pmd, offs, 0));
+}
+
+static void free_pmd_table(pud_t *pud, unsigned long offs)
+{
+	pmd_t *pmd = pmd_offset(pud, offs, 0);
+	int n;
+
+	for (n = 0; n < PAGE_SIZE / sizeof(pmd_t); n++, pmd++)
+		if (pmd_valid(pmd) && !pmd_is_hugepage(pmd))
+			free_pt_table(pmd, offs);
+	page_table_free(pmd_offset(pud, offs, 0));
+}
+
+/*
+ * Replace a large page by a table of the next smaller page size that
+ * provides the same translation. The table is filled before it is hooked
+ * up so that concurrent walkers never see partial state.
+ */
+static int split_pud_hugepage(pgd_t *page_table, pud_t *pud,
+			      unsigned long table_flags,
+			      enum page_map_coherent coherent)
+{
+	unsigned long phys = *pud & HUGEPAGE_1G_ADDR_MASK;
+	unsigned long flags = hugepage_flags(*pud);
+	pmd_t *pmd;
+	int n;
+
+	pmd = page_table_alloc(page_table);
+	if (!pmd)
+		return -ENOMEM;
+	for (n = 0; n < PAGE_SIZE / sizeof(pmd_t); n++, phys += HUGEPAGE_SIZE)
+		set_pmd_hugepage(&pmd[n], phys, flags);
+	flush_page_table(pmd, PAGE_SIZE, coherent);
+
+	set_pud(pud, page_map_hvirt2phys(pmd),
+		table_flags | (flags & PAGE_TABLE_FLAGS_MASK));
+	flush_page_table(pud, sizeof(pud), coherent);
+
+	return 0;
+}
+
+static int split_pmd_hugepage(pgd_t *page_table, pmd_t *pmd,
+			      unsigned long table_flags,
+			      enum page_map_coherent coherent)
+{
+	unsigned long phys = *pmd & HUGEPAGE_ADDR_MASK;
+	unsigned long flags = hugepage_flags(*pmd);
+	pte_t *pte;
+	int n;
+
+	pte = page_table_alloc(page_table);
+	if (!pte)
+		return -ENOMEM;
+	for (n = 0; n < PAGE_SIZE / sizeof(pte_t); n++, phys += PAGE_SIZE)
+		set_pte(&pte[n], phys, flags);
+	flush_page_table(pte, PAGE_SIZE, coherent);
+
+	set_pmd(pmd, page_map_hvirt2phys(pte),
+		table_flags | (flags & PAGE_TABLE_FLAGS_MASK));
+	flush_page_table(pmd, sizeof(pmd), coherent);
+
+	return 0;
+}
+
 int page_map_create(pgd_t *page_table, unsigned long phys, unsigned long size,
 		    unsigned long virt, unsigned long flags,
 		    unsigned long table_flags, unsigned int levels,
-		    enum page_map_coherent coherent)
+		    unsigned long huge_pages, enum page_map_coherent coherent)
 {
 	unsigned long offs = hypervisor_header.page_offset;
+	unsigned long start = virt, flush_size, page_size;
+	pud_t *pud, old_pud;
+	pmd_t *pmd, old_pmd;
 	pgd_t *pgd;
-	pud_t *pud;
-	pmd_t *pmd;
 	pte_t *pte;
+	int err;
 
-	for (size = PAGE_ALIGN(size); size > 0;
-	     phys += PAGE_SIZE, virt += PAGE_SIZE, size -= PAGE_SIZE) {
+	size = PAGE_ALIGN(size);
+	flush_size = size;
+
+	for (; size > 0;
+	     phys += page_size, virt += page_size, size -= page_size) {
 		switch (levels) {
 		case 4:
 			pgd = pgd_offset(page_table, virt);
 			if (!pgd_valid(pgd)) {
-				pud = page_alloc(&mem_pool, 1);
+				pud = page_table_alloc(page_table);
 				if (!pud)
 					return -ENOMEM;
 				set_pgd(pgd, page_map_hvirt2phys(pud),
@@ -143,45 +487,84 @@ int page_map_create(pgd_t *page_table, unsigned long phys, unsigned long size,
 			return -EINVAL;
 		}
 
+		if (huge_pages & PAGE_MAP_HUGE_1G &&
+		    hugepage_fits(phys, virt, size, HUGEPAGE_1G_SIZE)) {
+			old_pud = *pud;
+			set_pud_hugepage(pud, phys, flags);
+			flush_page_table(pud, sizeof(pud), coherent);
+			if (pud_valid(&old_pud) && !pud_is_hugepage(&old_pud))
+				free_pmd_table(&old_pud, offs);
+			page_size = HUGEPAGE_1G_SIZE;
+			continue;
+		}
+
 		if (!pud_valid(pud)) {
-			pmd = page_alloc(&mem_pool, 1);
+			pmd = page_table_alloc(page_table);
 			if (!pmd)
 				return -ENOMEM;
 			set_pud(pud, page_map_hvirt2phys(pmd), table_flags);
 			flush_page_table(pud, sizeof(pud), coherent);
+		} else if (pud_is_hugepage(pud)) {
+			err = split_pud_hugepage(page_table, pud, table_flags,
+						 coherent);
+			if (err)
+				return err;
 		}
 
 		pmd = pmd_offset(pud, offs, virt);
+		if (huge_pages & PAGE_MAP_HUGE_2M &&
+		    hugepage_fits(phys, virt, size, HUGEPAGE_SIZE)) {
+			old_pmd = *pmd;
+			set_pmd_hugepage(pmd, phys, flags);
+			flush_page_table(pmd, sizeof(pmd), coherent);
+			if (pmd_valid(&old_pmd) && !pmd_is_hugepage(&old_pmd))
+				free_pt_table(&old_pmd, offs);
+			page_size = HUGEPAGE_SIZE;
+			continue;
+		}
+
 		if (!pmd_valid(pmd)) {
-			pte = page_alloc(&mem_pool, 1);
+			pte = page_table_alloc(page_table);
 			if (!pte)
 				return -ENOMEM;
 			set_pmd(pmd, page_map_hvirt2phys(pte), table_flags);
 			flush_page_table(pmd, sizeof(pmd), coherent);
+		} else if (pmd_is_hugepage(pmd)) {
+			err = split_pmd_hugepage(page_table, pmd, table_flags,
+						 coherent);
+			if (err)
+				return err;
 		}
 
 		pte = pte_offset(pmd, offs, virt);
 		set_pte(pte, phys, flags);
 		flush_page_table(pte, sizeof(pte), coherent);
+		page_size = PAGE_SIZE;
 	}
 
-	flush_tlb();
+	flush_hv_tlb(page_table, start, flush_size);
 
 	return 0;
 }
 
-void page_map_destroy(pgd_t *page_table, unsigned long virt,
-		      unsigned long size, unsigned int levels,
-		      enum page_map_coherent coherent)
+int page_map_destroy(pgd_t *page_table, unsigned long virt,
+		     unsigned long size, unsigned long table_flags,
+		     unsigned int levels, enum page_map_coherent coherent)
 {
 	unsigned long offs = hypervisor_header.page_offset;
+	unsigned long start = virt, flush_size, page_size;
+	int err = 0;
 	pgd_t *pgd;
 	pud_t *pud;
 	pmd_t *pmd;
 	pte_t *pte;
 
-	for (size = PAGE_ALIGN(size); size > 0;
-	     virt += PAGE_SIZE, size -= PAGE_SIZE) {
+	size = PAGE_ALIGN(size);
+	flush_size = size;
+
+	for (; size > 0; virt += page_size, size -= page_size) {
+		page_size = page_span(virt, size, HUGEPAGE_1G_SIZE);
+
 		switch (levels) {
 		case 4:
 			pgd = pgd_offset(page_table, virt);
@@ -195,39 +578,173 @@ void page_map_destroy(pgd_t *page_table, unsigned long virt,
 			pud = pud3l_offset(page_table, virt);
 			break;
 		default:
-			return;
+			return -EINVAL;
 		}
 		if (!pud_valid(pud))
 			continue;
 
+		if (pud_is_hugepage(pud)) {
+			if (page_size == HUGEPAGE_1G_SIZE)
+				goto clear_pud_hugepage;
+			/* On failure, rather drop the whole page than leaving
+			 * the unmapped range accessible. */
+			if (split_pud_hugepage(page_table, pud, table_flags,
+					       coherent) < 0) {
+				err = -ENOMEM;
+				goto clear_pud_hugepage;
+			}
+		}
+
+		page_size = page_span(virt, size, HUGEPAGE_SIZE);
+
 		pmd = pmd_offset(pud, offs, virt);
 		if (!pmd_valid(pmd))
 			continue;
 
+		if (pmd_is_hugepage(pmd)) {
+			if (page_size == HUGEPAGE_SIZE)
+				goto clear_pmd_hugepage;
+			if (split_pmd_hugepage(page_table, pmd, table_flags,
+					       coherent) < 0) {
+				err = -ENOMEM;
+				goto clear_pmd_hugepage;
+			}
+		}
+
+		page_size = PAGE_SIZE;
+
 		pte = pte_offset(pmd, offs, virt);
 		clear_pte(pte);
 		flush_page_table(pte, sizeof(pte), coherent);
 
 		if (!pt_empty(pmd, offs))
 			continue;
-		page_free(&mem_pool, pte_offset(pmd, offs, 0), 1);
+		free_pt_table(pmd, offs);
+clear_pmd_hugepage:
 		clear_pmd(pmd);
 		flush_page_table(pmd, sizeof(pmd), coherent);
 
 		if (!pmd_empty(pud, offs))
 			continue;
-		page_free(&mem_pool, pmd_offset(pud, offs, 0), 1);
+		page_table_free(pmd_offset(pud, offs, 0));
+clear_pud_hugepage:
 		clear_pud(pud);
 		flush_page_table(pud, sizeof(pud), coherent);
 
 		if (levels < 4 || !pud_empty(pgd, offs))
 			continue;
-		page_free(&mem_pool, pud4l_offset(pgd, offs, 0), 1);
+		page_table_free(pud4l_offset(pgd, offs, 0));
 		clear_pgd(pgd);
 		flush_page_table(pgd, sizeof(pgd), coherent);
 	}
 
-	flush_tlb();
+	flush_hv_tlb(page_table, start, flush_size);
+
+	return err;
+}
+
+static unsigned long count_pmd_tables(pud_t *pud, unsigned long offs)
+{
+	pmd_t *pmd = pmd_offset(pud, offs, 0);
+	unsigned long tables = 1;
+	int n;
+
+	for (n = 0; n < PAGE_SIZE / sizeof(pmd_t); n++, pmd++)
+		if (pmd_valid(pmd) && !pmd_is_hugepage(pmd))
+			tables++;
+	return tables;
+}
+
+static unsigned long count_pud_tables(pud_t *pud, unsigned long offs)
+{
+	unsigned long tables = 1;
+	int n;
+
+	for (n = 0; n < PAGE_SIZE / sizeof(pud_t); n++, pud++)
+		if (pud_valid(pud) && !pud_is_hugepage(pud))
+			tables += count_pmd_tables(pud, offs);
+	return tables;
+}
+
+/* number of pages the page table occupies, including its root */
+unsigned long page_map_count_tables(pgd_t *page_table, unsigned int levels)
+{
+	unsigned long offs = hypervisor_header.page_offset;
+	unsigned long tables = 1;
+	pgd_t *pgd = page_table;
+	int n;
+
+	if (levels == 3)
+		return count_pud_tables(pud3l_offset(page_table, 0), offs);
+
+	for (n = 0; n < PAGE_SIZE / sizeof(pgd_t); n++, pgd++)
+		if (pgd_valid(pgd))
+			tables += count_pud_tables(pud4l_offset(pgd, offs, 0),
+						   offs);
+	return tables;
+}
+
+/* visits the leaves like page_map_destroy, but without splitting them */
+void page_map_walk(pgd_t *page_table, unsigned long virt, unsigned long size,
+		   unsigned int levels, page_map_walk_fn fn, void *arg)
+{
+	unsigned long offs = hypervisor_header.page_offset;
+	unsigned long page_size;
+	pgd_t *pgd;
+	pud_t *pud;
+	pmd_t *pmd;
+	pte_t *pte;
+
+	size = PAGE_ALIGN(size);
+
+	for (; size > 0; virt += page_size, size -= page_size) {
+		page_size = page_span(virt, size, HUGEPAGE_1G_SIZE);
+
+		if (levels == 4) {
+			pgd = pgd_offset(page_table, virt);
+			if (!pgd_valid(pgd))
+				continue;
+			pud = pud4l_offset(pgd, offs, virt);
+		} else {
+			pud = pud3l_offset(page_table, virt);
+		}
+		if (!pud_valid(pud))
+			continue;
+		if (pud_is_hugepage(pud)) {
+			fn(pud, page_size, arg);
+			continue;
+		}
+
+		page_size = page_span(virt, size, HUGEPAGE_SIZE);
+
+		pmd = pmd_offset(pud, offs, virt);
+		if (!pmd_valid(pmd))
+			continue;
+		if (pmd_is_hugepage(pmd)) {
+			fn(pmd, page_size, arg);
+			continue;
+		}
+
+		page_size = PAGE_SIZE;
+
+		pte = pte_offset(pmd, offs, virt);
+		if (pte_valid(pte))
+			fn(pte, page_size, arg);
+	}
+}
+
+static void *map_foreign_entry(unsigned long page_virt,
+			       unsigned long entry_phys)
+{
+	int err;
+
+	err = page_map_create(hv_page_table, entry_phys, PAGE_SIZE, page_virt,
+			      PAGE_READONLY_FLAGS, PAGE_DEFAULT_FLAGS,
+			      PAGE_DIR_LEVELS, PAGE_MAP_NO_HUGE,
+			      PAGE_MAP_NON_COHERENT);
+	if (err)
+		return NULL;
+	return (void *)(page_virt + (entry_phys & ~PAGE_MASK));
 }
 
 void *page_map_get_foreign_page(unsigned int mapping_region,
@@ -235,7 +752,7 @@ void *page_map_get_foreign_page(unsigned int mapping_region,
 				unsigned long page_table_offset,
 				unsigned long virt, unsigned long flags)
 {
-	unsigned long page_virt, phys;
+	unsigned long page_virt, phys, entry_phys;
 #if PAGE_DIR_LEVELS == 4
 	pgd_t *pgd;
 #endif
@@ -247,135 +764,212 @@ void *page_map_get_foreign_page(unsigned int mapping_region,
 	page_virt = FOREIGN_MAPPING_BASE +
 		mapping_region * PAGE_SIZE * NUM_FOREIGN_PAGES;
 
-	phys = page_table_paddr + page_table_offset;
-	err = page_map_create(hv_page_table, phys, PAGE_SIZE, page_virt,
-			      PAGE_READONLY_FLAGS, PAGE_DEFAULT_FLAGS,
-			      PAGE_DIR_LEVELS, PAGE_MAP_NON_COHERENT);
-	if (err)
-		return NULL;
-
 #if PAGE_DIR_LEVELS == 4
-	pgd = pgd_offset((pgd_t *)page_virt, virt);
-	if (!pgd_valid(pgd))
+	entry_phys = (unsigned long)
+		pgd_offset((pgd_t *)(page_table_paddr + page_table_offset),
+			   virt);
+	pgd = map_foreign_entry(page_virt, entry_phys);
+	if (!pgd || !pgd_valid(pgd))
 		return NULL;
-	phys = (unsigned long)pud4l_offset(pgd, page_table_offset, 0);
-	err = page_map_create(hv_page_table, phys, PAGE_SIZE, page_virt,
-			      PAGE_READONLY_FLAGS, PAGE_DEFAULT_FLAGS,
-			      PAGE_DIR_LEVELS, PAGE_MAP_NON_COHERENT);
-	if (err)
-		return NULL;
-
-	pud = pud4l_offset((pgd_t *)&page_virt, page_table_offset, virt);
+	entry_phys = (unsigned long)pud4l_offset(pgd, page_table_offset, virt);
 #elif PAGE_DIR_LEVELS == 3
-	pud = pud3l_offset((pgd_t *)page_virt, virt);
+	entry_phys = (unsigned long)
+		pud3l_offset((pgd_t *)(page_table_paddr + page_table_offset),
+			     virt);
 #else
 # error Unsupported paging level
 #endif
-	if (!pud_valid(pud))
-		return NULL;
-	phys = (unsigned long)pmd_offset(pud, page_table_offset, 0);
-	err = page_map_create(hv_page_table, phys, PAGE_SIZE, page_virt,
-			      PAGE_READONLY_FLAGS, PAGE_DEFAULT_FLAGS,
-			      PAGE_DIR_LEVELS, PAGE_MAP_NON_COHERENT);
-	if (err)
+	pud = map_foreign_entry(page_virt, entry_phys);
+	if (!pud || !pud_valid(pud))
 		return NULL;
+	if (pud_is_hugepage(pud)) {
+		phys = phys_address_hugepage_1g(pud, virt) + page_table_offset;
+		goto map_page;
+	}
 
-	pmd = pmd_offset((pud_t *)&page_virt, page_table_offset, virt);
-	if (!pmd_valid(pmd))
+	entry_phys = (unsigned long)pmd_offset(pud, page_table_offset, virt);
+	pmd = map_foreign_entry(page_virt, entry_phys);
+	if (!pmd || !pmd_valid(pmd))
 		return NULL;
-	if (pmd_is_hugepage(pmd))
-		phys = phys_address_hugepage(pmd, virt);
-	else {
-		phys = (unsigned long)pte_offset(pmd, page_table_offset, 0);
-		err = page_map_create(hv_page_table, phys, PAGE_SIZE,
-				      page_virt, PAGE_READONLY_FLAGS,
-				      PAGE_DEFAULT_FLAGS, PAGE_DIR_LEVELS,
-				      PAGE_MAP_NON_COHERENT);
-		if (err)
-			return NULL;
-
-		pte = pte_offset((pmd_t *)&page_virt, page_table_offset, virt);
-		if (!pte_valid(pte))
-			return NULL;
-		phys = phys_address(pte, 0) + page_table_offset;
+	if (pmd_is_hugepage(pmd)) {
+		phys = phys_address_hugepage(pmd, virt) + page_table_offset;
+		goto map_page;
 	}
 
+	entry_phys = (unsigned long)pte_offset(pmd, page_table_offset, virt);
+	pte = map_foreign_entry(page_virt, entry_phys);
+	if (!pte || !pte_valid(pte))
+		return NULL;
+	phys = phys_address(pte, 0) + page_table_offset;
+
+map_page:
 	err = page_map_create(hv_page_table, phys, PAGE_SIZE, page_virt,
 			      flags, PAGE_DEFAULT_FLAGS, PAGE_DIR_LEVELS,
-			      PAGE_MAP_NON_COHERENT);
+			      PAGE_MAP_NO_HUGE, PAGE_MAP_NON_COHERENT);
 	if (err)
 		return NULL;
 
 	return (void *)page_virt;
 }
 
+/*
+ * Node memory is mapped at the same offset as the hypervisor memory, so
+ * page_map_hvirt2phys keeps working for it. Linux cleared it on enable.
+ */
+static int numa_pools_init(void)
+{
+	struct jailhouse_memory *hv_mem = &system_config->hypervisor_memory;
+	struct jailhouse_numa_node *node;
+	struct page_pool *pool;
+	unsigned long virt;
+	unsigned int n;
+	void *meta;
+	int err;
+
+	for (n = 0; n < JAILHOUSE_MAX_NUMA_NODES; n++) {
+		node = &system_config->numa_nodes[n];
+		if (node->size == 0)
+			continue;
+
+		virt = (unsigned long)page_map_phys2hvirt(node->phys_start);
+		if ((node->phys_start | node->size) & ~PAGE_MASK ||
+		    (node->phys_start < hv_mem->phys_start + hv_mem->size &&
+		     node->phys_start + node->size > hv_mem->phys_start) ||
+		    (virt < REMAP_BASE_ADDR + remap_pool.pages * PAGE_SIZE &&
+		     virt + node->size > REMAP_BASE_ADDR)) {
+			printk("FATAL: invalid memory of NUMA node %d\n", n);
+			return -EINVAL;
+		}
+
+		pool = &numa_pools[n];
+		meta = page_alloc(&mem_pool,
+				  page_pool_meta_pages(node->size / PAGE_SIZE));
+		if (!meta)
+			return -ENOMEM;
+
+		err = page_map_create(hv_page_table, node->phys_start,
+				      node->size, virt, PAGE_DEFAULT_FLAGS,
+				      PAGE_DEFAULT_FLAGS, PAGE_DIR_LEVELS,
+				      PAGE_MAP_HUGE_2M, PAGE_MAP_NON_COHERENT);
+		if (err)
+			return err;
+
+		pool->base_address = (void *)virt;
+		pool->pages = node->size / PAGE_SIZE;
+		page_pool_init(pool, meta, 0);
+		pool->flags = PAGE_SCRUB_ON_FREE;
+	}
+	return 0;
+}
+
 int paging_init(void)
 {
-	unsigned long per_cpu_pages, config_pages, bitmap_pages;
-	unsigned long n;
+	unsigned long per_cpu_pages, config_pages, meta_pages;
+	void *remap_meta;
 	int err;
 
 	mem_pool.pages =
 		(hypervisor_header.size - (__page_pool - __start)) / PAGE_SIZE;
 	per_cpu_pages = hypervisor_header.possible_cpus *
 		sizeof(struct per_cpu) / PAGE_SIZE;
-	bitmap_pages = (mem_pool.pages + BITS_PER_PAGE - 1) / BITS_PER_PAGE;
+	meta_pages = page_pool_meta_pages(mem_pool.pages);
 
 	system_config = (struct jailhouse_system *)
 		(__page_pool + per_cpu_pages * PAGE_SIZE);
 	config_pages = (jailhouse_system_config_size(system_config) +
 			PAGE_SIZE - 1) / PAGE_SIZE;
 
-	if (mem_pool.pages <= per_cpu_pages + config_pages + bitmap_pages)
+	if (mem_pool.pages <= per_cpu_pages + config_pages + meta_pages)
 		goto error_nomem;
 
 	mem_pool.base_address = __page_pool;
-	mem_pool.used_bitmap =
-		(unsigned long *)(__page_pool + per_cpu_pages * PAGE_SIZE +
-				  config_pages * PAGE_SIZE);
-	mem_pool.used_pages = per_cpu_pages + config_pages + bitmap_pages;
-	for (n = 0; n < mem_pool.used_pages; n++)
-		set_bit(n, mem_pool.used_bitmap);
+	page_pool_init(&mem_pool,
+		       __page_pool + per_cpu_pages * PAGE_SIZE +
+		       config_pages * PAGE_SIZE,
+		       per_cpu_pages + config_pages + meta_pages);
 	mem_pool.flags = PAGE_SCRUB_ON_FREE;
 
-	remap_pool.used_bitmap = page_alloc(&mem_pool, NUM_REMAP_BITMAP_PAGES);
-	remap_pool.used_pages =
-		hypervisor_header.possible_cpus * NUM_FOREIGN_PAGES;
-	for (n = 0; n < remap_pool.used_pages; n++)
-		set_bit(n, remap_pool.used_bitmap);
+	remap_meta = page_alloc(&mem_pool,
+				page_pool_meta_pages(remap_pool.pages));
+	if (!remap_meta)
+		goto error_nomem;
+	page_pool_init(&remap_pool, remap_meta,
+		       hypervisor_header.possible_cpus * NUM_FOREIGN_PAGES);
 
 	hv_page_table = page_alloc(&mem_pool, 1);
 	if (!hv_page_table)
 		goto error_nomem;
 
+	magazines = page_alloc(&mem_pool,
+			       PAGE_ALIGN(hypervisor_header.possible_cpus *
+					  sizeof(struct page_magazine)) /
+			       PAGE_SIZE);
+	if (!magazines)
+		goto error_nomem;
+
 	/* Replicate hypervisor mapping of Linux */
 	err = page_map_create(hv_page_table, page_map_hvirt2phys(__start),
 			      hypervisor_header.size, (unsigned long)__start,
 			      PAGE_DEFAULT_FLAGS, PAGE_DEFAULT_FLAGS,
-			      PAGE_DIR_LEVELS, PAGE_MAP_NON_COHERENT);
+			      PAGE_DIR_LEVELS, PAGE_MAP_NO_HUGE,
+			      PAGE_MAP_NON_COHERENT);
 	if (err)
 		goto error_nomem;
 
 	/* Make sure any remappings to the foreign regions can be performed
 	 * without allocations of page table pages. */
 	err = page_map_create(hv_page_table, 0,
-			      remap_pool.used_pages * PAGE_SIZE,
+			      hypervisor_header.possible_cpus *
+			      NUM_FOREIGN_PAGES * PAGE_SIZE,
 			      FOREIGN_MAPPING_BASE, PAGE_NONPRESENT_FLAGS,
 			      PAGE_DEFAULT_FLAGS, PAGE_DIR_LEVELS,
-			      PAGE_MAP_NON_COHERENT);
+			      PAGE_MAP_NO_HUGE, PAGE_MAP_NON_COHERENT);
 	if (err)
 		goto error_nomem;
 
-	return 0;
+	err = numa_pools_init();
+	if (err == -ENOMEM)
+		goto error_nomem;
+	return err;
 
 error_nomem:
 	printk("FATAL: page pool much too small\n");
 	return -ENOMEM;
 }
 
+static unsigned long largest_free_block(struct page_pool *pool)
+{
+	int order;
+
+	for (order = PAGE_POOL_MAX_ORDER; order >= 0; order--)
+		if (pool->free_list[order] != INVALID_PAGE_NR)
+			return 1UL << order;
+	return 0;
+}
+
 void page_map_dump_stats(const char *when)
 {
-	printk("Page pool usage %s: mem %d/%d, remap %d/%d\n", when,
-	       mem_pool.used_pages, mem_pool.pages,
-	       remap_pool.used_pages, remap_pool.pages);
+	struct page_magazine *mag = magazines;
+	unsigned int cpu, node;
+
+	printk("Page pool usage %s: mem %d/%d (peak %d), "
+	       "remap %d/%d (peak %d)\n", when,
+	       mem_pool.used_pages, mem_pool.pages, mem_pool.peak_used_pages,
+	       remap_pool.used_pages, remap_pool.pages,
+	       remap_pool.peak_used_pages);
+	printk("Page pool free blocks: mem %d (largest %d pages), "
+	       "remap %d (largest %d pages)\n",
+	       mem_pool.free_blocks, largest_free_block(&mem_pool),
+	       remap_pool.free_blocks, largest_free_block(&remap_pool));
+	for (node = 0; node < JAILHOUSE_MAX_NUMA_NODES; node++)
+		if (numa_pools[node].pages > 0)
+			printk(" NUMA node %d: %d/%d (peak %d)\n", node,
+			       numa_pools[node].used_pages,
+			       numa_pools[node].pages,
+			       numa_pools[node].peak_used_pages);
+	for (cpu = 0; cpu < hypervisor_header.possible_cpus; cpu++, mag++)
+		if (mag->hits || mag->misses)
+			printk(" CPU %d page table cache: %d cached, "
+			       "%d hits, %d misses\n", cpu, mag->count,
+			       mag->hits, mag->misses);
 }
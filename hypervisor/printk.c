@@ -11,32 +11,211 @@
  */
 
 #include <stdarg.h>
+#include <jailhouse/entry.h>
+#include <jailhouse/paging.h>
 #include <jailhouse/printk.h>
 #include <jailhouse/processor.h>
 #include <jailhouse/string.h>
+#include <asm/bitops.h>
+#include <asm/percpu.h>
 #include <asm/spinlock.h>
 
+/*
+ * Once paging is up, printk writes into a ring of the calling CPU without
+ * taking any lock and publishes the message on return. Bytes are reserved
+ * by advancing tail before they are written, so readers treat everything
+ * below tail - JAILHOUSE_LOG_SIZE as overwritten. Linux reads the rings via
+ * JAILHOUSE_HC_CPU_GET_LOG. Unless CONFIG_LOG_NO_UART is set, CPUs of Linux
+ * feed the UART from the rings as far as it accepts data without waiting,
+ * continued on later messages and VM exits. Other cells never pay for the
+ * UART. Early messages and panic_printk are written synchronously.
+ */
+struct log_ring {
+	/* published bytes */
+	volatile unsigned long head;
+	/* reserved bytes, advanced by the owner before writing them */
+	volatile unsigned long tail;
+	/* bytes passed to the UART */
+	unsigned long drained;
+	char data[JAILHOUSE_LOG_SIZE];
+};
+
 volatile unsigned long panic_in_progress;
 unsigned int panic_cpu = -1;
 
 static DEFINE_SPINLOCK(printk_lock);
 
-#define console_write(msg)	arch_dbg_write(msg)
+static struct log_ring *log_rings;
+static unsigned long draining;
+static volatile bool undrained;
+static unsigned int drain_cpu;
+
+static void console_write(const char *msg)
+{
+	unsigned long pos, len;
+	struct log_ring *ring;
+
+	if (!log_rings || panic_in_progress) {
+		arch_dbg_write(msg);
+		return;
+	}
+
+	ring = &log_rings[this_cpu_data()->cpu_id];
+	pos = ring->tail;
+	len = strlen(msg);
+	ring->tail = pos + len;
+	memory_barrier();
+
+	while (*msg)
+		ring->data[pos++ % JAILHOUSE_LOG_SIZE] = *msg++;
+}
+
 #include "printk-core.c"
 
+static void log_drain(bool wait)
+{
+	unsigned long head, tail, offset, len, written;
+	struct log_ring *ring;
+	unsigned int n;
+
+	if (test_and_set_bit(0, &draining))
+		return;
+	undrained = false;
+
+	for (n = 0; n < hypervisor_header.possible_cpus; n++) {
+		ring = &log_rings[drain_cpu];
+		head = ring->head;
+		memory_barrier();
+
+		while (ring->drained != head && !panic_in_progress) {
+			/* skip what the owner has started to overwrite */
+			tail = ring->tail;
+			if (tail - ring->drained > JAILHOUSE_LOG_SIZE) {
+				ring->drained = tail - JAILHOUSE_LOG_SIZE;
+				if ((long)(head - ring->drained) < 0) {
+					ring->drained = head;
+					break;
+				}
+			}
+
+			offset = ring->drained % JAILHOUSE_LOG_SIZE;
+			len = head - ring->drained;
+			if (len > JAILHOUSE_LOG_SIZE - offset)
+				len = JAILHOUSE_LOG_SIZE - offset;
+
+			written = arch_dbg_write_nowait(&ring->data[offset],
+							len);
+			ring->drained += written;
+			if (written < len) {
+				if (wait) {
+					cpu_relax();
+					continue;
+				}
+				/* the UART is busy, continue here later */
+				undrained = true;
+				goto out;
+			}
+		}
+
+		drain_cpu = (drain_cpu + 1) % hypervisor_header.possible_cpus;
+	}
+
+out:
+	clear_bit(0, &draining);
+}
+
+static bool drain_on_this_cpu(void)
+{
+	return this_cpu_data()->cell == &linux_cell;
+}
+
+int printk_init(void)
+{
+	unsigned int pages = PAGE_ALIGN(hypervisor_header.possible_cpus *
+					sizeof(struct log_ring)) / PAGE_SIZE;
+	struct log_ring *rings;
+
+	rings = page_alloc(&mem_pool, pages);
+	if (!rings)
+		return -ENOMEM;
+
+	memory_barrier();
+	log_rings = rings;
+	return 0;
+}
+
 void printk(const char *fmt, ...)
 {
+	struct log_ring *ring;
 	va_list ap;
 
 	va_start(ap, fmt);
 
-	spin_lock(&printk_lock);
-	__vprintk(fmt, ap);
-	spin_unlock(&printk_lock);
+	if (!log_rings) {
+		spin_lock(&printk_lock);
+		__vprintk(fmt, ap);
+		spin_unlock(&printk_lock);
+	} else {
+		ring = &log_rings[this_cpu_data()->cpu_id];
+		__vprintk(fmt, ap);
+		memory_barrier();
+		ring->head = ring->tail;
+#ifndef CONFIG_LOG_NO_UART
+		undrained = true;
+		if (drain_on_this_cpu())
+			log_drain(false);
+#endif
+	}
 
 	va_end(ap);
 }
 
+/* called on VM exits, only costs a test while nothing is pending */
+void printk_drain(void)
+{
+#ifndef CONFIG_LOG_NO_UART
+	if (undrained && drain_on_this_cpu())
+		log_drain(false);
+#endif
+}
+
+/* waits for the UART, for use before the hypervisor memory is released */
+void printk_flush(void)
+{
+#ifndef CONFIG_LOG_NO_UART
+	if (!log_rings)
+		return;
+	while (test_bit(0, &draining))
+		cpu_relax();
+	log_drain(true);
+#endif
+}
+
+const char *printk_log_data(unsigned int cpu_id, unsigned long *head,
+			    unsigned long *tail)
+{
+	if (!log_rings)
+		return NULL;
+
+	*head = log_rings[cpu_id].head;
+	memory_barrier();
+	*tail = log_rings[cpu_id].tail;
+	return log_rings[cpu_id].data;
+}
+
+#ifdef CONFIG_SPINLOCK_STATS
+void spin_lock_print_stats(const char *name, spinlock_t *lock)
+{
+	printk(" %s lock: acquired %lu, contended %lu\n", name,
+	       lock->stats.acquired, lock->stats.contended);
+}
+
+void printk_lock_print_stats(void)
+{
+	spin_lock_print_stats("printk", &printk_lock);
+}
+#endif
+
 void panic_printk(const char *fmt, ...)
 {
 	unsigned int cpu_id = phys_processor_id();
@@ -10,11 +10,13 @@
  * the COPYING file in the top-level directory.
  */
 
+#include <jailhouse/acpi.h>
 #include <jailhouse/processor.h>
 #include <jailhouse/printk.h>
 #include <jailhouse/entry.h>
 #include <jailhouse/paging.h>
 #include <jailhouse/control.h>
+#include <jailhouse/shmem.h>
 #include <jailhouse/string.h>
 #include <asm/spinlock.h>
 
@@ -26,6 +28,7 @@ void *config_memory;
 static DEFINE_SPINLOCK(init_lock);
 static unsigned int master_cpu_id = -1;
 static volatile unsigned int initialized_cpus;
+static volatile bool init_done;
 static volatile int error;
 struct cell linux_cell;
 
@@ -39,6 +42,8 @@ static int register_linux_cpu(struct per_cpu *cpu_data)
 		return -EINVAL;
 
 	cpu_data->cell = &linux_cell;
+	cpu_data->stats = cpu_stats(cpu_data->cpu_id);
+	cpu_data->stats->cell_id = linux_cell.id;
 	set_bit(cpu_data->cpu_id, linux_cell.cpu_set->bitmap);
 	return 0;
 }
@@ -62,6 +67,10 @@ static void init_early(unsigned int cpu_id)
 	if (error)
 		return;
 
+	error = printk_init();
+	if (error)
+		return;
+
 	linux_cell.config = &system_config->system;
 
 	if (system_config->config_memory.size > 0) {
@@ -77,97 +86,126 @@ static void init_early(unsigned int cpu_id)
 				system_config->config_memory.phys_start,
 				size, (unsigned long)config_memory,
 				PAGE_READONLY_FLAGS, PAGE_DEFAULT_FLAGS,
-				PAGE_DIR_LEVELS, PAGE_MAP_NON_COHERENT);
+				PAGE_DIR_LEVELS, PAGE_MAP_NO_HUGE,
+				PAGE_MAP_NON_COHERENT);
 		if (error)
 			return;
 	}
 
+	acpi_init();
+
 	error = check_mem_regions(&system_config->system);
 	if (error)
 		return;
 
+	/* the tables of Linux come from mem_pool, see cell_init */
+	linux_cell.numa_node = NUMA_NO_NODE;
+
 	error = arch_init_early(&linux_cell);
 	if (error)
 		return;
 
-	linux_cell.id = -1;
 	error = cell_init(&linux_cell, false);
 	if (error)
 		return;
+	cell_register(&linux_cell);
+
+	error = stats_init();
+	if (error)
+		return;
+
+	error = shmem_cell_init(&linux_cell);
+	if (error)
+		return;
+	shmem_cell_activate(&linux_cell);
 
 	page_map_dump_stats("after early setup");
-	printk("Initializing first processor:\n");
+	printk("Initializing processors:\n");
 }
 
+/*
+ * Runs in parallel on all CPUs. Apart from the CPU set of the Linux cell
+ * (atomic bitops), only error and initialized_cpus are shared, and they are
+ * updated under init_lock.
+ */
 static void cpu_init(struct per_cpu *cpu_data)
 {
 	int err;
 
-	printk(" CPU %d... ", cpu_data->cpu_id);
-
 	err = register_linux_cpu(cpu_data);
-	if (err)
-		goto failed;
+	if (!err)
+		err = arch_cpu_init(cpu_data);
 
-	err = arch_cpu_init(cpu_data);
-	if (err)
-		goto failed;
+	printk(" CPU %d... %s\n", cpu_data->cpu_id, err ? "FAILED" : "OK");
 
-	printk("OK\n");
-
-	/* If this CPU is last, make sure everything was committed before we
-	 * signal the other CPUs spinning on initialized_cpus that they can
-	 * continue. */
-	memory_barrier();
-	initialized_cpus++;
-	return;
-
-failed:
-	printk("FAILED\n");
-	if (!error)
+	spin_lock(&init_lock);
+	if (err && !error)
 		error = err;
+	else if (!err)
+		initialized_cpus++;
+	spin_unlock(&init_lock);
 }
 
+/* called on the master after all CPUs are initialized */
 static void init_late(void)
 {
-	error = arch_init_late(&linux_cell);
-	if (error)
+	int err;
+
+	err = arch_init_late(&linux_cell);
+	if (err) {
+		error = err;
 		return;
+	}
+
+	/* all CPUs have joined Linux by now */
+	stats_update_cell(&linux_cell, JAILHOUSE_CELL_STATE_RUNNING);
 
 	page_map_dump_stats("after late setup");
-	printk("Initializing remaining processors:\n");
+
+	memory_barrier();
+	init_done = true;
 }
 
 int entry(struct per_cpu *cpu_data)
 {
 	bool master = false;
 
+	/* the others wait here until the master completed the global setup */
 	spin_lock(&init_lock);
-
 	if (master_cpu_id == -1) {
 		master = true;
 		init_early(cpu_data->cpu_id);
 	}
+	spin_unlock(&init_lock);
 
-	if (!error) {
+	if (!error)
 		cpu_init(cpu_data);
 
-		if (master && !error)
+	if (master) {
+		while (!error &&
+		       initialized_cpus < hypervisor_header.online_cpus)
+			cpu_relax();
+		if (!error)
 			init_late();
 	}
 
-	spin_unlock(&init_lock);
-
-	while (!error && initialized_cpus < hypervisor_header.online_cpus)
+	while (!error && !init_done)
 		cpu_relax();
 
 	if (error) {
+		printk_flush();
 		arch_cpu_restore(cpu_data);
 		return error;
 	}
 
-	if (master)
+	if (master) {
+#ifdef CONFIG_SPINLOCK_STATS
+		spin_lock_print_stats("init", &init_lock);
+#endif
 		printk("Activating hypervisor\n");
+	}
+
+	printk_flush();
 
 	/* point of no return */
 	arch_cpu_activate_vmm(cpu_data);
@@ -0,0 +1,227 @@
+/*
+ * Jailhouse, a Linux-based partitioning hypervisor
+ *
+ * Copyright (c) Siemens AG, 2013
+ *
+ * Authors:
+ *  Jan Kiszka <jan.kiszka@siemens.com>
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.  See
+ * the COPYING file in the top-level directory.
+ */
+
+#include <jailhouse/control.h>
+#include <jailhouse/mmio.h>
+#include <jailhouse/paging.h>
+#include <jailhouse/printk.h>
+#include <jailhouse/shmem.h>
+#include <asm/bitops.h>
+#include <asm/spinlock.h>
+
+/*
+ * Endpoints of a cell are kept in a single page. Once the cell runs, they
+ * are linked into the list of active endpoints that doorbell writes are
+ * dispatched against. As cells own their CPUs and interrupt controllers,
+ * ringing a peer is a plain IPI that the receiver takes without VM exit.
+ */
+
+#define SHMEM_MAX_ENDPOINTS	(PAGE_SIZE / sizeof(struct shmem_endpoint))
+
+static DEFINE_SPINLOCK(shmem_lock);
+static struct shmem_endpoint *active_endpoints;
+
+static int shmem_doorbell_access(struct per_cpu *cpu_data, void *arg,
+				 unsigned long offset, unsigned int size,
+				 unsigned long *value, bool is_write)
+{
+	struct shmem_endpoint *endpoint = arg;
+	struct shmem_endpoint *peer;
+
+	if (!is_write) {
+		*value = 0;
+		return 0;
+	}
+	if (offset != JAILHOUSE_SHMEM_DOORBELL)
+		return 0;
+
+	spin_lock(&shmem_lock);
+	for (peer = active_endpoints; peer; peer = peer->next)
+		if (peer->config->id == endpoint->config->id &&
+		    peer->cell != endpoint->cell && peer->config->vector)
+			arch_send_irq(peer->config->cpu, peer->config->vector);
+	spin_unlock(&shmem_lock);
+
+	return 0;
+}
+
+static void shmem_mem_region(const struct jailhouse_shmem *shmem,
+			     struct jailhouse_memory *mem)
+{
+	mem->phys_start = shmem->phys_start;
+	mem->virt_start = shmem->virt_start;
+	mem->size = shmem->size;
+	mem->access_flags = shmem->flags;
+}
+
+static int shmem_check(struct cell *cell, const struct jailhouse_shmem *shmem)
+{
+	const unsigned long *cpu_set = jailhouse_cell_cpu_set(cell->config);
+	const struct jailhouse_memory *mem =
+		jailhouse_cell_mem_regions(cell->config);
+	unsigned long doorbell = shmem->doorbell_address;
+	unsigned int n;
+
+	if (shmem->size == 0 || (shmem->phys_start & ~PAGE_MASK) ||
+	    (shmem->virt_start & ~PAGE_MASK) || (shmem->size & ~PAGE_MASK) ||
+	    (doorbell & ~PAGE_MASK) ||
+	    shmem->flags & ~(JAILHOUSE_MEM_READ | JAILHOUSE_MEM_WRITE))
+		return -EINVAL;
+
+	/* a mapped doorbell page would never trap */
+	if (doorbell + PAGE_SIZE > shmem->virt_start &&
+	    doorbell < shmem->virt_start + shmem->size)
+		return -EINVAL;
+	for (n = 0; n < cell->config->num_memory_regions; n++, mem++)
+		if (doorbell + PAGE_SIZE > mem->virt_start &&
+		    doorbell < mem->virt_start + mem->size)
+			return -EINVAL;
+
+	/* polled endpoint */
+	if (shmem->vector == 0)
+		return 0;
+
+	if (shmem->cpu >= cell->config->cpu_set_size * 8 ||
+	    !test_bit(shmem->cpu, cpu_set) ||
+	    shmem->vector < SHMEM_MIN_VECTOR)
+		return -EINVAL;
+	return 0;
+}
+
+/* live endpoints of other cells must not notify CPUs that we take over */
+static int shmem_check_targets(struct cell *cell)
+{
+	struct shmem_endpoint *endpoint;
+	int err = 0;
+
+	spin_lock(&shmem_lock);
+	for (endpoint = active_endpoints; endpoint; endpoint = endpoint->next)
+		if (endpoint->cell != cell && endpoint->config->vector &&
+		    endpoint->config->cpu <= cell->cpu_set->max_cpu_id &&
+		    test_bit(endpoint->config->cpu, cell->cpu_set->bitmap)) {
+			printk("ERROR: CPU %d is shmem target of cell \"%s\"\n",
+			       endpoint->config->cpu,
+			       endpoint->cell->config->name);
+			err = -EBUSY;
+			break;
+		}
+	spin_unlock(&shmem_lock);
+
+	return err;
+}
+
+static void shmem_release(struct cell *cell, unsigned int count)
+{
+	struct jailhouse_memory mem;
+
+	while (count-- > 0) {
+		shmem_mem_region(cell->shmem_endpoints[count].config, &mem);
+		mmio_region_unregister(cell,
+			cell->shmem_endpoints[count].config->doorbell_address);
+		arch_unmap_memory_region(cell, &mem);
+	}
+	page_free(&mem_pool, cell->shmem_endpoints, 1);
+	cell->shmem_endpoints = NULL;
+}
+
+/*
+ * Maps the shared regions and traps the doorbells of a cell whose CPUs are
+ * not running yet. The endpoints become visible to peers on activation.
+ */
+int shmem_cell_init(struct cell *cell)
+{
+	const struct jailhouse_shmem *shmem =
+		jailhouse_cell_shmem(cell->config);
+	unsigned int num = cell->config->num_shmem;
+	struct shmem_endpoint *endpoint;
+	struct jailhouse_memory mem;
+	unsigned int n;
+	int err;
+
+	if (num == 0)
+		return 0;
+	if (num > SHMEM_MAX_ENDPOINTS)
+		return -E2BIG;
+
+	err = shmem_check_targets(cell);
+	if (err)
+		return err;
+
+	cell->shmem_endpoints = page_alloc(&mem_pool, 1);
+	if (!cell->shmem_endpoints)
+		return -ENOMEM;
+
+	for (n = 0; n < num; n++, shmem++) {
+		err = shmem_check(cell, shmem);
+		if (err)
+			goto error;
+
+		shmem_mem_region(shmem, &mem);
+		err = arch_map_memory_region(cell, &mem);
+		if (err)
+			goto error;
+
+		endpoint = &cell->shmem_endpoints[n];
+		endpoint->cell = cell;
+		endpoint->config = shmem;
+		endpoint->next = NULL;
+
+		err = mmio_region_register(cell, shmem->doorbell_address,
+					   PAGE_SIZE, shmem_doorbell_access,
+					   endpoint);
+		if (err) {
+			arch_unmap_memory_region(cell, &mem);
+			goto error;
+		}
+	}
+
+	return 0;
+
+error:
+	shmem_release(cell, n);
+	return err;
+}
+
+void shmem_cell_activate(struct cell *cell)
+{
+	unsigned int n;
+
+	if (!cell->shmem_endpoints)
+		return;
+
+	spin_lock(&shmem_lock);
+	for (n = 0; n < cell->config->num_shmem; n++) {
+		cell->shmem_endpoints[n].next = active_endpoints;
+		active_endpoints = &cell->shmem_endpoints[n];
+	}
+	spin_unlock(&shmem_lock);
+}
+
+/* Peers may ring until the endpoints are unlinked, so do this first. */
+void shmem_cell_exit(struct cell *cell)
+{
+	struct shmem_endpoint **link;
+
+	if (!cell->shmem_endpoints)
+		return;
+
+	spin_lock(&shmem_lock);
+	link = &active_endpoints;
+	while (*link)
+		if ((*link)->cell == cell)
+			*link = (*link)->next;
+		else
+			link = &(*link)->next;
+	spin_unlock(&shmem_lock);
+
+	shmem_release(cell, cell->config->num_shmem);
+}
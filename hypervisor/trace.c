@@ -0,0 +1,92 @@
+/*
+ * Jailhouse, a Linux-based partitioning hypervisor
+ *
+ * Copyright (c) Siemens AG, 2013
+ *
+ * Authors:
+ *  Jan Kiszka <jan.kiszka@siemens.com>
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.  See
+ * the COPYING file in the top-level directory.
+ */
+
+#include <jailhouse/entry.h>
+#include <jailhouse/paging.h>
+#include <jailhouse/processor.h>
+#include <jailhouse/trace.h>
+#include <asm/percpu.h>
+#include <asm/spinlock.h>
+
+/*
+ * Like the log, events are written into a ring of the recording CPU without
+ * locking and published by advancing head. The rings are allocated when
+ * Linux enables tracing for the first time and stay until shutdown.
+ */
+struct trace_ring {
+	/* published events */
+	volatile unsigned long head;
+	struct jailhouse_trace_event events[JAILHOUSE_TRACE_EVENTS];
+};
+
+volatile unsigned long trace_mask;
+
+static DEFINE_SPINLOCK(trace_lock);
+
+static struct trace_ring *trace_rings;
+
+void __trace_event(unsigned int type, unsigned long arg)
+{
+	unsigned int cpu_id = this_cpu_data()->cpu_id;
+	struct trace_ring *ring = &trace_rings[cpu_id];
+	struct jailhouse_trace_event *event =
+		&ring->events[ring->head % JAILHOUSE_TRACE_EVENTS];
+
+	event->timestamp = read_tsc();
+	event->arg = arg;
+	event->type = type;
+	event->cpu_id = cpu_id;
+	memory_barrier();
+	ring->head++;
+}
+
+/* returns the previously enabled events */
+int trace_set_mask(unsigned long mask)
+{
+	unsigned int pages = PAGE_ALIGN(hypervisor_header.possible_cpus *
+					sizeof(struct trace_ring)) / PAGE_SIZE;
+	struct trace_ring *rings;
+	unsigned long old_mask;
+
+	mask &= CONFIG_TRACE_EVENTS;
+
+	spin_lock(&trace_lock);
+
+	if (mask && !trace_rings) {
+		rings = page_alloc(&mem_pool, pages);
+		if (!rings) {
+			spin_unlock(&trace_lock);
+			return -ENOMEM;
+		}
+		/* publish the rings before any event can use them */
+		memory_barrier();
+		trace_rings = rings;
+	}
+
+	old_mask = trace_mask;
+	trace_mask = mask;
+
+	spin_unlock(&trace_lock);
+
+	return old_mask;
+}
+
+const struct jailhouse_trace_event *trace_data(unsigned int cpu_id,
+					       unsigned long *head)
+{
+	if (!trace_rings)
+		return NULL;
+
+	*head = trace_rings[cpu_id].head;
+	memory_barrier();
+	return trace_rings[cpu_id].events;
+}
@@ -15,7 +15,6 @@
 #define NS_PER_MSEC		1000000UL
 #define NS_PER_SEC		1000000000UL
 
-#define NUM_IDT_DESC		33
 #define APIC_TIMER_VECTOR	32
 
 #define X2APIC_EOI		0x80b
@@ -26,37 +25,10 @@
 
 #define APIC_EOI_ACK		0
 
-static u32 idt[NUM_IDT_DESC * 4];
 static unsigned long apic_frequency;
 static unsigned long expected_time;
 static unsigned long min = -1, max;
 
-struct desc_table_reg {
-	u16 limit;
-	u64 base;
-} __attribute__((packed));
-
-static inline unsigned long read_msr(unsigned int msr)
-{
-	u32 low, high;
-
-	asm volatile("rdmsr" : "=a" (low), "=d" (high) : "c" (msr));
-	return low | ((unsigned long)high << 32);
-}
-
-static inline void write_msr(unsigned int msr, unsigned long val)
-{
-	asm volatile("wrmsr"
-		: /* no output */
-		: "c" (msr), "a" (val), "d" (val >> 32)
-		: "memory");
-}
-
-static inline void write_idtr(struct desc_table_reg *val)
-{
-	asm volatile("lidtq %0" : "=m" (*val));
-}
-
 void irq_handler(void)
 {
 	unsigned long delta;
@@ -78,8 +50,6 @@ void irq_handler(void)
 
 static void init_apic(void)
 {
-	unsigned long entry = (unsigned long)irq_entry + FSEGMENT_BASE;
-	struct desc_table_reg dtr;
 	unsigned long start, end;
 	unsigned long tmr;
 
@@ -99,13 +69,8 @@ static void init_apic(void)
 	printk("Calibrated APIC frequency: %lu kHz\n",
 	       (apic_frequency * 16 + 500) / 1000);
 
-	idt[APIC_TIMER_VECTOR * 4] = (entry & 0xffff) | (INMATE_CS << 16);
-	idt[APIC_TIMER_VECTOR * 4 + 1] = 0x8e00 | (entry & 0xffff0000);
-	idt[APIC_TIMER_VECTOR * 4 + 2] = entry >> 32;
-
-	dtr.limit = NUM_IDT_DESC * 16 - 1;
-	dtr.base = (u64)&idt;
-	write_idtr(&dtr);
+	int_set_vector(APIC_TIMER_VECTOR);
+	int_load_idt();
 
 	write_msr(X2APIC_LVTT, APIC_TIMER_VECTOR);
 	expected_time = read_pm_timer();
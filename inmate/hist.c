@@ -0,0 +1,68 @@
+/*
+ * Jailhouse, a Linux-based partitioning hypervisor
+ *
+ * Copyright (c) Siemens AG, 2013
+ *
+ * Authors:
+ *  Jan Kiszka <jan.kiszka@siemens.com>
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.  See
+ * the COPYING file in the top-level directory.
+ */
+
+#include <inmate.h>
+
+/*
+ * Latency histograms in nanoseconds. The counts array is provided by the
+ * caller so that it can be placed in memory shared with Linux. It has to
+ * hold num_buckets + 1 entries, the last one collects everything beyond
+ * the histogram.
+ */
+void hist_init(struct histogram *hist, u32 *counts, unsigned int num_buckets,
+	       unsigned long bucket_ns)
+{
+	hist->counts = counts;
+	hist->num_buckets = num_buckets;
+	hist->bucket_ns = bucket_ns;
+	hist_reset(hist);
+}
+
+void hist_reset(struct histogram *hist)
+{
+	memset(hist->counts, 0, (hist->num_buckets + 1) * sizeof(u32));
+	hist->samples = 0;
+	hist->total = 0;
+	hist->min = -1;
+	hist->max = 0;
+}
+
+void hist_add(struct histogram *hist, unsigned long ns)
+{
+	unsigned long bucket = ns / hist->bucket_ns;
+
+	hist->counts[bucket < hist->num_buckets ? bucket : hist->num_buckets]++;
+	hist->samples++;
+	hist->total += ns;
+	if (ns < hist->min)
+		hist->min = ns;
+	if (ns > hist->max)
+		hist->max = ns;
+}
+
+/*
+ * Returns the upper bound of the bucket that reaches per_10k / 10000 of all
+ * samples, or the maximum if that one lies beyond the histogram.
+ */
+unsigned long hist_percentile(struct histogram *hist, unsigned int per_10k)
+{
+	unsigned long threshold = (hist->samples * per_10k + 9999) / 10000;
+	unsigned long count = 0;
+	unsigned int n;
+
+	for (n = 0; n < hist->num_buckets; n++) {
+		count += hist->counts[n];
+		if (count >= threshold)
+			return (n + 1) * hist->bucket_ns;
+	}
+	return hist->max;
+}
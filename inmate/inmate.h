@@ -30,11 +30,91 @@ typedef unsigned long u64;
 
 typedef enum { true=1, false=0 } bool;
 
+/* for shared Jailhouse headers */
+typedef u8 __u8;
+typedef u16 __u16;
+typedef u32 __u32;
+typedef u64 __u64;
+
 static inline void cpu_relax(void)
 {
 	asm volatile("rep; nop");
 }
 
+static inline void memory_barrier(void)
+{
+	asm volatile("mfence" : : : "memory");
+}
+
+typedef struct {
+	volatile u32 locked;
+} spinlock_t;
+
+#define DEFINE_SPINLOCK(name)	spinlock_t (name)
+
+static inline void spin_lock(spinlock_t *lock)
+{
+	u32 val;
+
+	do {
+		while (lock->locked)
+			cpu_relax();
+		val = 1;
+		asm volatile("xchg %0,%1"
+			: "+r" (val), "+m" (lock->locked) : : "memory");
+	} while (val);
+}
+
+static inline void spin_unlock(spinlock_t *lock)
+{
+	asm volatile("" : : : "memory");
+	lock->locked = 0;
+}
+
+static inline unsigned long read_msr(unsigned int msr)
+{
+	u32 low, high;
+
+	asm volatile("rdmsr" : "=a" (low), "=d" (high) : "c" (msr));
+	return low | ((unsigned long)high << 32);
+}
+
+static inline void write_msr(unsigned int msr, unsigned long val)
+{
+	asm volatile("wrmsr"
+		: /* no output */
+		: "c" (msr), "a" (val), "d" (val >> 32)
+		: "memory");
+}
+
+static inline unsigned long read_tsc(void)
+{
+	u32 low, high;
+
+	asm volatile("rdtsc" : "=a" (low), "=d" (high));
+	return low | ((unsigned long)high << 32);
+}
+
+static inline void cpuid(u32 op, u32 *eax, u32 *ebx, u32 *ecx, u32 *edx)
+{
+	*eax = op;
+	*ecx = 0;
+	asm volatile("cpuid"
+		: "+a" (*eax), "=b" (*ebx), "+c" (*ecx), "=d" (*edx));
+}
+
+#define CPUID_REG(reg)						\
+static inline u32 cpuid_##reg(u32 op)				\
+{								\
+	u32 eax, ebx, ecx, edx;					\
+								\
+	cpuid(op, &eax, &ebx, &ecx, &edx);			\
+	return reg;						\
+}
+
+CPUID_REG(ecx)
+CPUID_REG(edx)
+
 static inline void outb(u8 v, u16 port)
 {
 	asm volatile("outb %0,%1" : : "a" (v), "dN" (port));
@@ -61,8 +141,61 @@ void *memset(void *s, int c, unsigned long n);
 extern u8 irq_entry[];
 void irq_handler(void);
 
+extern u8 stack_top[];
+
 void inmate_main(void);
 
 bool init_pm_timer(void);
 unsigned long read_pm_timer(void);
+
+#define SMP_MAX_CPUS		8
+#define SMP_STACK_SIZE		0x4000
+
+void smp_ap_entry(void);
+unsigned int smp_cpu_id(void);
+bool smp_start_cpu(unsigned int apic_id, void (*entry)(void));
+
+unsigned long init_tsc(void);
+unsigned long tsc_cycles_to_ns(unsigned long cycles);
+unsigned long tsc_read_ns(void);
+bool tsc_deadline_init(unsigned int vector);
+void tsc_deadline_set(unsigned long ns);
+
+void int_set_vector(unsigned int vector);
+void int_load_idt(void);
+
+struct histogram {
+	u32 *counts;
+	unsigned int num_buckets;
+	unsigned long bucket_ns;
+	unsigned long samples;
+	unsigned long min, max, total;
+};
+
+void hist_init(struct histogram *hist, u32 *counts, unsigned int num_buckets,
+	       unsigned long bucket_ns);
+void hist_reset(struct histogram *hist);
+void hist_add(struct histogram *hist, unsigned long ns);
+unsigned long hist_percentile(struct histogram *hist, unsigned int per_10k);
+
+struct jailhouse_ring;
+
+struct ring_channel {
+	struct jailhouse_ring *ring;
+	unsigned long size;
+	volatile u32 *doorbell;
+};
+
+typedef void (*ring_handler)(const void *data, u32 len);
+
+bool ring_channel_setup(struct ring_channel *channel, void *shmem,
+			unsigned long size, void *doorbell, u32 slot_size,
+			u32 flags);
+void ring_channel_attach(struct ring_channel *channel, void *shmem,
+			 unsigned long size, void *doorbell);
+void ring_notify(struct ring_channel *channel);
+bool ring_send(struct ring_channel *channel, const void *data, u32 len);
+u32 ring_receive(struct ring_channel *channel, ring_handler handler);
+void ring_wait_send(struct ring_channel *channel);
+void ring_wait_receive(struct ring_channel *channel);
 #endif
@@ -0,0 +1,52 @@
+/*
+ * Jailhouse, a Linux-based partitioning hypervisor
+ *
+ * Copyright (c) Siemens AG, 2013
+ *
+ * Authors:
+ *  Jan Kiszka <jan.kiszka@siemens.com>
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.  See
+ * the COPYING file in the top-level directory.
+ */
+
+#include <inmate.h>
+
+/*
+ * All vectors enabled via int_set_vector are delivered to irq_handler. The
+ * IDT is shared, each CPU that takes interrupts has to call int_load_idt.
+ */
+#define NUM_IDT_DESC		64
+
+static u32 idt[NUM_IDT_DESC * 4];
+
+struct desc_table_reg {
+	u16 limit;
+	u64 base;
+} __attribute__((packed));
+
+static inline void write_idtr(struct desc_table_reg *val)
+{
+	asm volatile("lidtq %0" : "=m" (*val));
+}
+
+void int_set_vector(unsigned int vector)
+{
+	unsigned long entry = (unsigned long)irq_entry + FSEGMENT_BASE;
+
+	if (vector >= NUM_IDT_DESC)
+		return;
+
+	idt[vector * 4] = (entry & 0xffff) | (INMATE_CS << 16);
+	idt[vector * 4 + 1] = 0x8e00 | (entry & 0xffff0000);
+	idt[vector * 4 + 2] = entry >> 32;
+}
+
+void int_load_idt(void)
+{
+	struct desc_table_reg dtr;
+
+	dtr.limit = NUM_IDT_DESC * 16 - 1;
+	dtr.base = (u64)&idt;
+	write_idtr(&dtr);
+}
@@ -0,0 +1,208 @@
+/*
+ * Jailhouse, a Linux-based partitioning hypervisor
+ *
+ * Copyright (c) Siemens AG, 2013
+ *
+ * Authors:
+ *  Jan Kiszka <jan.kiszka@siemens.com>
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.  See
+ * the COPYING file in the top-level directory.
+ */
+
+#include <inmate.h>
+#include <jailhouse/cell-config.h>
+#include <jailhouse/shmem-echo.h>
+
+/*
+ * Measures IPI round trips through the hypervisor. Within the cell, the CPU
+ * with APIC ID CONFIG_IPI_BENCH_PEER_APIC_ID bounces every IPI back, using
+ * physical and then logical destination mode. Besides the round trip, the
+ * cost of the ICR write on the sender is recorded.
+ *
+ * If CONFIG_IPI_BENCH_SHMEM is set, round trips to "jailhouse shmem echo"
+ * on Linux are measured in addition. The cell then needs a shmem endpoint
+ * that maps the region at CONFIG_IPI_BENCH_SHMEM, traps the doorbell at
+ * CONFIG_IPI_BENCH_DOORBELL and notifies the boot CPU via IPI_VECTOR.
+ */
+#ifndef CONFIG_IPI_BENCH_PEER_APIC_ID
+#define CONFIG_IPI_BENCH_PEER_APIC_ID	1
+#endif
+#ifndef CONFIG_IPI_BENCH_ROUNDS
+#define CONFIG_IPI_BENCH_ROUNDS		100000
+#endif
+
+#define HIST_BUCKETS		1000
+#define HIST_BUCKET_NS		100
+
+#define IPI_VECTOR		33
+
+#define X2APIC_EOI		0x80b
+#define X2APIC_LDR		0x80d
+#define X2APIC_ICR		0x830
+
+#define APIC_EOI_ACK		0
+#define APIC_ICR_DEST_LOGICAL	0x00000800
+
+static u32 round_trip_counts[HIST_BUCKETS + 1];
+static u32 icr_write_counts[HIST_BUCKETS + 1];
+static struct histogram round_trip, icr_write;
+static unsigned int boot_apic_id;
+static volatile unsigned long received;
+static volatile u32 peer_ldr;
+/* set up by the boot CPU for each run */
+static volatile u32 boot_dest, peer_dest;
+static volatile u32 dest_mode;
+
+static void send_ipi(u32 dest)
+{
+	write_msr(X2APIC_ICR,
+		  ((unsigned long)dest << 32) | dest_mode | IPI_VECTOR);
+}
+
+/* the peer bounces every IPI, the boot CPU counts them */
+void irq_handler(void)
+{
+	if (smp_cpu_id() != boot_apic_id)
+		send_ipi(boot_dest);
+	else
+		received++;
+
+	write_msr(X2APIC_EOI, APIC_EOI_ACK);
+}
+
+static void peer_main(void)
+{
+	int_load_idt();
+	peer_ldr = read_msr(X2APIC_LDR);
+	asm volatile("sti");
+
+	while (1)
+		asm volatile("hlt");
+}
+
+static void hist_print(const char *name, struct histogram *hist)
+{
+	printk("  %s: min: %lu avg: %lu max: %lu ns\n", name, hist->min,
+	       hist->total / hist->samples, hist->max);
+	printk("  %s: p50: %lu p99: %lu p99.9: %lu p99.99: %lu ns\n", name,
+	       hist_percentile(hist, 5000), hist_percentile(hist, 9900),
+	       hist_percentile(hist, 9990), hist_percentile(hist, 9999));
+}
+
+static void report(const char *name, unsigned long cycles)
+{
+	printk("%s: %lu round trips, %lu per second\n", name,
+	       round_trip.samples,
+	       round_trip.samples * 1000000000UL / tsc_cycles_to_ns(cycles));
+	hist_print("round trip", &round_trip);
+	if (icr_write.samples > 0)
+		hist_print("ICR write", &icr_write);
+}
+
+static void ping_pong(const char *name, u32 mode, u32 boot, u32 peer)
+{
+	unsigned long start, sent, end, total;
+	unsigned long expected;
+	unsigned int n;
+
+	hist_reset(&round_trip);
+	hist_reset(&icr_write);
+	dest_mode = mode;
+	boot_dest = boot;
+	peer_dest = peer;
+
+	total = read_tsc();
+	for (n = 0; n < CONFIG_IPI_BENCH_ROUNDS; n++) {
+		expected = received + 1;
+		start = read_tsc();
+		send_ipi(peer_dest);
+		sent = read_tsc();
+		while (received != expected)
+			cpu_relax();
+		end = read_tsc();
+
+		hist_add(&icr_write, tsc_cycles_to_ns(sent - start));
+		hist_add(&round_trip, tsc_cycles_to_ns(end - start));
+	}
+	report(name, read_tsc() - total);
+}
+
+#ifdef CONFIG_IPI_BENCH_SHMEM
+static void ping_linux(void)
+{
+	struct jailhouse_echo *echo =
+		(struct jailhouse_echo *)CONFIG_IPI_BENCH_SHMEM;
+	volatile u32 *doorbell = (u32 *)CONFIG_IPI_BENCH_DOORBELL;
+	unsigned long start, end, total;
+	unsigned long expected;
+	unsigned int n;
+
+	echo->ping = echo->pong = 0;
+	memory_barrier();
+	echo->magic = JAILHOUSE_ECHO_MAGIC;
+
+	hist_reset(&round_trip);
+	hist_reset(&icr_write);
+
+	printk("Waiting for Linux echo responder\n");
+
+	total = read_tsc();
+	for (n = 1; n <= CONFIG_IPI_BENCH_ROUNDS; n++) {
+		expected = received + 1;
+		start = read_tsc();
+		echo->ping = n;
+		doorbell[JAILHOUSE_SHMEM_DOORBELL / 4] = 1;
+		while (received != expected || echo->pong != n)
+			cpu_relax();
+		end = read_tsc();
+
+		/* the first round includes the responder startup */
+		if (n == 1)
+			total = end;
+		else
+			hist_add(&round_trip, tsc_cycles_to_ns(end - start));
+	}
+	report("Linux doorbell", read_tsc() - total);
+
+	echo->magic = 0;
+}
+#endif
+
+void inmate_main(void)
+{
+	if (!init_pm_timer()) {
+		printk("IPI benchmark setup failed\n");
+		asm volatile("hlt");
+	}
+	init_tsc();
+	hist_init(&round_trip, round_trip_counts, HIST_BUCKETS,
+		  HIST_BUCKET_NS);
+	hist_init(&icr_write, icr_write_counts, HIST_BUCKETS, HIST_BUCKET_NS);
+
+	boot_apic_id = smp_cpu_id();
+	int_set_vector(IPI_VECTOR);
+	int_load_idt();
+	asm volatile("sti");
+
+	if (smp_start_cpu(CONFIG_IPI_BENCH_PEER_APIC_ID, peer_main)) {
+		ping_pong("Physical destination", 0, boot_apic_id,
+			  CONFIG_IPI_BENCH_PEER_APIC_ID);
+
+		while (!peer_ldr)
+			cpu_relax();
+		ping_pong("Logical destination", APIC_ICR_DEST_LOGICAL,
+			  read_msr(X2APIC_LDR), peer_ldr);
+	} else {
+		printk("Peer CPU with APIC ID %d not available\n",
+		       CONFIG_IPI_BENCH_PEER_APIC_ID);
+	}
+
+#ifdef CONFIG_IPI_BENCH_SHMEM
+	ping_linux();
+#endif
+
+	printk("IPI benchmark done\n");
+	while (1)
+		asm volatile("hlt");
+}
@@ -0,0 +1,221 @@
+/*
+ * Jailhouse, a Linux-based partitioning hypervisor
+ *
+ * Copyright (c) Siemens AG, 2013
+ *
+ * Authors:
+ *  Jan Kiszka <jan.kiszka@siemens.com>
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.  See
+ * the COPYING file in the top-level directory.
+ */
+
+#include <inmate.h>
+
+/*
+ * Measures the latency of periodic timer interrupts against the TSC. The
+ * timer is programmed in TSC-deadline mode if available, in APIC one-shot
+ * mode otherwise. Samples are accumulated in a histogram, reporting is done
+ * outside of the interrupt handler every CONFIG_LATENCY_BENCH_REPORT_SEC.
+ *
+ * If CONFIG_LATENCY_BENCH_SHMEM is set, the results are kept at this address
+ * so that Linux can read them. The cell then needs a memory region shared
+ * with Linux that covers struct latency_results. seq is odd while the
+ * summary is updated, the histogram is updated continuously.
+ */
+#ifndef CONFIG_LATENCY_BENCH_PERIOD_US
+#define CONFIG_LATENCY_BENCH_PERIOD_US		1000
+#endif
+#ifndef CONFIG_LATENCY_BENCH_REPORT_SEC
+#define CONFIG_LATENCY_BENCH_REPORT_SEC		10
+#endif
+#ifndef CONFIG_LATENCY_BENCH_BUCKET_NS
+#define CONFIG_LATENCY_BENCH_BUCKET_NS		1000
+#endif
+#define LATENCY_BUCKETS				1000
+
+#define LATENCY_RESULTS_MAGIC	0x4254414c /* "LATB" */
+
+#define LATENCY_MODE_ONESHOT	0
+#define LATENCY_MODE_DEADLINE	1
+
+#define NS_PER_MSEC		1000000UL
+#define NS_PER_SEC		1000000000UL
+
+#define APIC_TIMER_VECTOR	32
+
+#define X2APIC_EOI		0x80b
+#define X2APIC_LVTT		0x832
+#define X2APIC_TMICT		0x838
+#define X2APIC_TMCCT		0x839
+#define X2APIC_TDCR		0x83e
+
+#define APIC_EOI_ACK		0
+#define APIC_TDCR_DIV_1		0xb
+
+struct latency_results {
+	u32 magic;
+	volatile u32 seq;
+	u32 mode;
+	u32 period_us;
+	u32 bucket_ns;
+	u32 num_buckets;
+	u64 samples;
+	u64 overruns;
+	u64 min_ns;
+	u64 max_ns;
+	u64 avg_ns;
+	u64 p50_ns;
+	u64 p99_ns;
+	u64 p999_ns;
+	u64 p9999_ns;
+	/* the last bucket collects everything beyond the histogram */
+	u32 histogram[LATENCY_BUCKETS + 1];
+};
+
+#ifndef CONFIG_LATENCY_BENCH_SHMEM
+static struct latency_results local_results;
+#endif
+static struct latency_results *results;
+static struct histogram latency_hist;
+static unsigned long apic_khz;
+static unsigned long expected_ns;
+static bool tsc_deadline;
+
+static void arm_timer(unsigned long now)
+{
+	if (tsc_deadline)
+		tsc_deadline_set(expected_ns);
+	else
+		write_msr(X2APIC_TMICT,
+			  (expected_ns - now) * apic_khz / NS_PER_MSEC + 1);
+}
+
+void irq_handler(void)
+{
+	long delta = tsc_read_ns() - expected_ns;
+	unsigned long now;
+
+	hist_add(&latency_hist, delta > 0 ? delta : 0);
+
+	/* skip periods we already missed */
+	expected_ns += CONFIG_LATENCY_BENCH_PERIOD_US * 1000UL;
+	now = tsc_read_ns();
+	while ((long)(expected_ns - now) <= 0) {
+		expected_ns += CONFIG_LATENCY_BENCH_PERIOD_US * 1000UL;
+		results->overruns++;
+	}
+	arm_timer(now);
+
+	write_msr(X2APIC_EOI, APIC_EOI_ACK);
+}
+
+static void report(void)
+{
+	struct histogram *hist = &latency_hist;
+	unsigned long samples = hist->samples;
+
+	if (samples == 0)
+		return;
+
+	results->seq++;
+	memory_barrier();
+	results->samples = samples;
+	results->min_ns = hist->min;
+	results->max_ns = hist->max;
+	results->avg_ns = hist->total / samples;
+	results->p50_ns = hist_percentile(hist, 5000);
+	results->p99_ns = hist_percentile(hist, 9900);
+	results->p999_ns = hist_percentile(hist, 9990);
+	results->p9999_ns = hist_percentile(hist, 9999);
+	memory_barrier();
+	results->seq++;
+
+	printk("samples: %lu overruns: %lu min: %lu avg: %lu max: %lu ns\n",
+	       samples, results->overruns, results->min_ns, results->avg_ns,
+	       results->max_ns);
+	printk("  p50: %lu p99: %lu p99.9: %lu p99.99: %lu ns\n",
+	       results->p50_ns, results->p99_ns, results->p999_ns,
+	       results->p9999_ns);
+}
+
+static void calibrate_apic(void)
+{
+	unsigned long start, end, tmr;
+
+	write_msr(X2APIC_TDCR, APIC_TDCR_DIV_1);
+
+	start = tsc_read_ns();
+	write_msr(X2APIC_TMICT, 0xffffffff);
+
+	while (tsc_read_ns() - start < 100 * NS_PER_MSEC)
+		cpu_relax();
+
+	end = tsc_read_ns();
+	tmr = read_msr(X2APIC_TMCCT);
+	write_msr(X2APIC_TMICT, 0);
+
+	apic_khz = (0xffffffff - tmr) * NS_PER_MSEC / (end - start);
+
+	printk("Calibrated APIC frequency: %lu kHz\n", apic_khz);
+}
+
+static void init_timer(void)
+{
+	int_set_vector(APIC_TIMER_VECTOR);
+	int_load_idt();
+
+	tsc_deadline = tsc_deadline_init(APIC_TIMER_VECTOR);
+	if (!tsc_deadline) {
+		calibrate_apic();
+		write_msr(X2APIC_LVTT, APIC_TIMER_VECTOR);
+	}
+	results->mode = tsc_deadline ?
+		LATENCY_MODE_DEADLINE : LATENCY_MODE_ONESHOT;
+
+	printk("Timer period: %u us, mode: %s\n",
+	       CONFIG_LATENCY_BENCH_PERIOD_US,
+	       tsc_deadline ? "TSC deadline" : "APIC one-shot");
+
+	expected_ns = tsc_read_ns() + CONFIG_LATENCY_BENCH_PERIOD_US * 1000UL;
+	arm_timer(tsc_read_ns());
+
+	asm volatile("sti");
+}
+
+void inmate_main(void)
+{
+	unsigned long next_report, report_samples;
+
+#ifdef CONFIG_LATENCY_BENCH_SHMEM
+	results = (struct latency_results *)CONFIG_LATENCY_BENCH_SHMEM;
+#else
+	results = &local_results;
+#endif
+	memset(results, 0, sizeof(*results));
+	results->period_us = CONFIG_LATENCY_BENCH_PERIOD_US;
+	results->bucket_ns = CONFIG_LATENCY_BENCH_BUCKET_NS;
+	results->num_buckets = LATENCY_BUCKETS;
+	hist_init(&latency_hist, results->histogram, LATENCY_BUCKETS,
+		  CONFIG_LATENCY_BENCH_BUCKET_NS);
+	memory_barrier();
+	results->magic = LATENCY_RESULTS_MAGIC;
+
+	if (!init_pm_timer()) {
+		printk("Latency benchmark setup failed\n");
+		asm volatile("hlt");
+	}
+	init_tsc();
+	init_timer();
+
+	report_samples = CONFIG_LATENCY_BENCH_REPORT_SEC * 1000000UL /
+		CONFIG_LATENCY_BENCH_PERIOD_US;
+	next_report = report_samples;
+	while (1) {
+		asm volatile("hlt");
+		if (latency_hist.samples >= next_report) {
+			report();
+			next_report += report_samples;
+		}
+	}
+}
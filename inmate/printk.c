@@ -39,13 +39,17 @@ static void uart_write(const char *msg)
 #define console_write(msg)	uart_write(msg)
 #include "../hypervisor/printk-core.c"
 
+static DEFINE_SPINLOCK(printk_lock);
+
 void printk(const char *fmt, ...)
 {
 	va_list ap;
 
 	va_start(ap, fmt);
 
+	spin_lock(&printk_lock);
 	__vprintk(fmt, ap);
+	spin_unlock(&printk_lock);
 
 	va_end(ap);
 }
@@ -0,0 +1,67 @@
+/*
+ * Jailhouse, a Linux-based partitioning hypervisor
+ *
+ * Copyright (c) Siemens AG, 2013
+ *
+ * Authors:
+ *  Jan Kiszka <jan.kiszka@siemens.com>
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.  See
+ * the COPYING file in the top-level directory.
+ */
+
+#include <inmate.h>
+
+/*
+ * Streams PM timer samples over a shared memory ring. The cell needs a
+ * shmem endpoint that maps the ring at RING_SHMEM_BASE, traps the doorbell
+ * at RING_DOORBELL and notifies the cell via RING_VECTOR.
+ */
+#define RING_SHMEM_BASE		0x100000
+#define RING_SHMEM_SIZE		0x0ff000
+#define RING_DOORBELL		0x1ff000
+#define RING_VECTOR		33
+#define RING_SLOT_SIZE		64
+
+#define NS_PER_MSEC		1000000UL
+
+#define X2APIC_EOI		0x80b
+#define APIC_EOI_ACK		0
+
+
+/* the doorbell only wakes us up */
+void irq_handler(void)
+{
+	write_msr(X2APIC_EOI, APIC_EOI_ACK);
+}
+
+void inmate_main(void)
+{
+	struct ring_channel channel;
+	unsigned long sample, next;
+
+	int_set_vector(RING_VECTOR);
+	int_load_idt();
+
+	if (!init_pm_timer() ||
+	    !ring_channel_setup(&channel, (void *)RING_SHMEM_BASE,
+				RING_SHMEM_SIZE, (void *)RING_DOORBELL,
+				RING_SLOT_SIZE, 0)) {
+		printk("Ring demo setup failed\n");
+		asm volatile("hlt");
+	}
+
+	printk("Streaming PM timer samples\n");
+
+	next = read_pm_timer();
+	while (1) {
+		do {
+			sample = read_pm_timer();
+			cpu_relax();
+		} while (sample < next);
+		next += NS_PER_MSEC;
+
+		while (!ring_send(&channel, &sample, sizeof(sample)))
+			ring_wait_send(&channel);
+	}
+}
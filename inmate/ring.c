@@ -0,0 +1,120 @@
+/*
+ * Jailhouse, a Linux-based partitioning hypervisor
+ *
+ * Copyright (c) Siemens AG, 2013
+ *
+ * Authors:
+ *  Jan Kiszka <jan.kiszka@siemens.com>
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.  See
+ * the COPYING file in the top-level directory.
+ */
+
+#include <inmate.h>
+#include <jailhouse/cell-config.h>
+#include <jailhouse/shmem-ring.h>
+
+/*
+ * Waiting requires the doorbell vector of the shmem endpoint to be set up
+ * in the IDT with a handler that acknowledges the interrupt.
+ */
+
+static void copy_bytes(u8 *dst, const u8 *src, u32 len)
+{
+	while (len-- > 0)
+		*dst++ = *src++;
+}
+
+static void wait_for_doorbell(void)
+{
+	/* sti takes effect after hlt, so no doorbell can get lost */
+	asm volatile("sti; hlt; cli" : : : "memory");
+}
+
+bool ring_channel_setup(struct ring_channel *channel, void *shmem,
+			unsigned long size, void *doorbell, u32 slot_size,
+			u32 flags)
+{
+	channel->ring = shmem;
+	channel->size = size;
+	channel->doorbell = doorbell;
+
+	return jailhouse_ring_init(channel->ring, size, slot_size, flags) != 0;
+}
+
+/* waits for the peer to set up the ring */
+void ring_channel_attach(struct ring_channel *channel, void *shmem,
+			 unsigned long size, void *doorbell)
+{
+	channel->ring = shmem;
+	channel->size = size;
+	channel->doorbell = doorbell;
+
+	while (!jailhouse_ring_valid(channel->ring, size))
+		cpu_relax();
+}
+
+void ring_notify(struct ring_channel *channel)
+{
+	channel->doorbell[JAILHOUSE_SHMEM_DOORBELL / 4] = 1;
+}
+
+/* Copies a message into the next free slot, fails if the ring is full. */
+bool ring_send(struct ring_channel *channel, const void *data, u32 len)
+{
+	struct jailhouse_ring *ring = channel->ring;
+	struct jailhouse_ring_slot *slot;
+	u32 index;
+
+	if (len > jailhouse_ring_payload_size(ring) ||
+	    jailhouse_ring_reserve(ring, &index, 1) == 0)
+		return false;
+
+	slot = jailhouse_ring_slot(ring, index);
+	slot->len = len;
+	slot->flags = 0;
+	copy_bytes(slot->data, data, len);
+
+	if (jailhouse_ring_commit(ring, index, 1))
+		ring_notify(channel);
+	return true;
+}
+
+/*
+ * Passes all pending messages in place to the handler and releases them as
+ * one batch. Returns the number of messages.
+ */
+u32 ring_receive(struct ring_channel *channel, ring_handler handler)
+{
+	struct jailhouse_ring *ring = channel->ring;
+	struct jailhouse_ring_slot *slot;
+	u32 index, count, n, len;
+
+	count = jailhouse_ring_peek(ring, &index);
+	if (count == 0)
+		return 0;
+
+	for (n = 0; n < count; n++) {
+		slot = jailhouse_ring_slot(ring, index + n);
+		len = slot->len;
+		if (len > jailhouse_ring_payload_size(ring))
+			len = jailhouse_ring_payload_size(ring);
+		handler(slot->data, len);
+	}
+
+	if (jailhouse_ring_release(ring, count))
+		ring_notify(channel);
+	return count;
+}
+
+void ring_wait_send(struct ring_channel *channel)
+{
+	if (jailhouse_ring_producer_idle(channel->ring))
+		wait_for_doorbell();
+}
+
+void ring_wait_receive(struct ring_channel *channel)
+{
+	if (jailhouse_ring_consumer_idle(channel->ring))
+		wait_for_doorbell();
+}
@@ -0,0 +1,74 @@
+/*
+ * Jailhouse, a Linux-based partitioning hypervisor
+ *
+ * Copyright (c) Siemens AG, 2013
+ *
+ * Authors:
+ *  Jan Kiszka <jan.kiszka@siemens.com>
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.  See
+ * the COPYING file in the top-level directory.
+ */
+
+#include <inmate.h>
+
+/*
+ * Starts the CPUs with the APIC IDs listed in CONFIG_SMP_DEMO_APIC_IDS and
+ * lets each of them run a worker loop. The boot CPU reports the progress of
+ * all workers once per second.
+ */
+#ifndef CONFIG_SMP_DEMO_APIC_IDS
+#define CONFIG_SMP_DEMO_APIC_IDS	1
+#endif
+
+#define NS_PER_SEC		1000000000UL
+
+static const unsigned int apic_ids[] = { CONFIG_SMP_DEMO_APIC_IDS };
+
+static volatile unsigned long loops[SMP_MAX_CPUS];
+static unsigned int num_workers;
+static DEFINE_SPINLOCK(worker_lock);
+
+static void worker(void)
+{
+	unsigned int slot;
+
+	spin_lock(&worker_lock);
+	slot = num_workers++;
+	spin_unlock(&worker_lock);
+
+	printk("CPU %d running worker %d\n", smp_cpu_id(), slot);
+
+	while (1) {
+		loops[slot]++;
+		cpu_relax();
+	}
+}
+
+void inmate_main(void)
+{
+	unsigned long next;
+	unsigned int n;
+
+	if (!init_pm_timer()) {
+		printk("SMP demo setup failed\n");
+		asm volatile("hlt");
+	}
+
+	for (n = 0; n < sizeof(apic_ids) / sizeof(apic_ids[0]); n++)
+		if (!smp_start_cpu(apic_ids[n], worker))
+			printk("Failed to start CPU with APIC ID %d\n",
+			       apic_ids[n]);
+
+	next = read_pm_timer();
+	while (1) {
+		while (read_pm_timer() < next)
+			cpu_relax();
+		next += NS_PER_SEC;
+
+		spin_lock(&worker_lock);
+		for (n = 0; n < num_workers; n++)
+			printk("worker %d: %lu loops\n", n, loops[n]);
+		spin_unlock(&worker_lock);
+	}
+}
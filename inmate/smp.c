@@ -0,0 +1,95 @@
+/*
+ * Jailhouse, a Linux-based partitioning hypervisor
+ *
+ * Copyright (c) Siemens AG, 2013
+ *
+ * Authors:
+ *  Jan Kiszka <jan.kiszka@siemens.com>
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.  See
+ * the COPYING file in the top-level directory.
+ */
+
+#include <inmate.h>
+
+/*
+ * Only the first CPU of a cell boots, the others wait for INIT/SIPI. APs are
+ * started one at a time and run through the regular startup code in
+ * header.S. Their stacks are SMP_STACK_SIZE each, placed below the one of
+ * the boot CPU, so the cell memory has to cover
+ * SMP_MAX_CPUS * SMP_STACK_SIZE below stack_top.
+ */
+#define X2APIC_ID		0x802
+#define X2APIC_ICR		0x830
+
+#define APIC_ICR_DLVR_INIT	0x00000500
+#define APIC_ICR_DLVR_SIPI	0x00000600
+#define APIC_ICR_LV_ASSERT	0x00004000
+
+#define SMP_SIPI_VECTOR		(FSEGMENT_BASE >> 12)
+
+#define SMP_INIT_DELAY		100000
+#define SMP_START_TIMEOUT	10000000
+
+/* picked up by the startup code of the AP */
+volatile unsigned long ap_stack;
+
+static void (*volatile ap_entry)(void);
+static volatile bool ap_started;
+static unsigned int smp_cpus = 1;
+
+void smp_ap_entry(void)
+{
+	void (*entry)(void) = ap_entry;
+
+	memory_barrier();
+	ap_started = true;
+
+	entry();
+
+	while (1)
+		asm volatile("cli; hlt");
+}
+
+unsigned int smp_cpu_id(void)
+{
+	return read_msr(X2APIC_ID);
+}
+
+static void send_ipi(unsigned int apic_id, u32 icr_lo)
+{
+	write_msr(X2APIC_ICR, ((unsigned long)apic_id << 32) | icr_lo);
+}
+
+static bool wait_started(unsigned long loops)
+{
+	while (loops-- > 0 && !ap_started)
+		cpu_relax();
+	return ap_started;
+}
+
+bool smp_start_cpu(unsigned int apic_id, void (*entry)(void))
+{
+	unsigned int n;
+
+	if (smp_cpus >= SMP_MAX_CPUS)
+		return false;
+
+	ap_stack = (unsigned long)stack_top - smp_cpus * SMP_STACK_SIZE;
+	ap_entry = entry;
+	ap_started = false;
+	memory_barrier();
+
+	send_ipi(apic_id, APIC_ICR_DLVR_INIT | APIC_ICR_LV_ASSERT);
+	wait_started(SMP_INIT_DELAY);
+
+	/* the second SIPI is ignored if the first one succeeded */
+	for (n = 0; n < 2; n++) {
+		send_ipi(apic_id, APIC_ICR_DLVR_SIPI | SMP_SIPI_VECTOR);
+		if (wait_started(SMP_START_TIMEOUT)) {
+			smp_cpus++;
+			return true;
+		}
+	}
+	return false;
+}
@@ -0,0 +1,137 @@
+/*
+ * Jailhouse, a Linux-based partitioning hypervisor
+ *
+ * Copyright (c) Siemens AG, 2013
+ *
+ * Authors:
+ *  Jan Kiszka <jan.kiszka@siemens.com>
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.  See
+ * the COPYING file in the top-level directory.
+ */
+
+#include <inmate.h>
+#include <jailhouse/cell-config.h>
+
+#define NS_PER_MSEC		1000000UL
+#define NS_PER_SEC		1000000000UL
+
+/* CPUID 1 ECX and CPUID 0x80000007 EDX */
+#define X86_FEATURE_TSC_DEADLINE	(1 << 24)
+#define X86_FEATURE_INVARIANT_TSC	(1 << 8)
+
+#define MSR_IA32_TSC_DEADLINE	0x6e0
+#define X2APIC_LVTT		0x832
+
+#define APIC_LVTT_TSC_DEADLINE	(2 << 17)
+
+/*
+ * Conversions are done with 32.32 fixed-point factors, so reading the time
+ * costs an rdtsc and a multiplication.
+ *
+ * Unless CONFIG_INMATE_TIME_PAGE is 0, the cell config has to map the
+ * hypervisor's time page at that address, by default where config/minimal.c
+ * places it. Its calibration is then taken instead of measuring against the
+ * PM timer. Override the address in jailhouse/config.h.
+ */
+#ifndef CONFIG_INMATE_TIME_PAGE
+#define CONFIG_INMATE_TIME_PAGE		0x100000
+#endif
+
+static unsigned long tsc_to_ns_mult, ns_to_tsc_mult;
+
+#if CONFIG_INMATE_TIME_PAGE
+static unsigned long time_page_tsc_khz(void)
+{
+	struct jailhouse_time_page *page =
+		(struct jailhouse_time_page *)CONFIG_INMATE_TIME_PAGE;
+	unsigned long tsc_khz;
+	u32 seq;
+
+	if (page->magic != JAILHOUSE_TIME_PAGE_MAGIC)
+		return 0;
+
+	do {
+		seq = page->seq;
+		memory_barrier();
+		tsc_khz = page->tsc_khz;
+		memory_barrier();
+	} while ((seq & 1) || page->seq != seq);
+
+	return tsc_khz;
+}
+#else
+static unsigned long time_page_tsc_khz(void)
+{
+	return 0;
+}
+#endif
+
+/*
+ * requires a working PM timer unless the time page is available, returns the
+ * TSC frequency in kHz
+ */
+unsigned long init_tsc(void)
+{
+	unsigned long pm_start, pm_end, tsc_start, tsc_end, tsc_khz;
+
+	if (!(cpuid_edx(0x80000007) & X86_FEATURE_INVARIANT_TSC))
+		printk("WARNING: TSC is not invariant\n");
+
+	tsc_khz = time_page_tsc_khz();
+	if (tsc_khz != 0) {
+		printk("TSC frequency from time page: %lu kHz\n", tsc_khz);
+		goto set_factors;
+	}
+
+	pm_start = read_pm_timer();
+	tsc_start = read_tsc();
+
+	while (read_pm_timer() - pm_start < 100 * NS_PER_MSEC)
+		cpu_relax();
+
+	pm_end = read_pm_timer();
+	tsc_end = read_tsc();
+
+	tsc_khz = (tsc_end - tsc_start) * (NS_PER_SEC / 1000) /
+		(pm_end - pm_start);
+
+	printk("Calibrated TSC frequency: %lu kHz\n", tsc_khz);
+
+set_factors:
+	tsc_to_ns_mult = (NS_PER_SEC << 32) / (tsc_khz * 1000);
+	ns_to_tsc_mult = (tsc_khz << 32) / NS_PER_MSEC;
+
+	return tsc_khz;
+}
+
+unsigned long tsc_cycles_to_ns(unsigned long cycles)
+{
+	return ((unsigned __int128)cycles * tsc_to_ns_mult) >> 32;
+}
+
+unsigned long tsc_read_ns(void)
+{
+	return tsc_cycles_to_ns(read_tsc());
+}
+
+/* switches the APIC timer to TSC-deadline mode if the CPU supports it */
+bool tsc_deadline_init(unsigned int vector)
+{
+	if (!(cpuid_ecx(1) & X86_FEATURE_TSC_DEADLINE))
+		return false;
+
+	write_msr(X2APIC_LVTT, vector | APIC_LVTT_TSC_DEADLINE);
+	return true;
+}
+
+/*
+ * ns is an absolute time as returned by tsc_read_ns, 0 disarms the timer.
+ * The deadline is rounded up so that the timer never fires early.
+ */
+void tsc_deadline_set(unsigned long ns)
+{
+	unsigned long deadline = ((unsigned __int128)ns * ns_to_tsc_mult) >> 32;
+
+	write_msr(MSR_IA32_TSC_DEADLINE, ns ? deadline + 1 : 0);
+}
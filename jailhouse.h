@@ -17,6 +17,7 @@
 struct jailhouse_preload_image {
 	__u64 source_address;
 	__u64 size;
+	/* guest-physical, may be in any memory region of the cell */
 	__u64 target_address;
 	__u64 padding;
 };
@@ -33,7 +34,68 @@ struct jailhouse_cell {
 	__u32 config_size;
 };
 
+struct jailhouse_cell_mem_info {
+	char name[JAILHOUSE_CELL_NAME_MAXLEN+1];
+	struct jailhouse_mem_info info;
+};
+
+struct jailhouse_cell_working_set {
+	char name[JAILHOUSE_CELL_NAME_MAXLEN+1];
+	struct jailhouse_working_set ws;
+};
+
+/* the CPU has to be part of the cell's configuration */
+struct jailhouse_cell_cpu {
+	char name[JAILHOUSE_CELL_NAME_MAXLEN+1];
+	__u32 cpu_id;
+	__u32 padding;
+};
+
+struct jailhouse_cpu_stats_query {
+	__u32 cpu_id;
+	__u32 padding;
+	struct jailhouse_cpu_stats stats;
+};
+
+struct jailhouse_dma_faults_query {
+	__u32 unit;
+	__u32 padding;
+	struct jailhouse_dma_faults faults;
+};
+
+struct jailhouse_cpu_log_query {
+	__u32 cpu_id;
+	__u32 padding;
+	struct jailhouse_cpu_log log;
+};
+
+struct jailhouse_cpu_trace_query {
+	__u32 cpu_id;
+	__u32 padding;
+	struct jailhouse_cpu_trace trace;
+};
+
+/* read from /dev/jailhouse on completion of an asynchronous request */
+struct jailhouse_async_event {
+	__u32 id;
+	__s32 result;
+};
+
 #define JAILHOUSE_ENABLE		_IOW(0, 0, struct jailhouse_system)
 #define JAILHOUSE_DISABLE		_IO(0, 1)
 #define JAILHOUSE_CELL_CREATE		_IOW(0, 2, struct jailhouse_new_cell)
 #define JAILHOUSE_CELL_DESTROY		_IOW(0, 3, struct jailhouse_cell)
+#define JAILHOUSE_CELL_MEM_INFO		_IOWR(0, 4, struct jailhouse_cell_mem_info)
+#define JAILHOUSE_CPU_STATS		_IOWR(0, 5, struct jailhouse_cpu_stats_query)
+#define JAILHOUSE_DMA_FAULTS		_IOWR(0, 6, struct jailhouse_dma_faults_query)
+#define JAILHOUSE_CELL_RESTART		_IOW(0, 7, struct jailhouse_new_cell)
+#define JAILHOUSE_CELL_CREATE_ASYNC	_IOW(0, 8, struct jailhouse_new_cell)
+#define JAILHOUSE_CELL_DESTROY_ASYNC	_IOW(0, 9, struct jailhouse_cell)
+#define JAILHOUSE_CPU_LOG		_IOWR(0, 10, struct jailhouse_cpu_log_query)
+#define JAILHOUSE_CPU_TRACE		_IOWR(0, 11, struct jailhouse_cpu_trace_query)
+/* argument is the JAILHOUSE_TRACE_* event mask, returns the previous one */
+#define JAILHOUSE_TRACE_SET_EVENTS	_IO(0, 12)
+#define JAILHOUSE_CELL_WORKING_SET	_IOWR(0, 13, \
+					      struct jailhouse_cell_working_set)
+#define JAILHOUSE_CELL_ADD_CPU		_IOW(0, 14, struct jailhouse_cell_cpu)
+#define JAILHOUSE_CELL_REMOVE_CPU	_IOW(0, 15, struct jailhouse_cell_cpu)
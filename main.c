@@ -18,18 +18,25 @@
 #include <linux/miscdevice.h>
 #include <linux/firmware.h>
 #include <linux/mm.h>
+#include <linux/poll.h>
 #include <linux/slab.h>
 #include <linux/smp.h>
 #include <linux/uaccess.h>
+#include <linux/vmalloc.h>
+#include <linux/workqueue.h>
 #include <asm/smp.h>
 #include <asm/cacheflush.h>
 
 #include "jailhouse.h"
+#include "shmem.h"
 #include <jailhouse/header.h>
 #include <jailhouse/hypercall.h>
 
 #define JAILHOUSE_FW_NAME	"jailhouse.bin"
 
+/* smaller ranges are not worth distributing over the CPUs */
+#define JAILHOUSE_PARALLEL_CLEAR_MIN	(16 * 1024 * 1024)
+
 MODULE_DESCRIPTION("Loader for Jailhouse partitioning hypervisor");
 MODULE_LICENSE("GPL");
 MODULE_FIRMWARE(JAILHOUSE_FW_NAME);
@@ -41,6 +48,19 @@ static void *hypervisor_mem;
 static cpumask_t offlined_cpus;
 static atomic_t call_done;
 static int error_code;
+/* read-only statistics area of the hypervisor, see jailhouse_mmap */
+static unsigned long stats_pfn;
+static unsigned long stats_size;
+static atomic_t stats_mappings;
+
+/* per open file, collects completions of asynchronous requests */
+struct jailhouse_file {
+	spinlock_t lock;
+	wait_queue_head_t wait;
+	struct list_head events;
+	unsigned int pending;
+	__u32 next_id;
+};
 
 static inline unsigned int
 cell_cpumask_next(int n, const struct jailhouse_cell_desc *config)
@@ -80,6 +100,57 @@ static void *jailhouse_ioremap(phys_addr_t start, unsigned long size)
 #error Unsupported architecture
 #endif
 
+struct clear_work {
+	struct work_struct work;
+	void *start;
+	unsigned long size;
+};
+
+static void clear_work_fn(struct work_struct *work)
+{
+	struct clear_work *clear = container_of(work, struct clear_work, work);
+
+	memset(clear->start, 0, clear->size);
+}
+
+/* clears large ranges in page-aligned chunks on all online CPUs */
+static void clear_memory(void *start, unsigned long size)
+{
+	struct clear_work *clear;
+	unsigned int cpu, num = 0, n;
+	unsigned long chunk;
+
+	clear = NULL;
+	if (size >= JAILHOUSE_PARALLEL_CLEAR_MIN)
+		clear = kcalloc(nr_cpu_ids, sizeof(*clear), GFP_KERNEL);
+	if (!clear) {
+		memset(start, 0, size);
+		return;
+	}
+
+	get_online_cpus();
+
+	chunk = PAGE_ALIGN(DIV_ROUND_UP(size, num_online_cpus()));
+	for_each_online_cpu(cpu) {
+		if (size == 0)
+			break;
+		clear[num].start = start;
+		clear[num].size = min(chunk, size);
+		INIT_WORK(&clear[num].work, clear_work_fn);
+		queue_work_on(cpu, system_wq, &clear[num].work);
+
+		start += clear[num].size;
+		size -= clear[num].size;
+		num++;
+	}
+	for (n = 0; n < num; n++)
+		flush_work(&clear[n].work);
+
+	put_online_cpus();
+
+	kfree(clear);
+}
+
 static void enter_hypervisor(void *info)
 {
 	struct jailhouse_header *header = info;
@@ -96,13 +167,40 @@ static void enter_hypervisor(void *info)
 	atomic_inc(&call_done);
 }
 
+/* the hypervisor expects its node-local pools to be zeroed */
+static int clear_numa_memory(const struct jailhouse_system *config)
+{
+	const struct jailhouse_numa_node *node;
+	unsigned int n;
+	void *mem;
+
+	for (n = 0; n < JAILHOUSE_MAX_NUMA_NODES; n++) {
+		node = &config->numa_nodes[n];
+		if (node->size == 0)
+			continue;
+
+		mem = jailhouse_ioremap(node->phys_start, node->size);
+		if (!mem) {
+			pr_err("jailhouse: Unable to map RAM reserved for NUMA "
+			       "node %u at %08lx\n", n,
+			       (unsigned long)node->phys_start);
+			return -ENOMEM;
+		}
+		clear_memory(mem, node->size);
+		iounmap((__force void __iomem *)mem);
+	}
+	return 0;
+}
+
 static int jailhouse_enable(struct jailhouse_system __user *arg)
 {
 	unsigned long hv_core_size, percpu_size, config_size;
 	const struct firmware *hypervisor;
 	struct jailhouse_system config_header;
 	struct jailhouse_memory *hv_mem = &config_header.hypervisor_memory;
+	struct jailhouse_cell_desc *linux_config;
 	struct jailhouse_header *header;
+	struct jailhouse_system *config;
 	int err;
 
 	if (copy_from_user(&config_header, arg, sizeof(config_header)))
@@ -144,8 +242,8 @@ static int jailhouse_enable(struct jailhouse_system __user *arg)
 	}
 
 	memcpy(hypervisor_mem, hypervisor->data, hypervisor->size);
-	memset(hypervisor_mem + hypervisor->size, 0,
-	       hv_mem->size - hypervisor->size);
+	clear_memory(hypervisor_mem + hypervisor->size,
+		     hv_mem->size - hypervisor->size);
 
 	header = (struct jailhouse_header *)hypervisor_mem;
 	header->size = hv_mem->size;
@@ -153,12 +251,25 @@ static int jailhouse_enable(struct jailhouse_system __user *arg)
 		(unsigned long)hypervisor_mem - hv_mem->phys_start;
 	header->possible_cpus = num_possible_cpus();
 
-	if (copy_from_user(hypervisor_mem + hv_core_size + percpu_size, arg,
-			   config_size)) {
+	config = hypervisor_mem + hv_core_size + percpu_size;
+	if (copy_from_user(config, arg, config_size)) {
 		err = -EFAULT;
 		goto error_unmap;
 	}
 
+	err = clear_numa_memory(config);
+	if (err)
+		goto error_unmap;
+
+	/* the hypervisor memory is inaccessible once we are running on it */
+	linux_config = kmemdup(&config->system,
+			       jailhouse_cell_config_size(&config->system),
+			       GFP_KERNEL);
+	if (!linux_config) {
+		err = -ENOMEM;
+		goto error_unmap;
+	}
+
 	error_code = 0;
 
 	preempt_disable();
@@ -174,19 +285,36 @@ static int jailhouse_enable(struct jailhouse_system __user *arg)
 
 	if (error_code) {
 		err = error_code;
-		goto error_unmap;
+		goto error_free_config;
 	}
 
 	release_firmware(hypervisor);
 
 	enabled = true;
 
+	err = (int)jailhouse_call0(JAILHOUSE_HC_GET_STATS_AREA);
+	if (err > 0) {
+		stats_pfn = err;
+		stats_size = PAGE_ALIGN(jailhouse_stats_size(
+				num_possible_cpus()));
+	} else
+		pr_warn("jailhouse: Statistics area unavailable (%d)\n", err);
+
+	err = jailhouse_shmem_init(linux_config);
+	if (err)
+		pr_warn("jailhouse: Shared memory devices unavailable (%d)\n",
+			err);
+	kfree(linux_config);
+
 	mutex_unlock(&lock);
 
 	pr_info("The Jailhouse is opening.\n");
 
 	return 0;
 
+error_free_config:
+	kfree(linux_config);
+
 error_unmap:
 	iounmap((__force void __iomem *)hypervisor_mem);
 
@@ -226,6 +354,17 @@ static int jailhouse_disable(void)
 		return -EINVAL;
 	}
 
+	/* the statistics area becomes inaccessible on re-enabling */
+	if (atomic_read(&stats_mappings) > 0) {
+		err = -EBUSY;
+		goto unlock_out;
+	}
+
+	/* not restored if disabling fails below */
+	err = jailhouse_shmem_exit();
+	if (err)
+		goto unlock_out;
+
 	error_code = 0;
 
 	preempt_disable();
@@ -242,6 +381,7 @@ static int jailhouse_disable(void)
 		goto unlock_out;
 
 	iounmap((__force void __iomem *)hypervisor_mem);
+	stats_pfn = 0;
 
 	for_each_cpu_mask(cpu, offlined_cpus) {
 		if (cpu_up(cpu) != 0)
@@ -261,69 +401,247 @@ unlock_out:
 	return err;
 }
 
-static int jailhouse_cell_create(struct jailhouse_new_cell __user *arg)
+static const struct jailhouse_memory *
+find_image_region(const struct jailhouse_cell_desc *config,
+		  const struct jailhouse_preload_image *image)
 {
-	struct {
-		struct jailhouse_new_cell cell;
-		struct jailhouse_preload_image image;
-	} cell_buffer;
-	struct jailhouse_new_cell *cell = &cell_buffer.cell;
-	struct jailhouse_preload_image *image = &cell->image[0];
-	struct jailhouse_cell_desc *config;
-	const struct jailhouse_memory *ram;
-	unsigned int cpu;
-	void *cell_mem;
-	int err;
+	const struct jailhouse_memory *mem =
+		jailhouse_cell_mem_regions(config);
+	unsigned int n;
+
+	for (n = 0; n < config->num_memory_regions; n++, mem++)
+		if (image->target_address >= mem->virt_start &&
+		    image->size <= mem->size &&
+		    image->target_address - mem->virt_start <=
+		    mem->size - image->size)
+			return mem;
+	return NULL;
+}
 
-	if (copy_from_user(cell, arg, sizeof(*cell)))
-		return -EFAULT;
+/* maps page-aligned, so that set_memory_x is happy */
+static void *jailhouse_ioremap_range(phys_addr_t start, unsigned long size,
+				     void **mapping)
+{
+	unsigned long offset = start & ~PAGE_MASK;
 
-	if (cell->num_preload_images != 1)
-		return -EINVAL;
+	*mapping = jailhouse_ioremap(start - offset,
+				     PAGE_ALIGN(offset + size));
+	return *mapping ? *mapping + offset : NULL;
+}
 
-	if (copy_from_user(cell->image, arg->image,
-			   sizeof(*cell->image) * cell->num_preload_images))
-		return -EFAULT;
+static int load_image(const struct jailhouse_memory *mem,
+		      const struct jailhouse_preload_image *image)
+{
+	void *mapping, *target;
+	int err = 0;
 
-	config = kmalloc(cell->config_size, GFP_KERNEL | GFP_DMA);
-	if (!config)
-		return -ENOMEM;
+	if (image->size == 0)
+		return 0;
+
+	target = jailhouse_ioremap_range(mem->phys_start +
+					 image->target_address -
+					 mem->virt_start, image->size,
+					 &mapping);
+	if (!target) {
+		pr_err("jailhouse: Unable to map RAM reserved for cell "
+		       "at %08lx\n", (unsigned long)mem->phys_start);
+		return -EBUSY;
+	}
 
-	if (copy_from_user(config, (void *)(unsigned long)cell->config_address,
-			   cell->config_size)) {
+	/* straight from the user's (mmapped) pages into the cell */
+	if (copy_from_user(target,
+			   (void *)(unsigned long)image->source_address,
+			   image->size))
 		err = -EFAULT;
-		goto kfree_config_out;
+
+	iounmap((__force void __iomem *)mapping);
+
+	return err;
+}
+
+static int clear_range(phys_addr_t start, unsigned long size)
+{
+	void *mapping, *target;
+
+	if (size == 0)
+		return 0;
+
+	target = jailhouse_ioremap_range(start, size, &mapping);
+	if (!target) {
+		pr_err("jailhouse: Unable to map RAM reserved for cell "
+		       "at %08lx\n", (unsigned long)start);
+		return -EBUSY;
 	}
-	config->name[JAILHOUSE_CELL_NAME_MAXLEN] = 0;
+	clear_memory(target, size);
+	iounmap((__force void __iomem *)mapping);
 
-	ram = jailhouse_cell_mem_regions(config);
-	if (config->num_memory_regions < 1 || ram->size < 1024 * 1024 ||
-	    image->target_address + image->size > ram->size) {
-		err = -EINVAL;
-		goto kfree_config_out;
+	return 0;
+}
+
+/* clears the cell's RAM except for what the images overwrite anyway */
+static int clear_cell_ram(const struct jailhouse_memory *ram,
+			  const struct jailhouse_preload_image *image,
+			  unsigned int num_images)
+{
+	unsigned long offset = 0, start, next, end;
+	unsigned int n;
+	int err;
+
+	while (offset < ram->size) {
+		/* find the gap up to the next image at or after offset */
+		next = ram->size;
+		end = offset;
+		for (n = 0; n < num_images; n++) {
+			start = image[n].target_address - ram->virt_start;
+			if (image[n].target_address < ram->virt_start ||
+			    start >= ram->size || image[n].size == 0 ||
+			    start + image[n].size <= offset)
+				continue;
+			if (start <= offset) {
+				/* offset is covered, skip past the image */
+				if (start + image[n].size > end)
+					end = start + image[n].size;
+			} else if (start < next)
+				next = start;
+		}
+		if (end > offset) {
+			offset = end;
+			continue;
+		}
+
+		err = clear_range(ram->phys_start + offset, next - offset);
+		if (err)
+			return err;
+		offset = next;
 	}
+	return 0;
+}
 
-	cell_mem = jailhouse_ioremap(ram->phys_start, ram->size);
-	if (!cell_mem) {
-		pr_err("jailhouse: Unable to map RAM reserved for cell "
-		       "at %08lx\n", (unsigned long)ram->phys_start);
-		err = -EBUSY;
-		goto kfree_config_out;
+/* a create or destroy request, completed either in place or by a worker */
+struct cell_request {
+	struct work_struct work;
+	struct jailhouse_file *file;
+	struct list_head list;
+	struct jailhouse_async_event event;
+	struct jailhouse_cell_desc *config;
+	struct jailhouse_preload_image *image;
+	unsigned int num_images;
+};
+
+static void free_cell_request_data(struct cell_request *req)
+{
+	kfree(req->config);
+	kfree(req->image);
+	req->config = NULL;
+	req->image = NULL;
+}
+
+static void free_cell_request(struct cell_request *req)
+{
+	free_cell_request_data(req);
+	kfree(req);
+}
+
+static struct cell_request *
+alloc_cell_request(__u64 config_address, __u32 config_size)
+{
+	struct cell_request *req;
+
+	req = kzalloc(sizeof(*req), GFP_KERNEL);
+	if (!req)
+		return ERR_PTR(-ENOMEM);
+
+	req->config = kmalloc(config_size, GFP_KERNEL | GFP_DMA);
+	if (!req->config) {
+		kfree(req);
+		return ERR_PTR(-ENOMEM);
 	}
-	memset(cell_mem, 0, ram->size);
 
-	if (copy_from_user(cell_mem + image->target_address,
-			   (void *)(unsigned long)image->source_address,
-			   image->size)) {
+	if (copy_from_user(req->config, (void *)(unsigned long)config_address,
+			   config_size)) {
+		free_cell_request(req);
+		return ERR_PTR(-EFAULT);
+	}
+	req->config->name[JAILHOUSE_CELL_NAME_MAXLEN] = 0;
+
+	return req;
+}
+
+/*
+ * Everything that needs the caller's address space: copying the request and
+ * loading the images. Clearing the remaining RAM is left to the commit.
+ */
+static struct cell_request *
+cell_create_prepare(struct jailhouse_new_cell __user *arg)
+{
+	const struct jailhouse_memory *mem;
+	struct jailhouse_new_cell cell;
+	struct cell_request *req;
+	unsigned int n;
+	int err;
+
+	if (copy_from_user(&cell, arg, sizeof(cell)))
+		return ERR_PTR(-EFAULT);
+
+	req = alloc_cell_request(cell.config_address, cell.config_size);
+	if (IS_ERR(req))
+		return req;
+
+	req->num_images = cell.num_preload_images;
+	req->image = kcalloc(req->num_images, sizeof(*req->image),
+			     GFP_KERNEL);
+	if (req->num_images > 0 && !req->image) {
+		err = -ENOMEM;
+		goto error_free;
+	}
+
+	if (copy_from_user(req->image, arg->image,
+			   sizeof(*req->image) * req->num_images)) {
 		err = -EFAULT;
-		goto iounmap_out;
+		goto error_free;
 	}
 
-	if (mutex_lock_interruptible(&lock) != 0) {
-		err = -EINTR;
-		goto iounmap_out;
+	if (req->config->num_memory_regions < 1 ||
+	    jailhouse_cell_mem_regions(req->config)->size < 1024 * 1024) {
+		err = -EINVAL;
+		goto error_free;
 	}
 
+	for (n = 0; n < req->num_images; n++)
+		if (!find_image_region(req->config, &req->image[n])) {
+			err = -EINVAL;
+			goto error_free;
+		}
+
+	/* images are never cleared, so they can be loaded first */
+	for (n = 0; n < req->num_images; n++) {
+		mem = find_image_region(req->config, &req->image[n]);
+		err = load_image(mem, &req->image[n]);
+		if (err)
+			goto error_free;
+	}
+
+	return req;
+
+error_free:
+	free_cell_request(req);
+	return ERR_PTR(err);
+}
+
+static int cell_create_commit(struct cell_request *req)
+{
+	struct jailhouse_cell_desc *config = req->config;
+	unsigned int cpu;
+	int err;
+
+	err = clear_cell_ram(jailhouse_cell_mem_regions(config), req->image,
+			     req->num_images);
+	if (err)
+		return err;
+
+	if (mutex_lock_interruptible(&lock) != 0)
+		return -EINTR;
+
 	if (!enabled) {
 		err = -EINVAL;
 		goto unlock_out;
@@ -352,25 +670,154 @@ cpu_online_out:
 unlock_out:
 	mutex_unlock(&lock);
 
-iounmap_out:
-	iounmap((__force void __iomem *)cell_mem);
+	return err;
+}
+
+static struct cell_request *
+cell_destroy_prepare(struct jailhouse_cell __user *arg)
+{
+	struct jailhouse_cell cell;
+
+	if (copy_from_user(&cell, arg, sizeof(cell)))
+		return ERR_PTR(-EFAULT);
 
-kfree_config_out:
-	kfree(config);
+	return alloc_cell_request(cell.config_address, cell.config_size);
+}
+
+static int cell_destroy_commit(struct cell_request *req)
+{
+	struct jailhouse_cell_desc *config = req->config;
+	unsigned int cpu;
+	int err;
+
+	if (mutex_lock_interruptible(&lock) != 0)
+		return -EINTR;
+
+	if (!enabled) {
+		err = -EINVAL;
+		goto unlock_out;
+	}
+
+	err = jailhouse_call1(JAILHOUSE_HC_CELL_DESTROY, __pa(config->name));
+	if (err)
+		goto unlock_out;
+
+	for_each_cell_cpu(cpu, config)
+		if (cpu_isset(cpu, offlined_cpus)) {
+			if (cpu_up(cpu) != 0)
+				pr_err("Jailhouse: failed to bring CPU %d "
+				       "back online\n", cpu);
+			cpu_clear(cpu, offlined_cpus);
+		}
+
+	pr_info("Destroyed Jailhouse cell \"%s\"\n", config->name);
+
+unlock_out:
+	mutex_unlock(&lock);
+
+	return err;
+}
+
+static int jailhouse_cell_create(struct jailhouse_new_cell __user *arg)
+{
+	struct cell_request *req = cell_create_prepare(arg);
+	int err;
+
+	if (IS_ERR(req))
+		return PTR_ERR(req);
+
+	err = cell_create_commit(req);
+	free_cell_request(req);
+
+	return err;
+}
+
+static int jailhouse_cell_destroy(struct jailhouse_cell __user *arg)
+{
+	struct cell_request *req = cell_destroy_prepare(arg);
+	int err;
+
+	if (IS_ERR(req))
+		return PTR_ERR(req);
+
+	err = cell_destroy_commit(req);
+	free_cell_request(req);
 
 	return err;
 }
 
-static int jailhouse_cell_destroy(const char __user *arg)
+static void complete_cell_request(struct cell_request *req, int result)
 {
+	struct jailhouse_file *jf = req->file;
+
+	free_cell_request_data(req);
+	req->event.result = result;
+
+	/* waking up under the lock keeps jf alive, see jailhouse_release */
+	spin_lock(&jf->lock);
+	list_add_tail(&req->list, &jf->events);
+	jf->pending--;
+	wake_up_all(&jf->wait);
+	spin_unlock(&jf->lock);
+}
+
+static void cell_create_work(struct work_struct *work)
+{
+	struct cell_request *req =
+		container_of(work, struct cell_request, work);
+
+	complete_cell_request(req, cell_create_commit(req));
+}
+
+static void cell_destroy_work(struct work_struct *work)
+{
+	struct cell_request *req =
+		container_of(work, struct cell_request, work);
+
+	complete_cell_request(req, cell_destroy_commit(req));
+}
+
+/* returns the request ID that the completion event will carry */
+static long jailhouse_queue_request(struct jailhouse_file *jf,
+				    struct cell_request *req,
+				    work_func_t func)
+{
+	if (IS_ERR(req))
+		return PTR_ERR(req);
+
+	req->file = jf;
+
+	spin_lock(&jf->lock);
+	req->event.id = jf->next_id;
+	jf->next_id = jf->next_id < INT_MAX ? jf->next_id + 1 : 1;
+	jf->pending++;
+	spin_unlock(&jf->lock);
+
+	/* unbound, as the worker may take its own CPU offline */
+	INIT_WORK(&req->work, func);
+	queue_work(system_unbound_wq, &req->work);
+
+	return req->event.id;
+}
+
+static int jailhouse_cell_restart(struct jailhouse_new_cell __user *arg)
+{
+	struct jailhouse_preload_image preload;
+	struct jailhouse_cell_image *image = NULL;
+	const struct jailhouse_memory *ram;
 	struct jailhouse_cell_desc *config;
-	struct jailhouse_cell cell;
-	unsigned int cpu;
+	struct jailhouse_new_cell cell;
+	unsigned long num_pages, n;
+	void *image_mem = NULL;
+	u64 *page_list = NULL;
 	int err;
 
 	if (copy_from_user(&cell, arg, sizeof(cell)))
 		return -EFAULT;
 
+	if (cell.num_preload_images > 1)
+		return -EINVAL;
+
 	config = kmalloc(cell.config_size, GFP_KERNEL | GFP_DMA);
 	if (!config)
 		return -ENOMEM;
@@ -382,38 +829,504 @@ static int jailhouse_cell_destroy(const char __user *arg)
 	}
 	config->name[JAILHOUSE_CELL_NAME_MAXLEN] = 0;
 
+	if (cell.num_preload_images == 1) {
+		if (copy_from_user(&preload, arg->image, sizeof(preload))) {
+			err = -EFAULT;
+			goto kfree_config_out;
+		}
 
-	if (mutex_lock_interruptible(&lock) != 0)
-		return -EINTR;
+		if (preload.size == 0) {
+			err = -EINVAL;
+			goto kfree_config_out;
+		}
+
+		/* the hypervisor copies the image page by page */
+		num_pages = PAGE_ALIGN(preload.size) / PAGE_SIZE;
+		image = kmalloc(sizeof(*image), GFP_KERNEL | GFP_DMA);
+		page_list = kmalloc(num_pages * sizeof(*page_list),
+				    GFP_KERNEL);
+		image_mem = vmalloc(preload.size);
+		if (!image || !page_list || !image_mem) {
+			err = -ENOMEM;
+			goto kfree_image_out;
+		}
+
+		if (copy_from_user(image_mem,
+				   (void *)(unsigned long)preload.source_address,
+				   preload.size)) {
+			err = -EFAULT;
+			goto kfree_image_out;
+		}
+
+		/* the hypervisor expects an offset into the first region */
+		ram = jailhouse_cell_mem_regions(config);
+		if (config->num_memory_regions < 1 ||
+		    preload.target_address < ram->virt_start) {
+			err = -EINVAL;
+			goto kfree_image_out;
+		}
+
+		for (n = 0; n < num_pages; n++)
+			page_list[n] = page_to_phys(
+				vmalloc_to_page(image_mem + n * PAGE_SIZE));
+
+		image->page_list_address = __pa(page_list);
+		image->size = preload.size;
+		image->target_address = preload.target_address -
+			ram->virt_start;
+	}
+
+	if (mutex_lock_interruptible(&lock) != 0) {
+		err = -EINTR;
+		goto kfree_image_out;
+	}
+
+	/* the CPUs of the cell stay offline */
+	if (enabled)
+		err = jailhouse_call2(JAILHOUSE_HC_CELL_RESTART,
+				      __pa(config->name),
+				      image ? __pa(image) : 0);
+	else
+		err = -EINVAL;
+
+	mutex_unlock(&lock);
+
+	if (!err)
+		pr_info("Restarted Jailhouse cell \"%s\"\n", config->name);
+
+kfree_image_out:
+	vfree(image_mem);
+	kfree(page_list);
+	kfree(image);
+
+kfree_config_out:
+	kfree(config);
+
+	return err;
+}
+
+static int jailhouse_cell_mem_info(struct jailhouse_cell_mem_info __user *arg)
+{
+	struct jailhouse_cell_mem_info *query;
+	int err;
+
+	query = kmalloc(sizeof(*query), GFP_KERNEL | GFP_DMA);
+	if (!query)
+		return -ENOMEM;
+
+	if (copy_from_user(query->name, arg->name, sizeof(query->name))) {
+		err = -EFAULT;
+		goto kfree_out;
+	}
+	query->name[JAILHOUSE_CELL_NAME_MAXLEN] = 0;
+
+	if (mutex_lock_interruptible(&lock) != 0) {
+		err = -EINTR;
+		goto kfree_out;
+	}
+
+	if (enabled)
+		err = jailhouse_call2(JAILHOUSE_HC_CELL_GET_MEM_INFO,
+				      __pa(query->name), __pa(&query->info));
+	else
+		err = -EINVAL;
+
+	mutex_unlock(&lock);
+
+	if (!err && copy_to_user(&arg->info, &query->info,
+				 sizeof(query->info)))
+		err = -EFAULT;
+
+kfree_out:
+	kfree(query);
+
+	return err;
+}
+
+static int
+jailhouse_cell_working_set(struct jailhouse_cell_working_set __user *arg)
+{
+	struct jailhouse_cell_working_set *query;
+	int err;
+
+	query = kmalloc(sizeof(*query), GFP_KERNEL | GFP_DMA);
+	if (!query)
+		return -ENOMEM;
+
+	if (copy_from_user(query, arg, sizeof(*query))) {
+		err = -EFAULT;
+		goto kfree_out;
+	}
+	query->name[JAILHOUSE_CELL_NAME_MAXLEN] = 0;
+
+	if (mutex_lock_interruptible(&lock) != 0) {
+		err = -EINTR;
+		goto kfree_out;
+	}
+
+	if (enabled)
+		err = jailhouse_call2(JAILHOUSE_HC_CELL_GET_WORKING_SET,
+				      __pa(query->name), __pa(&query->ws));
+	else
+		err = -EINVAL;
+
+	mutex_unlock(&lock);
+
+	if (!err && copy_to_user(&arg->ws, &query->ws, sizeof(query->ws)))
+		err = -EFAULT;
+
+kfree_out:
+	kfree(query);
+
+	return err;
+}
+
+/*
+ * Moves a single CPU between Linux and a running cell. Linux gives up the
+ * CPU before it is added and takes it back after it was removed.
+ */
+static int jailhouse_cell_move_cpu(struct jailhouse_cell_cpu __user *arg,
+				   bool add)
+{
+	struct jailhouse_cell_cpu *req;
+	bool offlined = false;
+	unsigned int cpu;
+	int err;
+
+	req = kmalloc(sizeof(*req), GFP_KERNEL | GFP_DMA);
+	if (!req)
+		return -ENOMEM;
+
+	if (copy_from_user(req, arg, sizeof(*req))) {
+		err = -EFAULT;
+		goto kfree_out;
+	}
+	req->name[JAILHOUSE_CELL_NAME_MAXLEN] = 0;
+	cpu = req->cpu_id;
+
+	if (cpu >= nr_cpu_ids) {
+		err = -EINVAL;
+		goto kfree_out;
+	}
+
+	if (mutex_lock_interruptible(&lock) != 0) {
+		err = -EINTR;
+		goto kfree_out;
+	}
 
 	if (!enabled) {
 		err = -EINVAL;
 		goto unlock_out;
 	}
 
-	err = jailhouse_call1(JAILHOUSE_HC_CELL_DESTROY, __pa(config->name));
-	if (err)
-		goto unlock_out;
+	if (add) {
+		if (cpu_online(cpu)) {
+			err = cpu_down(cpu);
+			if (err)
+				goto unlock_out;
+			offlined = true;
+		}
+
+		err = jailhouse_call2(JAILHOUSE_HC_CELL_ADD_CPU,
+				      __pa(req->name), cpu);
+		if (err) {
+			if (offlined && cpu_up(cpu) != 0)
+				pr_err("Jailhouse: failed to bring CPU %d "
+				       "back online\n", cpu);
+			goto unlock_out;
+		}
+		if (offlined)
+			cpu_set(cpu, offlined_cpus);
+	} else {
+		err = jailhouse_call2(JAILHOUSE_HC_CELL_REMOVE_CPU,
+				      __pa(req->name), cpu);
+		if (err)
+			goto unlock_out;
 
-	for_each_cell_cpu(cpu, config)
 		if (cpu_isset(cpu, offlined_cpus)) {
 			if (cpu_up(cpu) != 0)
 				pr_err("Jailhouse: failed to bring CPU %d "
 				       "back online\n", cpu);
 			cpu_clear(cpu, offlined_cpus);
 		}
+	}
 
-	pr_info("Destroyed Jailhouse cell \"%s\"\n", config->name);
+	pr_info("Moved CPU %d %s Jailhouse cell \"%s\"\n", cpu,
+		add ? "to" : "from", req->name);
 
 unlock_out:
 	mutex_unlock(&lock);
 
-kfree_config_out:
-	kfree(config);
+kfree_out:
+	kfree(req);
+
+	return err;
+}
+
+static int jailhouse_cpu_stats(struct jailhouse_cpu_stats_query __user *arg)
+{
+	struct jailhouse_cpu_stats *stats;
+	__u32 cpu_id;
+	int err;
+
+	if (get_user(cpu_id, &arg->cpu_id))
+		return -EFAULT;
+
+	stats = kmalloc(sizeof(*stats), GFP_KERNEL | GFP_DMA);
+	if (!stats)
+		return -ENOMEM;
+
+	if (mutex_lock_interruptible(&lock) != 0) {
+		err = -EINTR;
+		goto kfree_out;
+	}
+
+	if (enabled)
+		err = jailhouse_call2(JAILHOUSE_HC_CPU_GET_STATS, cpu_id,
+				      __pa(stats));
+	else
+		err = -EINVAL;
+
+	mutex_unlock(&lock);
+
+	if (!err && copy_to_user(&arg->stats, stats, sizeof(*stats)))
+		err = -EFAULT;
+
+kfree_out:
+	kfree(stats);
+
+	return err;
+}
+
+static int jailhouse_cpu_log(struct jailhouse_cpu_log_query __user *arg)
+{
+	struct jailhouse_cpu_log *log;
+	__u32 cpu_id;
+	int err;
+
+	if (get_user(cpu_id, &arg->cpu_id))
+		return -EFAULT;
+
+	log = kmalloc(sizeof(*log), GFP_KERNEL | GFP_DMA);
+	if (!log)
+		return -ENOMEM;
+
+	if (copy_from_user(&log->pos, &arg->log.pos, sizeof(log->pos))) {
+		err = -EFAULT;
+		goto kfree_out;
+	}
+
+	if (mutex_lock_interruptible(&lock) != 0) {
+		err = -EINTR;
+		goto kfree_out;
+	}
+
+	if (enabled)
+		err = jailhouse_call2(JAILHOUSE_HC_CPU_GET_LOG, cpu_id,
+				      __pa(log));
+	else
+		err = -EINVAL;
+
+	mutex_unlock(&lock);
+
+	if (!err && copy_to_user(&arg->log, log, sizeof(*log)))
+		err = -EFAULT;
+
+kfree_out:
+	kfree(log);
+
+	return err;
+}
+
+static int jailhouse_cpu_trace(struct jailhouse_cpu_trace_query __user *arg)
+{
+	struct jailhouse_cpu_trace *trace;
+	__u32 cpu_id;
+	int err;
+
+	if (get_user(cpu_id, &arg->cpu_id))
+		return -EFAULT;
+
+	trace = kmalloc(sizeof(*trace), GFP_KERNEL);
+	if (!trace)
+		return -ENOMEM;
+
+	if (copy_from_user(&trace->pos, &arg->trace.pos,
+			   sizeof(trace->pos))) {
+		err = -EFAULT;
+		goto kfree_out;
+	}
+
+	if (mutex_lock_interruptible(&lock) != 0) {
+		err = -EINTR;
+		goto kfree_out;
+	}
+
+	if (enabled)
+		err = jailhouse_call2(JAILHOUSE_HC_CPU_GET_TRACE, cpu_id,
+				      __pa(trace));
+	else
+		err = -EINVAL;
+
+	mutex_unlock(&lock);
+
+	if (!err && copy_to_user(&arg->trace, trace, sizeof(*trace)))
+		err = -EFAULT;
+
+kfree_out:
+	kfree(trace);
+
+	return err;
+}
+
+static int jailhouse_trace_set_events(unsigned long mask)
+{
+	int err;
+
+	if (mutex_lock_interruptible(&lock) != 0)
+		return -EINTR;
+
+	if (enabled)
+		err = jailhouse_call1(JAILHOUSE_HC_TRACE_SET_EVENTS, mask);
+	else
+		err = -EINVAL;
+
+	mutex_unlock(&lock);
 
 	return err;
 }
 
+static int jailhouse_dma_faults(struct jailhouse_dma_faults_query __user *arg)
+{
+	struct jailhouse_dma_faults *faults;
+	__u32 unit;
+	int err;
+
+	if (get_user(unit, &arg->unit))
+		return -EFAULT;
+
+	faults = kmalloc(sizeof(*faults), GFP_KERNEL | GFP_DMA);
+	if (!faults)
+		return -ENOMEM;
+
+	if (mutex_lock_interruptible(&lock) != 0) {
+		err = -EINTR;
+		goto kfree_out;
+	}
+
+	if (enabled)
+		err = jailhouse_call2(JAILHOUSE_HC_DMA_GET_FAULTS, unit,
+				      __pa(faults));
+	else
+		err = -EINVAL;
+
+	mutex_unlock(&lock);
+
+	if (!err && copy_to_user(&arg->faults, faults, sizeof(*faults)))
+		err = -EFAULT;
+
+kfree_out:
+	kfree(faults);
+
+	return err;
+}
+
+static int jailhouse_open(struct inode *inode, struct file *file)
+{
+	struct jailhouse_file *jf;
+
+	jf = kzalloc(sizeof(*jf), GFP_KERNEL);
+	if (!jf)
+		return -ENOMEM;
+
+	spin_lock_init(&jf->lock);
+	init_waitqueue_head(&jf->wait);
+	INIT_LIST_HEAD(&jf->events);
+	jf->next_id = 1;
+
+	file->private_data = jf;
+
+	return 0;
+}
+
+static bool jailhouse_requests_done(struct jailhouse_file *jf)
+{
+	bool done;
+
+	spin_lock(&jf->lock);
+	done = jf->pending == 0;
+	spin_unlock(&jf->lock);
+
+	return done;
+}
+
+static int jailhouse_release(struct inode *inode, struct file *file)
+{
+	struct jailhouse_file *jf = file->private_data;
+	struct cell_request *req, *tmp;
+
+	/* outstanding requests still refer to jf */
+	wait_event(jf->wait, jailhouse_requests_done(jf));
+
+	list_for_each_entry_safe(req, tmp, &jf->events, list)
+		kfree(req);
+	kfree(jf);
+
+	return 0;
+}
+
+static ssize_t jailhouse_read(struct file *file, char __user *buf,
+			      size_t count, loff_t *ppos)
+{
+	struct jailhouse_file *jf = file->private_data;
+	struct cell_request *req;
+	ssize_t done = 0;
+	int err;
+
+	if (count < sizeof(struct jailhouse_async_event))
+		return -EINVAL;
+
+	spin_lock(&jf->lock);
+	while (list_empty(&jf->events)) {
+		spin_unlock(&jf->lock);
+		if (file->f_flags & O_NONBLOCK)
+			return -EAGAIN;
+		err = wait_event_interruptible(jf->wait,
+				!list_empty_careful(&jf->events));
+		if (err)
+			return err;
+		spin_lock(&jf->lock);
+	}
+
+	while (!list_empty(&jf->events) &&
+	       count - done >= sizeof(struct jailhouse_async_event)) {
+		req = list_first_entry(&jf->events, struct cell_request, list);
+		list_del(&req->list);
+		spin_unlock(&jf->lock);
+
+		err = copy_to_user(buf + done, &req->event,
+				   sizeof(req->event));
+		kfree(req);
+		if (err)
+			return done > 0 ? done : -EFAULT;
+		done += sizeof(struct jailhouse_async_event);
+
+		spin_lock(&jf->lock);
+	}
+	spin_unlock(&jf->lock);
+
+	return done;
+}
+
+static unsigned int jailhouse_poll(struct file *file, poll_table *wait)
+{
+	struct jailhouse_file *jf = file->private_data;
+
+	poll_wait(file, &jf->wait, wait);
+
+	return list_empty_careful(&jf->events) ? 0 : POLLIN | POLLRDNORM;
+}
+
 static long jailhouse_ioctl(struct file *file, unsigned int ioctl,
 			    unsigned long arg)
 {
@@ -432,7 +1345,59 @@ static long jailhouse_ioctl(struct file *file, unsigned int ioctl,
 			(struct jailhouse_new_cell __user *)arg);
 		break;
 	case JAILHOUSE_CELL_DESTROY:
-		err = jailhouse_cell_destroy((const char __user *)arg);
+		err = jailhouse_cell_destroy(
+			(struct jailhouse_cell __user *)arg);
+		break;
+	case JAILHOUSE_CELL_CREATE_ASYNC:
+		err = jailhouse_queue_request(file->private_data,
+			cell_create_prepare(
+				(struct jailhouse_new_cell __user *)arg),
+			cell_create_work);
+		break;
+	case JAILHOUSE_CELL_DESTROY_ASYNC:
+		err = jailhouse_queue_request(file->private_data,
+			cell_destroy_prepare(
+				(struct jailhouse_cell __user *)arg),
+			cell_destroy_work);
+		break;
+	case JAILHOUSE_CELL_RESTART:
+		err = jailhouse_cell_restart(
+			(struct jailhouse_new_cell __user *)arg);
+		break;
+	case JAILHOUSE_CELL_MEM_INFO:
+		err = jailhouse_cell_mem_info(
+			(struct jailhouse_cell_mem_info __user *)arg);
+		break;
+	case JAILHOUSE_CELL_WORKING_SET:
+		err = jailhouse_cell_working_set(
+			(struct jailhouse_cell_working_set __user *)arg);
+		break;
+	case JAILHOUSE_CELL_ADD_CPU:
+		err = jailhouse_cell_move_cpu(
+			(struct jailhouse_cell_cpu __user *)arg, true);
+		break;
+	case JAILHOUSE_CELL_REMOVE_CPU:
+		err = jailhouse_cell_move_cpu(
+			(struct jailhouse_cell_cpu __user *)arg, false);
+		break;
+	case JAILHOUSE_CPU_STATS:
+		err = jailhouse_cpu_stats(
+			(struct jailhouse_cpu_stats_query __user *)arg);
+		break;
+	case JAILHOUSE_DMA_FAULTS:
+		err = jailhouse_dma_faults(
+			(struct jailhouse_dma_faults_query __user *)arg);
+		break;
+	case JAILHOUSE_CPU_LOG:
+		err = jailhouse_cpu_log(
+			(struct jailhouse_cpu_log_query __user *)arg);
+		break;
+	case JAILHOUSE_CPU_TRACE:
+		err = jailhouse_cpu_trace(
+			(struct jailhouse_cpu_trace_query __user *)arg);
+		break;
+	case JAILHOUSE_TRACE_SET_EVENTS:
+		err = jailhouse_trace_set_events(arg);
 		break;
 	default:
 		err = -EINVAL;
@@ -442,8 +1407,65 @@ static long jailhouse_ioctl(struct file *file, unsigned int ioctl,
 	return err;
 }
 
+static void jailhouse_stats_vm_open(struct vm_area_struct *vma)
+{
+	atomic_inc(&stats_mappings);
+}
+
+static void jailhouse_stats_vm_close(struct vm_area_struct *vma)
+{
+	atomic_dec(&stats_mappings);
+}
+
+static const struct vm_operations_struct jailhouse_stats_vm_ops = {
+	.open = jailhouse_stats_vm_open,
+	.close = jailhouse_stats_vm_close,
+};
+
+/*
+ * Maps the statistics area (struct jailhouse_stats) that the hypervisor
+ * shares read-only with Linux. It is updated in place, so monitors can
+ * sample it without issuing ioctls. Disabling fails while it is mapped.
+ */
+static int jailhouse_mmap(struct file *file, struct vm_area_struct *vma)
+{
+	unsigned long size = vma->vm_end - vma->vm_start;
+	int err;
+
+	if (vma->vm_flags & VM_WRITE)
+		return -EPERM;
+	if (vma->vm_pgoff != 0)
+		return -EINVAL;
+
+	if (mutex_lock_interruptible(&lock) != 0)
+		return -EINTR;
+
+	if (!enabled || !stats_pfn) {
+		err = -ENODEV;
+	} else if (size > stats_size) {
+		err = -EINVAL;
+	} else {
+		vma->vm_flags &= ~VM_MAYWRITE;
+		err = remap_pfn_range(vma, vma->vm_start, stats_pfn, size,
+				      vma->vm_page_prot);
+		if (!err) {
+			vma->vm_ops = &jailhouse_stats_vm_ops;
+			jailhouse_stats_vm_open(vma);
+		}
+	}
+
+	mutex_unlock(&lock);
+
+	return err;
+}
+
 static const struct file_operations jailhouse_fops = {
 	.owner = THIS_MODULE,
+	.open = jailhouse_open,
+	.release = jailhouse_release,
+	.read = jailhouse_read,
+	.poll = jailhouse_poll,
+	.mmap = jailhouse_mmap,
 	.unlocked_ioctl = jailhouse_ioctl,
 	.compat_ioctl = jailhouse_ioctl,
 	.llseek = noop_llseek,
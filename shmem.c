@@ -0,0 +1,264 @@
+/*
+ * Jailhouse, a Linux-based partitioning hypervisor
+ *
+ * Copyright (c) Siemens AG, 2013
+ *
+ * Authors:
+ *  Jan Kiszka <jan.kiszka@siemens.com>
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.  See
+ * the COPYING file in the top-level directory.
+ */
+
+#include <linux/kernel.h>
+#include <linux/fs.h>
+#include <linux/io.h>
+#include <linux/miscdevice.h>
+#include <linux/mm.h>
+#include <linux/mutex.h>
+#include <linux/poll.h>
+#include <linux/slab.h>
+#include <linux/timer.h>
+#include <linux/wait.h>
+
+#include "jailhouse.h"
+#include "shmem.h"
+#include <jailhouse/shmem-ring.h>
+
+/*
+ * Every shmem endpoint of the Linux cell is exposed as
+ * /dev/jailhouse-shmem<id>. mmap maps the shared region, writing to the
+ * device rings the doorbell. poll reports the state of the jailhouse_ring
+ * at the start of the region: POLLIN if slots are published, POLLOUT if
+ * slots can be claimed.
+ *
+ * Linux has no handler for doorbell vectors, so its endpoints should use
+ * vector 0. Waiters are then woken up by a timer that re-checks the ring.
+ */
+
+#define JAILHOUSE_SHMEM_POLL_INTERVAL	1	/* jiffies */
+
+struct jailhouse_shmem_dev {
+	struct miscdevice misc;
+	char name[32];
+	struct jailhouse_shmem config;
+	struct jailhouse_ring *ring;
+	void __iomem *doorbell;
+	wait_queue_head_t wait;
+	struct timer_list poll_timer;
+	unsigned int users;
+};
+
+static DEFINE_MUTEX(shmem_lock);
+static struct jailhouse_shmem_dev *shmem_devs;
+static unsigned int num_shmem_devs;
+static bool shmem_closing;
+
+static struct jailhouse_shmem_dev *to_shmem_dev(struct file *file)
+{
+	return container_of(file->private_data, struct jailhouse_shmem_dev,
+			    misc);
+}
+
+static int jailhouse_shmem_open(struct inode *inode, struct file *file)
+{
+	struct jailhouse_shmem_dev *dev = to_shmem_dev(file);
+	int err = -ENODEV;
+
+	mutex_lock(&shmem_lock);
+	if (!shmem_closing) {
+		dev->users++;
+		err = 0;
+	}
+	mutex_unlock(&shmem_lock);
+
+	return err ? err : nonseekable_open(inode, file);
+}
+
+static int jailhouse_shmem_release(struct inode *inode, struct file *file)
+{
+	struct jailhouse_shmem_dev *dev = to_shmem_dev(file);
+
+	mutex_lock(&shmem_lock);
+	dev->users--;
+	mutex_unlock(&shmem_lock);
+
+	return 0;
+}
+
+static int jailhouse_shmem_mmap(struct file *file, struct vm_area_struct *vma)
+{
+	struct jailhouse_shmem_dev *dev = to_shmem_dev(file);
+	unsigned long offset = vma->vm_pgoff << PAGE_SHIFT;
+	unsigned long size = vma->vm_end - vma->vm_start;
+
+	if (offset >= dev->config.size || size > dev->config.size - offset)
+		return -EINVAL;
+
+	if (!(dev->config.flags & JAILHOUSE_MEM_WRITE)) {
+		if (vma->vm_flags & VM_WRITE)
+			return -EPERM;
+		vma->vm_flags &= ~VM_MAYWRITE;
+	}
+
+	return remap_pfn_range(vma, vma->vm_start,
+			       (dev->config.virt_start + offset) >> PAGE_SHIFT,
+			       size, vma->vm_page_prot);
+}
+
+static ssize_t jailhouse_shmem_write(struct file *file, const char __user *buf,
+				     size_t count, loff_t *ppos)
+{
+	struct jailhouse_shmem_dev *dev = to_shmem_dev(file);
+
+	writel(1, dev->doorbell + JAILHOUSE_SHMEM_DOORBELL);
+
+	return count;
+}
+
+static unsigned int jailhouse_shmem_poll(struct file *file, poll_table *wait)
+{
+	struct jailhouse_shmem_dev *dev = to_shmem_dev(file);
+	unsigned int mask = 0;
+	__u32 first;
+
+	poll_wait(file, &dev->wait, wait);
+
+	if (jailhouse_ring_valid(dev->ring, dev->config.size)) {
+		if (jailhouse_ring_peek(dev->ring, &first) > 0)
+			mask |= POLLIN | POLLRDNORM;
+		if (dev->config.flags & JAILHOUSE_MEM_WRITE &&
+		    jailhouse_ring_space(dev->ring) > 0)
+			mask |= POLLOUT | POLLWRNORM;
+	}
+
+	if (!(mask & poll_requested_events(wait)))
+		mod_timer(&dev->poll_timer,
+			  jiffies + JAILHOUSE_SHMEM_POLL_INTERVAL);
+
+	return mask;
+}
+
+static const struct file_operations jailhouse_shmem_fops = {
+	.owner = THIS_MODULE,
+	.open = jailhouse_shmem_open,
+	.release = jailhouse_shmem_release,
+	.mmap = jailhouse_shmem_mmap,
+	.write = jailhouse_shmem_write,
+	.poll = jailhouse_shmem_poll,
+	.llseek = no_llseek,
+};
+
+static void jailhouse_shmem_poll_timer(unsigned long data)
+{
+	struct jailhouse_shmem_dev *dev = (struct jailhouse_shmem_dev *)data;
+
+	wake_up_interruptible(&dev->wait);
+}
+
+static int shmem_dev_init(struct jailhouse_shmem_dev *dev,
+			  const struct jailhouse_shmem *config)
+{
+	int err;
+
+	dev->config = *config;
+
+	dev->ring = (__force struct jailhouse_ring *)
+		ioremap_cache(config->virt_start, config->size);
+	if (!dev->ring)
+		return -ENOMEM;
+
+	dev->doorbell = ioremap_nocache(config->doorbell_address, PAGE_SIZE);
+	if (!dev->doorbell) {
+		err = -ENOMEM;
+		goto error_unmap_ring;
+	}
+
+	init_waitqueue_head(&dev->wait);
+	setup_timer(&dev->poll_timer, jailhouse_shmem_poll_timer,
+		    (unsigned long)dev);
+
+	snprintf(dev->name, sizeof(dev->name), "jailhouse-shmem%u",
+		 config->id);
+	dev->misc.minor = MISC_DYNAMIC_MINOR;
+	dev->misc.name = dev->name;
+	dev->misc.fops = &jailhouse_shmem_fops;
+
+	err = misc_register(&dev->misc);
+	if (err)
+		goto error_unmap_doorbell;
+
+	return 0;
+
+error_unmap_doorbell:
+	iounmap(dev->doorbell);
+error_unmap_ring:
+	iounmap((__force void __iomem *)dev->ring);
+	return err;
+}
+
+static void shmem_dev_exit(struct jailhouse_shmem_dev *dev)
+{
+	misc_deregister(&dev->misc);
+	del_timer_sync(&dev->poll_timer);
+	iounmap(dev->doorbell);
+	iounmap((__force void __iomem *)dev->ring);
+}
+
+int jailhouse_shmem_init(const struct jailhouse_cell_desc *linux_config)
+{
+	const struct jailhouse_shmem *shmem =
+		jailhouse_cell_shmem(linux_config);
+	unsigned int n;
+	int err;
+
+	shmem_closing = false;
+
+	if (linux_config->num_shmem == 0)
+		return 0;
+
+	shmem_devs = kcalloc(linux_config->num_shmem, sizeof(*shmem_devs),
+			     GFP_KERNEL);
+	if (!shmem_devs)
+		return -ENOMEM;
+
+	for (n = 0; n < linux_config->num_shmem; n++) {
+		err = shmem_dev_init(&shmem_devs[n], &shmem[n]);
+		if (err)
+			goto error;
+		num_shmem_devs++;
+	}
+
+	return 0;
+
+error:
+	jailhouse_shmem_exit();
+	return err;
+}
+
+/*
+ * Fails with -EBUSY while devices are open or mapped. The misc core holds
+ * its lock while calling open, so deregistration must not hold ours.
+ */
+int jailhouse_shmem_exit(void)
+{
+	unsigned int n;
+
+	mutex_lock(&shmem_lock);
+	for (n = 0; n < num_shmem_devs; n++)
+		if (shmem_devs[n].users > 0) {
+			mutex_unlock(&shmem_lock);
+			return -EBUSY;
+		}
+	shmem_closing = true;
+	mutex_unlock(&shmem_lock);
+
+	for (n = 0; n < num_shmem_devs; n++)
+		shmem_dev_exit(&shmem_devs[n]);
+
+	kfree(shmem_devs);
+	shmem_devs = NULL;
+	num_shmem_devs = 0;
+
+	return 0;
+}
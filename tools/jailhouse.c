@@ -16,11 +16,14 @@
 #include <unistd.h>
 #include <fcntl.h>
 #include <errno.h>
+#include <sched.h>
 #include <sys/types.h>
 #include <sys/ioctl.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 
 #include <jailhouse.h>
+#include <jailhouse/shmem-echo.h>
 
 static void help(const char *progname)
 {
@@ -28,8 +31,24 @@ static void help(const char *progname)
 	       "\nAvailable commands:\n"
 	       "   enable CONFIGFILE\n"
 	       "   disable\n"
-	       "   cell create CONFIGFILE PRELOADIMAGE [-l ADDRESS]\n"
-	       "   cell destroy CONFIGFILE\n",
+	       "   cell create CONFIGFILE PRELOADIMAGE [-l ADDRESS] "
+	       "[PRELOADIMAGE [-l ADDRESS] ...]\n"
+	       "   cell destroy CONFIGFILE\n"
+	       "   cell restart CONFIGFILE [PRELOADIMAGE [-l ADDRESS]]\n"
+	       "   cell meminfo NAME\n"
+	       "   cell workingset NAME [-c] [START SIZE]\n"
+	       "   cell addcpu NAME CPU\n"
+	       "   cell removecpu NAME CPU\n"
+	       "   cell list\n"
+	       "   cpu stats CPU\n"
+	       "   cpu log CPU [-f]\n"
+	       "   dma faults UNIT\n"
+	       "   trace enable [EVENT ...]\n"
+	       "   trace disable\n"
+	       "   trace dump [-f]\n"
+	       "   stat [INTERVAL]\n"
+	       "   config check CONFIGFILE [-o OUTFILE]\n"
+	       "   shmem echo DEVICE\n",
 	       progname);
 }
 
@@ -81,6 +100,42 @@ static void *read_file(const char *name, size_t *size)
 	return buffer;
 }
 
+/* images are passed to the driver straight from the page cache */
+static void *map_file(const char *name, size_t *size)
+{
+	struct stat stat;
+	void *buffer;
+	int fd;
+
+	fd = open(name, O_RDONLY);
+	if (fd < 0) {
+		fprintf(stderr, "opening %s: %s\n", name, strerror(errno));
+		exit(1);
+	}
+
+	if (fstat(fd, &stat) < 0) {
+		perror("fstat");
+		exit(1);
+	}
+
+	buffer = NULL;
+	if (stat.st_size > 0) {
+		buffer = mmap(NULL, stat.st_size, PROT_READ, MAP_PRIVATE, fd,
+			      0);
+		if (buffer == MAP_FAILED) {
+			fprintf(stderr, "mapping %s: %s\n", name,
+				strerror(errno));
+			exit(1);
+		}
+	}
+
+	close(fd);
+
+	*size = stat.st_size;
+
+	return buffer;
+}
+
 static int enable(int argc, char *argv[])
 {
 	void *config;
@@ -106,6 +161,98 @@ static int enable(int argc, char *argv[])
 }
 
 static int cell_create(int argc, char *argv[])
+{
+	struct jailhouse_preload_image *image;
+	struct jailhouse_new_cell *cell;
+	unsigned int images, n;
+	int err, fd, arg_num;
+	size_t size;
+	char *endp;
+
+	if (argc < 5) {
+		help(argv[0]);
+		exit(1);
+	}
+
+	/* an upper bound, -l arguments are counted as well */
+	images = argc - 4;
+	cell = malloc(sizeof(*cell) + sizeof(*image) * images);
+	if (!cell) {
+		fprintf(stderr, "insufficient memory\n");
+		exit(1);
+	}
+
+	cell->config_address = (unsigned long)read_file(argv[3], &size);
+	cell->config_size = size;
+
+	image = cell->image;
+	for (n = 0, arg_num = 4; arg_num < argc; n++) {
+		image[n].source_address =
+			(unsigned long)map_file(argv[arg_num++], &size);
+		image[n].size = size;
+		image[n].target_address = 0;
+
+		if (arg_num < argc && strcmp(argv[arg_num], "-l") == 0) {
+			if (arg_num + 1 >= argc) {
+				help(argv[0]);
+				exit(1);
+			}
+			errno = 0;
+			image[n].target_address =
+				strtoll(argv[arg_num + 1], &endp, 0);
+			if (errno != 0 || *endp != 0) {
+				help(argv[0]);
+				exit(1);
+			}
+			arg_num += 2;
+		}
+	}
+	cell->num_preload_images = n;
+
+	fd = open_dev();
+
+	err = ioctl(fd, JAILHOUSE_CELL_CREATE, cell);
+	if (err)
+		perror("JAILHOUSE_CELL_CREATE");
+
+	close(fd);
+	for (n = 0; n < cell->num_preload_images; n++)
+		if (image[n].size > 0)
+			munmap((void *)(unsigned long)image[n].source_address,
+			       image[n].size);
+	free((void *)(unsigned long)cell->config_address);
+	free(cell);
+
+	return err;
+}
+
+static int cell_destroy(int argc, char *argv[])
+{
+	struct jailhouse_cell cell;
+	size_t size;
+	int err, fd;
+
+	if (argc != 4) {
+		help(argv[0]);
+		exit(1);
+	}
+
+	cell.config_address = (unsigned long)read_file(argv[3], &size);
+	cell.config_size = size;
+
+	fd = open_dev();
+
+	err = ioctl(fd, JAILHOUSE_CELL_DESTROY, &cell);
+	if (err)
+		perror("JAILHOUSE_CELL_DESTROY");
+
+	close(fd);
+	free((void *)(unsigned long)cell.config_address);
+
+	return err;
+}
+
+static int cell_restart(int argc, char *argv[])
 {
 	struct {
 		struct jailhouse_new_cell cell;
@@ -117,18 +264,23 @@ static int cell_create(int argc, char *argv[])
 	int err, fd;
 	char *endp;
 
-	if (argc != 5 && argc != 7) {
+	if (argc != 4 && argc != 5 && argc != 7) {
 		help(argv[0]);
 		exit(1);
 	}
 
 	cell->config_address = (unsigned long)read_file(argv[3], &size);
 	cell->config_size = size;
-	cell->num_preload_images = 1;
+	cell->num_preload_images = 0;
 
-	image->source_address = (unsigned long)read_file(argv[4], &size);
-	image->size = size;
-	image->target_address = 0;
+	image->source_address = 0;
+	if (argc > 4) {
+		cell->num_preload_images = 1;
+		image->source_address =
+			(unsigned long)read_file(argv[4], &size);
+		image->size = size;
+		image->target_address = 0;
+	}
 
 	if (argc == 7) {
 		errno = 0;
@@ -141,9 +293,9 @@ static int cell_create(int argc, char *argv[])
 
 	fd = open_dev();
 
-	err = ioctl(fd, JAILHOUSE_CELL_CREATE, &params);
+	err = ioctl(fd, JAILHOUSE_CELL_RESTART, &params);
 	if (err)
-		perror("JAILHOUSE_CELL_CREATE");
+		perror("JAILHOUSE_CELL_RESTART");
 
 	close(fd);
 	free((void *)(unsigned long)cell->config_address);
@@ -152,10 +304,10 @@ static int cell_create(int argc, char *argv[])
 	return err;
 }
 
-static int cell_destroy(int argc, char *argv[])
+static int cell_meminfo(int argc, char *argv[])
 {
-	struct jailhouse_cell cell;
-	size_t size;
+	struct jailhouse_cell_mem_info query;
+	struct jailhouse_mem_info *info = &query.info;
 	int err, fd;
 
 	if (argc != 4) {
@@ -163,22 +315,246 @@ static int cell_destroy(int argc, char *argv[])
 		exit(1);
 	}
 
-	cell.config_address = (unsigned long)read_file(argv[3], &size);
-	cell.config_size = size;
+	memset(&query, 0, sizeof(query));
+	strncpy(query.name, argv[3], JAILHOUSE_CELL_NAME_MAXLEN);
 
 	fd = open_dev();
 
-	err = ioctl(fd, JAILHOUSE_CELL_DESTROY, &cell);
+	err = ioctl(fd, JAILHOUSE_CELL_MEM_INFO, &query);
+	if (err) {
+		perror("JAILHOUSE_CELL_MEM_INFO");
+		close(fd);
+		return err;
+	}
+	close(fd);
+
+	printf("Hypervisor memory (pages):\n"
+	       "  mem pool:       %u used, %u peak, %u total\n"
+	       "  remap pool:     %u used, %u peak, %u total\n"
+	       "  DMA context:    %u\n",
+	       info->mem_pool_used, info->mem_pool_peak, info->mem_pool_pages,
+	       info->remap_pool_used, info->remap_pool_peak,
+	       info->remap_pool_pages, info->dma_context_tables);
+	printf("Cell \"%s\" (pages):\n"
+	       "  cell data:      %u\n"
+	       "  cpu set:        %u\n"
+	       "  page tables:    %u (peak %u)\n"
+	       "  DMA tables:     %u (peak %u)\n",
+	       query.name, info->cell_data, info->cpu_set,
+	       info->page_tables, info->page_tables_peak,
+	       info->dma_page_tables, info->dma_page_tables_peak);
+
+	return 0;
+}
+
+static int cell_workingset(int argc, char *argv[])
+{
+	struct jailhouse_cell_working_set query;
+	struct jailhouse_working_set *ws = &query.ws;
+	int arg = 4, err, fd;
+	char *endp;
+
+	if (argc < 4 || argc > 7) {
+		help(argv[0]);
+		exit(1);
+	}
+
+	memset(&query, 0, sizeof(query));
+	strncpy(query.name, argv[3], JAILHOUSE_CELL_NAME_MAXLEN);
+
+	if (arg < argc && strcmp(argv[arg], "-c") == 0) {
+		ws->flags |= JAILHOUSE_WS_CLEAR;
+		arg++;
+	}
+	if (argc - arg == 2) {
+		errno = 0;
+		ws->start = strtoull(argv[arg], &endp, 0);
+		if (errno == 0 && *endp == 0)
+			ws->size = strtoull(argv[arg + 1], &endp, 0);
+		if (errno != 0 || *endp != 0 || ws->size == 0) {
+			help(argv[0]);
+			exit(1);
+		}
+	} else if (arg != argc) {
+		help(argv[0]);
+		exit(1);
+	}
+
+	fd = open_dev();
+
+	err = ioctl(fd, JAILHOUSE_CELL_WORKING_SET, &query);
+	if (err) {
+		perror("JAILHOUSE_CELL_WORKING_SET");
+		close(fd);
+		return err;
+	}
+	close(fd);
+
+	printf("Cell \"%s\" (KiB):\n"
+	       "  mapped:         %llu\n"
+	       "  accessed:       %llu\n"
+	       "  dirty:          %llu\n",
+	       query.name, (unsigned long long)ws->mapped / 1024,
+	       (unsigned long long)ws->accessed / 1024,
+	       (unsigned long long)ws->dirty / 1024);
+
+	return 0;
+}
+
+static int cell_move_cpu(int argc, char *argv[])
+{
+	struct jailhouse_cell_cpu req;
+	int add = strcmp(argv[2], "addcpu") == 0;
+	char *endp;
+	int err, fd;
+
+	if (argc != 5) {
+		help(argv[0]);
+		exit(1);
+	}
+
+	memset(&req, 0, sizeof(req));
+	strncpy(req.name, argv[3], JAILHOUSE_CELL_NAME_MAXLEN);
+
+	errno = 0;
+	req.cpu_id = strtoul(argv[4], &endp, 0);
+	if (errno != 0 || *endp != 0) {
+		help(argv[0]);
+		exit(1);
+	}
+
+	fd = open_dev();
+
+	err = ioctl(fd, add ? JAILHOUSE_CELL_ADD_CPU :
+		    JAILHOUSE_CELL_REMOVE_CPU, &req);
 	if (err)
-		perror("JAILHOUSE_CELL_DESTROY");
+		perror(add ? "JAILHOUSE_CELL_ADD_CPU" :
+		       "JAILHOUSE_CELL_REMOVE_CPU");
+
+	close(fd);
+	return err;
+}
+
+static const char *exit_stat_names[JAILHOUSE_NUM_EXIT_STATS] = {
+	[JAILHOUSE_EXIT_STAT_MANAGEMENT] = "management",
+	[JAILHOUSE_EXIT_STAT_CPUID] = "cpuid",
+	[JAILHOUSE_EXIT_STAT_CR] = "cr access",
+	[JAILHOUSE_EXIT_STAT_MSR_READ] = "msr read",
+	[JAILHOUSE_EXIT_STAT_MSR_WRITE] = "msr write",
+	[JAILHOUSE_EXIT_STAT_MSR_WRITE_ICR] = "msr write icr",
+	[JAILHOUSE_EXIT_STAT_APIC_ACCESS] = "apic access",
+	[JAILHOUSE_EXIT_STAT_XSETBV] = "xsetbv",
+	[JAILHOUSE_EXIT_STAT_VMCALL] = "hypercall",
+	[JAILHOUSE_EXIT_STAT_HLT] = "hlt",
+	[JAILHOUSE_EXIT_STAT_MWAIT] = "monitor/mwait",
+	[JAILHOUSE_EXIT_STAT_PAUSE] = "pause loop",
+	[JAILHOUSE_EXIT_STAT_MMIO] = "mmio",
+	[JAILHOUSE_EXIT_STAT_PREEMPTION_TIMER] = "preemption timer",
+};
+
+static int cpu_stats(int argc, char *argv[])
+{
+	struct jailhouse_cpu_stats_query query;
+	struct jailhouse_exit_stat *stat;
+	unsigned int n;
+	int err, fd;
+	char *endp;
+
+	if (argc != 4) {
+		help(argv[0]);
+		exit(1);
+	}
+
+	memset(&query, 0, sizeof(query));
+	errno = 0;
+	query.cpu_id = strtoul(argv[3], &endp, 0);
+	if (errno != 0 || *endp != 0) {
+		help(argv[0]);
+		exit(1);
+	}
+
+	fd = open_dev();
+
+	err = ioctl(fd, JAILHOUSE_CPU_STATS, &query);
+	if (err) {
+		perror("JAILHOUSE_CPU_STATS");
+		close(fd);
+		return err;
+	}
+	close(fd);
+
+	printf("%-16s %12s %16s %12s %12s\n", "VM exit", "count",
+	       "cycles", "avg", "max");
+	for (n = 0; n < JAILHOUSE_NUM_EXIT_STATS; n++) {
+		stat = &query.stats.exit[n];
+		printf("%-16s %12llu %16llu %12llu %12llu\n",
+		       exit_stat_names[n], (unsigned long long)stat->count,
+		       (unsigned long long)stat->cycles,
+		       (unsigned long long)(stat->count ?
+					    stat->cycles / stat->count : 0),
+		       (unsigned long long)stat->max_cycles);
+	}
+
+	printf("\n%-16s %16llu\n%-16s %16llu\n%-16s %16llu\n",
+	       "guest cycles", (unsigned long long)query.stats.guest_cycles,
+	       "hypervisor", (unsigned long long)query.stats.hypervisor_cycles,
+	       "suspended", (unsigned long long)query.stats.suspended_cycles);
+
+	return 0;
+}
+
+/* prints what the hypervisor logged on a CPU, optionally following it */
+static int cpu_log(int argc, char *argv[])
+{
+	struct jailhouse_cpu_log_query query;
+	struct jailhouse_log_position *pos = &query.log.pos;
+	int follow = 0;
+	__u64 next = 0;
+	int err, fd;
+	char *endp;
+
+	if (argc == 5 && strcmp(argv[4], "-f") == 0)
+		follow = 1;
+	else if (argc != 4) {
+		help(argv[0]);
+		exit(1);
+	}
+
+	memset(&query, 0, sizeof(query));
+	errno = 0;
+	query.cpu_id = strtoul(argv[3], &endp, 0);
+	if (errno != 0 || *endp != 0) {
+		help(argv[0]);
+		exit(1);
+	}
+
+	fd = open_dev();
+
+	do {
+		pos->start = next;
+		err = ioctl(fd, JAILHOUSE_CPU_LOG, &query);
+		if (err) {
+			perror("JAILHOUSE_CPU_LOG");
+			break;
+		}
+
+		if (next != 0 && pos->start != next)
+			printf("[%llu bytes lost]\n",
+			       (unsigned long long)(pos->start - next));
+		for (next = pos->start; next < pos->end; next++)
+			putchar(query.log.data[next % JAILHOUSE_LOG_SIZE]);
+		fflush(stdout);
+
+		if (follow)
+			usleep(100000);
+	} while (follow);
 
 	close(fd);
-	free((void *)(unsigned long)cell.config_address);
 
 	return err;
 }
 
-static int cell_management(int argc, char *argv[])
+static int cpu_management(int argc, char *argv[])
 {
 	int err;
 
@@ -187,10 +563,10 @@ static int cell_management(int argc, char *argv[])
 		exit(1);
 	}
 
-	if (strcmp(argv[2], "create") == 0)
-		err = cell_create(argc, argv);
-	else if (strcmp(argv[2], "destroy") == 0)
-		err = cell_destroy(argc, argv);
+	if (strcmp(argv[2], "stats") == 0)
+		err = cpu_stats(argc, argv);
+	else if (strcmp(argv[2], "log") == 0)
+		err = cpu_log(argc, argv);
 	else {
 		help(argv[0]);
 		exit(1);
@@ -199,6 +575,1006 @@ static int cell_management(int argc, char *argv[])
 	return err;
 }
 
+static int dma_faults(int argc, char *argv[])
+{
+	struct jailhouse_dma_faults_query query;
+	struct jailhouse_dma_faults *faults = &query.faults;
+	struct jailhouse_dma_fault *record;
+	unsigned int n, seq;
+	int err, fd;
+	char *endp;
+
+	if (argc != 4 || strcmp(argv[2], "faults") != 0) {
+		help(argv[0]);
+		exit(1);
+	}
+
+	memset(&query, 0, sizeof(query));
+	errno = 0;
+	query.unit = strtoul(argv[3], &endp, 0);
+	if (errno != 0 || *endp != 0) {
+		help(argv[0]);
+		exit(1);
+	}
+
+	fd = open_dev();
+
+	err = ioctl(fd, JAILHOUSE_DMA_FAULTS, &query);
+	if (err) {
+		perror("JAILHOUSE_DMA_FAULTS");
+		close(fd);
+		return err;
+	}
+	close(fd);
+
+	printf("DMA remapping unit %u of %u: %u faults, %u overflows\n",
+	       query.unit, faults->num_units, faults->total,
+	       faults->overflows);
+
+	printf("\n%-12s %12s\n", "device", "faults");
+	for (n = 0; n < JAILHOUSE_DMA_FAULT_DEVICES; n++)
+		if (faults->device[n].count > 0)
+			printf("%02x:%02x.%x      %12u\n",
+			       faults->device[n].source_id >> 8,
+			       (faults->device[n].source_id >> 3) & 0x1f,
+			       faults->device[n].source_id & 7,
+			       faults->device[n].count);
+
+	printf("\n%-10s %-12s %-6s %-6s %18s\n", "fault", "device", "reason",
+	       "access", "address");
+	seq = faults->total > JAILHOUSE_DMA_FAULT_RECORDS ?
+		faults->total - JAILHOUSE_DMA_FAULT_RECORDS + 1 : 1;
+	for (; seq <= faults->total; seq++) {
+		record = &faults->record[(seq - 1) %
+					 JAILHOUSE_DMA_FAULT_RECORDS];
+		if (record->seq != seq)
+			continue;
+		printf("%-10u %02x:%02x.%x      0x%02x   %-6s 0x%016llx\n",
+		       seq, record->source_id >> 8,
+		       (record->source_id >> 3) & 0x1f,
+		       record->source_id & 7, record->reason,
+		       record->flags & JAILHOUSE_DMA_FAULT_READ ?
+		       "read" : "write",
+		       (unsigned long long)record->address);
+	}
+
+	return 0;
+}
+
+static const char *trace_event_names[JAILHOUSE_TRACE_NUM_EVENTS] = {
+	[JAILHOUSE_TRACE_VMEXIT] = "vmexit",
+	[JAILHOUSE_TRACE_VMENTRY] = "vmentry",
+	[JAILHOUSE_TRACE_IPI] = "ipi",
+	[JAILHOUSE_TRACE_SUSPEND_CPU] = "suspend",
+	[JAILHOUSE_TRACE_RESUME_CPU] = "resume",
+	[JAILHOUSE_TRACE_INVEPT] = "invept",
+	[JAILHOUSE_TRACE_IOMMU_FLUSH] = "iommu-flush",
+	[JAILHOUSE_TRACE_CELL_CREATE] = "cell-create",
+	[JAILHOUSE_TRACE_CELL_DESTROY] = "cell-destroy",
+	[JAILHOUSE_TRACE_CELL_RESTART] = "cell-restart",
+	[JAILHOUSE_TRACE_CPU_MOVE] = "cpu-move",
+};
+
+static int trace_set_events(int argc, char *argv[])
+{
+	unsigned long mask = 0;
+	unsigned int n;
+	int arg, ret, fd;
+
+	if (strcmp(argv[2], "enable") == 0) {
+		if (argc == 3)
+			mask = JAILHOUSE_TRACE_ALL;
+		for (arg = 3; arg < argc; arg++) {
+			for (n = 0; n < JAILHOUSE_TRACE_NUM_EVENTS; n++)
+				if (strcmp(argv[arg], trace_event_names[n]) == 0)
+					break;
+			if (n == JAILHOUSE_TRACE_NUM_EVENTS) {
+				fprintf(stderr, "unknown trace event: %s\n",
+					argv[arg]);
+				exit(1);
+			}
+			mask |= 1UL << n;
+		}
+	} else if (argc != 3) {
+		help(argv[0]);
+		exit(1);
+	}
+
+	fd = open_dev();
+
+	ret = ioctl(fd, JAILHOUSE_TRACE_SET_EVENTS, mask);
+	if (ret < 0)
+		perror("JAILHOUSE_TRACE_SET_EVENTS");
+	close(fd);
+
+	return ret < 0 ? ret : 0;
+}
+
+static int trace_event_compare(const void *a, const void *b)
+{
+	const struct jailhouse_trace_event *ea = a, *eb = b;
+
+	if (ea->timestamp != eb->timestamp)
+		return ea->timestamp < eb->timestamp ? -1 : 1;
+	return ea->cpu_id - eb->cpu_id;
+}
+
+static void trace_print_event(const struct jailhouse_trace_event *event)
+{
+	printf("%20llu %3u ", (unsigned long long)event->timestamp,
+	       event->cpu_id);
+
+	switch (event->type) {
+	case JAILHOUSE_TRACE_VMENTRY:
+		printf("%-12s %s\n", trace_event_names[event->type],
+		       event->arg < JAILHOUSE_NUM_EXIT_STATS ?
+		       exit_stat_names[event->arg] : "?");
+		break;
+	case JAILHOUSE_TRACE_IPI:
+		printf("%-12s cpu %u icr %04x\n",
+		       trace_event_names[event->type], event->arg >> 16,
+		       event->arg & 0xffff);
+		break;
+	case JAILHOUSE_TRACE_SUSPEND_CPU:
+	case JAILHOUSE_TRACE_RESUME_CPU:
+		printf("%-12s cpu %u\n", trace_event_names[event->type],
+		       event->arg);
+		break;
+	case JAILHOUSE_TRACE_INVEPT:
+	case JAILHOUSE_TRACE_CELL_CREATE:
+	case JAILHOUSE_TRACE_CELL_DESTROY:
+	case JAILHOUSE_TRACE_CELL_RESTART:
+		printf("%-12s cell %u\n", trace_event_names[event->type],
+		       event->arg);
+		break;
+	case JAILHOUSE_TRACE_CPU_MOVE:
+		printf("%-12s cpu %u cell %u\n",
+		       trace_event_names[event->type], event->arg >> 16,
+		       event->arg & 0xffff);
+		break;
+	case JAILHOUSE_TRACE_IOMMU_FLUSH:
+		printf("%-12s gran %u domain %u\n",
+		       trace_event_names[event->type], event->arg >> 16,
+		       event->arg & 0xffff);
+		break;
+	case JAILHOUSE_TRACE_VMEXIT:
+		printf("%-12s reason %u\n", trace_event_names[event->type],
+		       event->arg);
+		break;
+	default:
+		printf("%-12u %08x\n", event->type, event->arg);
+		break;
+	}
+}
+
+/*
+ * Collects the new events of all CPUs and prints them ordered by TSC. The
+ * timestamps can be correlated with ftrace using its x86-tsc clock.
+ */
+static int trace_dump(int argc, char *argv[])
+{
+	struct jailhouse_cpu_trace_query *query;
+	struct jailhouse_log_position *pos;
+	struct jailhouse_trace_event *events, *batch = NULL;
+	unsigned int num_cpus = 0, cpu, count, n;
+	__u64 *next = NULL;
+	int follow = 0;
+	int err = 0, fd;
+
+	if (argc == 4 && strcmp(argv[3], "-f") == 0)
+		follow = 1;
+	else if (argc != 3) {
+		help(argv[0]);
+		exit(1);
+	}
+
+	query = malloc(sizeof(*query));
+	if (!query) {
+		fprintf(stderr, "insufficient memory\n");
+		exit(1);
+	}
+	memset(query, 0, sizeof(*query));
+	pos = &query->trace.pos;
+	events = query->trace.events;
+
+	fd = open_dev();
+
+	/* the hypervisor rejects the first CPU ID beyond the last one */
+	while (1) {
+		query->cpu_id = num_cpus;
+		if (ioctl(fd, JAILHOUSE_CPU_TRACE, query) < 0)
+			break;
+		num_cpus++;
+	}
+	if (num_cpus == 0) {
+		perror("JAILHOUSE_CPU_TRACE");
+		err = -1;
+		goto out;
+	}
+
+	next = calloc(num_cpus, sizeof(*next));
+	batch = malloc(num_cpus * sizeof(query->trace.events));
+	if (!next || !batch) {
+		fprintf(stderr, "insufficient memory\n");
+		exit(1);
+	}
+
+	do {
+		count = 0;
+		for (cpu = 0; cpu < num_cpus; cpu++) {
+			query->cpu_id = cpu;
+			pos->start = next[cpu];
+			err = ioctl(fd, JAILHOUSE_CPU_TRACE, query);
+			if (err) {
+				perror("JAILHOUSE_CPU_TRACE");
+				goto out;
+			}
+
+			if (next[cpu] != 0 && pos->start != next[cpu])
+				printf("[CPU %u: %llu events lost]\n", cpu,
+				       (unsigned long long)
+				       (pos->start - next[cpu]));
+			for (next[cpu] = pos->start; next[cpu] < pos->end;
+			     next[cpu]++) {
+				n = next[cpu] % JAILHOUSE_TRACE_EVENTS;
+				batch[count++] = events[n];
+			}
+		}
+
+		qsort(batch, count, sizeof(*batch), trace_event_compare);
+		for (n = 0; n < count; n++)
+			trace_print_event(&batch[n]);
+		fflush(stdout);
+
+		if (follow)
+			usleep(100000);
+	} while (follow);
+
+out:
+	close(fd);
+	free(batch);
+	free(next);
+	free(query);
+
+	return err;
+}
+
+static int trace_management(int argc, char *argv[])
+{
+	int err;
+
+	if (argc < 3) {
+		help(argv[0]);
+		exit(1);
+	}
+
+	if (strcmp(argv[2], "enable") == 0 ||
+	    strcmp(argv[2], "disable") == 0)
+		err = trace_set_events(argc, argv);
+	else if (strcmp(argv[2], "dump") == 0)
+		err = trace_dump(argc, argv);
+	else {
+		help(argv[0]);
+		exit(1);
+	}
+
+	return err;
+}
+
+static struct jailhouse_stats *map_stats(int fd, size_t *size)
+{
+	long page_size = sysconf(_SC_PAGESIZE);
+	struct jailhouse_stats *stats;
+	unsigned int num_cpus;
+
+	stats = mmap(NULL, page_size, PROT_READ, MAP_SHARED, fd, 0);
+	if (stats == MAP_FAILED) {
+		perror("mmap statistics area");
+		exit(1);
+	}
+	if (stats->version != JAILHOUSE_STATS_VERSION) {
+		fprintf(stderr, "unsupported statistics area version %u\n",
+			stats->version);
+		exit(1);
+	}
+	num_cpus = stats->num_cpus;
+	munmap(stats, page_size);
+
+	*size = jailhouse_stats_size(num_cpus);
+	stats = mmap(NULL, *size, PROT_READ, MAP_SHARED, fd, 0);
+	if (stats == MAP_FAILED) {
+		perror("mmap statistics area");
+		exit(1);
+	}
+	return stats;
+}
+
+/* retries while the hypervisor updates the cell assignments */
+static void read_stats(struct jailhouse_stats *copy,
+		       const struct jailhouse_stats *stats, size_t size)
+{
+	__u32 seq;
+
+	do {
+		while ((seq = stats->seq) & 1)
+			sched_yield();
+		__sync_synchronize();
+		memcpy(copy, stats, size);
+		__sync_synchronize();
+	} while (stats->seq != seq);
+}
+
+static __u64 cpu_exits(const struct jailhouse_cpu_stats *stats)
+{
+	__u64 exits = 0;
+	unsigned int n;
+
+	for (n = 0; n < JAILHOUSE_NUM_EXIT_STATS; n++)
+		exits += stats->exit[n].count;
+	return exits;
+}
+
+static __u64 cpu_exit_cycles(const struct jailhouse_cpu_stats *stats)
+{
+	__u64 cycles = 0;
+	unsigned int n;
+
+	for (n = 0; n < JAILHOUSE_NUM_EXIT_STATS; n++)
+		cycles += stats->exit[n].cycles;
+	return cycles;
+}
+
+static void print_share(unsigned long long part, unsigned long long total)
+{
+	unsigned long long permille = total ? part * 1000 / total : 0;
+
+	printf(" %5llu.%llu%%", permille / 10, permille % 10);
+}
+
+static void print_pool_stats(const char *name,
+			     const struct jailhouse_pool_stats *pool)
+{
+	printf("  %-6s %8u of %8u pages used (peak %u)\n", name, pool->used,
+	       pool->pages, pool->peak);
+}
+
+/* rates are per second, cycle counts per exit handled in the interval */
+static void print_stats(const struct jailhouse_stats *prev,
+			const struct jailhouse_stats *cur,
+			unsigned int interval)
+{
+	unsigned long long count, cycles, max, guest, hv, suspended, total;
+	const struct jailhouse_cpu_stats *p, *c;
+	unsigned int cpu, other, n;
+
+	printf("\033[H\033[2J");
+	printf("Jailhouse statistics, %u s interval\n\nPage pools:\n",
+	       interval);
+	print_pool_stats("mem", &cur->mem_pool);
+	print_pool_stats("remap", &cur->remap_pool);
+
+	printf("\n%-6s %6s %12s %12s %12s %12s\n", "CPU", "cell", "exits/s",
+	       "avg cycles", "IPIs/s", "IRQs/s");
+	for (cpu = 0; cpu < cur->num_cpus; cpu++) {
+		p = &prev->cpu[cpu];
+		c = &cur->cpu[cpu];
+		count = cpu_exits(c) - cpu_exits(p);
+		cycles = cpu_exit_cycles(c) - cpu_exit_cycles(p);
+		printf("%-6u %6u %12llu %12llu %12llu %12llu\n", cpu,
+		       c->cell_id, count / interval,
+		       count ? cycles / count : 0,
+		       (unsigned long long)(c->ipis - p->ipis) / interval,
+		       (unsigned long long)(c->interrupts - p->interrupts) /
+		       interval);
+	}
+
+	printf("\n%-6s %12s %12s %8s %8s %8s\n", "cell", "exits/s",
+	       "avg cycles", "guest", "hv", "susp");
+	for (cpu = 0; cpu < cur->num_cpus; cpu++) {
+		/* report each cell once, at its first CPU */
+		for (other = 0; other < cpu; other++)
+			if (cur->cpu[other].cell_id == cur->cpu[cpu].cell_id)
+				break;
+		if (other < cpu)
+			continue;
+
+		count = cycles = guest = hv = suspended = 0;
+		for (other = cpu; other < cur->num_cpus; other++) {
+			if (cur->cpu[other].cell_id != cur->cpu[cpu].cell_id)
+				continue;
+			p = &prev->cpu[other];
+			c = &cur->cpu[other];
+			count += cpu_exits(c) - cpu_exits(p);
+			cycles += cpu_exit_cycles(c) - cpu_exit_cycles(p);
+			guest += c->guest_cycles - p->guest_cycles;
+			hv += c->hypervisor_cycles - p->hypervisor_cycles;
+			suspended += c->suspended_cycles - p->suspended_cycles;
+		}
+		printf("%-6u %12llu %12llu", cur->cpu[cpu].cell_id,
+		       count / interval, count ? cycles / count : 0);
+		total = guest + hv + suspended;
+		print_share(guest, total);
+		print_share(hv, total);
+		print_share(suspended, total);
+		printf("\n");
+	}
+
+	printf("\n%-16s %12s %12s %12s\n", "VM exit", "exits/s",
+	       "avg cycles", "max cycles");
+	for (n = 0; n < JAILHOUSE_NUM_EXIT_STATS; n++) {
+		count = cycles = max = 0;
+		for (cpu = 0; cpu < cur->num_cpus; cpu++) {
+			p = &prev->cpu[cpu];
+			c = &cur->cpu[cpu];
+			count += c->exit[n].count - p->exit[n].count;
+			cycles += c->exit[n].cycles - p->exit[n].cycles;
+			if (c->exit[n].max_cycles > max)
+				max = c->exit[n].max_cycles;
+		}
+		printf("%-16s %12llu %12llu %12llu\n", exit_stat_names[n],
+		       count / interval, count ? cycles / count : 0, max);
+	}
+	printf("\n(max cycles since enabling the hypervisor)\n");
+	fflush(stdout);
+}
+
+/*
+ * Samples the statistics area the hypervisor shares with Linux, so the
+ * monitor does not cause any VM exits itself.
+ */
+static int stat_monitor(int argc, char *argv[])
+{
+	struct jailhouse_stats *stats, *prev, *cur, *tmp;
+	unsigned int interval = 1;
+	char *endp;
+	size_t size;
+	int fd;
+
+	if (argc > 3) {
+		help(argv[0]);
+		exit(1);
+	}
+	if (argc == 3) {
+		errno = 0;
+		interval = strtoul(argv[2], &endp, 0);
+		if (errno != 0 || *endp != 0 || interval == 0) {
+			help(argv[0]);
+			exit(1);
+		}
+	}
+
+	fd = open_dev();
+	stats = map_stats(fd, &size);
+
+	prev = malloc(size);
+	cur = malloc(size);
+	if (!prev || !cur) {
+		fprintf(stderr, "insufficient memory\n");
+		exit(1);
+	}
+
+	read_stats(prev, stats, size);
+	while (1) {
+		sleep(interval);
+		read_stats(cur, stats, size);
+		print_stats(prev, cur, interval);
+
+		tmp = prev;
+		prev = cur;
+		cur = tmp;
+	}
+
+	return 0;
+}
+
+static const char *cell_state_names[] = {
+	[JAILHOUSE_CELL_STATE_RUNNING]	= "running",
+	[JAILHOUSE_CELL_STATE_PARKED]	= "parked",
+};
+
+static int cell_list(int argc, char *argv[])
+{
+	const struct jailhouse_cell_status *cell;
+	struct jailhouse_stats *stats, *copy;
+	unsigned int id, cpu, count;
+	size_t size;
+	int fd;
+
+	if (argc != 3) {
+		help(argv[0]);
+		exit(1);
+	}
+
+	fd = open_dev();
+	stats = map_stats(fd, &size);
+	copy = malloc(size);
+	if (!copy) {
+		fprintf(stderr, "insufficient memory\n");
+		exit(1);
+	}
+	read_stats(copy, stats, size);
+
+	printf("%-4s %-32s %-8s %s\n", "ID", "name", "state", "CPUs");
+	for (id = 0; id < copy->max_cells; id++) {
+		cell = &jailhouse_stats_cells(copy)[id];
+		if (cell->state != JAILHOUSE_CELL_STATE_RUNNING &&
+		    cell->state != JAILHOUSE_CELL_STATE_PARKED)
+			continue;
+
+		printf("%-4u %-32.32s %-8s", id, cell->name,
+		       cell_state_names[cell->state]);
+		count = 0;
+		for (cpu = 0; cpu < copy->num_cpus; cpu++)
+			if (copy->cpu[cpu].cell_id == id)
+				printf("%s%u", count++ ? "," : " ", cpu);
+		printf("\n");
+	}
+
+	printf("\nPage pools:\n");
+	print_pool_stats("mem", &copy->mem_pool);
+	print_pool_stats("remap", &copy->remap_pool);
+
+	free(copy);
+	munmap(stats, size);
+	close(fd);
+	return 0;
+}
+
+static int cell_management(int argc, char *argv[])
+{
+	int err;
+
+	if (argc < 3) {
+		help(argv[0]);
+		exit(1);
+	}
+
+	if (strcmp(argv[2], "create") == 0)
+		err = cell_create(argc, argv);
+	else if (strcmp(argv[2], "destroy") == 0)
+		err = cell_destroy(argc, argv);
+	else if (strcmp(argv[2], "restart") == 0)
+		err = cell_restart(argc, argv);
+	else if (strcmp(argv[2], "meminfo") == 0)
+		err = cell_meminfo(argc, argv);
+	else if (strcmp(argv[2], "workingset") == 0)
+		err = cell_workingset(argc, argv);
+	else if (strcmp(argv[2], "addcpu") == 0 ||
+		 strcmp(argv[2], "removecpu") == 0)
+		err = cell_move_cpu(argc, argv);
+	else if (strcmp(argv[2], "list") == 0)
+		err = cell_list(argc, argv);
+	else {
+		help(argv[0]);
+		exit(1);
+	}
+
+	return err;
+}
+
+/*
+ * Offline checks of configuration files. The page table estimate follows
+ * the EPT setup of the hypervisor: 4 levels, 2 MiB and 1 GiB pages used
+ * wherever the alignment of both addresses permits.
+ */
+#define CONFIG_PAGE_4K		0x1000ULL
+#define CONFIG_PAGE_2M		0x200000ULL
+#define CONFIG_PAGE_1G		0x40000000ULL
+
+struct config_file {
+	void *data;
+	size_t size;
+	/* NULL for cell configurations */
+	struct jailhouse_system *system;
+	struct jailhouse_cell_desc *cell;
+};
+
+struct index_set {
+	unsigned long long *index;
+	size_t num, max;
+};
+
+struct mapping_stats {
+	unsigned long long pages_4k, pages_2m, pages_1g;
+	unsigned long long bytes;
+	/* page tables per level below the root: PDPTs, PDs, PTs */
+	struct index_set tables[3];
+};
+
+static void config_load(const char *name, struct config_file *config)
+{
+	config->data = read_file(name, &config->size);
+	config->system = NULL;
+	config->cell = config->data;
+
+	if (config->size >= sizeof(struct jailhouse_system) &&
+	    jailhouse_system_config_size(config->data) == config->size) {
+		config->system = config->data;
+		config->cell = &config->system->system;
+	} else if (config->size < sizeof(struct jailhouse_cell_desc) ||
+		   jailhouse_cell_config_size(config->cell) != config->size) {
+		fprintf(stderr, "%s: not a system or cell configuration\n",
+			name);
+		exit(1);
+	}
+}
+
+static void index_set_add(struct index_set *set, unsigned long long index)
+{
+	/* regions are walked upwards, so most duplicates are adjacent */
+	if (set->num > 0 && set->index[set->num - 1] == index)
+		return;
+
+	if (set->num == set->max) {
+		set->max = set->max ? set->max * 2 : 64;
+		set->index = realloc(set->index,
+				     set->max * sizeof(*set->index));
+		if (!set->index) {
+			fprintf(stderr, "insufficient memory\n");
+			exit(1);
+		}
+	}
+	set->index[set->num++] = index;
+}
+
+static int index_compare(const void *a, const void *b)
+{
+	const unsigned long long *ia = a, *ib = b;
+
+	return *ia < *ib ? -1 : *ia > *ib;
+}
+
+static size_t index_set_count(struct index_set *set)
+{
+	size_t n, count = 0;
+
+	qsort(set->index, set->num, sizeof(*set->index), index_compare);
+	for (n = 0; n < set->num; n++)
+		if (n == 0 || set->index[n] != set->index[n - 1])
+			count++;
+	return count;
+}
+
+static void account_region(const struct jailhouse_memory *mem,
+			   struct mapping_stats *stats)
+{
+	unsigned long long virt = mem->virt_start;
+	unsigned long long phys = mem->phys_start;
+	unsigned long long left = mem->size;
+	unsigned long long size;
+
+	stats->bytes += left;
+
+	while (left > 0) {
+		if (((virt | phys) & (CONFIG_PAGE_1G - 1)) == 0 &&
+		    left >= CONFIG_PAGE_1G) {
+			size = CONFIG_PAGE_1G;
+			stats->pages_1g++;
+		} else if (((virt | phys) & (CONFIG_PAGE_2M - 1)) == 0 &&
+			   left >= CONFIG_PAGE_2M) {
+			size = CONFIG_PAGE_2M;
+			stats->pages_2m++;
+		} else {
+			size = CONFIG_PAGE_4K;
+			stats->pages_4k++;
+		}
+
+		index_set_add(&stats->tables[0], virt >> 39);
+		if (size < CONFIG_PAGE_1G)
+			index_set_add(&stats->tables[1], virt >> 30);
+		if (size < CONFIG_PAGE_2M)
+			index_set_add(&stats->tables[2], virt >> 21);
+
+		virt += size;
+		phys += size;
+		left -= size;
+	}
+}
+
+static void print_mapping_stats(const char *what,
+				const struct jailhouse_memory *mem,
+				unsigned int num)
+{
+	struct mapping_stats stats;
+	unsigned long long large;
+	size_t tables;
+	unsigned int n;
+
+	memset(&stats, 0, sizeof(stats));
+	for (n = 0; n < num; n++)
+		account_region(&mem[n], &stats);
+
+	/* the root table is always there */
+	tables = 1;
+	for (n = 0; n < 3; n++) {
+		tables += index_set_count(&stats.tables[n]);
+		free(stats.tables[n].index);
+	}
+
+	large = stats.pages_2m * CONFIG_PAGE_2M +
+		stats.pages_1g * CONFIG_PAGE_1G;
+	printf("%s: %u regions, %llu/%llu/%llu pages of 4K/2M/1G, "
+	       "%zu page tables (%zu KiB), %llu%% in large pages\n", what,
+	       num, stats.pages_4k, stats.pages_2m, stats.pages_1g, tables,
+	       tables * 4, stats.bytes ? large * 100 / stats.bytes : 0);
+}
+
+static int regions_overlap(unsigned long long start1,
+			    unsigned long long size1,
+			    unsigned long long start2,
+			    unsigned long long size2)
+{
+	return start1 < start2 + size2 && start2 < start1 + size1;
+}
+
+static void print_region(unsigned int n, const struct jailhouse_memory *mem)
+{
+	printf("  %3u: phys %016llx virt %016llx size %016llx %c%c%c%c\n",
+	       n, (unsigned long long)mem->phys_start,
+	       (unsigned long long)mem->virt_start,
+	       (unsigned long long)mem->size,
+	       mem->access_flags & JAILHOUSE_MEM_READ ? 'R' : '-',
+	       mem->access_flags & JAILHOUSE_MEM_WRITE ? 'W' : '-',
+	       mem->access_flags & JAILHOUSE_MEM_EXECUTE ? 'X' : '-',
+	       mem->access_flags & JAILHOUSE_MEM_DMA ? 'D' : '-');
+}
+
+/* returns the number of errors, hints are printed as warnings */
+static unsigned int check_regions(const struct config_file *config)
+{
+	const struct jailhouse_memory *mem =
+		jailhouse_cell_mem_regions(config->cell);
+	const struct jailhouse_memory *hv_mem;
+	const struct jailhouse_numa_node *numa;
+	unsigned int num = config->cell->num_memory_regions;
+	unsigned int errors = 0;
+	unsigned int n, other, node;
+
+	for (n = 0; n < num; n++) {
+		print_region(n, &mem[n]);
+
+		if ((mem[n].phys_start | mem[n].virt_start | mem[n].size) &
+		    (CONFIG_PAGE_4K - 1) || mem[n].size == 0 ||
+		    mem[n].access_flags & ~JAILHOUSE_MEM_VALID_FLAGS) {
+			printf("       error: invalid alignment, size or "
+			       "flags\n");
+			errors++;
+			continue;
+		}
+
+		for (other = 0; other < n; other++) {
+			if (regions_overlap(mem[n].virt_start, mem[n].size,
+					    mem[other].virt_start,
+					    mem[other].size)) {
+				printf("       error: overlaps region %u\n",
+				       other);
+				errors++;
+			} else if (regions_overlap(mem[n].phys_start,
+						   mem[n].size,
+						   mem[other].phys_start,
+						   mem[other].size))
+				printf("       warning: aliases memory of "
+				       "region %u\n", other);
+		}
+
+		if (config->system) {
+			hv_mem = &config->system->hypervisor_memory;
+			if (regions_overlap(mem[n].phys_start, mem[n].size,
+					    hv_mem->phys_start,
+					    hv_mem->size)) {
+				printf("       error: overlaps hypervisor "
+				       "memory\n");
+				errors++;
+			}
+			for (node = 0; node < JAILHOUSE_MAX_NUMA_NODES;
+			     node++) {
+				numa = &config->system->numa_nodes[node];
+				if (numa->size > 0 &&
+				    regions_overlap(mem[n].phys_start,
+						    mem[n].size,
+						    numa->phys_start,
+						    numa->size)) {
+					printf("       error: overlaps memory "
+					       "of NUMA node %u\n", node);
+					errors++;
+				}
+			}
+		}
+
+		if (mem[n].size >= CONFIG_PAGE_2M &&
+		    (mem[n].phys_start ^ mem[n].virt_start) &
+		    (CONFIG_PAGE_2M - 1))
+			printf("       warning: phys/virt offset rules out "
+			       "2 MiB pages\n");
+		else if (mem[n].size >= CONFIG_PAGE_1G &&
+			 (mem[n].phys_start ^ mem[n].virt_start) &
+			 (CONFIG_PAGE_1G - 1))
+			printf("       warning: phys/virt offset rules out "
+			       "1 GiB pages\n");
+		else if (mem[n].size >= CONFIG_PAGE_2M &&
+			 (mem[n].virt_start | mem[n].size) &
+			 (CONFIG_PAGE_2M - 1))
+			printf("       warning: not 2 MiB aligned, edges "
+			       "need 4K pages\n");
+	}
+
+	return errors;
+}
+
+/*
+ * Merges regions that continue each other with equal flags. The first
+ * region keeps its position and start because images are loaded relative
+ * to it.
+ */
+static unsigned int coalesce_regions(struct jailhouse_memory *mem,
+				     unsigned int num)
+{
+	unsigned int n, other;
+	int merged;
+
+	do {
+		merged = 0;
+		for (n = 0; n < num; n++)
+			for (other = 1; other < num; other++) {
+				if (other == n ||
+				    mem[n].access_flags !=
+				    mem[other].access_flags ||
+				    mem[n].phys_start + mem[n].size !=
+				    mem[other].phys_start ||
+				    mem[n].virt_start + mem[n].size !=
+				    mem[other].virt_start)
+					continue;
+
+				mem[n].size += mem[other].size;
+				memmove(&mem[other], &mem[other + 1],
+					(num - other - 1) * sizeof(*mem));
+				num--;
+				merged = 1;
+				break;
+			}
+	} while (merged);
+
+	return num;
+}
+
+static void config_write(const char *name, const struct config_file *config,
+			 const struct jailhouse_memory *mem, unsigned int num)
+{
+	const struct jailhouse_memory *old_mem =
+		jailhouse_cell_mem_regions(config->cell);
+	size_t head = (const void *)old_mem - config->data;
+	size_t tail = head +
+		config->cell->num_memory_regions * sizeof(*mem);
+	size_t size = config->size - (tail - head) + num * sizeof(*mem);
+	struct jailhouse_cell_desc *cell;
+	void *out;
+	int fd;
+
+	out = malloc(size);
+	if (!out) {
+		fprintf(stderr, "insufficient memory\n");
+		exit(1);
+	}
+
+	memcpy(out, config->data, head);
+	memcpy(out + head, mem, num * sizeof(*mem));
+	memcpy(out + head + num * sizeof(*mem), config->data + tail,
+	       config->size - tail);
+
+	cell = out + ((void *)config->cell - config->data);
+	cell->num_memory_regions = num;
+
+	fd = open(name, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0 || write(fd, out, size) != (ssize_t)size || close(fd) < 0) {
+		fprintf(stderr, "writing %s: %s\n", name, strerror(errno));
+		exit(1);
+	}
+
+	free(out);
+}
+
+static int config_check(int argc, char *argv[])
+{
+	struct config_file config;
+	struct jailhouse_memory *mem;
+	unsigned int num, errors, n;
+
+	if ((argc != 4 && argc != 6) || strcmp(argv[2], "check") != 0 ||
+	    (argc == 6 && strcmp(argv[4], "-o") != 0)) {
+		help(argv[0]);
+		exit(1);
+	}
+
+	config_load(argv[3], &config);
+
+	printf("%s configuration \"%.*s\", memory regions:\n",
+	       config.system ? "System" : "Cell",
+	       JAILHOUSE_CELL_NAME_MAXLEN, config.cell->name);
+	errors = check_regions(&config);
+
+	num = config.cell->num_memory_regions;
+	mem = calloc(num, sizeof(*mem));
+	if (!mem && num > 0) {
+		fprintf(stderr, "insufficient memory\n");
+		exit(1);
+	}
+	memcpy(mem, jailhouse_cell_mem_regions(config.cell),
+	       num * sizeof(*mem));
+
+	printf("\n");
+	print_mapping_stats("As configured", mem, num);
+	if (errors == 0) {
+		num = coalesce_regions(mem, num);
+		print_mapping_stats("Coalesced", mem, num);
+		for (n = 0; n < num; n++)
+			print_region(n, &mem[n]);
+	}
+
+	if (errors > 0)
+		printf("\nNot coalescing, %u error(s) found\n", errors);
+	else if (argc == 6)
+		config_write(argv[5], &config, mem, num);
+
+	free(mem);
+	free(config.data);
+
+	return errors > 0 ? -1 : 0;
+}
+
+/*
+ * Responder for doorbell round trip measurements of inmates. Linux gets no
+ * doorbell interrupts, so the region is polled without sleeping.
+ */
+static int shmem_echo(int argc, char *argv[])
+{
+	struct jailhouse_echo *echo;
+	unsigned long count = 0;
+	int err = 0;
+	__u32 ping;
+	int fd;
+
+	if (argc != 4 || strcmp(argv[2], "echo") != 0) {
+		help(argv[0]);
+		exit(1);
+	}
+
+	fd = open(argv[3], O_RDWR);
+	if (fd < 0) {
+		perror("opening shmem device");
+		exit(1);
+	}
+
+	echo = mmap(NULL, sizeof(*echo), PROT_READ | PROT_WRITE, MAP_SHARED,
+		    fd, 0);
+	if (echo == MAP_FAILED) {
+		perror("mapping shmem device");
+		exit(1);
+	}
+
+	printf("Echoing pings on %s\n", argv[3]);
+	while (1) {
+		while (*(volatile __u32 *)&echo->magic !=
+		       JAILHOUSE_ECHO_MAGIC || echo->ping == echo->pong)
+			;
+		ping = echo->ping;
+		echo->pong = ping;
+		__sync_synchronize();
+
+		if (write(fd, "", 1) < 0) {
+			perror("ringing doorbell");
+			err = -1;
+			break;
+		}
+		if (++count % 100000 == 0)
+			printf("%lu pings echoed\n", count);
+	}
+
+	munmap(echo, sizeof(*echo));
+	close(fd);
+
+	return err;
+}
+
 int main(int argc, char *argv[])
 {
 	int fd;
@@ -219,6 +1595,18 @@ int main(int argc, char *argv[])
 		close(fd);
 	} else if (strcmp(argv[1], "cell") == 0) {
 		err = cell_management(argc, argv);
+	} else if (strcmp(argv[1], "cpu") == 0) {
+		err = cpu_management(argc, argv);
+	} else if (strcmp(argv[1], "dma") == 0) {
+		err = dma_faults(argc, argv);
+	} else if (strcmp(argv[1], "trace") == 0) {
+		err = trace_management(argc, argv);
+	} else if (strcmp(argv[1], "stat") == 0) {
+		err = stat_monitor(argc, argv);
+	} else if (strcmp(argv[1], "config") == 0) {
+		err = config_check(argc, argv);
+	} else if (strcmp(argv[1], "shmem") == 0) {
+		err = shmem_echo(argc, argv);
 	} else {
 		help(argv[0]);
 		exit(1);
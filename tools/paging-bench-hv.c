@@ -0,0 +1,95 @@
+/*
+ * Jailhouse, a Linux-based partitioning hypervisor
+ *
+ * Copyright (c) Siemens AG, 2013
+ *
+ * Authors:
+ *  Jan Kiszka <jan.kiszka@siemens.com>
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.  See
+ * the COPYING file in the top-level directory.
+ */
+
+/*
+ * User space build of the generic paging code. Only mem_pool is set up,
+ * there is no hypervisor page table, no per-CPU data and thus no page
+ * table magazines.
+ */
+
+#include "../hypervisor/paging.c"
+#include "paging-bench.h"
+
+int vprintf(const char *format, __builtin_va_list ap);
+
+/* provided by the linker script, setup.c and control.c otherwise */
+u8 __start[PAGE_SIZE], __page_pool[PAGE_SIZE];
+struct jailhouse_header hypervisor_header;
+struct jailhouse_system *system_config;
+unsigned long cache_line_size = 64;
+
+void printk(const char *fmt, ...)
+{
+	__builtin_va_list ap;
+
+	__builtin_va_start(ap, fmt);
+	vprintf(fmt, ap);
+	__builtin_va_end(ap);
+}
+
+int bench_paging_init(void *mem, unsigned long size, unsigned long phys_start)
+{
+	unsigned long meta_pages;
+
+	hypervisor_header.page_offset = (unsigned long)mem - phys_start;
+
+	mem_pool.base_address = mem;
+	mem_pool.pages = size / PAGE_SIZE;
+	meta_pages = page_pool_meta_pages(mem_pool.pages);
+	if (meta_pages >= mem_pool.pages)
+		return -ENOMEM;
+
+	page_pool_init(&mem_pool, mem, meta_pages);
+	mem_pool.flags = PAGE_SCRUB_ON_FREE;
+
+	return 0;
+}
+
+void bench_pool_stats(struct bench_pool_stats *stats)
+{
+	stats->pages = mem_pool.pages;
+	stats->used = mem_pool.used_pages;
+	stats->peak = mem_pool.peak_used_pages;
+	stats->free_blocks = mem_pool.free_blocks;
+	stats->largest_free_block = largest_free_block(&mem_pool);
+}
+
+void *bench_page_alloc(unsigned int num)
+{
+	return page_alloc(&mem_pool, num);
+}
+
+void bench_page_free(void *page, unsigned int num)
+{
+	page_free(&mem_pool, page, num);
+}
+
+int bench_map(void *root, unsigned long phys, unsigned long size,
+	      unsigned long virt, int huge_pages)
+{
+	return page_map_create(root, phys, size, virt, PAGE_DEFAULT_FLAGS,
+			       PAGE_DEFAULT_FLAGS, PAGE_DIR_LEVELS,
+			       huge_pages ?
+			       PAGE_MAP_HUGE_2M | PAGE_MAP_HUGE_1G :
+			       PAGE_MAP_NO_HUGE, PAGE_MAP_NON_COHERENT);
+}
+
+int bench_unmap(void *root, unsigned long virt, unsigned long size)
+{
+	return page_map_destroy(root, virt, size, PAGE_DEFAULT_FLAGS,
+				PAGE_DIR_LEVELS, PAGE_MAP_NON_COHERENT);
+}
+
+unsigned long bench_count_tables(void *root)
+{
+	return page_map_count_tables(root, PAGE_DIR_LEVELS);
+}
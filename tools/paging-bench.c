@@ -0,0 +1,278 @@
+/*
+ * Jailhouse, a Linux-based partitioning hypervisor
+ *
+ * Copyright (c) Siemens AG, 2013
+ *
+ * Authors:
+ *  Jan Kiszka <jan.kiszka@siemens.com>
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.  See
+ * the COPYING file in the top-level directory.
+ */
+
+/*
+ * Runs the hypervisor's page pool and page_map_create/destroy on the host.
+ * For each given system or cell configuration, the memory regions are
+ * mapped into a fresh second-level page table and unmapped again, with and
+ * without huge pages. Finally, the allocator is exercised under
+ * fragmentation. Leaked pages are reported as errors.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <jailhouse.h>
+
+#include "paging-bench.h"
+
+#define POOL_SIZE		(256 * 1024 * 1024UL)
+/* physical address the pool is mapped at, only affects the table entries */
+#define POOL_PHYS_START		0x100000000UL
+
+#define DEFAULT_ROUNDS		100
+
+#define FRAG_SLOTS		4096
+#define FRAG_MAX_PAGES		16
+#define FRAG_OPERATIONS		1000000
+
+static void help(const char *progname)
+{
+	printf("%s [-n ROUNDS] CONFIGFILE [CONFIGFILE ...]\n", progname);
+}
+
+static void *read_file(const char *name, size_t *size)
+{
+	struct stat stat;
+	void *buffer;
+	int fd;
+
+	fd = open(name, O_RDONLY);
+	if (fd < 0) {
+		fprintf(stderr, "opening %s: %s\n", name, strerror(errno));
+		exit(1);
+	}
+
+	if (fstat(fd, &stat) < 0) {
+		perror("fstat");
+		exit(1);
+	}
+
+	buffer = malloc(stat.st_size);
+	if (!buffer) {
+		fprintf(stderr, "insufficient memory\n");
+		exit(1);
+	}
+
+	if (read(fd, buffer, stat.st_size) < stat.st_size) {
+		fprintf(stderr, "reading %s: %s\n", name, strerror(errno));
+		exit(1);
+	}
+
+	close(fd);
+
+	*size = stat.st_size;
+	return buffer;
+}
+
+static struct jailhouse_cell_desc *config_load(const char *name, void **data)
+{
+	struct jailhouse_system *system;
+	size_t size;
+
+	*data = read_file(name, &size);
+	system = *data;
+
+	if (size >= sizeof(struct jailhouse_system) &&
+	    jailhouse_system_config_size(system) == size)
+		return &system->system;
+	if (size >= sizeof(struct jailhouse_cell_desc) &&
+	    jailhouse_cell_config_size(*data) == size)
+		return *data;
+
+	fprintf(stderr, "%s: not a system or cell configuration\n", name);
+	exit(1);
+}
+
+static unsigned long long now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static unsigned long pages_used(void)
+{
+	struct bench_pool_stats stats;
+
+	bench_pool_stats(&stats);
+	return stats.used;
+}
+
+static unsigned int bench_config(struct jailhouse_cell_desc *cell,
+				 unsigned int rounds, int huge_pages)
+{
+	const struct jailhouse_memory *mem = jailhouse_cell_mem_regions(cell);
+	unsigned long long map_ns = 0, unmap_ns = 0, start;
+	unsigned long used = pages_used(), tables = 0;
+	unsigned int round, n, errors = 0;
+	void *root;
+
+	for (round = 0; round < rounds; round++) {
+		root = bench_page_alloc(1);
+		if (!root) {
+			fprintf(stderr, "page pool exhausted\n");
+			exit(1);
+		}
+
+		start = now_ns();
+		for (n = 0; n < cell->num_memory_regions; n++)
+			if (bench_map(root, mem[n].phys_start, mem[n].size,
+				      mem[n].virt_start, huge_pages) != 0)
+				errors++;
+		map_ns += now_ns() - start;
+
+		tables = bench_count_tables(root);
+
+		start = now_ns();
+		for (n = 0; n < cell->num_memory_regions; n++)
+			if (bench_unmap(root, mem[n].virt_start,
+					mem[n].size) != 0)
+				errors++;
+		unmap_ns += now_ns() - start;
+
+		bench_page_free(root, 1);
+	}
+
+	printf("  %-12s map %8llu ns, unmap %8llu ns, page tables %lu\n",
+	       huge_pages ? "huge pages:" : "4K pages:", map_ns / rounds,
+	       unmap_ns / rounds, tables);
+
+	if (errors > 0)
+		printf("  error: %u failed map/unmap calls\n", errors);
+	if (pages_used() != used) {
+		printf("  error: %ld pages leaked\n", pages_used() - used);
+		errors++;
+	}
+	return errors;
+}
+
+/* random sizes with a fixed seed, so runs are comparable */
+static unsigned int next_random(unsigned int *seed)
+{
+	*seed = *seed * 1103515245 + 12345;
+	return *seed >> 16;
+}
+
+static unsigned int bench_fragmentation(void)
+{
+	static struct {
+		void *page;
+		unsigned int num;
+	} slot[FRAG_SLOTS];
+	unsigned long long alloc_ns = 0, free_ns = 0, start;
+	unsigned long allocs = 0, frees = 0, failed = 0;
+	unsigned long used = pages_used();
+	struct bench_pool_stats stats;
+	unsigned int seed = 1, n, op;
+
+	for (op = 0; op < FRAG_OPERATIONS; op++) {
+		n = next_random(&seed) % FRAG_SLOTS;
+		if (slot[n].page) {
+			start = now_ns();
+			bench_page_free(slot[n].page, slot[n].num);
+			free_ns += now_ns() - start;
+			slot[n].page = NULL;
+			frees++;
+		} else {
+			slot[n].num = 1 + next_random(&seed) % FRAG_MAX_PAGES;
+			start = now_ns();
+			slot[n].page = bench_page_alloc(slot[n].num);
+			alloc_ns += now_ns() - start;
+			if (slot[n].page)
+				allocs++;
+			else
+				failed++;
+		}
+	}
+
+	bench_pool_stats(&stats);
+	printf("Fragmentation, %u operations of 1..%u pages:\n"
+	       "  alloc %llu ns, free %llu ns, %lu failed\n"
+	       "  %lu pages used, %lu free blocks, largest %lu pages\n",
+	       FRAG_OPERATIONS, FRAG_MAX_PAGES,
+	       allocs ? alloc_ns / allocs : 0, frees ? free_ns / frees : 0,
+	       failed, stats.used - used, stats.free_blocks,
+	       stats.largest_free_block);
+
+	for (n = 0; n < FRAG_SLOTS; n++)
+		bench_page_free(slot[n].page, slot[n].num);
+
+	bench_pool_stats(&stats);
+	if (stats.used != used) {
+		printf("  error: %ld pages leaked\n", stats.used - used);
+		return 1;
+	}
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned int rounds = DEFAULT_ROUNDS, errors = 0;
+	struct jailhouse_cell_desc *cell;
+	struct bench_pool_stats stats;
+	int arg = 1;
+	char *endp;
+	void *mem;
+	void *data;
+
+	if (argc > 2 && strcmp(argv[1], "-n") == 0) {
+		errno = 0;
+		rounds = strtoul(argv[2], &endp, 0);
+		if (errno != 0 || *endp != 0 || rounds == 0) {
+			help(argv[0]);
+			exit(1);
+		}
+		arg = 3;
+	}
+	if (arg >= argc) {
+		help(argv[0]);
+		exit(1);
+	}
+
+	mem = mmap(NULL, POOL_SIZE, PROT_READ | PROT_WRITE,
+		   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (mem == MAP_FAILED) {
+		perror("mmap");
+		exit(1);
+	}
+	if (bench_paging_init(mem, POOL_SIZE, POOL_PHYS_START) != 0) {
+		fprintf(stderr, "page pool setup failed\n");
+		exit(1);
+	}
+
+	for (; arg < argc; arg++) {
+		cell = config_load(argv[arg], &data);
+		printf("Configuration \"%.*s\", %u memory regions, "
+		       "%u rounds:\n", JAILHOUSE_CELL_NAME_MAXLEN, cell->name,
+		       cell->num_memory_regions, rounds);
+		errors += bench_config(cell, rounds, 0);
+		errors += bench_config(cell, rounds, 1);
+		free(data);
+	}
+
+	errors += bench_fragmentation();
+
+	bench_pool_stats(&stats);
+	printf("Page pool: %lu pages, %lu used, %lu peak\n", stats.pages,
+	       stats.used, stats.peak);
+
+	return errors > 0 ? 1 : 0;
+}
@@ -0,0 +1,39 @@
+/*
+ * Jailhouse, a Linux-based partitioning hypervisor
+ *
+ * Copyright (c) Siemens AG, 2013
+ *
+ * Authors:
+ *  Jan Kiszka <jan.kiszka@siemens.com>
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.  See
+ * the COPYING file in the top-level directory.
+ */
+
+/*
+ * Interface between the benchmark driver and the hypervisor's paging code
+ * built for user space. Only plain C types are used here as both sides are
+ * compiled against different headers.
+ */
+
+#define BENCH_PAGE_SIZE		4096
+
+struct bench_pool_stats {
+	unsigned long pages;
+	unsigned long used;
+	unsigned long peak;
+	unsigned long free_blocks;
+	unsigned long largest_free_block;
+};
+
+/* mem has to be page-aligned and zeroed, it is mapped at phys_start */
+int bench_paging_init(void *mem, unsigned long size, unsigned long phys_start);
+void bench_pool_stats(struct bench_pool_stats *stats);
+
+void *bench_page_alloc(unsigned int num);
+void bench_page_free(void *page, unsigned int num);
+
+int bench_map(void *root, unsigned long phys, unsigned long size,
+	      unsigned long virt, int huge_pages);
+int bench_unmap(void *root, unsigned long virt, unsigned long size);
+unsigned long bench_count_tables(void *root);